@@ -3,7 +3,7 @@
 /* AUTO GENERATED - DO NOT EDIT */
 #include <capnp_c.h>
 
-#if CAPN_VERSION != 1
+#if CAPN_VERSION != 2
 #error "version mismatch between capnp_c.h and generated code"
 #endif
 
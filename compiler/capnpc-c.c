@@ -35,6 +35,13 @@
 #define ANNOTATION_NAMEINFIX 0x85a8d86d736ba637UL
 #define ANNOTATION_MAPLISTCOUNT 0xb6ea49eb8a9b0f9eUL
 #define ANNOTATION_MAPUNIONTAG 0xdce06d41858f91acUL
+#define ANNOTATION_FIELDCOLUMNS 0xe3c9f5a1b2d40c61UL
+#define ANNOTATION_ARROWEXPORT 0xa7d2c4e91f3b6508UL
+#define ANNOTATION_INLINEACCESSORS 0xd6f0b8e2a4c51937UL
+#define ANNOTATION_CONTIGUOUSLIST 0xe85b3a7c1d9f2640UL
+#define ANNOTATION_BORROWTEXT 0xc4f1a82d6b3e9075UL
+#define ANNOTATION_TABLEDRIVEN 0x9e4c7b2a5d1f3068UL
+#define ANNOTATION_EMBEDSCHEMA 0xa3e1d7c94b6f2058UL
 
 struct value {
   struct Type t;
@@ -81,6 +88,11 @@ typedef struct {
   int g_valc;
   int g_val0used, g_nullused;
   int g_fieldgetset;
+  int g_fieldcolumns;
+  int g_arrowexport;
+  int g_inlineaccessors;
+  int g_tabledriven;
+  int g_embedschema;
   int g_codecgen;
   struct capn_tree *g_node_tree;
   CodeGeneratorRequest_ptr root;
@@ -236,6 +248,31 @@ static const char *get_mapuniontag(Annotation_list l) {
   return get_text_annotation(l, ANNOTATION_MAPUNIONTAG);
 }
 
+static int has_annotation(Annotation_list l, unsigned long id) {
+  int i;
+
+  for (i = capn_len(l) - 1; i >= 0; i--) {
+    struct Annotation a;
+
+    get_Annotation(&a, l, i);
+    if (a.id == id) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int get_contiguouslist(Annotation_list l) {
+  return has_annotation(l, ANNOTATION_CONTIGUOUSLIST);
+}
+
+/* NULL when the text is copied, otherwise the (possibly empty) name of
+ * the member holding its length */
+static const char *get_borrowtext(Annotation_list l) {
+  return get_text_annotation(l, ANNOTATION_BORROWTEXT);
+}
+
 /* resolve_names recursively follows the nestedNodes tree in order to
  * set node->name.
  * It also builds up the list of nodes within a file (file_nodes and
@@ -862,12 +899,22 @@ static void mk_simple_list_encoder(struct str *func, const char *tab,
     str_add(func, tab, -1);
     str_addf(func, "\td->%s = capn_new_%s(cs, s->%s);\n", dvar, list_type,
              cvar);
-    str_add(func, tab, -1);
-    str_addf(func, "\tfor(i_ = 0; i_ < s->%s; i_ ++) {\n", cvar);
-    str_add(func, tab, -1);
-    str_addf(func, "\t\tcapn_%s(d->%s, i_, s->%s[i_]);\n", setf, dvar, svar);
-    str_add(func, tab, -1);
-    str_addf(func, "\t}\n");
+    if (strcmp(setf, "set1") != 0) {
+      /* copied as bits, so floats keep their representation */
+      str_add(func, tab, -1);
+      str_addf(func, "\tcapn_setv%s(d->%s, 0, (const uint%s_t *) s->%s, s->%s);\n",
+               setf + 3, dvar, setf + 3, svar, cvar);
+      str_add(func, tab, -1);
+      str_addf(func, "\tcapnp_use(i_);\n");
+    } else {
+      str_add(func, tab, -1);
+      str_addf(func, "\tfor(i_ = 0; i_ < s->%s; i_ ++) {\n", cvar);
+      str_add(func, tab, -1);
+      str_addf(func, "\t\tcapn_%s(d->%s, i_, s->%s[i_]);\n", setf, dvar,
+               svar);
+      str_add(func, tab, -1);
+      str_addf(func, "\t}\n");
+    }
   }
   str_add(func, tab, -1);
   str_addf(func, "}\n");
@@ -876,7 +923,7 @@ static void mk_simple_list_encoder(struct str *func, const char *tab,
 static void mk_simple_list_decoder(struct str *func, const char *tab,
                                    const char *list_type, const char *getf,
                                    const char *dvar, const char *cvar,
-                                   const char *svar) {
+                                   const char *svar, int borrow) {
   str_add(func, tab, -1);
   str_addf(func, "if (1) {\n");
   str_add(func, tab, -1);
@@ -895,7 +942,9 @@ static void mk_simple_list_decoder(struct str *func, const char *tab,
     str_add(func, tab, -1);
     str_addf(func, "\telse {\n");
     str_add(func, tab, -1);
-    str_addf(func, "\t\td->%s = (char **)calloc(nc_, sizeof(char *));\n", dvar);
+    str_addf(func,
+             "\t\td->%s = (char **)capn_codec_calloc(a, nc_, sizeof(char *));\n",
+             dvar);
     str_add(func, tab, -1);
     str_addf(func, "\t\tfor(i_ = 0; i_ < nc_; i_ ++) {\n");
     str_add(func, tab, -1);
@@ -903,7 +952,12 @@ static void mk_simple_list_decoder(struct str *func, const char *tab,
              "\t\t\tcapn_text text_ = capn_get_text(s->%s, i_, capn_val0);\n",
              svar);
     str_add(func, tab, -1);
-    str_addf(func, "\t\t\td->%s[i_] = STRING_DUP(text_.str);\n", dvar);
+    if (borrow) {
+      str_addf(func, "\t\t\td->%s[i_] = (char *)text_.str;\n", dvar);
+    } else {
+      str_addf(func, "\t\t\td->%s[i_] = capn_codec_strdup(a, text_.str);\n",
+               dvar);
+    }
     str_add(func, tab, -1);
     str_addf(func, "\t\t}\n");
     str_add(func, tab, -1);
@@ -922,14 +976,23 @@ static void mk_simple_list_decoder(struct str *func, const char *tab,
     str_add(func, tab, -1);
     str_addf(func, "\telse {\n");
     str_add(func, tab, -1);
-    str_addf(func, "\t\td->%s = (%s *)calloc(nc_, sizeof(%s));\n", dvar,
-             list_type, list_type);
-    str_add(func, tab, -1);
-    str_addf(func, "\t\tfor(i_ = 0; i_ < nc_; i_ ++) {\n");
-    str_add(func, tab, -1);
-    str_addf(func, "\t\t\td->%s[i_] = capn_%s(s->%s, i_);\n", dvar, getf, svar);
-    str_add(func, tab, -1);
-    str_addf(func, "\t\t}\n");
+    str_addf(func, "\t\td->%s = (%s *)capn_codec_calloc(a, nc_, sizeof(%s));\n",
+             dvar, list_type, list_type);
+    if (strcmp(getf, "get1") != 0) {
+      str_add(func, tab, -1);
+      str_addf(func, "\t\tcapn_getv%s(s->%s, 0, (uint%s_t *) d->%s, nc_);\n",
+               getf + 3, svar, getf + 3, dvar);
+      str_add(func, tab, -1);
+      str_addf(func, "\t\tcapnp_use(i_);\n");
+    } else {
+      str_add(func, tab, -1);
+      str_addf(func, "\t\tfor(i_ = 0; i_ < nc_; i_ ++) {\n");
+      str_add(func, tab, -1);
+      str_addf(func, "\t\t\td->%s[i_] = capn_%s(s->%s, i_);\n", dvar, getf,
+               svar);
+      str_add(func, tab, -1);
+      str_addf(func, "\t\t}\n");
+    }
     str_add(func, tab, -1);
     str_addf(func, "\t}\n");
   }
@@ -943,14 +1006,14 @@ static void mk_simple_list_decoder(struct str *func, const char *tab,
 static void mk_simple_list_free(struct str *func, const char *tab,
                                 const char *list_type, const char *getf,
                                 const char *dvar, const char *cvar,
-                                const char *svar) {
+                                const char *svar, int borrow) {
   str_add(func, tab, -1);
   str_addf(func, "if (1) {\n");
   str_add(func, tab, -1);
   str_addf(func, "\tint i_, nc_ = d->%s;\n", cvar);
   str_add(func, tab, -1);
   str_addf(func, "\tcapnp_use(i_);capnp_use(nc_);\n");
-  if (strcmp(list_type, "text") == 0) {
+  if (strcmp(list_type, "text") == 0 && !borrow) {
     str_add(func, tab, -1);
     str_addf(func, "\tfor(i_ = 0; i_ < nc_; i_ ++) {\n");
     str_add(func, tab, -1);
@@ -970,7 +1033,7 @@ static void mk_simple_list_free(struct str *func, const char *tab,
 static void gen_call_list_encoder(capnp_ctx_t *ctx, struct str *func,
                                   struct Type *type, const char *tab,
                                   const char *var, const char *countvar,
-                                  const char *var2) {
+                                  const char *var2, int contiguous) {
   struct node *n = NULL;
 
   str_add(func, tab, -1);
@@ -1006,8 +1069,8 @@ static void gen_call_list_encoder(capnp_ctx_t *ctx, struct str *func,
     if (n != NULL) {
       char *dtypename = n->name.str;
 
-      str_addf(func, "encode_%s_list(cs, &(d->%s), s->%s, s->%s);\n", dtypename,
-               var, countvar, var2);
+      str_addf(func, "encode_%s_%s(cs, &(d->%s), s->%s, s->%s);\n", dtypename,
+               contiguous ? "array" : "list", var, countvar, var2);
     }
     break;
   }
@@ -1016,7 +1079,8 @@ static void gen_call_list_encoder(capnp_ctx_t *ctx, struct str *func,
 static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
                                   struct Type *type, const char *tab,
                                   const char *var, const char *countvar,
-                                  const char *var2) {
+                                  const char *var2, int contiguous,
+                                  int borrow) {
   char *t = NULL;
   struct node *n = NULL;
 
@@ -1025,7 +1089,7 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
   switch (type->which) {
   case Type__bool:
     t = "uint8_t";
-    mk_simple_list_decoder(func, tab, t, "get1", var, countvar, var2);
+    mk_simple_list_decoder(func, tab, t, "get1", var, countvar, var2, 0);
     break;
   case Type_int8:
   case Type_uint8:
@@ -1034,7 +1098,7 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "uint8_t";
     }
-    mk_simple_list_decoder(func, tab, t, "get8", var, countvar, var2);
+    mk_simple_list_decoder(func, tab, t, "get8", var, countvar, var2, 0);
     break;
   case Type_int16:
   case Type_uint16:
@@ -1043,7 +1107,7 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "uint16_t";
     }
-    mk_simple_list_decoder(func, tab, t, "get16", var, countvar, var2);
+    mk_simple_list_decoder(func, tab, t, "get16", var, countvar, var2, 0);
     break;
   case Type_int32:
   case Type_uint32:
@@ -1055,7 +1119,7 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "float";
     }
-    mk_simple_list_decoder(func, tab, t, "get32", var, countvar, var2);
+    mk_simple_list_decoder(func, tab, t, "get32", var, countvar, var2, 0);
     break;
   case Type_int64:
   case Type_uint64:
@@ -1067,19 +1131,20 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "double";
     }
-    mk_simple_list_decoder(func, tab, t, "get64", var, countvar, var2);
+    mk_simple_list_decoder(func, tab, t, "get64", var, countvar, var2, 0);
     break;
 
   case Type_text:
-    mk_simple_list_decoder(func, tab, "text", NULL, var, countvar, var2);
+    mk_simple_list_decoder(func, tab, "text", NULL, var, countvar, var2,
+                           borrow);
     break;
   case Type__struct:
     n = find_node(ctx, type->_struct.typeId);
     if (n != NULL) {
       char *dtypename = n->name.str;
 
-      str_addf(func, "decode_%s_list(&(d->%s), &(d->%s), s->%s);\n", dtypename,
-               countvar, var, var2);
+      str_addf(func, "decode_%s_%s_arena(a, &(d->%s), &(d->%s), s->%s);\n",
+               dtypename, contiguous ? "array" : "list", countvar, var, var2);
     }
     break;
   }
@@ -1088,7 +1153,7 @@ static void gen_call_list_decoder(capnp_ctx_t *ctx, struct str *func,
 static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
                                struct Type *type, const char *tab,
                                const char *var, const char *countvar,
-                               const char *var2) {
+                               const char *var2, int contiguous, int borrow) {
   char *t = NULL;
   struct node *n = NULL;
 
@@ -1097,7 +1162,7 @@ static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
   switch (type->which) {
   case Type__bool:
     t = "uint8_t";
-    mk_simple_list_free(func, tab, t, "get1", var, countvar, var2);
+    mk_simple_list_free(func, tab, t, "get1", var, countvar, var2, 0);
     break;
   case Type_int8:
   case Type_uint8:
@@ -1106,7 +1171,7 @@ static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "uint8_t";
     }
-    mk_simple_list_free(func, tab, t, "get8", var, countvar, var2);
+    mk_simple_list_free(func, tab, t, "get8", var, countvar, var2, 0);
     break;
   case Type_int16:
   case Type_uint16:
@@ -1115,7 +1180,7 @@ static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "uint16_t";
     }
-    mk_simple_list_free(func, tab, t, "get16", var, countvar, var2);
+    mk_simple_list_free(func, tab, t, "get16", var, countvar, var2, 0);
     break;
   case Type_int32:
   case Type_uint32:
@@ -1127,7 +1192,7 @@ static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "float";
     }
-    mk_simple_list_free(func, tab, t, "get32", var, countvar, var2);
+    mk_simple_list_free(func, tab, t, "get32", var, countvar, var2, 0);
     break;
   case Type_int64:
   case Type_uint64:
@@ -1139,18 +1204,19 @@ static void gen_call_list_free(capnp_ctx_t *ctx, struct str *func,
     } else {
       t = "double";
     }
-    mk_simple_list_free(func, tab, t, "get64", var, countvar, var2);
+    mk_simple_list_free(func, tab, t, "get64", var, countvar, var2, 0);
     break;
 
   case Type_text:
-    mk_simple_list_free(func, tab, "text", NULL, var, countvar, var2);
+    mk_simple_list_free(func, tab, "text", NULL, var, countvar, var2, borrow);
     break;
   case Type__struct:
     n = find_node(ctx, type->_struct.typeId);
     if (n != NULL) {
       char *dtypename = n->name.str;
 
-      str_addf(func, "free_%s_list(d->%s, d->%s);\n", dtypename, countvar, var);
+      str_addf(func, "free_%s_%s(d->%s, d->%s);\n", dtypename,
+               contiguous ? "array" : "list", countvar, var);
     }
     break;
   }
@@ -1160,6 +1226,7 @@ static void encode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
                           const char *tab, const char *var, const char *var2) {
   struct Type list_type;
   struct node *n = NULL;
+  const char *borrowlen = get_borrowtext(f->f.annotations);
 
   if (f->v.t.which == Type__void) {
     return;
@@ -1191,7 +1258,11 @@ static void encode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
     str_add(func, tab, -1);
     str_addf(func, "\td->%s.str = s->%s;\n", var, var2);
     str_add(func, tab, -1);
-    str_addf(func, "\td->%s.len = strlen(s->%s);\n", var, var2);
+    if (borrowlen != NULL && *borrowlen) {
+      str_addf(func, "\td->%s.len = s->%s;\n", var, borrowlen);
+    } else {
+      str_addf(func, "\td->%s.len = strlen(s->%s);\n", var, var2);
+    }
     str_add(func, tab, -1);
     str_addf(func, "}\n");
     str_add(func, tab, -1);
@@ -1235,7 +1306,8 @@ static void encode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
         sprintf(buf, "n_%s", var2);
       }
 
-      gen_call_list_encoder(ctx, func, &list_type, tab, var, buf, var2);
+      gen_call_list_encoder(ctx, func, &list_type, tab, var, buf, var2,
+                            get_contiguouslist(f->f.annotations));
     }
     break;
   default:
@@ -1249,6 +1321,7 @@ static void decode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
                           const char *tab, const char *var, const char *var2) {
   struct Type list_type;
   struct node *n = NULL;
+  const char *borrowlen = get_borrowtext(f->f.annotations);
 
   if (f->v.t.which == Type__void) {
     return;
@@ -1276,14 +1349,23 @@ static void decode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
     break;
   case Type_text:
     str_add(func, tab, -1);
-    str_addf(func, "d->%s = STRING_DUP(s->%s.str);\n", var2, var);
+    if (borrowlen == NULL) {
+      str_addf(func, "d->%s = capn_codec_strdup(a, s->%s.str);\n", var2, var);
+      break;
+    }
+    /* points into the message, which must outlive d */
+    str_addf(func, "d->%s = (char *)s->%s.str;\n", var2, var);
+    if (*borrowlen) {
+      str_add(func, tab, -1);
+      str_addf(func, "d->%s = s->%s.len;\n", borrowlen, var);
+    }
     break;
   case Type__struct:
     n = find_node(ctx, f->v.t._struct.typeId);
     if (n != NULL) {
       str_add(func, tab, -1);
-      str_addf(func, "decode_%s_ptr(&(d->%s), s->%s);\n", n->name.str, var2,
-               var);
+      str_addf(func, "decode_%s_ptr_arena(a, &(d->%s), s->%s);\n", n->name.str,
+               var2, var);
     }
     break;
   case Type__list:
@@ -1321,7 +1403,9 @@ static void decode_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
         }
       }
 
-      gen_call_list_decoder(ctx, func, &list_type, tab, var2, buf, var);
+      gen_call_list_decoder(ctx, func, &list_type, tab, var2, buf, var,
+                            get_contiguouslist(f->f.annotations),
+                            borrowlen != NULL);
     }
     break;
   default:
@@ -1335,6 +1419,7 @@ static void free_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
                         const char *tab, const char *var, const char *var2) {
   struct Type list_type;
   struct node *n = NULL;
+  const char *borrowlen = get_borrowtext(f->f.annotations);
 
   if (f->v.t.which == Type__void) {
     return;
@@ -1359,6 +1444,9 @@ static void free_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
   case Type__enum:
     break;
   case Type_text:
+    if (borrowlen != NULL) {
+      break;
+    }
     str_add(func, tab, -1);
     str_addf(func, "if (d->%s != NULL) {\n", var2);
     str_add(func, tab, -1);
@@ -1408,7 +1496,9 @@ static void free_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
         }
       }
 
-      gen_call_list_free(ctx, func, &list_type, tab, var2, buf, var);
+      gen_call_list_free(ctx, func, &list_type, tab, var2, buf, var,
+                         get_contiguouslist(f->f.annotations),
+                         borrowlen != NULL);
     }
     break;
   default:
@@ -1418,6 +1508,129 @@ static void free_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
   }
 }
 
+/* size_member adds the words encode_member allocates for f to n_. It
+ * follows the allocations made by capn_new_struct, capn_new_list and
+ * capn_new_string, so that size_X is exact. */
+static void size_member(capnp_ctx_t *ctx, struct str *func, struct field *f,
+                        const char *tab, const char *var, const char *var2) {
+  static const char *words[] = {
+      [Type__bool] = "((size_t) d->%s + 63) / 64",
+      [Type_int8] = "((size_t) d->%s + 7) / 8",
+      [Type_uint8] = "((size_t) d->%s + 7) / 8",
+      [Type_int16] = "(2 * (size_t) d->%s + 7) / 8",
+      [Type_uint16] = "(2 * (size_t) d->%s + 7) / 8",
+      [Type_int32] = "(4 * (size_t) d->%s + 7) / 8",
+      [Type_uint32] = "(4 * (size_t) d->%s + 7) / 8",
+      [Type_float32] = "(4 * (size_t) d->%s + 7) / 8",
+      [Type_int64] = "(size_t) d->%s",
+      [Type_uint64] = "(size_t) d->%s",
+      [Type_float64] = "(size_t) d->%s",
+  };
+  struct Type list_type;
+  struct node *n = NULL;
+  const char *borrowlen = get_borrowtext(f->f.annotations);
+
+  if (var2 == NULL) {
+    var2 = var;
+  }
+
+  switch (f->v.t.which) {
+  case Type_text:
+    /* a NULL text is encoded as an empty one */
+    str_add(func, tab, -1);
+    if (borrowlen != NULL && *borrowlen) {
+      str_addf(func, "n_ += d->%s ? ((size_t) d->%s + 8) / 8 : 1;\n", var2,
+               borrowlen);
+    } else {
+      str_addf(func, "n_ += d->%s ? (strlen(d->%s) + 8) / 8 : 1;\n", var2,
+               var2);
+    }
+    break;
+  case Type__struct:
+    n = find_node(ctx, f->v.t._struct.typeId);
+    if (n != NULL) {
+      str_add(func, tab, -1);
+      str_addf(func, "n_ += size_%s(d->%s);\n", n->name.str, var2);
+    }
+    break;
+  case Type__list:
+    read_Type(&list_type, f->v.t._list.elementType);
+    if (list_type.which != Type__void) {
+      char *name = NULL;
+      char *ncount = NULL;
+      char buf[256];
+
+      name = (char *)get_mapname(f->f.annotations);
+      if (name == NULL) {
+        var2 = var;
+      } else {
+        var2 = name;
+      }
+
+      ncount = (char *)get_maplistcount(f->f.annotations);
+      if (ncount != NULL) {
+        sprintf(buf, "%s", ncount);
+      } else {
+        char buf2[256];
+        char *p;
+
+        strcpy(buf2, var2);
+        p = strchr(buf2, '.');
+        if (p != NULL) {
+          *p = 0x0;
+          p++;
+        }
+
+        strcpy(buf, buf2);
+        if (p != NULL) {
+          strcat(buf, ".");
+          sprintf(&buf[strlen(buf)], "n_%s", p);
+        }
+      }
+
+      switch (list_type.which) {
+      case Type_text:
+        str_add(func, tab, -1);
+        str_addf(func, "if (1) {\n");
+        str_add(func, tab, -1);
+        str_addf(func, "\tint i_;\n");
+        str_add(func, tab, -1);
+        str_addf(func, "\tn_ += (size_t) d->%s;\n", buf);
+        str_add(func, tab, -1);
+        str_addf(func, "\tfor(i_ = 0; i_ < d->%s; i_ ++) {\n", buf);
+        str_add(func, tab, -1);
+        str_addf(func, "\t\tn_ += (strlen(d->%s[i_]) + 8) / 8;\n", var2);
+        str_add(func, tab, -1);
+        str_addf(func, "\t}\n");
+        str_add(func, tab, -1);
+        str_addf(func, "}\n");
+        break;
+      case Type__struct:
+        n = find_node(ctx, list_type._struct.typeId);
+        if (n != NULL) {
+          str_add(func, tab, -1);
+          str_addf(func, "n_ += size_%s_%s(d->%s, d->%s);\n", n->name.str,
+                   get_contiguouslist(f->f.annotations) ? "array" : "list",
+                   buf, var2);
+        }
+        break;
+      default:
+        if (list_type.which < sizeof(words) / sizeof(words[0]) &&
+            words[list_type.which] != NULL) {
+          str_add(func, tab, -1);
+          str_addf(func, "n_ += ");
+          str_addf(func, words[list_type.which], buf);
+          str_addf(func, ";\n");
+        }
+        break;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+}
+
 void mk_struct_list_encoder(capnp_ctx_t *ctx, struct node *n) {
   if (n == NULL) {
     return;
@@ -1447,6 +1660,22 @@ void mk_struct_list_encoder(capnp_ctx_t *ctx, struct node *n) {
     str_addf(&(ctx->SRC), "\t}\n");
     str_addf(&(ctx->SRC), "\t(*l) = lst;\n");
     str_addf(&(ctx->SRC), "}\n");
+
+    /* $C.contiguouslist lists are arrays of structs rather than pointers */
+    str_addf(&(ctx->SRC),
+             "void encode_%s_array(struct capn_segment *cs, %s_list *l,int "
+             "count,%s *s) {\n",
+             n->name.str, n->name.str, buf);
+    str_addf(&(ctx->SRC), "\t%s_list lst;\n", n->name.str);
+    str_addf(&(ctx->SRC), "\tint i;\n");
+    str_addf(&(ctx->SRC), "\tlst = new_%s_list(cs, count);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\tfor(i = 0; i < count; i ++) {\n");
+    str_addf(&(ctx->SRC), "\t\tstruct %s d;\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t\tencode_%s(cs, &d, &s[i]);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t\tset_%s(&d, lst, i);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t}\n");
+    str_addf(&(ctx->SRC), "\t(*l) = lst;\n");
+    str_addf(&(ctx->SRC), "}\n");
   }
 }
 
@@ -1501,7 +1730,8 @@ void mk_struct_list_decoder(capnp_ctx_t *ctx, struct node *n) {
     }
 
     str_addf(&(ctx->SRC),
-             "void decode_%s_list(int *pcount, %s ***d, %s_list list) {\n",
+             "void decode_%s_list_arena(struct capn_arena *a, int *pcount, "
+             "%s ***d, %s_list list) {\n",
              n->name.str, buf, n->name.str);
     str_addf(&(ctx->SRC), "\tint i;\n");
     str_addf(&(ctx->SRC), "\tint nc;\n");
@@ -1513,18 +1743,60 @@ void mk_struct_list_decoder(capnp_ctx_t *ctx, struct node *n) {
     str_addf(&(ctx->SRC), "\t\t(*pcount) = 0;\n");
     str_addf(&(ctx->SRC), "\t\treturn;\n");
     str_addf(&(ctx->SRC), "\t}\n");
-    str_addf(&(ctx->SRC), "\tptr = (%s **)calloc(nc, sizeof(%s *));\n", buf,
+    str_addf(&(ctx->SRC),
+             "\tptr = (%s **)capn_codec_calloc(a, nc, sizeof(%s *));\n", buf,
              buf);
     str_addf(&(ctx->SRC), "\tfor(i = 0; i < nc; i ++) {\n");
     str_addf(&(ctx->SRC), "\t\tstruct %s s;\n", n->name.str);
     str_addf(&(ctx->SRC), "\t\tget_%s(&s, list, i);\n", n->name.str);
-    str_addf(&(ctx->SRC), "\t\tptr[i] = (%s *)calloc(1, sizeof(%s));\n", buf,
+    str_addf(&(ctx->SRC),
+             "\t\tptr[i] = (%s *)capn_codec_calloc(a, 1, sizeof(%s));\n", buf,
+             buf);
+    str_addf(&(ctx->SRC), "\t\tdecode_%s_arena(a, ptr[i], &s);\n",
+             n->name.str);
+    str_addf(&(ctx->SRC), "\t}\n");
+    str_addf(&(ctx->SRC), "\t(*d) = ptr;\n");
+    str_addf(&(ctx->SRC), "\t(*pcount) = nc;\n");
+    str_addf(&(ctx->SRC), "}\n");
+    str_addf(&(ctx->SRC),
+             "void decode_%s_list(int *pcount, %s ***d, %s_list list) {\n",
+             n->name.str, buf, n->name.str);
+    str_addf(&(ctx->SRC), "\tdecode_%s_list_arena(NULL, pcount, d, list);\n",
+             n->name.str);
+    str_addf(&(ctx->SRC), "}\n");
+
+    str_addf(&(ctx->SRC),
+             "void decode_%s_array_arena(struct capn_arena *a, int *pcount, "
+             "%s **d, %s_list list) {\n",
+             n->name.str, buf, n->name.str);
+    str_addf(&(ctx->SRC), "\tint i;\n");
+    str_addf(&(ctx->SRC), "\tint nc;\n");
+    str_addf(&(ctx->SRC), "\t%s *ptr;\n", buf);
+    str_addf(&(ctx->SRC), "\tcapn_resolve(&(list.p));\n");
+    str_addf(&(ctx->SRC), "\tnc = list.p.len;\n");
+    str_addf(&(ctx->SRC), "\tif (nc == 0) {\n");
+    str_addf(&(ctx->SRC), "\t\t(*d) = NULL;\n");
+    str_addf(&(ctx->SRC), "\t\t(*pcount) = 0;\n");
+    str_addf(&(ctx->SRC), "\t\treturn;\n");
+    str_addf(&(ctx->SRC), "\t}\n");
+    str_addf(&(ctx->SRC),
+             "\tptr = (%s *)capn_codec_calloc(a, nc, sizeof(%s));\n", buf,
              buf);
-    str_addf(&(ctx->SRC), "\t\tdecode_%s(ptr[i], &s);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\tfor(i = 0; i < nc; i ++) {\n");
+    str_addf(&(ctx->SRC), "\t\tstruct %s s;\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t\tget_%s(&s, list, i);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t\tdecode_%s_arena(a, &ptr[i], &s);\n",
+             n->name.str);
     str_addf(&(ctx->SRC), "\t}\n");
     str_addf(&(ctx->SRC), "\t(*d) = ptr;\n");
     str_addf(&(ctx->SRC), "\t(*pcount) = nc;\n");
     str_addf(&(ctx->SRC), "}\n");
+    str_addf(&(ctx->SRC),
+             "void decode_%s_array(int *pcount, %s **d, %s_list list) {\n",
+             n->name.str, buf, n->name.str);
+    str_addf(&(ctx->SRC), "\tdecode_%s_array_arena(NULL, pcount, d, list);\n",
+             n->name.str);
+    str_addf(&(ctx->SRC), "}\n");
   }
 }
 
@@ -1544,18 +1816,42 @@ void mk_struct_ptr_decoder(capnp_ctx_t *ctx, struct node *n) {
     strcpy(buf, mapname);
   }
 
+  str_addf(&(ctx->SRC),
+           "void decode_%s_ptr_arena(struct capn_arena *a, %s **d,"
+           "%s_ptr p) {\n",
+           n->name.str, buf, n->name.str);
+  str_addf(&(ctx->SRC), "\tstruct %s s;\n", n->name.str);
+  str_addf(&(ctx->SRC), "\tcapn_resolve(&(p.p));\n");
+  str_addf(&(ctx->SRC), "\tif (p.p.type == CAPN_NULL) {\n");
+  str_addf(&(ctx->SRC), "\t\t(*d) = NULL;\n");
+  str_addf(&(ctx->SRC), "\t\treturn;\n");
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\t*d = (%s *)capn_codec_calloc(a, 1, sizeof(%s));\n",
+           buf, buf);
+  str_addf(&(ctx->SRC), "\tread_%s(&s, p);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\tdecode_%s_arena(a, *d, &s);\n", n->name.str);
+  str_addf(&(ctx->SRC), "}\n");
   str_addf(&(ctx->SRC),
            "void decode_%s_ptr(%s **d,"
            "%s_ptr p) {\n",
            n->name.str, buf, n->name.str);
+  str_addf(&(ctx->SRC), "\tdecode_%s_ptr_arena(NULL, d, p);\n", n->name.str);
+  str_addf(&(ctx->SRC), "}\n");
+
+  /* fields left out of the mask decode as if they were not set */
+  str_addf(&(ctx->SRC),
+           "void decode_%s_fields(%s **d,"
+           "%s_ptr p, uint64_t mask) {\n",
+           n->name.str, buf, n->name.str);
   str_addf(&(ctx->SRC), "\tstruct %s s;\n", n->name.str);
   str_addf(&(ctx->SRC), "\tcapn_resolve(&(p.p));\n");
   str_addf(&(ctx->SRC), "\tif (p.p.type == CAPN_NULL) {\n");
   str_addf(&(ctx->SRC), "\t\t(*d) = NULL;\n");
   str_addf(&(ctx->SRC), "\t\treturn;\n");
   str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\tmemset(&s, 0, sizeof(s));\n");
   str_addf(&(ctx->SRC), "\t*d = (%s *)calloc(1, sizeof(%s));\n", buf, buf);
-  str_addf(&(ctx->SRC), "\tread_%s(&s, p);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\tread_%s_fields(&s, p, mask);\n", n->name.str);
   str_addf(&(ctx->SRC), "\tdecode_%s(*d, &s);\n", n->name.str);
   str_addf(&(ctx->SRC), "}\n");
   ctx->g_nullused = 1;
@@ -1589,6 +1885,16 @@ void mk_struct_list_free(capnp_ctx_t *ctx, struct node *n) {
     str_addf(&(ctx->SRC), "\t}\n");
     str_addf(&(ctx->SRC), "\tfree(ptr);\n");
     str_addf(&(ctx->SRC), "}\n");
+
+    str_addf(&(ctx->SRC), "void free_%s_array(int pcount, %s *d) {\n",
+             n->name.str, buf);
+    str_addf(&(ctx->SRC), "\tint i;\n");
+    str_addf(&(ctx->SRC), "\tif (d == NULL) return;\n");
+    str_addf(&(ctx->SRC), "\tfor(i = 0; i < pcount; i ++) {\n");
+    str_addf(&(ctx->SRC), "\t\tfree_%s(&d[i]);\n", n->name.str);
+    str_addf(&(ctx->SRC), "\t}\n");
+    str_addf(&(ctx->SRC), "\tfree(d);\n");
+    str_addf(&(ctx->SRC), "}\n");
   }
 }
 
@@ -1616,6 +1922,48 @@ void mk_struct_ptr_free(capnp_ctx_t *ctx, struct node *n) {
   str_addf(&(ctx->SRC), "}\n");
 }
 
+/* size_X_list and size_X_array count the list tag, if capn_new_list
+ * writes one, along with each element. */
+void mk_struct_list_size(capnp_ctx_t *ctx, struct node *n) {
+  char *mapname;
+  char buf[256];
+  int tag;
+
+  if (n == NULL) {
+    return;
+  }
+
+  mapname = (char *)get_mapname(n->n.annotations);
+
+  if (mapname == NULL) {
+    sprintf(buf, "struct %s_", n->name.str);
+  } else {
+    strcpy(buf, mapname);
+  }
+
+  tag = n->n._struct.pointerCount > 0 || n->n._struct.dataWordCount > 1;
+
+  str_addf(&(ctx->SRC), "size_t size_%s_list(int count, %s **d) {\n",
+           n->name.str, buf);
+  str_addf(&(ctx->SRC), "\tsize_t n_ = %d;\n", tag);
+  str_addf(&(ctx->SRC), "\tint i;\n");
+  str_addf(&(ctx->SRC), "\tfor(i = 0; i < count; i ++) {\n");
+  str_addf(&(ctx->SRC), "\t\tn_ += size_%s(d[i]);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\treturn n_;\n");
+  str_addf(&(ctx->SRC), "}\n");
+
+  str_addf(&(ctx->SRC), "size_t size_%s_array(int count, const %s *d) {\n",
+           n->name.str, buf);
+  str_addf(&(ctx->SRC), "\tsize_t n_ = %d;\n", tag);
+  str_addf(&(ctx->SRC), "\tint i;\n");
+  str_addf(&(ctx->SRC), "\tfor(i = 0; i < count; i ++) {\n");
+  str_addf(&(ctx->SRC), "\t\tn_ += size_%s(&d[i]);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\treturn n_;\n");
+  str_addf(&(ctx->SRC), "}\n");
+}
+
 struct strings {
   struct str ftab;
   struct str dtab;
@@ -1624,6 +1972,13 @@ struct strings {
   struct str encoder;
   struct str decoder;
   struct str freeup;
+  struct str sizer;
+  struct str table;
+  /* $C.tabledriven: the struct the table is for, its length, and the
+   * CAPN_FIELD_WHICH entry and discriminant of the union case being
+   * defined */
+  const char *table_struct;
+  int table_len, table_which, table_tag;
   struct str enums;
   struct str decl;
   struct str var;
@@ -1755,6 +2110,89 @@ static const char *field_name(struct field *f) {
   return s;
 }
 
+/* table_entry adds the capn_field entry for the slot f to the table of a
+ * $C.tabledriven struct. The member is named by s->var and the field
+ * name, as in the code generated for read_X. */
+static void table_entry(struct strings *s, struct field *f) {
+  const char *type;
+  int off = f->f.slot.offset;
+  uint64_t xor = 0;
+  int def = 0;
+
+  if (s->table_struct == NULL) {
+    return;
+  }
+
+  switch (f->v.t.which) {
+  case Type__void:
+    return;
+  case Type__bool:
+    type = "CAPN_FIELD_BOOL";
+    xor = f->v.intval;
+    break;
+  case Type_int8:
+  case Type_uint8:
+    type = "CAPN_FIELD_BITS8";
+    xor = (uint8_t)f->v.intval;
+    break;
+  case Type_int16:
+  case Type_uint16:
+    type = "CAPN_FIELD_BITS16";
+    xor = (uint16_t)f->v.intval;
+    off *= 2;
+    break;
+  case Type__enum:
+    type = "CAPN_FIELD_ENUM";
+    xor = (uint16_t)f->v.intval;
+    off *= 2;
+    break;
+  case Type_int32:
+  case Type_uint32:
+  case Type_float32:
+    type = "CAPN_FIELD_BITS32";
+    xor = (uint32_t)f->v.intval;
+    off *= 4;
+    break;
+  case Type_int64:
+  case Type_uint64:
+  case Type_float64:
+    type = "CAPN_FIELD_BITS64";
+    xor = f->v.intval;
+    off *= 8;
+    break;
+  case Type_text:
+    type = "CAPN_FIELD_TEXT";
+    def = (int)f->v.intval;
+    break;
+  case Type_data:
+    type = "CAPN_FIELD_DATA";
+    def = (int)f->v.intval;
+    break;
+  default:
+    type = "CAPN_FIELD_PTR";
+    def = (int)f->v.intval;
+    break;
+  }
+
+  str_addf(&s->table, "\t{%s, %d, offsetof(struct %s, %s%s), %d, %d, ", type,
+           off, s->table_struct, s->var.str + 3, field_name(f),
+           s->table_which, s->table_tag);
+  if (xor >> 32) {
+    str_addf(&s->table, "((uint64_t) %#xu << 32) | %#xu, ",
+             (uint32_t)(xor >> 32), (uint32_t)xor);
+  } else if (xor) {
+    str_addf(&s->table, "%#xu, ", (uint32_t)xor);
+  } else {
+    str_addf(&s->table, "0, ");
+  }
+  if (def) {
+    str_addf(&s->table, "&capn_val%d},\n", def);
+  } else {
+    str_addf(&s->table, "NULL},\n");
+  }
+  s->table_len++;
+}
+
 static void union_block(capnp_ctx_t *ctx, struct strings *s, struct field *f,
                         const char *u1, const char *u2) {
   static struct str buf = STR_INIT;
@@ -1763,6 +2201,8 @@ static void union_block(capnp_ctx_t *ctx, struct strings *s, struct field *f,
              strf(&buf, "%s%s", s->var.str, field_name(f)));
   get_member(ctx, &s->get, f, "p.p", s->ftab.str,
              strf(&buf, "%s%s", s->var.str, field_name(f)));
+  s->table_tag = f->f.discriminantValue;
+  table_entry(s, f);
   str_addf(&s->set, "%sbreak;\n", s->ftab.str);
   str_addf(&s->get, "%sbreak;\n", s->ftab.str);
   if (ctx->g_codecgen) {
@@ -1792,6 +2232,8 @@ static void union_block(capnp_ctx_t *ctx, struct strings *s, struct field *f,
     str_addf(&s->decoder, "%sbreak;\n", s->ftab.str);
     free_member(ctx, &s->freeup, f, s->ftab.str, var1, var2);
     str_addf(&s->freeup, "%sbreak;\n", s->ftab.str);
+    size_member(ctx, &s->sizer, f, s->ftab.str, var1, var2);
+    str_addf(&s->sizer, "%sbreak;\n", s->ftab.str);
   }
   str_setlen(&s->ftab, s->ftab.len - 1);
 }
@@ -1826,6 +2268,8 @@ static void union_cases(capnp_ctx_t *ctx, struct strings *s, struct node *n,
                field_name(f));
       str_addf(&s->freeup, "%scase %s_%s:\n", s->ftab.str, n->name.str,
                field_name(f));
+      str_addf(&s->sizer, "%scase %s_%s:\n", s->ftab.str, n->name.str,
+               field_name(f));
     }
 
     if (u) {
@@ -1840,8 +2284,9 @@ static void declare_slot(struct strings *s, struct field *f) {
   case Type__void:
     break;
   case Type__bool:
-    str_addf(&s->decl, "%s%s %s : 1;\n", s->dtab.str, f->v.tname,
-             field_name(f));
+    /* capn_field needs the offset of the member, so no bit field */
+    str_addf(&s->decl, "%s%s %s%s;\n", s->dtab.str, f->v.tname,
+             field_name(f), s->table_struct ? "" : " : 1");
     break;
   default:
     str_addf(&s->decl, "%s%s %s;\n", s->dtab.str, f->v.tname, field_name(f));
@@ -1862,6 +2307,7 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
   struct field *f;
   static struct str tag = STR_INIT;
   struct str enums = STR_INIT;
+  int outer_which = s->table_which, outer_tag = s->table_tag;
 
   str_reset(&tag);
 
@@ -1882,6 +2328,14 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
 
   str_addf(&s->set, "%scapn_write16(p.p, %d, %s);\n", s->ftab.str, tagoff,
            tag.str);
+  if (s->table_struct != NULL) {
+    str_addf(&s->table,
+             "\t{CAPN_FIELD_WHICH, %d, offsetof(struct %s, %s), %d, %d, 0, "
+             "NULL},\n",
+             tagoff, s->table_struct, tag.str + 3, s->table_which,
+             s->table_tag);
+    s->table_which = ++s->table_len;
+  }
   str_addf(&s->set, "%sswitch (%s) {\n", s->ftab.str, tag.str);
   str_addf(&s->get, "%sswitch (%s) {\n", s->ftab.str, tag.str);
 
@@ -1898,6 +2352,7 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
     str_addf(&s->encoder, "%sswitch (%s) {\n", s->ftab.str, var);
     str_addf(&s->decoder, "%sswitch (%s) {\n", s->ftab.str, tag.str);
     str_addf(&s->freeup, "%sswitch (%s) {\n", s->ftab.str, uniontag);
+    str_addf(&s->sizer, "%sswitch (%s) {\n", s->ftab.str, uniontag);
   }
 
   /* if we have a bunch of the same C type with zero defaults, we
@@ -1937,6 +2392,7 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
       str_addf(&s->set, "%scase %s_%s:\n", s->ftab.str, n->name.str,
                field_name(f));
       str_add(&s->ftab, "\t", -1);
+      s->table_tag = f->f.discriminantValue;
       // When we add a union inside a union, we need to enclose it in its
       // own struct so that its members do not overwrite its own
       // discriminant.
@@ -1948,6 +2404,7 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
         str_addf(&s->encoder, "%sbreak;\n", s->ftab.str);
         str_addf(&s->decoder, "%sbreak;\n", s->ftab.str);
         str_addf(&s->freeup, "%sbreak;\n", s->ftab.str);
+        str_addf(&s->sizer, "%sbreak;\n", s->ftab.str);
       }
       str_setlen(&s->ftab, s->ftab.len - 1);
       break;
@@ -1966,6 +2423,8 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
                    field_name(f));
           str_addf(&s->freeup, "%scase %s_%s:\n", s->ftab.str, n->name.str,
                    field_name(f));
+          str_addf(&s->sizer, "%scase %s_%s:\n", s->ftab.str, n->name.str,
+                   field_name(f));
         }
         union_block(
             ctx, s, f,
@@ -1980,6 +2439,8 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
   }
 
   str_setlen(&s->dtab, s->dtab.len - 1);
+  s->table_which = outer_which;
+  s->table_tag = outer_tag;
 
   if (union_name) {
     str_addf(&s->decl, "%s} %s;\n", s->dtab.str, union_name);
@@ -1999,6 +2460,8 @@ static void do_union(capnp_ctx_t *ctx, struct strings *s, struct node *n,
              s->ftab.str, s->ftab.str);
     str_addf(&s->freeup, "%sdefault:\n%s\tbreak;\n%s}\n", s->ftab.str,
              s->ftab.str, s->ftab.str);
+    str_addf(&s->sizer, "%sdefault:\n%s\tbreak;\n%s}\n", s->ftab.str,
+             s->ftab.str, s->ftab.str);
   }
 
   str_addf(&enums, "\n};\n");
@@ -2017,6 +2480,7 @@ static void define_field(capnp_ctx_t *ctx, struct strings *s, struct field *f,
                strf(&buf, "%s%s", s->var.str, field_name(f)));
     get_member(ctx, &s->get, f, "p.p", s->ftab.str,
                strf(&buf, "%s%s", s->var.str, field_name(f)));
+    table_entry(s, f);
     if (ctx->g_codecgen) {
       encode_member(ctx, &s->encoder, f, s->ftab.str, field_name(f),
                     get_mapname(f->f.annotations));
@@ -2024,6 +2488,8 @@ static void define_field(capnp_ctx_t *ctx, struct strings *s, struct field *f,
                     get_mapname(f->f.annotations));
       free_member(ctx, &s->freeup, f, s->ftab.str, field_name(f),
                   get_mapname(f->f.annotations));
+      size_member(ctx, &s->sizer, f, s->ftab.str, field_name(f),
+                  get_mapname(f->f.annotations));
     }
     break;
 
@@ -2065,45 +2531,179 @@ static void define_field(capnp_ctx_t *ctx, struct strings *s, struct field *f,
   }
 }
 
+/* is_scalar returns whether f is stored in the data section, so that its
+ * accessors only need the inline capn_read and capn_write functions. */
+static int is_scalar(struct field *f) {
+  switch (f->v.t.which) {
+  case Type__bool:
+  case Type_int8:
+  case Type_int16:
+  case Type_int32:
+  case Type_int64:
+  case Type_uint8:
+  case Type_uint16:
+  case Type_uint32:
+  case Type_uint64:
+  case Type_float32:
+  case Type_float64:
+  case Type__enum:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
 static void define_getter_functions(capnp_ctx_t *ctx, struct node *node,
                                     struct field *field, struct strings *s,
                                     const char *extattr,
                                     const char *extattr_space) {
   /**
-   * define getter
+   * define getter, in the header for $C.inlineaccessors
    */
-  str_addf(&s->pub_get_header, "\n%s%s%s %s_get_%s(%s_ptr p);\n", extattr,
-           extattr_space, field->v.tname, node->name.str, field_name(field),
-           node->name.str);
-  str_addf(&s->pub_get, "\n%s%s%s %s_get_%s(%s_ptr p)\n", extattr,
-           extattr_space, field->v.tname, node->name.str, field_name(field),
-           node->name.str);
+  struct str *def = &s->pub_get;
+  if (ctx->g_inlineaccessors && is_scalar(field)) {
+    def = &s->pub_get_header;
+    str_addf(def, "\nCAPN_INLINE %s %s_get_%s(%s_ptr p)\n", field->v.tname,
+             node->name.str, field_name(field), node->name.str);
+  } else {
+    str_addf(&s->pub_get_header, "\n%s%s%s %s_get_%s(%s_ptr p);\n", extattr,
+             extattr_space, field->v.tname, node->name.str, field_name(field),
+             node->name.str);
+    str_addf(def, "\n%s%s%s %s_get_%s(%s_ptr p)\n", extattr, extattr_space,
+             field->v.tname, node->name.str, field_name(field),
+             node->name.str);
+  }
   struct str getter_body = STR_INIT;
   get_member(ctx, &getter_body, field, "p.p", "", field_name(field));
-  str_addf(&s->pub_get, "{\n");
-  str_addf(&s->pub_get, "%s%s %s;\n", s->ftab.str, field->v.tname,
-           field_name(field));
-  str_addf(&s->pub_get, "%s%s", s->ftab.str, getter_body.str);
+  str_addf(def, "{\n");
+  str_addf(def, "%s%s %s;\n", s->ftab.str, field->v.tname, field_name(field));
+  str_addf(def, "%s%s", s->ftab.str, getter_body.str);
   str_release(&getter_body);
-  str_addf(&s->pub_get, "%sreturn %s;\n}\n", s->ftab.str, field_name(field));
+  str_addf(def, "%sreturn %s;\n}\n", s->ftab.str, field_name(field));
 }
 
 static void define_setter_functions(capnp_ctx_t *ctx, struct node *node,
                                     struct field *field, struct strings *s,
                                     const char *extattr,
                                     const char *extattr_space) {
-  str_addf(&s->pub_set_header, "\n%s%svoid %s_set_%s(%s_ptr p, %s %s);\n",
-           extattr, extattr_space, node->name.str, field_name(field),
-           node->name.str, field->v.tname, field_name(field));
-  str_addf(&s->pub_set, "\n%s%svoid %s_set_%s(%s_ptr p, %s %s)\n", extattr,
-           extattr_space, node->name.str, field_name(field), node->name.str,
-           field->v.tname, field_name(field));
+  struct str *def = &s->pub_set;
+  if (ctx->g_inlineaccessors && is_scalar(field)) {
+    def = &s->pub_set_header;
+    str_addf(def, "\nCAPN_INLINE void %s_set_%s(%s_ptr p, %s %s)\n",
+             node->name.str, field_name(field), node->name.str,
+             field->v.tname, field_name(field));
+  } else {
+    str_addf(&s->pub_set_header, "\n%s%svoid %s_set_%s(%s_ptr p, %s %s);\n",
+             extattr, extattr_space, node->name.str, field_name(field),
+             node->name.str, field->v.tname, field_name(field));
+    str_addf(def, "\n%s%svoid %s_set_%s(%s_ptr p, %s %s)\n", extattr,
+             extattr_space, node->name.str, field_name(field), node->name.str,
+             field->v.tname, field_name(field));
+  }
   struct str setter_body = STR_INIT;
   set_member(ctx, &setter_body, field, "p.p", s->ftab.str, field_name(field));
-  str_addf(&s->pub_set, "{\n%s}\n", setter_body.str);
+  str_addf(def, "{\n%s}\n", setter_body.str);
   str_release(&setter_body);
 }
 
+/* define_column_function reads one field from a range of elements of a
+ * struct list, eg. Person_list_get_id_column(l, start, n, out). */
+static void define_column_function(struct node *node, struct field *field,
+                                   struct strings *s, const char *extattr,
+                                   const char *extattr_space) {
+  static struct str buf = STR_INIT;
+  const char *xor = xor_member(field);
+  const char *tname = field->v.tname;
+  const char *conv = NULL;
+  int bits, off;
+
+  switch (field->v.t.which) {
+  case Type__bool:
+    bits = 1;
+    tname = "uint8_t";
+    break;
+  case Type_int8:
+  case Type_uint8:
+    bits = 8;
+    break;
+  case Type_int16:
+  case Type_uint16:
+    bits = 16;
+    break;
+  case Type_int32:
+  case Type_uint32:
+    bits = 32;
+    break;
+  case Type_int64:
+  case Type_uint64:
+    bits = 64;
+    break;
+  case Type_float32:
+    bits = 32;
+    conv = "capn_to_f32";
+    break;
+  case Type_float64:
+    bits = 64;
+    conv = "capn_to_f64";
+    break;
+  case Type__enum:
+    bits = 16;
+    conv = strf(&buf, "(%s)(int)", field->v.tname);
+    break;
+  default:
+    return;
+  }
+
+  /* the field offset in bytes, or bits for bools */
+  off = bits == 1 ? (int)field->f.slot.offset
+                  : (int)field->f.slot.offset * (bits / 8);
+
+  str_addf(&s->pub_get_header,
+           "\n%s%sint %s_list_get_%s_column(%s_list l, int start, int n, %s "
+           "*out);\n",
+           extattr, extattr_space, node->name.str, field_name(field),
+           node->name.str, tname);
+  str_addf(&s->pub_get,
+           "\n%s%sint %s_list_get_%s_column(%s_list l, int start, int n, %s "
+           "*out)\n{\n",
+           extattr, extattr_space, node->name.str, field_name(field),
+           node->name.str, tname);
+
+  if (conv) {
+    /* converted types go through a buffer of raw values */
+    str_addf(&s->pub_get, "\tuint%d_t buf[64];\n", bits);
+    str_addf(&s->pub_get, "\tint i = 0, j, m;\n");
+    str_addf(&s->pub_get, "\twhile (i < n) {\n");
+    str_addf(&s->pub_get,
+             "\t\tm = capn_getcol%d(l.p, %d, start + i, buf, n - i < 64 ? n "
+             "- i : 64);\n",
+             bits, off);
+    str_addf(&s->pub_get, "\t\tif (m < 0)\n\t\t\treturn -1;\n");
+    str_addf(&s->pub_get, "\t\tif (m == 0)\n\t\t\tbreak;\n");
+    str_addf(&s->pub_get, "\t\tfor (j = 0; j < m; j++) {\n");
+    str_addf(&s->pub_get, "\t\t\tout[i + j] = %s(buf[j]%s);\n", conv, xor);
+    str_addf(&s->pub_get, "\t\t}\n\t\ti += m;\n\t}\n\treturn i;\n}\n");
+  } else if (bits == 1 && field->v.intval) {
+    str_addf(&s->pub_get, "\tint i;\n");
+    str_addf(&s->pub_get, "\tn = capn_getcol1(l.p, %d, start, out, n);\n",
+             off);
+    str_addf(&s->pub_get, "\tfor (i = 0; i < n; i++) {\n");
+    str_addf(&s->pub_get, "\t\tout[i] ^= 1;\n\t}\n\treturn n;\n}\n");
+  } else if (*xor) {
+    str_addf(&s->pub_get, "\tint i;\n");
+    str_addf(&s->pub_get, "\tn = capn_getcol%d(l.p, %d, start, %sout, n);\n",
+             bits, off,
+             tname[0] == 'u' ? "" : strf(&buf, "(uint%d_t*) ", bits));
+    str_addf(&s->pub_get, "\tfor (i = 0; i < n; i++) {\n");
+    str_addf(&s->pub_get, "\t\tout[i] = (%s) (out[i]%s);\n\t}\n", tname, xor);
+    str_addf(&s->pub_get, "\treturn n;\n}\n");
+  } else {
+    str_addf(&s->pub_get, "\treturn capn_getcol%d(l.p, %d, start, %sout, n);\n}\n",
+             bits, off,
+             bits == 1 || tname[0] == 'u' ? "" : strf(&buf, "(uint%d_t*) ", bits));
+  }
+}
+
 static void define_encode_function(capnp_ctx_t *ctx, struct node *node,
                                    struct strings *s, const char *extattr,
                                    const char *extattr_space) {}
@@ -2144,7 +2744,7 @@ static void define_group(capnp_ctx_t *ctx, struct strings *s, struct node *n,
   for (f = n->fields; f < n->fields + flen && !in_union(f); f++) {
     define_field(ctx, s, f, extattr, extattr_space);
 
-    if (!ctx->g_fieldgetset) {
+    if (!ctx->g_fieldgetset && !ctx->g_fieldcolumns) {
       continue;
     }
 
@@ -2160,8 +2760,14 @@ static void define_group(capnp_ctx_t *ctx, struct strings *s, struct node *n,
       continue;
     }
 
-    define_getter_functions(ctx, n, f, s, extattr, extattr_space);
-    define_setter_functions(ctx, n, f, s, extattr, extattr_space);
+    if (ctx->g_fieldgetset) {
+      define_getter_functions(ctx, n, f, s, extattr, extattr_space);
+      define_setter_functions(ctx, n, f, s, extattr, extattr_space);
+    }
+
+    if (ctx->g_fieldcolumns) {
+      define_column_function(n, f, s, extattr, extattr_space);
+    }
   }
 
   if (ulen > 0) {
@@ -2201,25 +2807,407 @@ static void define_group(capnp_ctx_t *ctx, struct strings *s, struct node *n,
   }
 }
 
+/* arrow_entry adds the capn_arrow_field entry for f to the table and
+ * returns 1, or returns 0 if f can't be exported. Fields in unions must
+ * always get an entry, as CAPN_ARROW_NULL if nothing else. */
+static int arrow_entry(struct str *tab, struct field *f, const char *name,
+                       int tag) {
+  const char *type;
+  int off = f->f.slot.offset;
+  uint64_t xor = 0;
+
+  switch (f->f.which == Field_slot ? f->v.t.which : Type__void) {
+  case Type__bool:
+    type = "CAPN_ARROW_BOOL";
+    xor = f->v.intval;
+    break;
+  case Type_int8:
+    type = "CAPN_ARROW_INT8";
+    xor = (uint8_t)f->v.intval;
+    break;
+  case Type_uint8:
+    type = "CAPN_ARROW_UINT8";
+    xor = (uint8_t)f->v.intval;
+    break;
+  case Type_int16:
+    type = "CAPN_ARROW_INT16";
+    xor = (uint16_t)f->v.intval;
+    off *= 2;
+    break;
+  case Type_uint16:
+  case Type__enum:
+    type = "CAPN_ARROW_UINT16";
+    xor = (uint16_t)f->v.intval;
+    off *= 2;
+    break;
+  case Type_int32:
+    type = "CAPN_ARROW_INT32";
+    xor = (uint32_t)f->v.intval;
+    off *= 4;
+    break;
+  case Type_uint32:
+    type = "CAPN_ARROW_UINT32";
+    xor = (uint32_t)f->v.intval;
+    off *= 4;
+    break;
+  case Type_float32:
+    type = "CAPN_ARROW_FLOAT32";
+    xor = (uint32_t)f->v.intval;
+    off *= 4;
+    break;
+  case Type_int64:
+    type = "CAPN_ARROW_INT64";
+    xor = f->v.intval;
+    off *= 8;
+    break;
+  case Type_uint64:
+    type = "CAPN_ARROW_UINT64";
+    xor = f->v.intval;
+    off *= 8;
+    break;
+  case Type_float64:
+    type = "CAPN_ARROW_FLOAT64";
+    xor = f->v.intval;
+    off *= 8;
+    break;
+  case Type_text:
+    type = "CAPN_ARROW_TEXT";
+    break;
+  case Type_data:
+    type = "CAPN_ARROW_DATA";
+    break;
+  default:
+    if (tag < 0)
+      return 0;
+    type = "CAPN_ARROW_NULL";
+    off = 0;
+    break;
+  }
+
+  str_addf(tab, "\t{\"%s\", %s, %d, 0, %d, ", name, type, off,
+           tag < 0 ? 0 : tag);
+  if (xor >> 32) {
+    str_addf(tab, "((uint64_t) %#xu << 32) | %#xu},\n", (uint32_t)(xor >> 32),
+             (uint32_t)xor);
+  } else if (xor) {
+    str_addf(tab, "%#xu},\n", (uint32_t)xor);
+  } else {
+    str_addf(tab, "0},\n");
+  }
+  return 1;
+}
+
+/* arrow_union adds a CAPN_ARROW_UNION entry for the fields of n that are
+ * in its union, followed by one entry per member. */
+static int arrow_union(struct str *tab, struct node *n, const char *name) {
+  struct field *f;
+  int flen = capn_len(n->n._struct.fields);
+
+  str_addf(tab, "\t{\"%s\", CAPN_ARROW_UNION, %d, %d, 0, 0},\n", name,
+           2 * n->n._struct.discriminantOffset,
+           n->n._struct.discriminantCount);
+  for (f = n->fields; f < n->fields + flen; f++) {
+    if (in_union(f))
+      arrow_entry(tab, f, f->f.name.str, f->f.discriminantValue);
+  }
+  return 1 + n->n._struct.discriminantCount;
+}
+
+/* define_arrow_export emits the field table of n for capn_arrow_export and
+ * X_list_to_arrow. Primitive, text and data fields and unions are exported;
+ * nested structs, lists and plain groups are left out. */
+static void define_arrow_export(capnp_ctx_t *ctx, struct node *n,
+                                const char *extattr,
+                                const char *extattr_space) {
+  struct str tab = STR_INIT;
+  struct field *f;
+  int flen = capn_len(n->n._struct.fields);
+  int num = 0;
+
+  for (f = n->fields; f < n->fields + flen; f++) {
+    if (in_union(f))
+      continue;
+    if (f->group) {
+      if (f->group->n._struct.discriminantCount ==
+          capn_len(f->group->n._struct.fields))
+        num += arrow_union(&tab, f->group, f->f.name.str);
+    } else {
+      num += arrow_entry(&tab, f, f->f.name.str, -1);
+    }
+  }
+  if (n->n._struct.discriminantCount > 0) {
+    num += arrow_union(&tab, n, "which");
+  }
+
+  if (num) {
+    str_addf(&(ctx->SRC),
+             "\nstatic const struct capn_arrow_field %s_arrow_fields[] = {\n",
+             n->name.str);
+    str_add(&(ctx->SRC), tab.str, tab.len);
+    str_addf(&(ctx->SRC), "};\n");
+  }
+  str_release(&tab);
+
+  str_addf(&(ctx->HDR),
+           "\n%s%sint %s_list_to_arrow(%s_list l, struct ArrowArray *array, "
+           "struct ArrowSchema *schema);\n",
+           extattr, extattr_space, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC),
+           "\n%s%sint %s_list_to_arrow(%s_list l, struct ArrowArray *array, "
+           "struct ArrowSchema *schema)\n{\n",
+           extattr, extattr_space, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC),
+           "\treturn capn_arrow_export(l.p, %s%s, %d, array, schema);\n}\n",
+           num ? n->name.str : "NULL", num ? "_arrow_fields" : "", num);
+}
+
+/* define_table_functions emits the capn_field table collected in s for a
+ * $C.tabledriven struct, and read_X and write_X that hand it to
+ * capn_read_fields and capn_write_fields. */
+static void define_table_functions(capnp_ctx_t *ctx, struct node *n,
+                                   struct strings *s, const char *extattr,
+                                   const char *extattr_space) {
+  const char *table = s->table_len ? n->name.str : "NULL";
+  const char *suffix = s->table_len ? "_fields" : "";
+
+  if (s->table_len) {
+    str_addf(&(ctx->SRC), "\nstatic const struct capn_field %s_fields[] = {\n",
+             n->name.str);
+    str_add(&(ctx->SRC), s->table.str, s->table.len);
+    str_addf(&(ctx->SRC), "};\n");
+  }
+
+  str_addf(&(ctx->SRC),
+           "%s%svoid read_%s(struct %s *s capnp_unused, %s_ptr p) {\n", extattr,
+           extattr_space, n->name.str, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC), "\tcapn_read_fields(p.p, s, %s%s, %d);\n", table,
+           suffix, s->table_len);
+  str_addf(&(ctx->SRC), "}\n");
+
+  str_addf(&(ctx->SRC),
+           "%s%svoid write_%s(const struct %s *s capnp_unused, %s_ptr p) {\n",
+           extattr, extattr_space, n->name.str, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC), "\tcapn_write_fields(p.p, s, %s%s, %d);\n", table,
+           suffix, s->table_len);
+  str_addf(&(ctx->SRC), "}\n");
+}
+
+/* unchecked_get copies the read body src into dst one tab deeper, with each
+ * capn_readN(p.p, off) replaced by a raw load. It is only valid once the
+ * data section has been checked to be at least as large as the schema
+ * expects. Returns the number of loads replaced. */
+static int unchecked_get(struct str *dst, const char *src) {
+  int loads = 0;
+
+  while (*src) {
+    const char *end = strchr(src, '\n');
+    end = end ? end + 1 : src + strlen(src);
+    str_add(dst, "\t", 1);
+
+    while (src < end) {
+      const char *p = strstr(src, "capn_read");
+      int bits, off, n = -1;
+
+      if (p == NULL || p >= end) {
+        str_add(dst, src, (int)(end - src));
+        src = end;
+        break;
+      }
+
+      sscanf(p, "capn_read%d(p.p, %d)%n", &bits, &off, &n);
+      if (n < 0) {
+        str_add(dst, src, (int)(p - src) + 9);
+        src = p + 9;
+        continue;
+      }
+
+      str_add(dst, src, (int)(p - src));
+      str_addf(dst, "capn_flip%d(*(uint%d_t*) (p.p.data+%d))", bits, bits,
+               off);
+      src = p + n;
+      loads++;
+    }
+  }
+
+  return loads;
+}
+
+static void reset_strings(struct strings *s) {
+  str_reset(&s->dtab);
+  str_reset(&s->ftab);
+  str_reset(&s->get);
+  str_reset(&s->set);
+  str_reset(&s->encoder);
+  str_reset(&s->decoder);
+  str_reset(&s->freeup);
+  str_reset(&s->sizer);
+  str_reset(&s->table);
+  s->table_len = 0;
+  s->table_which = 0;
+  s->table_tag = 0;
+  str_reset(&s->enums);
+  str_reset(&s->decl);
+  str_reset(&s->var);
+  str_reset(&s->pub_get);
+  str_reset(&s->pub_set);
+  str_reset(&s->pub_get_header);
+  str_reset(&s->pub_set_header);
+}
+
+/* field_mask returns the read_X_fields mask bit of f. Fields past the 64th
+ * have none and are always read. */
+static uint64_t field_mask(struct node *n, struct field *f) {
+  int i = (int)(f - n->fields);
+  return i < 64 ? (uint64_t)1 << i : 0;
+}
+
+/* define_read_fields emits read_X_fields, which only reads the top level
+ * fields of n whose bit is set in mask, along with an X_Y_mask constant for
+ * each of them. Groups and the unnamed union are read as a whole when any
+ * of their bits are set. */
+static void define_read_fields(capnp_ctx_t *ctx, struct node *n,
+                               const char *extattr,
+                               const char *extattr_space) {
+  static struct strings fs;
+  static struct str buf = STR_INIT;
+  int flen = capn_len(n->n._struct.fields);
+  struct field *f;
+
+  for (f = n->fields; f < n->fields + flen && field_mask(n, f); f++) {
+    str_addf(&(ctx->HDR),
+             "static const uint64_t %s_%s_mask = (uint64_t) 1 << %d;\n\n",
+             n->name.str, field_name(f), (int)(f - n->fields));
+  }
+
+  str_addf(&(ctx->SRC),
+           "%s%svoid read_%s_fields(struct %s *s capnp_unused, %s_ptr p, "
+           "uint64_t mask) {\n",
+           extattr, extattr_space, n->name.str, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC), "\tcapn_resolve(&p.p);\n\tcapnp_use(s);\n");
+
+  for (f = n->fields; f < n->fields + flen;) {
+    struct field *first = f;
+
+    reset_strings(&fs);
+    str_add(&fs.dtab, "\t", -1);
+    str_add(&fs.ftab, "\t\t", -1);
+    str_add(&fs.var, "s->", -1);
+
+    if (in_union(f)) {
+      do_union(ctx, &fs, n, f, NULL, extattr, extattr_space, NULL);
+      while (f < n->fields + flen && in_union(f))
+        f++;
+    } else if (f->f.which == Field_slot) {
+      get_member(ctx, &fs.get, f, "p.p", fs.ftab.str,
+                 strf(&buf, "s->%s", field_name(f)));
+      f++;
+    } else {
+      define_field(ctx, &fs, f, extattr, extattr_space);
+      f++;
+    }
+
+    if (fs.get.len == 0)
+      continue;
+
+    str_reset(&buf);
+    for (; first < f && field_mask(n, first); first++) {
+      str_addf(&buf, "%s%s_%s_mask", buf.len ? " | " : "", n->name.str,
+               field_name(first));
+    }
+    if (buf.len == 0) {
+      str_addf(&(ctx->SRC), "\t{\n");
+    } else if (strchr(buf.str, '|')) {
+      str_addf(&(ctx->SRC), "\tif (mask & (%s)) {\n", buf.str);
+    } else {
+      str_addf(&(ctx->SRC), "\tif (mask & %s) {\n", buf.str);
+    }
+    str_add(&(ctx->SRC), fs.get.str, fs.get.len);
+    str_addf(&(ctx->SRC), "\t}\n");
+  }
+
+  str_addf(&(ctx->SRC), "}\n");
+}
+
+/* define_range_open emits the start of read_X_range or write_X_range up to
+ * the loop over the elements of a composite list. Other lists go through
+ * get_X or set_X one element at a time. */
+static void define_range_open(capnp_ctx_t *ctx, struct node *n,
+                              const char *op, const char *fallback) {
+  str_addf(&(ctx->SRC), "\tcapn_resolve(&l.p);\n");
+  str_addf(&(ctx->SRC),
+           "\tif (start < 0 || n < 0 || start > l.p.len) return -1;\n");
+  str_addf(&(ctx->SRC),
+           "\tif (n > l.p.len - start) n = l.p.len - start;\n");
+  str_addf(&(ctx->SRC), "\tif (l.p.type != CAPN_LIST) {\n");
+  str_addf(&(ctx->SRC), "\t\tfor (i = 0; i < n; i++) {\n");
+  str_addf(&(ctx->SRC), "\t\t\t%s_%s(&%s[i], l, start + i);\n", fallback,
+           n->name.str, op);
+  str_addf(&(ctx->SRC), "\t\t}\n");
+  str_addf(&(ctx->SRC), "\t\treturn n;\n");
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\tstride = l.p.datasz + 8 * (size_t) l.p.ptrs;\n");
+  str_addf(&(ctx->SRC), "\tp.p = capn_getp(l.p, start, 0);\n");
+}
+
+/* define_range_functions emits read_X_range and write_X_range, which
+ * resolve the list once and then step through its elements by the list
+ * stride. The reader also prefetches the pointer targets of elements a
+ * few steps ahead. */
+static void define_range_functions(capnp_ctx_t *ctx, struct node *n,
+                                   const char *extattr,
+                                   const char *extattr_space) {
+  str_addf(&(ctx->SRC),
+           "\n%s%sint read_%s_range(%s_list l, int start, int n, struct %s "
+           "*out) {\n",
+           extattr, extattr_space, n->name.str, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC), "\t%s_ptr p;\n", n->name.str);
+  if (n->n._struct.pointerCount > 0) {
+    str_addf(&(ctx->SRC), "\tcapn_ptr ahead;\n");
+  }
+  str_addf(&(ctx->SRC), "\tsize_t stride;\n");
+  str_addf(&(ctx->SRC), "\tint i;\n");
+  define_range_open(ctx, n, "out", "get");
+  if (n->n._struct.pointerCount > 0) {
+    str_addf(&(ctx->SRC), "\tahead = p.p;\n");
+  }
+  str_addf(&(ctx->SRC), "\tfor (i = 0; i < n; i++, p.p.data += stride) {\n");
+  if (n->n._struct.pointerCount > 0) {
+    str_addf(&(ctx->SRC), "\t\tif (i + CAPN_PREFETCH_AHEAD < n) {\n");
+    str_addf(&(ctx->SRC),
+             "\t\t\tahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;\n");
+    str_addf(&(ctx->SRC), "\t\t\tcapn_prefetch_ptrs(ahead);\n");
+    str_addf(&(ctx->SRC), "\t\t}\n");
+  }
+  str_addf(&(ctx->SRC), "\t\tread_%s(&out[i], p);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\treturn n;\n");
+  str_addf(&(ctx->SRC), "}\n");
+
+  str_addf(&(ctx->SRC),
+           "\n%s%sint write_%s_range(%s_list l, int start, int n, const "
+           "struct %s *in) {\n",
+           extattr, extattr_space, n->name.str, n->name.str, n->name.str);
+  str_addf(&(ctx->SRC), "\t%s_ptr p;\n", n->name.str);
+  str_addf(&(ctx->SRC), "\tsize_t stride;\n");
+  str_addf(&(ctx->SRC), "\tint i;\n");
+  define_range_open(ctx, n, "in", "set");
+  str_addf(&(ctx->SRC), "\tfor (i = 0; i < n; i++, p.p.data += stride) {\n");
+  str_addf(&(ctx->SRC), "\t\twrite_%s(&in[i], p);\n", n->name.str);
+  str_addf(&(ctx->SRC), "\t}\n");
+  str_addf(&(ctx->SRC), "\treturn n;\n");
+  str_addf(&(ctx->SRC), "}\n");
+}
+
 static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
                           const char *extattr_space) {
   static struct strings s;
+  static struct str fast = STR_INIT;
+  char uniontagvar[256];
+  const char *uniontag = NULL;
   int i;
 
-  str_reset(&s.dtab);
-  str_reset(&s.ftab);
-  str_reset(&s.get);
-  str_reset(&s.set);
-  str_reset(&s.encoder);
-  str_reset(&s.decoder);
-  str_reset(&s.freeup);
-  str_reset(&s.enums);
-  str_reset(&s.decl);
-  str_reset(&s.var);
-  str_reset(&s.pub_get);
-  str_reset(&s.pub_set);
-  str_reset(&s.pub_get_header);
-  str_reset(&s.pub_set_header);
+  reset_strings(&s);
+  s.table_struct = ctx->g_tabledriven ? n->name.str : NULL;
 
   str_add(&s.dtab, "\t", -1);
   str_add(&s.ftab, "\t", -1);
@@ -2227,19 +3215,20 @@ static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
 
   if (ctx->g_codecgen) {
     if (n->n._struct.discriminantCount > 0) {
-      const char *uniontag = get_mapuniontag(n->n.annotations);
-      const char *tagname = "which";
+      const char *tagname = get_mapuniontag(n->n.annotations);
 
-      if (uniontag != NULL) {
-        tagname = uniontag;
+      if (tagname == NULL) {
+        tagname = "which";
       }
 
       str_addf(&s.encoder, "\td->which = s->%s;\n", tagname);
       str_addf(&s.decoder, "\td->%s = s->which;\n", tagname);
+      sprintf(uniontagvar, "d->%s", tagname);
+      uniontag = uniontagvar;
     }
   }
 
-  define_group(ctx, &s, n, NULL, false, extattr, extattr_space, NULL);
+  define_group(ctx, &s, n, NULL, false, extattr, extattr_space, uniontag);
 
   str_add(&(ctx->HDR), s.enums.str, s.enums.len);
 
@@ -2292,19 +3281,36 @@ static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
   str_addf(&(ctx->SRC), "\treturn p;\n");
   str_addf(&(ctx->SRC), "}\n");
 
-  str_addf(&(ctx->SRC),
-           "%s%svoid read_%s(struct %s *s capnp_unused, %s_ptr p) {\n", extattr,
-           extattr_space, n->name.str, n->name.str, n->name.str);
-  str_addf(&(ctx->SRC), "\tcapn_resolve(&p.p);\n\tcapnp_use(s);\n");
-  str_add(&(ctx->SRC), s.get.str, s.get.len);
-  str_addf(&(ctx->SRC), "}\n");
+  if (s.table_struct != NULL) {
+    define_table_functions(ctx, n, &s, extattr, extattr_space);
+  } else {
+    str_addf(&(ctx->SRC),
+             "%s%svoid read_%s(struct %s *s capnp_unused, %s_ptr p) {\n", extattr,
+             extattr_space, n->name.str, n->name.str, n->name.str);
+    str_addf(&(ctx->SRC), "\tcapn_resolve(&p.p);\n\tcapnp_use(s);\n");
+    /* structs written with this version of the schema or a later one take
+     * a single size check instead of one per field */
+    str_reset(&fast);
+    if (unchecked_get(&fast, s.get.str) > 0) {
+      str_addf(&(ctx->SRC), "\tif (p.p.datasz >= %d) {\n",
+               8 * n->n._struct.dataWordCount);
+      str_add(&(ctx->SRC), fast.str, fast.len);
+      str_addf(&(ctx->SRC), "\t\treturn;\n\t}\n");
+    }
+    str_add(&(ctx->SRC), s.get.str, s.get.len);
+    str_addf(&(ctx->SRC), "}\n");
+  }
 
-  str_addf(&(ctx->SRC),
-           "%s%svoid write_%s(const struct %s *s capnp_unused, %s_ptr p) {\n",
-           extattr, extattr_space, n->name.str, n->name.str, n->name.str);
-  str_addf(&(ctx->SRC), "\tcapn_resolve(&p.p);\n\tcapnp_use(s);\n");
-  str_add(&(ctx->SRC), s.set.str, s.set.len);
-  str_addf(&(ctx->SRC), "}\n");
+  define_read_fields(ctx, n, extattr, extattr_space);
+
+  if (s.table_struct == NULL) {
+    str_addf(&(ctx->SRC),
+             "%s%svoid write_%s(const struct %s *s capnp_unused, %s_ptr p) {\n",
+             extattr, extattr_space, n->name.str, n->name.str, n->name.str);
+    str_addf(&(ctx->SRC), "\tcapn_resolve(&p.p);\n\tcapnp_use(s);\n");
+    str_add(&(ctx->SRC), s.set.str, s.set.len);
+    str_addf(&(ctx->SRC), "}\n");
+  }
 
   str_addf(&(ctx->SRC), "%s%svoid get_%s(struct %s *s, %s_list l, int i) {\n",
            extattr, extattr_space, n->name.str, n->name.str, n->name.str);
@@ -2321,6 +3327,8 @@ static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
   str_addf(&(ctx->SRC), "\twrite_%s(s, p);\n", n->name.str);
   str_addf(&(ctx->SRC), "}\n");
 
+  define_range_functions(ctx, n, extattr, extattr_space);
+
   if (ctx->g_codecgen) {
     const char *mapname = get_mapname(n->n.annotations);
     char buf[256];
@@ -2332,17 +3340,35 @@ static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
     }
     str_addf(
         &(ctx->SRC),
-        "\nvoid encode_%s(struct capn_segment *cs,struct %s *d, %s *s) {\n",
+        "\nvoid encode_%s(struct capn_segment *cs capnp_unused,struct %s *d, "
+        "%s *s) {\n",
         n->name.str, n->name.str, buf);
+    str_addf(&(ctx->SRC), "\tcapnp_use(cs);\n");
     str_addf(&(ctx->SRC), "%s\n", s.encoder.str);
     str_addf(&(ctx->SRC), "}\n");
-    str_addf(&(ctx->SRC), "\nvoid decode_%s(%s *d, struct %s *s) {\n",
+    str_addf(&(ctx->SRC),
+             "\nvoid decode_%s_arena(struct capn_arena *a capnp_unused, %s *d, "
+             "struct %s *s) {\n",
              n->name.str, buf, n->name.str);
+    str_addf(&(ctx->SRC), "\tcapnp_use(a);\n");
     str_addf(&(ctx->SRC), "%s\n", s.decoder.str);
     str_addf(&(ctx->SRC), "}\n");
+    str_addf(&(ctx->SRC), "\nvoid decode_%s(%s *d, struct %s *s) {\n",
+             n->name.str, buf, n->name.str);
+    str_addf(&(ctx->SRC), "\tdecode_%s_arena(NULL, d, s);\n", n->name.str);
+    str_addf(&(ctx->SRC), "}\n");
     str_addf(&(ctx->SRC), "\nvoid free_%s(%s *d) {\n", n->name.str, buf);
     str_addf(&(ctx->SRC), "%s\n", s.freeup.str);
     str_addf(&(ctx->SRC), "}\n");
+    /* the struct itself is allocated by encode_X_ptr even when d is NULL */
+    str_addf(&(ctx->SRC), "\nsize_t size_%s(const %s *d) {\n", n->name.str,
+             buf);
+    str_addf(&(ctx->SRC), "\tsize_t n_ = %d;\n",
+             n->n._struct.dataWordCount + n->n._struct.pointerCount);
+    str_addf(&(ctx->SRC), "\tif (d == NULL) return n_;\n");
+    str_add(&(ctx->SRC), s.sizer.str, s.sizer.len);
+    str_addf(&(ctx->SRC), "\treturn n_;\n");
+    str_addf(&(ctx->SRC), "}\n");
   }
 
   str_add(&(ctx->SRC), s.pub_get.str, s.pub_get.len);
@@ -2350,6 +3376,10 @@ static void define_struct(capnp_ctx_t *ctx, struct node *n, const char *extattr,
 
   str_add(&(ctx->HDR), s.pub_get_header.str, s.pub_get_header.len);
   str_add(&(ctx->HDR), s.pub_set_header.str, s.pub_set_header.len);
+
+  if (ctx->g_arrowexport) {
+    define_arrow_export(ctx, n, extattr, extattr_space);
+  }
 }
 
 static void declare(capnp_ctx_t *ctx, struct node *file_node,
@@ -2403,6 +3433,9 @@ static void mk_codec_declares(capnp_ctx_t *ctx, const char *n1,
            "void encode_%s(struct capn_segment *,struct %s *, %s *);\n", n1, n1,
            n2);
   str_addf(&(ctx->HDR), "void decode_%s(%s *, struct %s *);\n", n1, n2, n1);
+  str_addf(&(ctx->HDR),
+           "void decode_%s_arena(struct capn_arena *, %s *, struct %s *);\n",
+           n1, n2, n1);
   str_addf(&(ctx->HDR), "void free_%s(%s *);\n", n1, n2);
   str_addf(
       &(ctx->HDR),
@@ -2410,12 +3443,34 @@ static void mk_codec_declares(capnp_ctx_t *ctx, const char *n1,
       n1, n2);
   str_addf(&(ctx->HDR), "void decode_%s_list(int *, %s ***, %s_list);\n", n1,
            n2, n1);
+  str_addf(&(ctx->HDR),
+           "void decode_%s_list_arena(struct capn_arena *, int *, %s ***, "
+           "%s_list);\n",
+           n1, n2, n1);
   str_addf(&(ctx->HDR), "void free_%s_list(int, %s **);\n", n1, n2);
+  str_addf(&(ctx->HDR),
+           "void encode_%s_array(struct capn_segment *,%s_list *, int, %s *);\n",
+           n1, n1, n2);
+  str_addf(&(ctx->HDR), "void decode_%s_array(int *, %s **, %s_list);\n", n1,
+           n2, n1);
+  str_addf(&(ctx->HDR),
+           "void decode_%s_array_arena(struct capn_arena *, int *, %s **, "
+           "%s_list);\n",
+           n1, n2, n1);
+  str_addf(&(ctx->HDR), "void free_%s_array(int, %s *);\n", n1, n2);
   str_addf(&(ctx->HDR),
            "void encode_%s_ptr(struct capn_segment*, %s_ptr *, %s *);\n", n1,
            n1, n2);
   str_addf(&(ctx->HDR), "void decode_%s_ptr(%s **, %s_ptr);\n", n1, n2, n1);
+  str_addf(&(ctx->HDR),
+           "void decode_%s_ptr_arena(struct capn_arena *, %s **, %s_ptr);\n",
+           n1, n2, n1);
+  str_addf(&(ctx->HDR), "void decode_%s_fields(%s **, %s_ptr, uint64_t);\n",
+           n1, n2, n1);
   str_addf(&(ctx->HDR), "void free_%s_ptr(%s **);\n", n1, n2);
+  str_addf(&(ctx->HDR), "size_t size_%s(const %s *);\n", n1, n2);
+  str_addf(&(ctx->HDR), "size_t size_%s_list(int, %s **);\n", n1, n2);
+  str_addf(&(ctx->HDR), "size_t size_%s_array(int, const %s *);\n", n1, n2);
 }
 static void declare_codec(capnp_ctx_t *ctx, struct node *file_node) {
   struct node *n;
@@ -2433,6 +3488,82 @@ static void declare_codec(capnp_ctx_t *ctx, struct node *file_node) {
     }
   }
 }
+/* in_file returns whether the node id is file_node or is nested in it,
+ * following the scopes up through structs and groups. */
+static int in_file(capnp_ctx_t *ctx, uint64_t id, struct node *file_node) {
+  struct node *n = find_node_mayfail(ctx, id);
+
+  while (n != NULL && n != file_node) {
+    if (n->n.which == Node_file)
+      return 0;
+    n = find_node_mayfail(ctx, n->n.scopeId);
+  }
+  return n != NULL;
+}
+
+/* define_schema embeds the Node data of file_node and of every node nested
+ * in it, groups included, as a serialized CodeGeneratorRequest for
+ * capn_dynamic_init. The array is named after the file, so addressbook.capnp
+ * gives addressbook_capnp_schema. */
+static void define_schema(capnp_ctx_t *ctx, struct node *file_node) {
+  struct capn c;
+  capn_ptr root;
+  CodeGeneratorRequest_ptr req;
+  Node_list nodes;
+  struct str name = STR_INIT;
+  const char *base = strrchr(file_node->n.displayName.str, '/');
+  uint8_t *buf;
+  int64_t sz;
+  int i, k, count = 0;
+
+  for (i = 0; i < capn_len(ctx->req.nodes); i++) {
+    capn_ptr np = capn_getp(ctx->req.nodes.p, i, 1);
+    count += in_file(ctx, capn_read64(np, 0), file_node);
+  }
+
+  capn_init_malloc(&c);
+  root = capn_root(&c);
+  req = new_CodeGeneratorRequest(root.seg);
+  nodes = new_Node_list(root.seg, count);
+  for (i = 0, k = 0; i < capn_len(ctx->req.nodes); i++) {
+    capn_ptr np = capn_getp(ctx->req.nodes.p, i, 1);
+    if (in_file(ctx, capn_read64(np, 0), file_node)) {
+      if (capn_setp(nodes.p, k++, np)) {
+        fail(2, "failed to copy the schema of %s\n",
+             file_node->n.displayName.str);
+      }
+    }
+  }
+  capn_setp(req.p, 0, nodes.p);
+  capn_setp(root, 0, req.p);
+
+  sz = capn_size(&c);
+  buf = malloc((size_t)sz);
+  if (buf == NULL || capn_write_mem(&c, buf, (size_t)sz, 0) != sz) {
+    fail(2, "failed to serialize the schema of %s\n",
+         file_node->n.displayName.str);
+  }
+
+  for (base = base ? base + 1 : file_node->n.displayName.str; *base; base++) {
+    char ch = *base;
+    str_add(&name, isalnum((unsigned char)ch) ? &ch : "_", 1);
+  }
+
+  str_addf(&(ctx->HDR), "\nextern const uint8_t %s_schema[%d];\n", name.str,
+           (int)sz);
+  str_addf(&(ctx->SRC), "\nconst uint8_t %s_schema[%d] = {", name.str,
+           (int)sz);
+  for (i = 0; i < sz; i++) {
+    str_addf(&(ctx->SRC), "%s%s%u", i ? "," : "", (i % 16) ? "" : "\n\t",
+             buf[i]);
+  }
+  str_addf(&(ctx->SRC), "\n};\n");
+
+  free(buf);
+  str_release(&name);
+  capn_free(&c);
+}
+
 int ctx_init(capnp_ctx_t *ctx, FILE *fp) {
   struct capn_segment *current_seg = NULL;
   int total_len = 0;
@@ -2617,6 +3748,21 @@ int ctx_gen(capnp_ctx_t *ctx) {
       case ANNOTATION_FIELDGETSET: /* $C::fieldgetset */
         ctx->g_fieldgetset = 1;
         break;
+      case ANNOTATION_FIELDCOLUMNS: /* $C::fieldcolumns */
+        ctx->g_fieldcolumns = 1;
+        break;
+      case ANNOTATION_ARROWEXPORT: /* $C::arrowexport */
+        ctx->g_arrowexport = 1;
+        break;
+      case ANNOTATION_INLINEACCESSORS: /* $C::inlineaccessors */
+        ctx->g_inlineaccessors = 1;
+        break;
+      case ANNOTATION_TABLEDRIVEN: /* $C::tabledriven */
+        ctx->g_tabledriven = 1;
+        break;
+      case ANNOTATION_EMBEDSCHEMA: /* $C::embedschema */
+        ctx->g_embedschema = 1;
+        break;
       case ANNOTATION_DONOTINCLUDE: /* $C::donotinclude */
         if (v.which != Value_uint64) {
           fail(2, "schema breakage on $C::donotinclude annotation\n");
@@ -2661,6 +3807,8 @@ int ctx_gen(capnp_ctx_t *ctx) {
              (uint32_t)(file_node->n.id >> 32), (uint32_t)file_node->n.id);
     str_addf(&(ctx->HDR), "/* AUTO GENERATED - DO NOT EDIT */\n");
     str_addf(&(ctx->HDR), "#include <capnp_c.h>\n");
+    if (ctx->g_arrowexport)
+      str_addf(&(ctx->HDR), "#include <capn-arrow.h>\n");
     /* Do [extraheader] in declaration order. */
     struct string_list **current = &extraheader_strings;
     struct string_list **prev = &extraheader_strings;
@@ -2679,8 +3827,20 @@ int ctx_gen(capnp_ctx_t *ctx) {
              "#ifndef STRING_DUP\n"
              "#define STRING_DUP strdup\n"
              "#endif\n\n");
+
+    if (ctx->g_codecgen) {
+      /* decoders allocate from the arena they are given, or with calloc
+       * and STRING_DUP when it is NULL */
+      str_addf(&(ctx->HDR),
+               "#ifndef capn_codec_calloc\n"
+               "#define capn_codec_calloc(a, n, sz) ((a) ? "
+               "capn_arena_calloc((a), (n), (sz)) : calloc((n), (sz)))\n"
+               "#define capn_codec_strdup(a, s) ((a) ? "
+               "capn_arena_strdup((a), (s)) : STRING_DUP(s))\n"
+               "#endif\n\n");
+    }
     
-    str_addf(&(ctx->HDR), "#if CAPN_VERSION != 1\n");
+    str_addf(&(ctx->HDR), "#if CAPN_VERSION != 2\n");
     str_addf(
         &(ctx->HDR),
         "#error \"version mismatch between capnp_c.h and generated code\"\n");
@@ -2745,6 +3905,7 @@ int ctx_gen(capnp_ctx_t *ctx) {
         mk_struct_ptr_decoder(ctx, n);
         mk_struct_list_free(ctx, n);
         mk_struct_ptr_free(ctx, n);
+        mk_struct_list_size(ctx, n);
       }
     }
 
@@ -2755,6 +3916,9 @@ int ctx_gen(capnp_ctx_t *ctx) {
                 extattr, extattr_space);
     declare_ext(ctx, file_node, "%s%svoid read_%s(struct %s*, %s_ptr);\n", 3,
                 extattr, extattr_space);
+    declare_ext(ctx, file_node,
+                "%s%svoid read_%s_fields(struct %s*, %s_ptr, uint64_t mask);\n",
+                3, extattr, extattr_space);
     declare_ext(ctx, file_node,
                 "%s%svoid write_%s(const struct %s*, %s_ptr);\n", 3, extattr,
                 extattr_space);
@@ -2764,11 +3928,23 @@ int ctx_gen(capnp_ctx_t *ctx) {
     declare_ext(ctx, file_node,
                 "%s%svoid set_%s(const struct %s*, %s_list, int i);\n", 3,
                 extattr, extattr_space);
+    declare_ext(ctx, file_node,
+                "%s%sint read_%s_range(%s_list, int start, int n, "
+                "struct %s *out);\n",
+                3, extattr, extattr_space);
+    declare_ext(ctx, file_node,
+                "%s%sint write_%s_range(%s_list, int start, int n, "
+                "const struct %s *in);\n",
+                3, extattr, extattr_space);
 
     if (ctx->g_codecgen) {
       declare_codec(ctx, file_node);
     }
 
+    if (ctx->g_embedschema) {
+      define_schema(ctx, file_node);
+    }
+
     str_addf(&(ctx->HDR), "\n#ifdef __cplusplus\n}\n#endif\n#endif\n");
 
     /* write out the header */
@@ -2802,6 +3978,8 @@ int ctx_gen(capnp_ctx_t *ctx) {
 
     fprintf(srcf, "#include <stdlib.h>\n"
                   "#include <string.h>\n");
+    if (ctx->g_tabledriven)
+      fprintf(srcf, "#include <stddef.h>\n");
     if (ctx->g_val0used)
       fprintf(srcf, "static const capn_text capn_val0 = {0,\"\",0};\n");
     if (ctx->g_nullused)
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "book.capnp.h"
+#include "book.h"
+
+/* Compares decoding a large book with calloc and STRING_DUP, and freeing
+ * it with free_Book_ptr, against decoding it into an arena. */
+
+#define CHAPTERS 10000
+#define AUTHORS 1000
+#define ROUNDS 50
+
+static void encode(struct capn *c) {
+    static chapter_t chapters_[CHAPTERS];
+    static chapter_t *chapters[CHAPTERS];
+    static char *authors[AUTHORS];
+    static char names[AUTHORS][16];
+    book_t book = {0};
+    Book_ptr p;
+    int i;
+
+    for (i = 0; i < CHAPTERS; i ++) {
+	chapters_[i].caption = "Chapter";
+	chapters_[i].start = i;
+	chapters_[i].end = i + 1;
+	chapters[i] = &chapters_[i];
+    }
+    for (i = 0; i < AUTHORS; i ++) {
+	snprintf(names[i], sizeof(names[i]), "author%d", i);
+	authors[i] = names[i];
+    }
+
+    book.title = "Book title";
+    book.n_authors = AUTHORS;
+    book.authors = authors;
+    book.n_chapters = CHAPTERS;
+    book.chapters_ = chapters;
+    book.acquire_method = Book_acquire_donation;
+    book.acquire.donation = "Library";
+
+    capn_init_malloc(c);
+    encode_Book_ptr(capn_root(c).seg, &p, &book);
+    capn_setp(capn_root(c), 0, p.p);
+}
+
+static double seconds(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main() {
+    struct capn c;
+    struct capn_arena arena;
+    Book_ptr p;
+    book_t *book;
+    long sum = 0;
+    clock_t start;
+    int i;
+
+    encode(&c);
+    p.p = capn_getp(capn_root(&c), 0, 1);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	decode_Book_ptr(&book, p);
+	sum += book->chapters_[CHAPTERS - 1]->end;
+	free_Book_ptr(&book);
+    }
+    printf("malloc: %.3f ms per decode\n", 1000 * seconds(start) / ROUNDS);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	capn_arena_init(&arena, (size_t) capn_size(&c));
+	decode_Book_ptr_arena(&arena, &book, p);
+	sum -= book->chapters_[CHAPTERS - 1]->end;
+	capn_arena_free(&arena);
+    }
+    printf("arena:  %.3f ms per decode\n", 1000 * seconds(start) / ROUNDS);
+
+    capn_free(&c);
+    return sum != 0;
+}
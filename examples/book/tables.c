@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "book.capnp.h"
+#include "book-small.capnp.h"
+#include "book.h"
+
+/* Compares decoding and encoding a large book with the per-field code of
+ * book.capnp against the field tables of book-small.capnp. Compare the
+ * object code of the two with size(1) on the object files. */
+
+#define CHAPTERS 10000
+#define ROUNDS 50
+
+static chapter_t chapters_[CHAPTERS];
+static chapter_t *chapters[CHAPTERS];
+
+static void fill(book_t *book) {
+    int i;
+
+    for (i = 0; i < CHAPTERS; i ++) {
+	chapters_[i].caption = "Chapter";
+	chapters_[i].start = i;
+	chapters_[i].end = i + 1;
+	chapters[i] = &chapters_[i];
+    }
+
+    memset(book, 0, sizeof(*book));
+    book->title = "Book title";
+    book->n_chapters = CHAPTERS;
+    book->chapters_ = chapters;
+    book->acquire_method = Book_acquire_donation;
+    book->acquire.donation = "Library";
+}
+
+static double seconds(clock_t start) {
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main() {
+    struct capn c;
+    struct capn_arena arena;
+    book_t book, *fast, *small;
+    Book_ptr p;
+    small_Book_ptr sp;
+    clock_t start;
+    int i, diff = 0;
+
+    fill(&book);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	capn_init_malloc(&c);
+	encode_Book_ptr(capn_root(&c).seg, &p, &book);
+	capn_free(&c);
+    }
+    printf("per-field encode: %.3f ms\n", 1000 * seconds(start) / ROUNDS);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	capn_init_malloc(&c);
+	encode_small_Book_ptr(capn_root(&c).seg, &sp, &book);
+	capn_free(&c);
+    }
+    printf("table encode:     %.3f ms\n", 1000 * seconds(start) / ROUNDS);
+
+    capn_init_malloc(&c);
+    encode_Book_ptr(capn_root(&c).seg, &p, &book);
+    capn_setp(capn_root(&c), 0, p.p);
+    p.p = capn_getp(capn_root(&c), 0, 1);
+    sp.p = p.p;
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	capn_arena_init(&arena, (size_t) capn_size(&c));
+	decode_Book_ptr_arena(&arena, &fast, p);
+	capn_arena_free(&arena);
+    }
+    printf("per-field decode: %.3f ms\n", 1000 * seconds(start) / ROUNDS);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i ++) {
+	capn_arena_init(&arena, (size_t) capn_size(&c));
+	decode_small_Book_ptr_arena(&arena, &small, sp);
+	capn_arena_free(&arena);
+    }
+    printf("table decode:     %.3f ms\n", 1000 * seconds(start) / ROUNDS);
+
+    /* both modes read the same message into the same values */
+    decode_Book_ptr(&fast, p);
+    decode_small_Book_ptr(&small, sp);
+    diff |= strcmp(fast->title, small->title);
+    diff |= strcmp(fast->acquire.donation, small->acquire.donation);
+    diff |= fast->n_chapters != small->n_chapters;
+    for (i = 0; !diff && i < fast->n_chapters; i ++) {
+	diff |= fast->chapters_[i]->end != small->chapters_[i]->end;
+	diff |= strcmp(fast->chapters_[i]->caption, small->chapters_[i]->caption);
+    }
+    free_Book_ptr(&fast);
+    free_small_Book_ptr(&small);
+
+    capn_free(&c);
+    return diff != 0;
+}
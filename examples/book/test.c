@@ -63,6 +63,8 @@ int encode() {
     book.acquire.buy = &buy;
 
     capn_init_malloc(&c);
+    /* the root pointer and the book fit in one segment */
+    capn_reserve(&c, 8 * (1 + size_Book(&book)));
     cs = capn_root(&c).seg;
 
     encode_Book_ptr(cs, &p, &book);
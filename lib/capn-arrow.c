@@ -0,0 +1,415 @@
+/* vim: set sw=8 ts=8 sts=8 noet: */
+/* capn-arrow.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "capn-arrow.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Each exported array and schema keeps its buffers, children and strings
+ * in private_data, so release only has to walk down the tree.
+ */
+struct array_priv {
+	const void *buffers[3];
+	struct ArrowArray *children;
+	struct ArrowArray **childp;
+};
+
+struct schema_priv {
+	char *format;
+	char *name;
+	struct ArrowSchema *children;
+	struct ArrowSchema **childp;
+};
+
+static void release_array(struct ArrowArray *a) {
+	struct array_priv *priv = (struct array_priv*) a->private_data;
+	int i;
+
+	for (i = 0; i < a->n_children; i++) {
+		if (priv->children[i].release)
+			priv->children[i].release(&priv->children[i]);
+	}
+	for (i = 0; i < 3; i++) {
+		free((void*) priv->buffers[i]);
+	}
+	free(priv->children);
+	free(priv->childp);
+	free(priv);
+	a->release = NULL;
+}
+
+static void release_schema(struct ArrowSchema *s) {
+	struct schema_priv *priv = (struct schema_priv*) s->private_data;
+	int i;
+
+	for (i = 0; i < s->n_children; i++) {
+		if (priv->children[i].release)
+			priv->children[i].release(&priv->children[i]);
+	}
+	free(priv->format);
+	free(priv->name);
+	free(priv->children);
+	free(priv->childp);
+	free(priv);
+	s->release = NULL;
+}
+
+static char *dup_str(const char *s) {
+	size_t len = strlen(s) + 1;
+	char *ret = (char*) malloc(len);
+	if (ret)
+		memcpy(ret, s, len);
+	return ret;
+}
+
+/* init_array and init_schema set up a with its children zeroed, so that
+ * release can be called at any point after they succeed */
+static int init_array(struct ArrowArray *a, int64_t len, int nbuf, int nchild) {
+	struct array_priv *priv = (struct array_priv*) calloc(1, sizeof(*priv));
+	int i;
+
+	memset(a, 0, sizeof(*a));
+	if (!priv)
+		return -1;
+
+	a->length = len;
+	a->n_buffers = nbuf;
+	a->n_children = nchild;
+	a->buffers = priv->buffers;
+	a->private_data = priv;
+	a->release = &release_array;
+
+	if (nchild) {
+		priv->children = (struct ArrowArray*) calloc(nchild, sizeof(*priv->children));
+		priv->childp = (struct ArrowArray**) calloc(nchild, sizeof(*priv->childp));
+		if (!priv->children || !priv->childp) {
+			release_array(a);
+			return -1;
+		}
+		for (i = 0; i < nchild; i++) {
+			priv->childp[i] = &priv->children[i];
+		}
+		a->children = priv->childp;
+	}
+
+	return 0;
+}
+
+static int init_schema(struct ArrowSchema *s, const char *format, const char *name, int nchild) {
+	struct schema_priv *priv = (struct schema_priv*) calloc(1, sizeof(*priv));
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if (!priv)
+		return -1;
+
+	s->n_children = nchild;
+	s->private_data = priv;
+	s->release = &release_schema;
+
+	priv->format = dup_str(format);
+	priv->name = dup_str(name);
+	if (!priv->format || !priv->name)
+		goto err;
+	s->format = priv->format;
+	s->name = priv->name;
+
+	if (nchild) {
+		priv->children = (struct ArrowSchema*) calloc(nchild, sizeof(*priv->children));
+		priv->childp = (struct ArrowSchema**) calloc(nchild, sizeof(*priv->childp));
+		if (!priv->children || !priv->childp)
+			goto err;
+		for (i = 0; i < nchild; i++) {
+			priv->childp[i] = &priv->children[i];
+		}
+		s->children = priv->childp;
+	}
+
+	return 0;
+
+err:
+	release_schema(s);
+	return -1;
+}
+
+/* buffers are never NULL, even when empty, as some consumers require it */
+static void *new_buffer(size_t sz) {
+	return calloc(sz ? sz : 1, 1);
+}
+
+static const char *formats[] = {
+	"n", "b", "c", "C", "s", "S", "i", "I", "l", "L", "f", "g", "u", "z"
+};
+
+static int fixed_column(capn_ptr p, int len, const struct capn_arrow_field *f, struct ArrowArray *a) {
+	struct array_priv *priv = (struct array_priv*) a->private_data;
+	void *buf;
+	int i, n;
+
+	switch (f->type) {
+	case CAPN_ARROW_INT8:
+	case CAPN_ARROW_UINT8:
+		buf = new_buffer(len);
+		if (!buf || (n = capn_getcol8(p, f->offset, 0, (uint8_t*) buf, len)) != len)
+			goto err;
+		for (i = 0; f->def && i < n; i++) {
+			((uint8_t*) buf)[i] ^= (uint8_t) f->def;
+		}
+		break;
+	case CAPN_ARROW_INT16:
+	case CAPN_ARROW_UINT16:
+		buf = new_buffer((size_t) len * 2);
+		if (!buf || (n = capn_getcol16(p, f->offset, 0, (uint16_t*) buf, len)) != len)
+			goto err;
+		for (i = 0; f->def && i < n; i++) {
+			((uint16_t*) buf)[i] ^= (uint16_t) f->def;
+		}
+		break;
+	case CAPN_ARROW_INT32:
+	case CAPN_ARROW_UINT32:
+	case CAPN_ARROW_FLOAT32:
+		buf = new_buffer((size_t) len * 4);
+		if (!buf || (n = capn_getcol32(p, f->offset, 0, (uint32_t*) buf, len)) != len)
+			goto err;
+		for (i = 0; f->def && i < n; i++) {
+			((uint32_t*) buf)[i] ^= (uint32_t) f->def;
+		}
+		break;
+	case CAPN_ARROW_INT64:
+	case CAPN_ARROW_UINT64:
+	case CAPN_ARROW_FLOAT64:
+		buf = new_buffer((size_t) len * 8);
+		if (!buf || (n = capn_getcol64(p, f->offset, 0, (uint64_t*) buf, len)) != len)
+			goto err;
+		for (i = 0; f->def && i < n; i++) {
+			((uint64_t*) buf)[i] ^= f->def;
+		}
+		break;
+	case CAPN_ARROW_BOOL:
+		/* unpacked into bytes first, then packed into the bitmap */
+		buf = new_buffer(len);
+		priv->buffers[1] = new_buffer(((size_t) len + 7) / 8);
+		if (!buf || !priv->buffers[1] || capn_getcol1(p, f->offset, 0, (uint8_t*) buf, len) != len)
+			goto err;
+		for (i = 0; i < len; i++) {
+			if (((uint8_t*) buf)[i] ^ (f->def & 1))
+				((uint8_t*) priv->buffers[1])[i/8] |= (uint8_t) (1 << (i%8));
+		}
+		free(buf);
+		return 0;
+	default:
+		return -1;
+	}
+
+	priv->buffers[1] = buf;
+	return 0;
+
+err:
+	free(buf);
+	return -1;
+}
+
+/* blob_column copies each text or data pointer into a values buffer, one
+ * element at a time. Union members that aren't selected are empty. */
+static int blob_column(capn_ptr p, int len, const struct capn_arrow_field *f, const uint16_t *tags, struct ArrowArray *a) {
+	struct array_priv *priv = (struct array_priv*) a->private_data;
+	static const capn_text empty = {0, "", NULL};
+	int32_t *offsets;
+	char *values = NULL;
+	size_t cap = 0, sz = 0;
+	int i;
+
+	offsets = (int32_t*) new_buffer(((size_t) len + 1) * 4);
+	priv->buffers[1] = offsets;
+	if (!offsets)
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		const char *data = NULL;
+		size_t n = 0;
+
+		if (!tags || tags[i] == f->tag) {
+			capn_ptr e = capn_getp(p, i, 0);
+			if (f->type == CAPN_ARROW_TEXT) {
+				capn_text t = capn_get_text(e, f->offset, empty);
+				data = t.str;
+				n = t.len;
+			} else {
+				capn_data d = capn_get_data(e, f->offset);
+				data = d.p.data;
+				n = d.p.len;
+			}
+		}
+
+		if (sz + n > INT32_MAX)
+			goto err;
+		if (sz + n > cap) {
+			char *v;
+			cap = cap ? cap * 2 : 256;
+			while (cap < sz + n) {
+				cap *= 2;
+			}
+			v = (char*) realloc(values, cap);
+			if (!v)
+				goto err;
+			values = v;
+		}
+		if (n)
+			memcpy(values + sz, data, n);
+		sz += n;
+		offsets[i+1] = (int32_t) sz;
+	}
+
+	priv->buffers[2] = values ? values : new_buffer(0);
+	return priv->buffers[2] ? 0 : -1;
+
+err:
+	free(values);
+	return -1;
+}
+
+static int export_column(capn_ptr p, int len, const struct capn_arrow_field *f, const uint16_t *tags, struct ArrowArray *a, struct ArrowSchema *s);
+
+/* union_column exports a sparse union: the discriminants are the type ids
+ * and each member is a child as long as the list. */
+static int union_column(capn_ptr p, int len, const struct capn_arrow_field *f, struct ArrowArray *a, struct ArrowSchema *s) {
+	struct array_priv *priv;
+	char *format = NULL;
+	uint16_t *tags = NULL;
+	int8_t *ids = NULL;
+	int i, j, used, ret = -1;
+
+	/* "+us:" and up to three digits and a comma per member */
+	format = (char*) malloc(5 + 4 * (size_t) f->members);
+	tags = (uint16_t*) new_buffer((size_t) len * 2);
+	ids = (int8_t*) new_buffer(len);
+	if (!format || !tags || !ids || capn_getcol16(p, f->offset, 0, tags, len) != len)
+		goto end;
+
+	for (i = 0; i < len; i++) {
+		if (tags[i] > 127)
+			goto end;
+		ids[i] = (int8_t) tags[i];
+	}
+
+	used = sprintf(format, "+us:");
+	for (j = 1; j <= f->members; j++) {
+		if (f[j].tag < 0 || f[j].tag > 127)
+			goto end;
+		used += sprintf(format + used, "%s%d", j > 1 ? "," : "", f[j].tag);
+	}
+
+	if (init_array(a, len, 1, f->members))
+		goto end;
+	if (init_schema(s, format, f->name, f->members)) {
+		a->release(a);
+		goto end;
+	}
+
+	priv = (struct array_priv*) a->private_data;
+	priv->buffers[0] = ids;
+	ids = NULL;
+
+	for (j = 1; j <= f->members; j++) {
+		if (export_column(p, len, &f[j], tags, a->children[j-1], s->children[j-1]) < 0) {
+			a->release(a);
+			s->release(s);
+			goto end;
+		}
+	}
+	ret = 0;
+
+end:
+	free(format);
+	free(tags);
+	free(ids);
+	return ret;
+}
+
+/* export_column exports f and returns the number of entries of the field
+ * table it used, or -1 on error. */
+static int export_column(capn_ptr p, int len, const struct capn_arrow_field *f, const uint16_t *tags, struct ArrowArray *a, struct ArrowSchema *s) {
+	int nbuf;
+
+	switch (f->type) {
+	case CAPN_ARROW_UNION:
+		/* unions don't nest in a struct without a group around them */
+		if (tags || union_column(p, len, f, a, s))
+			return -1;
+		return 1 + f->members;
+	case CAPN_ARROW_NULL:
+		nbuf = 0;
+		break;
+	case CAPN_ARROW_TEXT:
+	case CAPN_ARROW_DATA:
+		nbuf = 3;
+		break;
+	default:
+		if ((unsigned) f->type >= sizeof(formats) / sizeof(formats[0]))
+			return -1;
+		nbuf = 2;
+		break;
+	}
+
+	if (init_array(a, len, nbuf, 0))
+		return -1;
+	if (init_schema(s, formats[f->type], f->name, 0)) {
+		a->release(a);
+		return -1;
+	}
+
+	if (f->type == CAPN_ARROW_NULL) {
+		a->null_count = len;
+	} else if (f->type == CAPN_ARROW_TEXT || f->type == CAPN_ARROW_DATA
+			? blob_column(p, len, f, tags, a)
+			: fixed_column(p, len, f, a)) {
+		a->release(a);
+		s->release(s);
+		return -1;
+	}
+
+	return 1;
+}
+
+int capn_arrow_export(capn_ptr p, const struct capn_arrow_field *fields, int num, struct ArrowArray *array, struct ArrowSchema *schema) {
+	int i, n, cols = 0;
+
+	capn_resolve(&p);
+	if (p.type == CAPN_NULL) {
+		/* a null list exports as an empty one */
+		memset(&p, 0, sizeof(p));
+		p.type = CAPN_LIST;
+	} else if (p.type != CAPN_LIST) {
+		return -1;
+	}
+
+	for (i = 0; i < num; i += 1 + (fields[i].type == CAPN_ARROW_UNION ? fields[i].members : 0)) {
+		cols++;
+	}
+	if (i != num)
+		return -1;
+
+	if (init_array(array, p.len, 1, cols))
+		return -1;
+	if (init_schema(schema, "+s", "", cols)) {
+		array->release(array);
+		return -1;
+	}
+
+	for (i = 0, n = 0; i < num; n++) {
+		int used = export_column(p, p.len, &fields[i], NULL, array->children[n], schema->children[n]);
+		if (used < 0) {
+			array->release(array);
+			schema->release(schema);
+			return -1;
+		}
+		i += used;
+	}
+
+	return 0;
+}
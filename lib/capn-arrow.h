@@ -0,0 +1,116 @@
+/* vim: set sw=8 ts=8 sts=8 noet: */
+/* capn-arrow.h
+ *
+ * Export of struct lists as Apache Arrow arrays. This is kept out of
+ * capnp_c.h so that only the users of capn_arrow_export see the arrow
+ * definitions.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#ifndef CAPN_ARROW_H
+#define CAPN_ARROW_H
+
+#include "capnp_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The Apache Arrow C data interface, as published by the Arrow project.
+ * The definitions are guarded so they can be shared with arrow's own
+ * headers.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+	void (*release)(struct ArrowSchema *);
+	void *private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+	void (*release)(struct ArrowArray *);
+	void *private_data;
+};
+
+#endif
+
+/* struct capn_arrow_field describes one column of a struct list for
+ * capn_arrow_export. Generated code emits a table of these for each struct.
+ *
+ * offset is the byte offset of the field in the data section, the bit
+ * offset for CAPN_ARROW_BOOL, the pointer index for CAPN_ARROW_TEXT and
+ * CAPN_ARROW_DATA and the byte offset of the tag for CAPN_ARROW_UNION.
+ * def is the field's default value as it is stored on the wire.
+ *
+ * A CAPN_ARROW_UNION entry is followed by its member entries, one per
+ * member with its discriminant in tag. Members that can't be exported are
+ * listed as CAPN_ARROW_NULL.
+ */
+enum CAPN_ARROW_TYPE {
+	CAPN_ARROW_NULL = 0,
+	CAPN_ARROW_BOOL,
+	CAPN_ARROW_INT8,
+	CAPN_ARROW_UINT8,
+	CAPN_ARROW_INT16,
+	CAPN_ARROW_UINT16,
+	CAPN_ARROW_INT32,
+	CAPN_ARROW_UINT32,
+	CAPN_ARROW_INT64,
+	CAPN_ARROW_UINT64,
+	CAPN_ARROW_FLOAT32,
+	CAPN_ARROW_FLOAT64,
+	CAPN_ARROW_TEXT,
+	CAPN_ARROW_DATA,
+	CAPN_ARROW_UNION
+};
+
+struct capn_arrow_field {
+	const char *name;
+	enum CAPN_ARROW_TYPE type;
+	int offset;
+	int members;
+	int tag;
+	uint64_t def;
+};
+
+/* capn_arrow_export exports the struct list p as an arrow struct array
+ * with one child per top level entry of fields. Fixed width fields are
+ * copied into value buffers with capn_getcol*, text and data into offset
+ * and value buffers, and unions become sparse unions whose type ids are
+ * the discriminants. Nothing in the arrays refers to the message, so it
+ * can be freed straight away.
+ *
+ * The caller owns array and schema and frees them with their release
+ * callbacks. Returns 0 on success and -1 on error, in which case nothing
+ * needs to be released. Discriminants must be less than 128 and the
+ * text and data of a column less than 2 GiB.
+ */
+int capn_arrow_export(capn_ptr p, const struct capn_arrow_field *fields, int num, struct ArrowArray *array, struct ArrowSchema *schema);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,397 @@
+/* vim: set sw=8 ts=8 sts=8 noet: */
+/* capn-dynamic.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "capnp_c.h"
+#include <string.h>
+
+/* The runtime can't use the code generated from schema.capnp, so the
+ * members of Node, Field, Type and Value are read at their offsets. */
+#define NODE_ID 0
+#define NODE_WHICH 12
+#define NODE_STRUCT 1
+#define NODE_DISCRIMINANT_OFFSET 32
+#define NODE_NAME_PTR 0
+#define NODE_FIELDS_PTR 3
+#define FIELD_NAME_PTR 0
+#define FIELD_DISCRIMINANT 2
+#define FIELD_SLOT_OFFSET 4
+#define FIELD_WHICH 8
+#define FIELD_GROUP 1
+#define FIELD_GROUP_ID 16
+#define FIELD_TYPE_PTR 2
+#define FIELD_DEFAULT_PTR 3
+#define TYPE_WHICH 0
+#define TYPE_ID 8
+#define TYPE_ELEMENT_PTR 0
+#define VALUE_PTR 0
+
+static const capn_text empty_text = {0, "", 0};
+static const capn_ptr null_ptr = {CAPN_NULL};
+
+int capn_dynamic_init(struct capn_dynamic *d, const uint8_t *data, size_t sz) {
+	capn_ptr root;
+
+	memset(d, 0, sizeof(*d));
+	if (capn_init_mem(&d->capn, data, sz, 0))
+		return -1;
+	if (capn_freeze(&d->capn))
+		goto err;
+
+	root = capn_getp(capn_root(&d->capn), 0, 1);
+	d->nodes = capn_getp(root, 0, 1);
+	if (d->nodes.type != CAPN_LIST)
+		goto err;
+	return 0;
+
+err:
+	capn_free(&d->capn);
+	return -1;
+}
+
+void capn_dynamic_free(struct capn_dynamic *d) {
+	capn_free(&d->capn);
+}
+
+static capn_ptr find_node(struct capn_dynamic *d, uint64_t id) {
+	int i;
+
+	for (i = 0; i < d->nodes.len; i++) {
+		capn_ptr n = capn_getp(d->nodes, i, 1);
+		if (capn_read64(n, NODE_ID) == id)
+			return n;
+	}
+	return null_ptr;
+}
+
+uint64_t capn_dynamic_lookup(struct capn_dynamic *d, const char *name) {
+	int i;
+
+	for (i = 0; i < d->nodes.len; i++) {
+		capn_ptr n = capn_getp(d->nodes, i, 1);
+		capn_text t = capn_get_text(n, NODE_NAME_PTR, empty_text);
+		const char *colon = strchr(t.str, ':');
+
+		if (!strcmp(t.str, name) || (colon && !strcmp(colon + 1, name)))
+			return capn_read64(n, NODE_ID);
+	}
+	return 0;
+}
+
+/* describe fills in f for the field of the struct or group node. */
+static int describe(capn_ptr node, capn_ptr field, struct capn_dynamic_field *f) {
+	uint16_t disc = capn_read16(field, FIELD_DISCRIMINANT) ^ 0xFFFF;
+	capn_ptr type, value, element;
+
+	memset(f, 0, sizeof(*f));
+	f->name = capn_get_text(field, FIELD_NAME_PTR, empty_text).str;
+	f->union_offset = -1;
+	if (disc != 0xFFFF) {
+		f->union_offset = 2 * (int) capn_read32(node, NODE_DISCRIMINANT_OFFSET);
+		f->union_value = disc;
+	}
+
+	if (capn_read16(field, FIELD_WHICH) == FIELD_GROUP) {
+		f->type = CAPN_DYNAMIC_GROUP;
+		f->type_id = capn_read64(field, FIELD_GROUP_ID);
+		return 0;
+	}
+
+	type = capn_getp(field, FIELD_TYPE_PTR, 1);
+	value = capn_getp(field, FIELD_DEFAULT_PTR, 1);
+	f->type = (enum CAPN_DYNAMIC_TYPE) capn_read16(type, TYPE_WHICH);
+	f->offset = capn_read32(field, FIELD_SLOT_OFFSET);
+
+	switch (f->type) {
+	case CAPN_DYNAMIC_VOID:
+		break;
+	case CAPN_DYNAMIC_BOOL:
+		f->def = capn_read8(value, 2) & 1;
+		break;
+	case CAPN_DYNAMIC_INT8:
+	case CAPN_DYNAMIC_UINT8:
+		f->def = capn_read8(value, 2);
+		break;
+	case CAPN_DYNAMIC_ENUM:
+		f->type_id = capn_read64(type, TYPE_ID);
+		/* fallthrough */
+	case CAPN_DYNAMIC_INT16:
+	case CAPN_DYNAMIC_UINT16:
+		f->def = capn_read16(value, 2);
+		f->offset *= 2;
+		break;
+	case CAPN_DYNAMIC_INT32:
+	case CAPN_DYNAMIC_UINT32:
+	case CAPN_DYNAMIC_FLOAT32:
+		f->def = capn_read32(value, 4);
+		f->offset *= 4;
+		break;
+	case CAPN_DYNAMIC_INT64:
+	case CAPN_DYNAMIC_UINT64:
+	case CAPN_DYNAMIC_FLOAT64:
+		f->def = capn_read64(value, 8);
+		f->offset *= 8;
+		break;
+	case CAPN_DYNAMIC_LIST:
+		element = capn_getp(type, TYPE_ELEMENT_PTR, 1);
+		f->element = (enum CAPN_DYNAMIC_TYPE) capn_read16(element, TYPE_WHICH);
+		if (f->element == CAPN_DYNAMIC_STRUCT || f->element == CAPN_DYNAMIC_ENUM)
+			f->type_id = capn_read64(element, TYPE_ID);
+		f->defp = capn_getp(value, VALUE_PTR, 1);
+		break;
+	case CAPN_DYNAMIC_STRUCT:
+	case CAPN_DYNAMIC_INTERFACE:
+		f->type_id = capn_read64(type, TYPE_ID);
+		/* fallthrough */
+	case CAPN_DYNAMIC_TEXT:
+	case CAPN_DYNAMIC_DATA:
+	case CAPN_DYNAMIC_ANYPOINTER:
+		f->defp = capn_getp(value, VALUE_PTR, 1);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+static capn_ptr struct_node(struct capn_dynamic *d, uint64_t id) {
+	capn_ptr n = find_node(d, id);
+
+	if (n.type != CAPN_STRUCT || capn_read16(n, NODE_WHICH) != NODE_STRUCT)
+		return null_ptr;
+	return n;
+}
+
+int capn_dynamic_field(struct capn_dynamic *d, uint64_t id, const char *path, struct capn_dynamic_field *f) {
+	capn_ptr node = struct_node(d, id);
+
+	while (node.type == CAPN_STRUCT) {
+		capn_ptr fields = capn_getp(node, NODE_FIELDS_PTR, 1);
+		const char *dot = strchr(path, '.');
+		int len = dot ? (int) (dot - path) : (int) strlen(path);
+		int i;
+
+		for (i = 0; i < fields.len; i++) {
+			capn_ptr field = capn_getp(fields, i, 1);
+			capn_text name = capn_get_text(field, FIELD_NAME_PTR, empty_text);
+
+			if (name.len == len && !memcmp(name.str, path, len)) {
+				if (describe(node, field, f))
+					return -1;
+				break;
+			}
+		}
+
+		if (i == fields.len)
+			return -1;
+		if (dot == NULL)
+			return 0;
+		if (f->type != CAPN_DYNAMIC_GROUP)
+			return -1;
+
+		node = struct_node(d, f->type_id);
+		path = dot + 1;
+	}
+	return -1;
+}
+
+int capn_dynamic_field_at(struct capn_dynamic *d, uint64_t id, int i, struct capn_dynamic_field *f) {
+	capn_ptr node = struct_node(d, id);
+	capn_ptr fields = capn_getp(node, NODE_FIELDS_PTR, 1);
+
+	if (node.type != CAPN_STRUCT || i < 0 || i >= fields.len)
+		return -1;
+	return describe(node, capn_getp(fields, i, 1), f);
+}
+
+int capn_dynamic_has(capn_ptr p, const struct capn_dynamic_field *f) {
+	capn_resolve(&p);
+	return f->union_offset < 0 || capn_read16(p, f->union_offset) == f->union_value;
+}
+
+/* get_bits returns the raw value of a data field with the default applied,
+ * or 0 for other fields. */
+static uint64_t get_bits(capn_ptr p, const struct capn_dynamic_field *f) {
+	capn_resolve(&p);
+
+	switch (f->type) {
+	case CAPN_DYNAMIC_BOOL:
+		return ((capn_read8(p, f->offset / 8) >> (f->offset % 8)) & 1) ^ f->def;
+	case CAPN_DYNAMIC_INT8:
+	case CAPN_DYNAMIC_UINT8:
+		return (uint8_t) (capn_read8(p, f->offset) ^ f->def);
+	case CAPN_DYNAMIC_INT16:
+	case CAPN_DYNAMIC_UINT16:
+	case CAPN_DYNAMIC_ENUM:
+		return (uint16_t) (capn_read16(p, f->offset) ^ f->def);
+	case CAPN_DYNAMIC_INT32:
+	case CAPN_DYNAMIC_UINT32:
+	case CAPN_DYNAMIC_FLOAT32:
+		return (uint32_t) (capn_read32(p, f->offset) ^ f->def);
+	case CAPN_DYNAMIC_INT64:
+	case CAPN_DYNAMIC_UINT64:
+	case CAPN_DYNAMIC_FLOAT64:
+		return capn_read64(p, f->offset) ^ f->def;
+	default:
+		return 0;
+	}
+}
+
+int64_t capn_dynamic_get_int(capn_ptr p, const struct capn_dynamic_field *f) {
+	uint64_t v = get_bits(p, f);
+
+	switch (f->type) {
+	case CAPN_DYNAMIC_INT8:
+		return (int8_t) v;
+	case CAPN_DYNAMIC_INT16:
+		return (int16_t) v;
+	case CAPN_DYNAMIC_INT32:
+		return (int32_t) v;
+	case CAPN_DYNAMIC_FLOAT32:
+		return (int64_t) capn_to_f32((uint32_t) v);
+	case CAPN_DYNAMIC_FLOAT64:
+		return (int64_t) capn_to_f64(v);
+	default:
+		return (int64_t) v;
+	}
+}
+
+uint64_t capn_dynamic_get_uint(capn_ptr p, const struct capn_dynamic_field *f) {
+	switch (f->type) {
+	case CAPN_DYNAMIC_INT8:
+	case CAPN_DYNAMIC_INT16:
+	case CAPN_DYNAMIC_INT32:
+		return (uint64_t) capn_dynamic_get_int(p, f);
+	case CAPN_DYNAMIC_FLOAT32:
+	case CAPN_DYNAMIC_FLOAT64:
+		return (uint64_t) capn_dynamic_get_float(p, f);
+	default:
+		return get_bits(p, f);
+	}
+}
+
+double capn_dynamic_get_float(capn_ptr p, const struct capn_dynamic_field *f) {
+	switch (f->type) {
+	case CAPN_DYNAMIC_FLOAT32:
+		return capn_to_f32((uint32_t) get_bits(p, f));
+	case CAPN_DYNAMIC_FLOAT64:
+		return capn_to_f64(get_bits(p, f));
+	case CAPN_DYNAMIC_INT8:
+	case CAPN_DYNAMIC_INT16:
+	case CAPN_DYNAMIC_INT32:
+	case CAPN_DYNAMIC_INT64:
+		return (double) capn_dynamic_get_int(p, f);
+	default:
+		return (double) get_bits(p, f);
+	}
+}
+
+static int is_ptr(const struct capn_dynamic_field *f) {
+	switch (f->type) {
+	case CAPN_DYNAMIC_TEXT:
+	case CAPN_DYNAMIC_DATA:
+	case CAPN_DYNAMIC_LIST:
+	case CAPN_DYNAMIC_STRUCT:
+	case CAPN_DYNAMIC_INTERFACE:
+	case CAPN_DYNAMIC_ANYPOINTER:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+capn_text capn_dynamic_get_text(capn_ptr p, const struct capn_dynamic_field *f) {
+	capn_text def = empty_text;
+
+	if (f->type != CAPN_DYNAMIC_TEXT)
+		return empty_text;
+	if (f->defp.type == CAPN_LIST && f->defp.len > 0) {
+		def.len = f->defp.len - 1;
+		def.str = f->defp.data;
+		def.seg = f->defp.seg;
+	}
+	return capn_get_text(p, f->offset, def);
+}
+
+capn_ptr capn_dynamic_get_ptr(capn_ptr p, const struct capn_dynamic_field *f) {
+	capn_ptr v;
+
+	if (!is_ptr(f))
+		return null_ptr;
+	v = capn_getp(p, f->offset, 1);
+	return v.type == CAPN_NULL ? f->defp : v;
+}
+
+/* select_field sets the discriminant of the union f is in to f. */
+static int select_field(capn_ptr p, const struct capn_dynamic_field *f) {
+	if (f->union_offset < 0)
+		return 0;
+	return capn_write16(p, f->union_offset, f->union_value) ? -1 : 0;
+}
+
+/* set_number writes the data field f as bits, or as v for bools and
+ * floats. */
+static int set_number(capn_ptr p, const struct capn_dynamic_field *f, uint64_t bits, double v) {
+	int err;
+
+	capn_resolve(&p);
+
+	switch (f->type) {
+	case CAPN_DYNAMIC_BOOL:
+		err = capn_write1(p, f->offset, (v != 0) ^ (int) f->def);
+		break;
+	case CAPN_DYNAMIC_INT8:
+	case CAPN_DYNAMIC_UINT8:
+		err = capn_write8(p, f->offset, (uint8_t) (bits ^ f->def));
+		break;
+	case CAPN_DYNAMIC_INT16:
+	case CAPN_DYNAMIC_UINT16:
+	case CAPN_DYNAMIC_ENUM:
+		err = capn_write16(p, f->offset, (uint16_t) (bits ^ f->def));
+		break;
+	case CAPN_DYNAMIC_INT32:
+	case CAPN_DYNAMIC_UINT32:
+		err = capn_write32(p, f->offset, (uint32_t) (bits ^ f->def));
+		break;
+	case CAPN_DYNAMIC_FLOAT32:
+		err = capn_write32(p, f->offset, capn_from_f32((float) v) ^ (uint32_t) f->def);
+		break;
+	case CAPN_DYNAMIC_INT64:
+	case CAPN_DYNAMIC_UINT64:
+		err = capn_write64(p, f->offset, bits ^ f->def);
+		break;
+	case CAPN_DYNAMIC_FLOAT64:
+		err = capn_write64(p, f->offset, capn_from_f64(v) ^ f->def);
+		break;
+	default:
+		return -1;
+	}
+	return err ? -1 : select_field(p, f);
+}
+
+int capn_dynamic_set_int(capn_ptr p, const struct capn_dynamic_field *f, int64_t v) {
+	return set_number(p, f, (uint64_t) v, (double) v);
+}
+
+int capn_dynamic_set_uint(capn_ptr p, const struct capn_dynamic_field *f, uint64_t v) {
+	return set_number(p, f, v, (double) v);
+}
+
+int capn_dynamic_set_float(capn_ptr p, const struct capn_dynamic_field *f, double v) {
+	return set_number(p, f, (uint64_t) (int64_t) v, v);
+}
+
+int capn_dynamic_set_text(capn_ptr p, const struct capn_dynamic_field *f, capn_text v) {
+	if (f->type != CAPN_DYNAMIC_TEXT || capn_set_text(p, f->offset, v))
+		return -1;
+	return select_field(p, f);
+}
+
+int capn_dynamic_set_ptr(capn_ptr p, const struct capn_dynamic_field *f, capn_ptr v) {
+	if (!is_ptr(f) || capn_setp(p, f->offset, v))
+		return -1;
+	return select_field(p, f);
+}
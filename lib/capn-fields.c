@@ -0,0 +1,138 @@
+/* vim: set sw=8 ts=8 sts=8 noet: */
+/* capn-fields.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "capnp_c.h"
+#include <string.h>
+
+static const capn_text empty_text = {0, "", 0};
+static const capn_ptr null_ptr = {CAPN_NULL};
+
+/* present returns whether the union cases that f is in are selected in s.
+ * The tags have already been read when reading. */
+static int present(const char *s, const struct capn_field *fields, const struct capn_field *f) {
+	while (f->which) {
+		const struct capn_field *w = &fields[f->which - 1];
+		if (*(const int*) (s + w->member) != f->tag)
+			return 0;
+		f = w;
+	}
+	return 1;
+}
+
+void capn_read_fields(capn_ptr p, void *s, const struct capn_field *fields, int num) {
+	const struct capn_field *f;
+	uint8_t v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	capn_resolve(&p);
+
+	for (f = fields; f < fields + num; f++) {
+		char *m = (char*) s + f->member;
+
+		if (f->which && !present((char*) s, fields, f))
+			continue;
+
+		switch (f->type) {
+		case CAPN_FIELD_BOOL:
+			*(unsigned*) m = ((capn_read8(p, f->offset / 8) >> (f->offset % 8)) & 1) ^ (unsigned) f->def;
+			break;
+		case CAPN_FIELD_BITS8:
+			v8 = capn_read8(p, f->offset) ^ (uint8_t) f->def;
+			memcpy(m, &v8, 1);
+			break;
+		case CAPN_FIELD_BITS16:
+			v16 = capn_read16(p, f->offset) ^ (uint16_t) f->def;
+			memcpy(m, &v16, 2);
+			break;
+		case CAPN_FIELD_BITS32:
+			v32 = capn_read32(p, f->offset) ^ (uint32_t) f->def;
+			memcpy(m, &v32, 4);
+			break;
+		case CAPN_FIELD_BITS64:
+			v64 = capn_read64(p, f->offset) ^ f->def;
+			memcpy(m, &v64, 8);
+			break;
+		case CAPN_FIELD_ENUM:
+		case CAPN_FIELD_WHICH:
+			*(int*) m = (int) (uint16_t) (capn_read16(p, f->offset) ^ (uint16_t) f->def);
+			break;
+		case CAPN_FIELD_TEXT:
+			*(capn_text*) m = capn_get_text(p, f->offset, f->defp ? *(const capn_text*) f->defp : empty_text);
+			break;
+		case CAPN_FIELD_DATA:
+		case CAPN_FIELD_PTR:
+			if (f->type == CAPN_FIELD_DATA)
+				*(capn_data*) m = capn_get_data(p, f->offset);
+			else
+				*(capn_ptr*) m = capn_getp(p, f->offset, 0);
+			if (f->defp && !((capn_ptr*) m)->type)
+				*(capn_ptr*) m = *(const capn_ptr*) f->defp;
+			break;
+		}
+	}
+}
+
+void capn_write_fields(capn_ptr p, const void *s, const struct capn_field *fields, int num) {
+	const struct capn_field *f;
+	capn_text t;
+	capn_ptr v;
+	uint8_t v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	capn_resolve(&p);
+
+	for (f = fields; f < fields + num; f++) {
+		const char *m = (const char*) s + f->member;
+
+		if (f->which && !present((const char*) s, fields, f))
+			continue;
+
+		switch (f->type) {
+		case CAPN_FIELD_BOOL:
+			capn_write1(p, f->offset, (*(const unsigned*) m != 0) ^ (int) f->def);
+			break;
+		case CAPN_FIELD_BITS8:
+			memcpy(&v8, m, 1);
+			capn_write8(p, f->offset, v8 ^ (uint8_t) f->def);
+			break;
+		case CAPN_FIELD_BITS16:
+			memcpy(&v16, m, 2);
+			capn_write16(p, f->offset, v16 ^ (uint16_t) f->def);
+			break;
+		case CAPN_FIELD_BITS32:
+			memcpy(&v32, m, 4);
+			capn_write32(p, f->offset, v32 ^ (uint32_t) f->def);
+			break;
+		case CAPN_FIELD_BITS64:
+			memcpy(&v64, m, 8);
+			capn_write64(p, f->offset, v64 ^ f->def);
+			break;
+		case CAPN_FIELD_ENUM:
+		case CAPN_FIELD_WHICH:
+			capn_write16(p, f->offset, (uint16_t) (*(const int*) m ^ (int) f->def));
+			break;
+		case CAPN_FIELD_TEXT:
+			/* the default is written as an empty text, as write_X does */
+			t = *(const capn_text*) m;
+			if (f->defp && t.str == ((const capn_text*) f->defp)->str)
+				t = empty_text;
+			capn_set_text(p, f->offset, t);
+			break;
+		case CAPN_FIELD_DATA:
+		case CAPN_FIELD_PTR:
+			v = *(const capn_ptr*) m;
+			if (f->defp && v.data == ((const capn_ptr*) f->defp)->data)
+				v = null_ptr;
+			capn_setp(p, f->offset, v);
+			break;
+		}
+	}
+}
@@ -33,22 +33,26 @@ struct check_segment_alignment {
 	unsigned int foo : (sizeof(struct capn_segment)&7) ? -1 : 1;
 };
 
-static struct capn_segment *create(void *u, uint32_t id, int sz) {
+static struct capn_segment *create(void *u, uint32_t id, size_t sz) {
 	struct capn_segment *s;
+	if (sz > SIZE_MAX - sizeof(*s) - 4095)
+		return NULL;
 	sz += sizeof(*s);
 	if (sz < 4096) {
 		sz = 4096;
 	} else {
-		sz = (sz + 4095) & ~4095;
+		sz = (sz + 4095) & ~(size_t) 4095;
 	}
 	s = (struct capn_segment*) calloc(1, sz);
+	if (!s)
+		return NULL;
 	s->data = (char*) (s+1);
 	s->cap = sz - sizeof(*s);
 	s->user = s;
 	return s;
 }
 
-static struct capn_segment *create_local(void *u, int sz) {
+static struct capn_segment *create_local(void *u, size_t sz) {
 	return create(u, 0, sz);
 }
 
@@ -58,14 +62,46 @@ void capn_init_malloc(struct capn *c) {
 	c->create_local = &create_local;
 }
 
-void capn_free(struct capn *c) {
-	struct capn_segment *s = c->seglist;
+static void free_segments(struct capn_segment *s) {
 	while (s != NULL) {
 		struct capn_segment *n = s->next;
 		free(s->user);
 		s = n;
 	}
+}
+
+static void unshare(struct capn_shared *sh) {
+	if (--sh->refs == 0) {
+		free_segments(sh->seglist);
+		if (sh->release)
+			sh->release(sh->buf, sh->len);
+		free(sh);
+	}
+}
+
+void capn_free(struct capn *c) {
+	struct capn_segment *s;
+
+	for (s = c->seglist; s != NULL; s = s->next) {
+		if (s->shared) {
+			unshare(s->shared);
+			s->shared = NULL;
+		}
+	}
+
+	if (c->shared) {
+		/* other sessions still point into our segments */
+		c->shared->seglist = c->seglist;
+		unshare(c->shared);
+		c->shared = NULL;
+	} else {
+		free_segments(c->seglist);
+	}
+
 	capn_reset_copy(c);
+	free(c->segtab);
+	c->segtab = NULL;
+	c->readonly = 0;
 }
 
 void capn_reset_copy(struct capn *c) {
@@ -79,6 +115,370 @@ void capn_reset_copy(struct capn *c) {
 	c->copylist = NULL;
 }
 
+int capn_freeze(struct capn *c) {
+	struct capn_segment *s;
+
+	if (c->readonly)
+		return 0;
+
+	c->segtab = (struct capn_segment**) calloc(c->segnum ? c->segnum : 1, sizeof(*c->segtab));
+	if (!c->segtab)
+		return -1;
+
+	for (s = c->seglist; s != NULL; s = s->next) {
+		if (s->id < c->segnum)
+			c->segtab[s->id] = s;
+	}
+
+	/* the copy tree is only used when copying into this session */
+	capn_reset_copy(c);
+	c->readonly = 1;
+	return 0;
+}
+
+int capn_share(capn_ptr p, int off, capn_ptr tgt) {
+	struct capn_shared *sh;
+	struct capn_segment *s;
+	struct capn *c;
+
+	capn_resolve(&p);
+	capn_resolve(&tgt);
+
+	c = p.seg ? p.seg->capn : NULL;
+	if (!c || c->readonly || !tgt.seg || !tgt.seg->capn || tgt.seg->capn == c
+			|| tgt.is_list_member || !capn_is_local(tgt))
+		return capn_setp(p, off, tgt);
+
+	/* a segment that is itself imported is shared from its source */
+	sh = tgt.seg->shared;
+	if (!sh) {
+		struct capn *src = tgt.seg->capn;
+		if (!src->shared) {
+			src->shared = (struct capn_shared*) calloc(1, sizeof(*src->shared));
+			if (!src->shared)
+				return -1;
+			src->shared->refs = 1;
+		}
+		sh = src->shared;
+	}
+
+	for (s = c->seglist; s != NULL; s = s->next) {
+		if (s->shared == sh && s->data == tgt.seg->data)
+			break;
+	}
+
+	if (!s) {
+		s = (struct capn_segment*) calloc(1, sizeof(*s));
+		if (!s)
+			return -1;
+		s->data = tgt.seg->data;
+		s->user = s;
+		s->shared = sh;
+		sh->refs++;
+		capn_append_segment(c, s);
+	}
+
+	/* the source may have grown since it was imported */
+	if (s->len < tgt.seg->len)
+		s->len = s->cap = tgt.seg->len;
+
+	tgt.seg = s;
+	return capn_setp(p, off, tgt);
+}
+
+capn_data capn_new_data_external(struct capn *c, const void *buf, size_t len, capn_release_fn release) {
+	capn_data d = {{CAPN_NULL}};
+	struct capn_shared *sh;
+	struct capn_segment *s, *root;
+
+	if (c->readonly || len >= (1 << 29))
+		return d;
+
+	/* segment 0 must hold the root pointer, so create it first */
+	root = capn_root(c).seg;
+	if (!root)
+		return d;
+
+	if (len == 0 || ((uintptr_t) buf & 7)) {
+		capn_list8 l = capn_new_list8(root, (int) len);
+		if (l.p.type == CAPN_NULL || capn_setv8(l, 0, (const uint8_t*) buf, (int) len) != (int) len)
+			return d;
+		if (release)
+			release(buf, len);
+		d.p = l.p;
+		return d;
+	}
+
+	sh = (struct capn_shared*) calloc(1, sizeof(*sh));
+	s = (struct capn_segment*) calloc(1, sizeof(*s));
+	if (!sh || !s) {
+		free(sh);
+		free(s);
+		return d;
+	}
+
+	sh->refs = 1;
+	sh->buf = buf;
+	sh->len = len;
+	sh->release = release;
+
+	/* the segment ends where buf does, so it is never read past its end;
+	 * the serializers zero pad the rest of the last word */
+	s->data = (char*) buf;
+	s->len = s->cap = len;
+	s->user = s;
+	s->shared = sh;
+	capn_append_segment(c, s);
+
+	d.p.type = CAPN_LIST;
+	d.p.seg = s;
+	d.p.data = s->data;
+	d.p.datasz = 1;
+	d.p.len = (int) len;
+	return d;
+}
+
+/* The image of a template is the message compacted depth first, so every
+ * object is found in preorder at the end of the objects found so far.
+ * Anything earlier is a second reference to an object already recorded.
+ */
+#define MAX_TEMPLATE_DEPTH 64
+
+struct template_walk {
+	capn_ptr *objs;
+	int num, cap;
+	char *end;
+};
+
+static size_t template_size(capn_ptr p) {
+	switch (p.type) {
+	case CAPN_STRUCT:
+		return p.datasz + 8*p.ptrs;
+	case CAPN_PTR_LIST:
+		return 8*(size_t) p.len;
+	case CAPN_BIT_LIST:
+		return (p.datasz + 7) & ~7;
+	case CAPN_LIST:
+		return 8*p.is_composite_list + (((size_t) p.len * (p.datasz + 8*p.ptrs) + 7) & ~(size_t) 7);
+	default:
+		return 0;
+	}
+}
+
+static int template_walk(struct template_walk *w, capn_ptr p, int depth) {
+	char *begin = p.data - 8*p.is_composite_list;
+	int i, j;
+
+	if (p.type == CAPN_NULL || begin < w->end)
+		return 0;
+	if (begin != w->end || depth > MAX_TEMPLATE_DEPTH)
+		return -1;
+
+	if (w->num == w->cap) {
+		int cap = w->cap ? 2 * w->cap : 16;
+		capn_ptr *objs = (capn_ptr*) realloc(w->objs, cap * sizeof(*objs));
+		if (!objs)
+			return -1;
+		w->objs = objs;
+		w->cap = cap;
+	}
+
+	w->objs[w->num++] = p;
+	w->end = begin + template_size(p);
+
+	switch (p.type) {
+	case CAPN_STRUCT:
+		for (j = 0; j < p.ptrs; j++) {
+			if (template_walk(w, capn_getp(p, j, 1), depth+1))
+				return -1;
+		}
+		return 0;
+	case CAPN_PTR_LIST:
+		for (j = 0; j < p.len; j++) {
+			if (template_walk(w, capn_getp(p, j, 1), depth+1))
+				return -1;
+		}
+		return 0;
+	case CAPN_LIST:
+		for (i = 0; i < p.len && p.ptrs; i++) {
+			capn_ptr m = capn_getp(p, i, 0);
+			for (j = 0; j < p.ptrs; j++) {
+				if (template_walk(w, capn_getp(m, j, 1), depth+1))
+					return -1;
+			}
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+struct capn_template *capn_template_compile(struct capn *c) {
+	struct capn tmp;
+	struct template_walk w;
+	struct capn_template *t = NULL;
+	struct capn_segment *s;
+	int i;
+
+	capn_init_malloc(&tmp);
+	memset(&w, 0, sizeof(w));
+
+	if (capn_compact(c, &tmp, CAPN_DEPTH_FIRST))
+		goto end;
+
+	s = tmp.seglist;
+	w.end = s->data + 8;
+	if (template_walk(&w, capn_getp(capn_root(&tmp), 0, 1), 0) || w.end != s->data + s->len)
+		goto end;
+
+	/* objs holds pointers so the image that follows is 8 byte aligned */
+	t = (struct capn_template*) malloc(sizeof(*t) + w.num * sizeof(capn_ptr) + s->len);
+	if (!t)
+		goto end;
+
+	t->num = w.num;
+	t->objs = (capn_ptr*) (t + 1);
+	t->len = s->len;
+	t->data = (char*) (t->objs + w.num);
+	memcpy(t->data, s->data, s->len);
+
+	for (i = 0; i < w.num; i++) {
+		t->objs[i] = w.objs[i];
+		t->objs[i].seg = NULL;
+		t->objs[i].data = t->data + (w.objs[i].data - s->data);
+	}
+
+end:
+	free(w.objs);
+	capn_free(&tmp);
+	return t;
+}
+
+void capn_template_free(struct capn_template *t) {
+	free(t);
+}
+
+capn_ptr capn_template_instantiate(const struct capn_template *t, struct capn *c, capn_ptr *objs) {
+	capn_ptr root = {CAPN_NULL};
+	struct capn_segment *s;
+	int i;
+
+	if (c->segnum || c->readonly || !c->create)
+		return root;
+
+	s = c->create(c->user, 0, t->len);
+	if (!s || s->cap < t->len)
+		return root;
+	capn_append_segment(c, s);
+
+	memcpy(s->data, t->data, t->len);
+	s->len = t->len;
+
+	for (i = 0; i < t->num; i++) {
+		capn_ptr p = t->objs[i];
+		p.seg = s;
+		p.data = s->data + (t->objs[i].data - t->data);
+		if (objs)
+			objs[i] = p;
+		if (i == 0)
+			root = p;
+	}
+
+	return root;
+}
+
+/* Arena blocks are handed out in ARENA_ALIGN steps after their header and
+ * each new block is at least twice the size of the last one.
+ */
+#define ARENA_ALIGN 16
+#define ARENA_MIN 4096
+
+struct capn_arena_block {
+	struct capn_arena_block *next;
+	size_t len, cap;
+};
+
+#define ARENA_HDR ((sizeof(struct capn_arena_block) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+void capn_arena_init(struct capn_arena *a, size_t size) {
+	a->blocks = NULL;
+	a->size = size;
+}
+
+void *capn_arena_calloc(struct capn_arena *a, size_t num, size_t sz) {
+	struct capn_arena_block *b = a->blocks;
+	size_t need, cap;
+	char *p;
+
+	if (sz && num > (SIZE_MAX / 2 - ARENA_HDR) / sz)
+		return NULL;
+	need = (num * sz + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+	if (!b || b->cap - b->len < need) {
+		cap = b ? 2 * b->cap : a->size;
+		if (cap < need)
+			cap = need;
+		if (cap < ARENA_MIN)
+			cap = ARENA_MIN;
+		if (cap > SIZE_MAX / 2 - ARENA_HDR)
+			cap = need;
+
+		b = (struct capn_arena_block*) calloc(1, ARENA_HDR + cap);
+		if (!b)
+			return NULL;
+		b->cap = cap;
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+
+	p = (char*) b + ARENA_HDR + b->len;
+	b->len += need;
+	return p;
+}
+
+char *capn_arena_strdup(struct capn_arena *a, const char *s) {
+	size_t len;
+	char *p;
+
+	if (!s)
+		return NULL;
+	len = strlen(s) + 1;
+	p = (char*) capn_arena_calloc(a, len, 1);
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
+
+void capn_arena_free(struct capn_arena *a) {
+	struct capn_arena_block *b = a->blocks;
+
+	while (b) {
+		struct capn_arena_block *next = b->next;
+		free(b);
+		b = next;
+	}
+	a->blocks = NULL;
+}
+
+/* seg_split returns how many bytes of the segment can be read straight
+ * from seg->data. A segment holding an external blob ends part way
+ * through its last word; the rest of that word is copied, zero padded,
+ * into tail and *tailsz is set to 8.
+ */
+static size_t seg_split(struct capn_segment *seg, uint8_t *tail, size_t *tailsz) {
+	size_t sz = seg->len;
+	*tailsz = 0;
+
+	if (seg->len & 7) {
+		sz = seg->len & ~(size_t) 7;
+		memset(tail, 0, 8);
+		memcpy(tail, seg->data + sz, seg->len - sz);
+		*tailsz = 8;
+	}
+
+	return sz;
+}
+
 #define ZBUF_SZ 4096
 
 static int read_fp(void *p, size_t sz, FILE *f, struct capn_stream *z, uint8_t* zbuf, int packed) {
@@ -114,6 +514,9 @@ static int read_fp(void *p, size_t sz, FILE *f, struct capn_stream *z, uint8_t*
 	}
 }
 
+/* A packed zero tag and its count byte stand for up to 256 zero words */
+#define PACKED_EXPANSION 1024
+
 static int init_fp(struct capn *c, FILE *f, struct capn_stream *z, int packed) {
 	/*
 	 * Initialize 'c' from the contents of 'f', assuming the message has been
@@ -127,7 +530,8 @@ static int init_fp(struct capn *c, FILE *f, struct capn_stream *z, int packed) {
 	 */
 
 	struct capn_segment *s = NULL;
-	uint32_t i, segnum, total = 0;
+	uint32_t i, segnum;
+	size_t total = 0, sizes[1024];
 	uint32_t hdr[1024];
 	uint8_t zbuf[ZBUF_SZ];
 	char *data = NULL;
@@ -147,14 +551,20 @@ static int init_fp(struct capn *c, FILE *f, struct capn_stream *z, int packed) {
 	if (read_fp(hdr, 8 * (segnum/2) + 4, f, z, zbuf, packed))
 		goto err;
 
+	/* a short header must not make us allocate a large message before
+	 * any of it has been read */
 	for (i = 0; i < segnum; i++) {
-		uint32_t n = capn_flip32(hdr[i]);
-		if (n > INT_MAX/8 || n > UINT32_MAX/8 || UINT32_MAX - total < n*8)
+		uint64_t n = (uint64_t) capn_flip32(hdr[i]) * 8;
+		if (n > CAPN_MAX_MESSAGE_SIZE - total || n > SIZE_MAX - sizeof(*s) * 1024 - total)
 			goto err;
-		hdr[i] = n*8;
-		total += hdr[i];
+		sizes[i] = (size_t) n;
+		total += sizes[i];
 	}
 
+	/* nor can a buffer hold more than it expands to */
+	if (!f && total > (packed ? z->zeros + z->avail_buf + (uint64_t) z->avail_in * PACKED_EXPANSION : z->avail_in))
+		goto err;
+
 	/* Allocate space for the data and the capn_segment structs */
 	s = (struct capn_segment*) calloc(1, total + (sizeof(*s) * segnum));
 	if (!s)
@@ -166,7 +576,7 @@ static int init_fp(struct capn *c, FILE *f, struct capn_stream *z, int packed) {
 		goto err;
 
 	for (i = 0; i < segnum; i++) {
-		s[i].len = s[i].cap = hdr[i];
+		s[i].len = s[i].cap = sizes[i];
 		s[i].data = data;
 		data += s[i].len;
 		capn_append_segment(c, &s[i]);
@@ -221,8 +631,10 @@ static int header_render(struct capn *c, struct capn_segment *seg, uint32_t *hea
 	for (i = 0; i < c->segnum; i++, seg = seg->next) {
 		if (0 == seg)
 			return -1;
-		*datasz += seg->len;
-		header[1 + i] = capn_flip32(seg->len / 8);
+		*datasz += capn_seg_size(seg);
+		if (capn_seg_size(seg) / 8 > UINT32_MAX)
+			return -1;
+		header[1 + i] = capn_flip32((uint32_t) (capn_seg_size(seg) / 8));
 	}
 	if (0 != seg)
 		return -1;
@@ -263,8 +675,17 @@ static int64_t capn_write_mem_packed(struct capn *c, uint8_t *p, size_t sz)
 		return -1;
 
 	for (seg = root.seg; seg; seg = seg->next) {
+		uint8_t tail[8];
+		size_t tailsz;
+
 		z.next_in = (uint8_t *)seg->data;
-		z.avail_in = seg->len;
+		z.avail_in = seg_split(seg, tail, &tailsz);
+		ret = capn_deflate(&z);
+		if (ret != 0 || z.avail_in != 0)
+			return -1;
+
+		z.next_in = tail;
+		z.avail_in = tailsz;
 		ret = capn_deflate(&z);
 		if (ret != 0 || z.avail_in != 0)
 			return -1;
@@ -306,8 +727,11 @@ capn_write_mem(struct capn *c, uint8_t *p, size_t sz, int packed)
 	p += headersz;
 
 	for (seg = root.seg; seg; seg = seg->next) {
-		memcpy(p, seg->data, seg->len);
-		p += seg->len;
+		uint8_t tail[8];
+		size_t tailsz, n = seg_split(seg, tail, &tailsz);
+		memcpy(p, seg->data, n);
+		memcpy(p + n, tail, tailsz);
+		p += capn_seg_size(seg);
 	}
 
 	return (int64_t)(headersz + datasz);
@@ -332,7 +756,40 @@ static int _write_fd(ssize_t (*write_fd)(int fd, const void *p, size_t count), i
 	return 0;
 }
 
-int capn_write_fd(struct capn *c, ssize_t (*write_fd)(int fd, const void *p, size_t count), int fd, int packed)
+/* write_fd_data writes sz bytes from data, deflating them through buf first
+ * if packed, and adds the number of bytes written to *datasz.
+ */
+static int write_fd_data(ssize_t (*write_fd)(int fd, const void *p, size_t count), int fd,
+		int packed, struct capn_stream *z, uint8_t *buf, size_t bufsz,
+		const uint8_t *data, size_t sz, size_t *datasz)
+{
+	int ret;
+
+	if (!packed) {
+		if (_write_fd(write_fd, fd, (void*) data, sz) < 0)
+			return -1;
+		*datasz += sz;
+		return 0;
+	}
+
+	z->next_in = data;
+	z->avail_in = sz;
+
+	do {
+		z->next_out = buf;
+		z->avail_out = bufsz;
+		ret = capn_deflate(z);
+		if (ret != 0 && ret != CAPN_NEED_MORE)
+			return -1;
+		if (_write_fd(write_fd, fd, buf, bufsz - z->avail_out) < 0)
+			return -1;
+		*datasz += bufsz - z->avail_out;
+	} while (ret == CAPN_NEED_MORE);
+
+	return 0;
+}
+
+int64_t capn_write_fd(struct capn *c, ssize_t (*write_fd)(int fd, const void *p, size_t count), int fd, int packed)
 {
 	unsigned char buf[4096];
 	struct capn_segment *seg;
@@ -383,26 +840,15 @@ int capn_write_fd(struct capn *c, ssize_t (*write_fd)(int fd, const void *p, siz
 
 	datasz = headersz;
 	for (seg = root.seg; seg; seg = seg->next) {
-		size_t bufsz;
-		if (packed) {
-			memset(&z, 0, sizeof(z));
-			z.next_in = (uint8_t*)seg->data;
-			z.avail_in = seg->len;
-			z.next_out = buf;
-			z.avail_out = sizeof(buf);
-			ret = capn_deflate(&z);
-			if (ret != 0)
-				return -1;
-			p = buf;
-			bufsz = sizeof(buf) - z.avail_out;
-		} else {
-			p = (uint8_t*)seg->data;
-			bufsz = seg->len;
-		}
-		ret = _write_fd(write_fd, fd, p, bufsz);
-		if (ret < 0)
+		/* large segments are deflated through buf in several passes,
+		 * unpacked ones are written straight from the segment */
+		uint8_t tail[8];
+		size_t tailsz, n = seg_split(seg, tail, &tailsz);
+
+		memset(&z, 0, sizeof(z));
+		if (write_fd_data(write_fd, fd, packed, &z, buf, sizeof(buf), (uint8_t*) seg->data, n, &datasz)
+				|| write_fd_data(write_fd, fd, packed, &z, buf, sizeof(buf), tail, tailsz, &datasz))
 			return -1;
-		datasz += bufsz;
 	}
 
 	return datasz;
@@ -426,10 +872,212 @@ int64_t capn_size(struct capn *c)
 	for (i = 0; i < c->segnum; i++, seg = seg->next) {
 		if (0 == seg)
 			return -1;
-		datasz += seg->len;
+		datasz += capn_seg_size(seg);
 	}
 	if (0 != seg)
 		return -1;
 
 	return (int64_t)(headersz + datasz);
 }
+
+/* A delta is a stream of little endian words, packed or not:
+ *
+ *   (4 bytes) The number of segments in next.
+ *   (4 bytes) The number of segments in prev, which the base must match.
+ *   For each segment of next:
+ *     (4 bytes) The size of the segment, in words.
+ *     (4 bytes) The number of ranges that follow.
+ *     For each range:
+ *       (4 bytes) The offset of the range, in words.
+ *       (4 bytes) The size of the range, in words.
+ *       The content of the range.
+ *
+ * A range covers words that differ from prev or are past its end. An
+ * unchanged word between two changed words costs the same as a new range
+ * header, so it is sent as part of the range.
+ */
+struct delta_seg {
+	const char *data;
+	size_t len, n;
+	uint8_t tail[8];
+};
+
+static void delta_seg_init(struct delta_seg *ds, struct capn_segment *s) {
+	size_t tailsz;
+
+	memset(ds, 0, sizeof(*ds));
+	if (s) {
+		ds->data = s->data;
+		ds->len = capn_seg_size(s);
+		ds->n = seg_split(s, ds->tail, &tailsz);
+	}
+}
+
+static const char *delta_word(const struct delta_seg *ds, size_t i) {
+	return 8*i < ds->n ? ds->data + 8*i : (const char*) ds->tail;
+}
+
+static int delta_changed(const struct delta_seg *ps, const struct delta_seg *ns, size_t i) {
+	return 8*i >= ps->len || memcmp(delta_word(ps, i), delta_word(ns, i), 8);
+}
+
+static int delta_write(struct capn_stream *z, const void *p, size_t sz, int packed) {
+	if (packed) {
+		z->next_in = (const uint8_t*) p;
+		z->avail_in = sz;
+		return capn_deflate(z) != 0 || z->avail_in != 0;
+	}
+
+	if (z->avail_out < sz)
+		return -1;
+	memcpy(z->next_out, p, sz);
+	z->next_out += sz;
+	z->avail_out -= sz;
+	return 0;
+}
+
+/* delta_ranges counts the ranges of ns that differ from ps and writes
+ * them out if z is not NULL */
+static int64_t delta_ranges(struct capn_stream *z, int packed, const struct delta_seg *ps, const struct delta_seg *ns) {
+	size_t i = 0, words = ns->len / 8;
+	int64_t num = 0;
+
+	while (i < words) {
+		size_t begin, end;
+		uint32_t hdr[2];
+
+		while (i < words && !delta_changed(ps, ns, i))
+			i++;
+		if (i == words)
+			break;
+
+		begin = i;
+		while (i < words) {
+			if (delta_changed(ps, ns, i)) {
+				i++;
+			} else if (i + 1 < words && delta_changed(ps, ns, i + 1)) {
+				i += 2;
+			} else {
+				break;
+			}
+		}
+		end = i;
+		num++;
+
+		if (!z)
+			continue;
+
+		hdr[0] = capn_flip32((uint32_t) begin);
+		hdr[1] = capn_flip32((uint32_t) (end - begin));
+		if (delta_write(z, hdr, 8, packed))
+			return -1;
+
+		/* only the last word can come from the tail */
+		if (8*end > ns->n) {
+			if ((8*begin < ns->n && delta_write(z, ns->data + 8*begin, ns->n - 8*begin, packed))
+					|| delta_write(z, ns->tail, 8, packed))
+				return -1;
+		} else if (delta_write(z, ns->data + 8*begin, 8*(end - begin), packed)) {
+			return -1;
+		}
+	}
+
+	return num;
+}
+
+int64_t capn_delta(struct capn *prev, struct capn *next, uint8_t *p, size_t sz, int packed) {
+	struct capn_stream z;
+	struct capn_segment *ps = prev->seglist, *ns;
+	uint32_t hdr[2];
+
+	if (next->segnum < prev->segnum)
+		return -1;
+
+	memset(&z, 0, sizeof(z));
+	z.next_out = p;
+	z.avail_out = sz;
+
+	hdr[0] = capn_flip32(next->segnum);
+	hdr[1] = capn_flip32(prev->segnum);
+	if (delta_write(&z, hdr, 8, packed))
+		return -1;
+
+	for (ns = next->seglist; ns; ns = ns->next, ps = ps ? ps->next : NULL) {
+		struct delta_seg pd, nd;
+		int64_t num;
+
+		delta_seg_init(&pd, ps);
+		delta_seg_init(&nd, ns);
+		num = delta_ranges(NULL, packed, &pd, &nd);
+
+		hdr[0] = capn_flip32((uint32_t) (nd.len / 8));
+		hdr[1] = capn_flip32((uint32_t) num);
+		if (delta_write(&z, hdr, 8, packed) || delta_ranges(&z, packed, &pd, &nd) < 0)
+			return -1;
+	}
+
+	return (int64_t) (sz - z.avail_out);
+}
+
+int capn_apply_delta(struct capn *c, const uint8_t *p, size_t sz, int packed) {
+	struct capn_stream z;
+	struct capn_segment *s;
+	uint32_t hdr[2], i, j, segnum;
+
+	if (c->readonly)
+		return -1;
+
+	memset(&z, 0, sizeof(z));
+	z.next_in = p;
+	z.avail_in = sz;
+
+	if (read_fp(hdr, 8, NULL, &z, NULL, packed))
+		return -1;
+
+	segnum = capn_flip32(hdr[0]);
+	if (capn_flip32(hdr[1]) != c->segnum || segnum < c->segnum || segnum > 1024)
+		return -1;
+
+	for (i = 0, s = c->seglist; i < segnum; i++, s = s->next) {
+		size_t len;
+		uint32_t num;
+
+		if (read_fp(hdr, 8, NULL, &z, NULL, packed))
+			return -1;
+		len = capn_flip32(hdr[0]);
+		num = capn_flip32(hdr[1]);
+		if (len > SIZE_MAX/8)
+			return -1;
+		len *= 8;
+
+		if (i >= c->segnum) {
+			s = c->create ? c->create(c->user, i, len) : NULL;
+			if (!s)
+				return -1;
+			capn_append_segment(c, s);
+		}
+
+		/* segments can only grow within their capacity */
+		if (s->shared || len > s->cap)
+			return -1;
+
+		for (j = 0; j < num; j++) {
+			uint32_t off, n;
+
+			if (read_fp(hdr, 8, NULL, &z, NULL, packed))
+				return -1;
+			off = capn_flip32(hdr[0]);
+			n = capn_flip32(hdr[1]);
+			if (off > len/8 || n > len/8 - off)
+				return -1;
+			if (read_fp(s->data + 8*(size_t) off, 8*(size_t) n, NULL, &z, NULL, packed))
+				return -1;
+		}
+
+		if (len < s->len)
+			memset(s->data + len, 0, s->len - len);
+		s->len = len;
+	}
+
+	return 0;
+}
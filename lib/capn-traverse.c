@@ -0,0 +1,322 @@
+/* vim: set sw=8 ts=8 sts=8 noet: */
+/* capn-traverse.c
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include "capnp_c.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#define CAPN_THREADS 1
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/* A range of more than GRAIN pointers or list members is run GRAIN at a
+ * time, with the rest left on the deque where idle workers can split it.
+ */
+#define GRAIN 256
+#define MAX_TRAVERSE_DEPTH 64
+#define MAX_TRAVERSE_THREADS 256
+
+/* A work item is either a single object (begin < 0) or a range of pointers
+ * or composite list members inside p.
+ */
+struct work {
+	capn_ptr p;
+	int begin, end;
+	int depth;
+};
+
+struct traverse;
+
+/* Each worker owns a deque. The owner pushes and pops at the tail so it
+ * runs depth first; thieves take from the head, which holds the oldest and
+ * therefore largest pieces of work.
+ */
+struct worker {
+	struct traverse *t;
+	struct work *q;
+	int head, tail, cap;
+	int id;
+	/* work found while running an item, pushed with one lock */
+	struct work out[GRAIN];
+	int nout;
+#ifdef CAPN_THREADS
+	pthread_mutex_t lock;
+	pthread_t thread;
+#endif
+};
+
+struct traverse {
+	capn_visit_fn visit;
+	void *user;
+	struct worker *workers;
+	int num;
+	long pending;
+	int ret;
+};
+
+#ifdef CAPN_THREADS
+#define LOCK(w) pthread_mutex_lock(&(w)->lock)
+#define UNLOCK(w) pthread_mutex_unlock(&(w)->lock)
+#define PENDING_ADD(t, v) __atomic_add_fetch(&(t)->pending, (v), __ATOMIC_ACQ_REL)
+#define PENDING(t) __atomic_load_n(&(t)->pending, __ATOMIC_ACQUIRE)
+#define FAILED(t) __atomic_load_n(&(t)->ret, __ATOMIC_RELAXED)
+static void fail(struct traverse *t, int ret) {
+	int zero = 0;
+	__atomic_compare_exchange_n(&t->ret, &zero, ret, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+#else
+#define LOCK(w) ((void) 0)
+#define UNLOCK(w) ((void) 0)
+#define PENDING_ADD(t, v) ((t)->pending += (v))
+#define PENDING(t) ((t)->pending)
+#define FAILED(t) ((t)->ret)
+static void fail(struct traverse *t, int ret) {
+	if (!t->ret)
+		t->ret = ret;
+}
+#endif
+
+static void push(struct worker *w, const struct work *k, int n) {
+	LOCK(w);
+	if (w->tail + n > w->cap && w->head > 0) {
+		memmove(w->q, w->q + w->head, (w->tail - w->head) * sizeof(*w->q));
+		w->tail -= w->head;
+		w->head = 0;
+	}
+	if (w->tail + n > w->cap) {
+		int cap = w->cap ? w->cap * 2 : 64;
+		struct work *q;
+		while (cap < w->tail + n)
+			cap *= 2;
+		q = (struct work*) realloc(w->q, cap * sizeof(*q));
+		if (!q) {
+			UNLOCK(w);
+			fail(w->t, -1);
+			return;
+		}
+		w->q = q;
+		w->cap = cap;
+	}
+
+	memcpy(w->q + w->tail, k, n * sizeof(*k));
+	w->tail += n;
+	PENDING_ADD(w->t, n);
+	UNLOCK(w);
+}
+
+static void flush(struct worker *w) {
+	if (w->nout) {
+		push(w, w->out, w->nout);
+		w->nout = 0;
+	}
+}
+
+static void defer(struct worker *w, capn_ptr p, int begin, int end, int depth) {
+	struct work *k;
+	if (w->nout == GRAIN)
+		flush(w);
+	k = &w->out[w->nout++];
+	k->p = p;
+	k->begin = begin;
+	k->end = end;
+	k->depth = depth;
+}
+
+static int pop(struct worker *w, struct work *k) {
+	int ok = 0;
+	LOCK(w);
+	if (w->tail > w->head) {
+		*k = w->q[--w->tail];
+		ok = 1;
+	}
+	if (w->tail == w->head) {
+		w->head = w->tail = 0;
+	}
+	UNLOCK(w);
+	return ok;
+}
+
+static int steal(struct worker *w, struct work *k) {
+	struct traverse *t = w->t;
+	int i;
+
+	for (i = 1; i < t->num; i++) {
+		struct worker *v = &t->workers[(w->id + i) % t->num];
+		int ok = 0;
+		LOCK(v);
+		if (v->tail > v->head) {
+			struct work *h = &v->q[v->head];
+			*k = *h;
+			if (h->begin >= 0 && h->end - h->begin > GRAIN) {
+				/* take the upper half of a long range and
+				 * leave the lower half to the owner */
+				k->begin = h->begin + (h->end - h->begin) / 2;
+				h->end = k->begin;
+				PENDING_ADD(t, 1);
+			} else {
+				v->head++;
+			}
+			ok = 1;
+		}
+		UNLOCK(v);
+		if (ok)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void visit_object(struct worker *w, capn_ptr p, int depth) {
+	struct traverse *t = w->t;
+	int ret;
+
+	if (depth > MAX_TRAVERSE_DEPTH) {
+		fail(t, -1);
+		return;
+	}
+
+	ret = t->visit(t->user, p, w->id);
+	if (ret) {
+		fail(t, ret);
+		return;
+	}
+
+	switch (p.type) {
+	case CAPN_STRUCT:
+		if (p.ptrs)
+			defer(w, p, 0, p.ptrs, depth);
+		break;
+	case CAPN_PTR_LIST:
+		if (p.len)
+			defer(w, p, 0, p.len, depth);
+		break;
+	case CAPN_LIST:
+		/* members of composite lists are visited even without
+		 * pointers of their own */
+		if (p.is_composite_list && p.len)
+			defer(w, p, 0, p.len, depth);
+		break;
+	default:
+		break;
+	}
+}
+
+static void run_range(struct worker *w, struct work *k) {
+	int i, end = k->end;
+
+	if (end - k->begin > GRAIN) {
+		struct work rest = *k;
+		rest.begin = end = k->begin + GRAIN;
+		push(w, &rest, 1);
+	}
+
+	/* children are visited in place and only the ranges of their own
+	 * pointers are queued, GRAIN at a time by flush */
+	for (i = k->begin; i < end && !FAILED(w->t); i++) {
+		capn_ptr c = capn_getp(k->p, i, 1);
+		if (c.type != CAPN_NULL)
+			visit_object(w, c, k->depth + 1);
+	}
+}
+
+static void run(struct worker *w) {
+	struct traverse *t = w->t;
+	struct work k;
+
+	for (;;) {
+		if (pop(w, &k) || steal(w, &k)) {
+			if (!FAILED(t)) {
+				if (k.begin < 0) {
+					visit_object(w, k.p, k.depth);
+				} else {
+					run_range(w, &k);
+				}
+			}
+			flush(w);
+			PENDING_ADD(t, -1);
+		} else if (PENDING(t) == 0) {
+			break;
+		} else {
+#ifdef CAPN_THREADS
+			sched_yield();
+#endif
+		}
+	}
+}
+
+#ifdef CAPN_THREADS
+static void *run_thread(void *arg) {
+	run((struct worker*) arg);
+	return NULL;
+}
+#endif
+
+int capn_traverse(capn_ptr root, int threads, capn_visit_fn visit, void *user) {
+	struct traverse t;
+	int i, started = 1;
+
+	capn_resolve(&root);
+	if (root.type == CAPN_NULL)
+		return 0;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_TRAVERSE_THREADS)
+		threads = MAX_TRAVERSE_THREADS;
+#ifndef CAPN_THREADS
+	threads = 1;
+#endif
+
+	/* lookup_segment is only safe to share once the session is frozen */
+	if (threads > 1 && root.seg && root.seg->capn && !root.seg->capn->readonly)
+		return -1;
+
+	memset(&t, 0, sizeof(t));
+	t.visit = visit;
+	t.user = user;
+	t.num = threads;
+	t.workers = (struct worker*) calloc(threads, sizeof(*t.workers));
+	if (!t.workers)
+		return -1;
+
+	for (i = 0; i < threads; i++) {
+		t.workers[i].t = &t;
+		t.workers[i].id = i;
+#ifdef CAPN_THREADS
+		pthread_mutex_init(&t.workers[i].lock, NULL);
+#endif
+	}
+
+	defer(&t.workers[0], root, -1, -1, 0);
+	flush(&t.workers[0]);
+
+#ifdef CAPN_THREADS
+	for (; started < threads; started++) {
+		if (pthread_create(&t.workers[started].thread, NULL, &run_thread, &t.workers[started]))
+			break;
+	}
+#endif
+
+	run(&t.workers[0]);
+
+#ifdef CAPN_THREADS
+	for (i = 1; i < started; i++) {
+		pthread_join(t.workers[i].thread, NULL);
+	}
+#endif
+
+	for (i = 0; i < threads; i++) {
+#ifdef CAPN_THREADS
+		pthread_mutex_destroy(&t.workers[i].lock);
+#endif
+		free(t.workers[i].q);
+	}
+	free(t.workers);
+	return t.ret;
+}
@@ -12,7 +12,9 @@
 #endif
 
 #include "capnp_c.h"
+#include "capnp_priv.h"
 
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #ifndef _MSC_VER
@@ -33,6 +35,9 @@
 #define PTR_LIST 6
 #define COMPOSITE_LIST 7
 
+/* segments imported by capn_share or capn_new_data_external are read-only */
+#define IMPORTED(p) ((p).seg && (p).seg->shared)
+
 #define U64(val) ((uint64_t) (val))
 #define I64(val) ((int64_t) (val))
 #define U32(val) ((uint32_t) (val))
@@ -176,9 +181,14 @@ void capn_append_segment(struct capn *c, struct capn_segment *s) {
 	c->segtree = capn_tree_insert(c->segtree, &s->hdr);
 }
 
-static char *new_data(struct capn *c, int sz, struct capn_segment **ps) {
+static char *new_data(struct capn *c, size_t sz, struct capn_segment **ps) {
 	struct capn_segment *s;
 
+	if (c->readonly) {
+		*ps = NULL;
+		return NULL;
+	}
+
 	/* find a segment with sufficient data */
 	for (s = c->seglist; s != NULL; s = s->next) {
 		if (s->len + sz <= s->cap) {
@@ -199,6 +209,36 @@ end:
 	return s->data + s->len - sz;
 }
 
+/* Segment lookup for a session frozen by capn_freeze. segtab is never
+ * resized after the freeze so readers only load from it. A segment missing
+ * from the table is loaded through c->lookup and published with a compare
+ * and swap. Should another reader have published the same id first, its
+ * segment is used instead of ours.
+ */
+static struct capn_segment *lookup_frozen(struct capn *c, uint32_t id) {
+	struct capn_segment *s, *cur = NULL;
+
+	if (id >= c->segnum)
+		return NULL;
+
+	s = capn_atomic_load_ptr(&c->segtab[id]);
+	if (s || !c->lookup)
+		return s;
+
+	s = c->lookup(c->user, id);
+	if (!s)
+		return NULL;
+
+	s->id = id;
+	s->capn = c;
+	s->next = NULL;
+
+	if (!capn_atomic_cas_ptr(&c->segtab[id], &cur, s))
+		return cur;
+
+	return s;
+}
+
 static struct capn_segment *lookup_segment(struct capn* c, struct capn_segment *s, uint32_t id) {
 	struct capn_tree **x;
 	struct capn_segment *y = NULL;
@@ -207,6 +247,8 @@ static struct capn_segment *lookup_segment(struct capn* c, struct capn_segment *
 		return s;
 	if (!c)
 		return NULL;
+	if (c->readonly)
+		return lookup_frozen(c, id);
 
 	if (id < c->segnum) {
 		x = &c->segtree;
@@ -310,15 +352,29 @@ static char *struct_ptr(struct capn_segment *s, char *d, int minsz) {
 	}
 
 	datasz = U16(val >> 32);
-	d += (I32(U32(val)) << 1) + 8;
+	d += I64(I32(U32(val))) * 2 + 8;
 
-	if (val != 0 && (val&3) != STRUCT_PTR && datasz >= minsz && s->data <= d && d < s->data + s->len) {
+	if (val != 0 && (val&3) == STRUCT_PTR && datasz*8 >= minsz
+			&& s->data <= d && d + minsz <= s->data + s->len) {
 		return d;
 	}
 
 	return NULL;
 }
 
+/* prefetch_struct starts loading the struct a pointer list element points
+ * to. Far pointers are left alone as following them means a segment lookup.
+ */
+static void prefetch_struct(struct capn_segment *s, char *d) {
+	uint64_t val = capn_flip64(*(uint64_t*)d);
+
+	if (val != 0 && (val&3) == STRUCT_PTR) {
+		int64_t off = I64(I32(U32(val))) * 2 + 8;
+		if (off >= s->data - d && off < s->data + s->len - d)
+			capn_prefetch(d + off);
+	}
+}
+
 static capn_ptr read_ptr(struct capn_segment *s, char *d) {
 	capn_ptr ret = {CAPN_NULL};
 	uint64_t val;
@@ -336,7 +392,7 @@ static capn_ptr read_ptr(struct capn_segment *s, char *d) {
 		break;
 	}
 
-	d += (I32(U32(val)) >> 2) * 8 + 8;
+	d += I64(I32(U32(val)) >> 2) * 8 + 8;
 
 	if (d < s->data) {
 		goto err;
@@ -372,19 +428,19 @@ static capn_ptr read_ptr(struct capn_segment *s, char *d) {
 			break;
 		case BYTE_2_LIST:
 			ret.datasz = 2;
-			e = d + ret.len * 2;
+			e = d + (size_t) ret.len * 2;
 			break;
 		case BYTE_4_LIST:
 			ret.datasz = 4;
-			e = d + ret.len * 4;
+			e = d + (size_t) ret.len * 4;
 			break;
 		case BYTE_8_LIST:
 			ret.datasz = 8;
-			e = d + ret.len * 8;
+			e = d + (size_t) ret.len * 8;
 			break;
 		case PTR_LIST:
 			ret.type = CAPN_PTR_LIST;
-			e = d + ret.len * 8;
+			e = d + (size_t) ret.len * 8;
 			break;
 		case COMPOSITE_LIST:
 			if ((size_t)((d+8) - s->data) > s->len) {
@@ -394,14 +450,14 @@ static capn_ptr read_ptr(struct capn_segment *s, char *d) {
 			val = capn_flip64(*(uint64_t*) d);
 
 			d += 8;
-			e = d + ret.len * 8;
+			e = d + (size_t) ret.len * 8;
 
 			ret.datasz = U32(U16(val >> 32)) * 8;
 			ret.ptrs = U32(U16(val >> 48));
 			ret.len = U32(val) >> 2;
 			ret.is_composite_list = 1;
 
-			if ((ret.datasz + 8*ret.ptrs) * ret.len != e - d) {
+			if ((ret.datasz + 8*ret.ptrs) * (size_t) ret.len != (size_t) (e - d)) {
 				goto err;
 			}
 			break;
@@ -442,7 +498,7 @@ capn_ptr capn_getp(capn_ptr p, int off, int resolve) {
 		if (off < p.len) {
 			capn_ptr ret = {CAPN_STRUCT};
 			ret.is_list_member = 1;
-			ret.data = p.data + off * (p.datasz + 8*p.ptrs);
+			ret.data = p.data + (size_t) off * (p.datasz + 8*p.ptrs);
 			ret.seg = p.seg;
 			ret.datasz = p.datasz;
 			ret.ptrs = p.ptrs;
@@ -455,14 +511,14 @@ capn_ptr capn_getp(capn_ptr p, int off, int resolve) {
 		if (off >= p.ptrs) {
 			goto err;
 		}
-		ret.data = p.data + p.datasz + 8*off;
+		ret.data = p.data + p.datasz + 8*(size_t) off;
 		break;
 
 	case CAPN_PTR_LIST:
 		if (off >= p.len) {
 			goto err;
 		}
-		ret.data = p.data + 8*off;
+		ret.data = p.data + 8*(size_t) off;
 		break;
 
 	default:
@@ -480,7 +536,7 @@ err:
 	return p;
 }
 
-static void write_ptr_tag(char *d, capn_ptr p, int off) {
+static void write_ptr_tag(char *d, capn_ptr p, int64_t off) {
 	/*
 	lsb                      struct pointer                       msb
 	+-+-----------------------------+---------------+---------------+
@@ -500,7 +556,7 @@ static void write_ptr_tag(char *d, capn_ptr p, int off) {
 	ASAN detector will rightly complain. So we do two's complement
 	manually, and check bounds, to stay within unsigned arithmetic.
 	*/
-	const int off_words = off / 8;
+	const int64_t off_words = off / 8;
 	uint64_t val;
 	if (off_words < 0) {
 		if (off_words < -(2147483647 >> 2) - 1) {
@@ -509,6 +565,9 @@ static void write_ptr_tag(char *d, capn_ptr p, int off) {
 		uint32_t twos = 1 + ~(U32(-off_words) << 2);
 		val = U64(twos);
 	} else {
+		if (off_words > (2147483647 >> 2)) {
+			goto err;
+		}
 		val = U64(U32(off_words) << 2);
 	}
 
@@ -519,7 +578,7 @@ static void write_ptr_tag(char *d, capn_ptr p, int off) {
 
 	case CAPN_LIST:
 		if (p.is_composite_list) {
-			val |= LIST_PTR | (U64(COMPOSITE_LIST) << 32) | (U64(p.len * (p.datasz/8 + p.ptrs)) << 35);
+			val |= LIST_PTR | (U64(COMPOSITE_LIST) << 32) | ((U64(p.len) * (p.datasz/8 + p.ptrs)) << 35);
 		} else {
 			val |= LIST_PTR | (U64(p.len) << 35);
 
@@ -625,12 +684,237 @@ static int write_ptr(struct capn_segment *s, char *d, capn_ptr p) {
 	}
 }
 
+static int is_ptr_equal(const struct capn_ptr *a, const struct capn_ptr *b) {
+	return a->data == b->data
+		&& a->type == b->type
+		&& a->len == b->len
+		&& a->datasz == b->datasz
+		&& a->ptrs == b->ptrs;
+}
+
+/* struct capn_copy holds the state of capn_setp copies into a session.
+ *
+ * Every non-empty source object that has been copied is recorded in an open
+ * addressing hash table keyed on the start of its source data, so that a
+ * source object referenced again (including recursive structures) finds
+ * its previous copy in constant time.
+ *
+ * Overlapped pointers would otherwise let a small message expand into a
+ * much larger copy. Objects that don't overlap can't add up to more bytes
+ * than their messages hold, so rather than keeping the source ranges in a
+ * tree the bytes of the objects copied are counted against the size of
+ * the source messages, and a copy that would exceed it is rejected. An
+ * object starting where a different one was copied is rejected as well.
+ * The table and the copy stack are allocated with create_local and are
+ * cleared at the end of each top level copy unless capn->keep_copy is set.
+ */
 struct copy {
-	struct capn_tree hdr;
+	char *fbegin;
 	struct capn_ptr to, from;
-	char *fbegin, *fend;
 };
 
+struct capn_copy {
+	struct copy **tab;
+	uint32_t size, used;
+	struct capn_ptr *to, *from;
+	int depth;
+
+	/* bytes of the objects copied, and of the source messages seen */
+	size_t copied, limit, srcsize;
+	struct capn *src;
+	struct capn_segment *srcseg;
+
+	/* where find_copy left off, for add_copy */
+	struct copy **slot;
+};
+
+#define COPY_TABLE_MIN 64
+
+static void *copy_alloc(struct capn *c, int sz) {
+	struct capn_segment *cs;
+	char *ret;
+
+	sz = (sz + 7) & ~7;
+
+	for (cs = c->copylist; cs != NULL; cs = cs->next) {
+		if (cs->len + sz <= cs->cap)
+			break;
+	}
+
+	if (!cs) {
+		cs = c->create_local ? c->create_local(c->user, sz) : NULL;
+		if (!cs) {
+			/* can't allocate copy state */
+			return NULL;
+		}
+		cs->next = c->copylist;
+		c->copylist = cs;
+	}
+
+	ret = cs->data + cs->len;
+	cs->len += sz;
+	memset(ret, 0, sz);
+	return ret;
+}
+
+static void clear_copy(struct capn *c) {
+	struct capn_segment *cs;
+	for (cs = c->copylist; cs != NULL; cs = cs->next) {
+		cs->len = 0;
+	}
+	c->copy = NULL;
+}
+
+static uint32_t copy_hash(const char *p) {
+	return (uint32_t) ((U64((uintptr_t) p >> 3) * UINT64_C(0x9E3779B97F4A7C15)) >> 32);
+}
+
+static struct copy **copy_slot(struct capn_copy *cp, char *fbegin) {
+	uint32_t i = copy_hash(fbegin) & (cp->size - 1);
+	while (cp->tab[i] && cp->tab[i]->fbegin != fbegin) {
+		i = (i + 1) & (cp->size - 1);
+	}
+	return &cp->tab[i];
+}
+
+static struct capn_copy *copy_state(struct capn *c) {
+	if (!c->copy) {
+		c->copy = (struct capn_copy*) copy_alloc(c, sizeof(*c->copy));
+	}
+	return c->copy;
+}
+
+static size_t message_bytes(struct capn_segment *seg) {
+	struct capn_segment *s;
+	size_t sz = 0;
+
+	if (!seg->capn)
+		return seg->len;
+	for (s = seg->capn->seglist; s != NULL; s = s->next)
+		sz += s->len;
+	return sz;
+}
+
+/* charge_copy counts the sz bytes of the new object f against the size of
+ * the source messages. Returns -1 once they add up to more, which only
+ * overlapping objects can do.
+ */
+static int charge_copy(struct capn_copy *k, capn_ptr *f, size_t sz) {
+	struct capn_segment *seg = f->seg;
+
+	if (!seg)
+		return 0;
+
+	if (seg->capn ? seg->capn != k->src : seg != k->srcseg) {
+		/* a new source message */
+		k->src = seg->capn;
+		k->srcseg = seg;
+		k->srcsize = message_bytes(seg);
+		k->limit += k->srcsize;
+	}
+
+	k->copied += sz;
+	if (k->copied > k->limit) {
+		/* the source may have looked up more segments since */
+		size_t srcsize = message_bytes(k->srcseg);
+		k->limit += srcsize - k->srcsize;
+		k->srcsize = srcsize;
+	}
+	return k->copied > k->limit ? -1 : 0;
+}
+
+/* find_copy looks up the source object f, whose data spans [fbegin, fend).
+ * It returns 1 with *cp set if f has been copied before, 0 if f is new and
+ * can be added with add_copy, and -1 if f overlaps the objects copied
+ * before or the copy state can't be allocated.
+ */
+static int find_copy(struct capn *c, capn_ptr *f, char *fbegin, char *fend, struct copy **cp) {
+	struct capn_copy *k = copy_state(c);
+
+	if (!k)
+		return -1;
+
+	if (2 * (k->used + 1) > k->size) {
+		struct copy **old = k->tab;
+		uint32_t i, oldsz = k->size;
+		uint32_t size = oldsz ? 2 * oldsz : COPY_TABLE_MIN;
+
+		if (size > INT_MAX / sizeof(*old))
+			return -1;
+
+		k->tab = (struct copy**) copy_alloc(c, size * sizeof(*old));
+		if (!k->tab) {
+			k->tab = old;
+			return -1;
+		}
+		k->size = size;
+
+		for (i = 0; i < oldsz; i++) {
+			if (old[i]) {
+				*copy_slot(k, old[i]->fbegin) = old[i];
+			}
+		}
+	}
+
+	k->slot = copy_slot(k, fbegin);
+	if (*k->slot) {
+		*cp = *k->slot;
+		return is_ptr_equal(f, &(*cp)->from) ? 1 : -1;
+	}
+
+	return charge_copy(k, f, fend - fbegin);
+}
+
+/* add_copy records the copy t of f after find_copy returned 0 for it */
+static int add_copy(struct capn *c, capn_ptr *f, char *fbegin, capn_ptr *t) {
+	struct capn_copy *k = c->copy;
+	struct copy *n = (struct copy*) copy_alloc(c, sizeof(*n));
+
+	if (!n)
+		return -1;
+
+	n->fbegin = fbegin;
+	n->from = *f;
+	n->to = *t;
+	*k->slot = n;
+	k->used++;
+	return 0;
+}
+
+/* grow_stack moves the to/from stacks of capn_setp into copy memory with
+ * room for at least twice as many levels.
+ */
+static int grow_stack(struct capn *c, struct capn_ptr **to, struct capn_ptr **from, int *depth) {
+	struct capn_copy *cp = copy_state(c);
+	int sz = 2 * *depth;
+
+	if (!cp)
+		return -1;
+
+	if (cp->depth < sz) {
+		struct capn_ptr *t, *f;
+
+		if (sz > INT_MAX / 2 / (int) sizeof(*t))
+			return -1;
+
+		t = (struct capn_ptr*) copy_alloc(c, sz * sizeof(*t));
+		f = t ? (struct capn_ptr*) copy_alloc(c, sz * sizeof(*f)) : NULL;
+		if (!f)
+			return -1;
+
+		cp->to = t;
+		cp->from = f;
+		cp->depth = sz;
+	}
+
+	memcpy(cp->to, *to, *depth * sizeof(**to));
+	memcpy(cp->from, *from, *depth * sizeof(**from));
+	*to = cp->to;
+	*from = cp->from;
+	*depth = cp->depth;
+	return 0;
+}
+
 static capn_ptr new_clone(struct capn_segment *s, capn_ptr p) {
 	switch (p.type) {
 	case CAPN_STRUCT:
@@ -646,57 +930,86 @@ static capn_ptr new_clone(struct capn_segment *s, capn_ptr p) {
 	}
 }
 
-static int is_ptr_equal(const struct capn_ptr *a, const struct capn_ptr *b) {
-	return a->data == b->data
-		&& a->type == b->type
-		&& a->len == b->len
-		&& a->datasz == b->datasz
-		&& a->ptrs == b->ptrs;
-}
-
-static int data_size(struct capn_ptr p) {
+static size_t data_size(struct capn_ptr p) {
 	switch (p.type) {
 	case CAPN_BIT_LIST:
 		return p.datasz;
 	case CAPN_PTR_LIST:
-		return p.len*8;
+		return (size_t) p.len*8;
 	case CAPN_STRUCT:
 		return p.datasz + 8*p.ptrs;
 	case CAPN_LIST:
-		return p.len * (p.datasz + 8*p.ptrs) + 8*p.is_composite_list;
+		return (size_t) p.len * (p.datasz + 8*p.ptrs) + 8*p.is_composite_list;
 	default:
 		return 0;
 	}
 }
 
+/* Walks that follow every pointer instead of visiting shared objects once
+ * can be made to do exponential work by a small message whose pointers
+ * share subtrees. Like the traversal limit of the reference implementation
+ * they get a budget of words to visit, TRAVERSE_FACTOR times the size of
+ * the message plus TRAVERSE_MIN, and fail once it runs out.
+ */
+#define TRAVERSE_FACTOR 8
+#define TRAVERSE_MIN (64*1024)
+
+static int64_t traverse_limit(struct capn_segment *seg) {
+	int64_t words = 0;
+	struct capn_segment *s;
+
+	if (seg && seg->capn) {
+		for (s = seg->capn->seglist; s != NULL; s = s->next)
+			words += s->len / 8;
+	} else if (seg) {
+		words = seg->len / 8;
+	}
+	return TRAVERSE_FACTOR * words + TRAVERSE_MIN;
+}
+
+/* traverse charges the words of p (at least one) to budget and returns -1
+ * once it is used up */
+static int traverse(int64_t *budget, capn_ptr p) {
+	*budget -= (int64_t) (data_size(p) / 8) + 1;
+	return *budget < 0 ? -1 : 0;
+}
+
+/* no_ptrs returns whether all ptrs pointers of each of the num records of
+ * stride bytes starting at p are null */
+static int no_ptrs(const char *p, int num, int stride, int ptrs) {
+	int i, j;
+	for (i = 0; i < num; i++, p += stride) {
+		for (j = 0; j < ptrs; j++) {
+			if (((const uint64_t*) p)[j])
+				return 0;
+		}
+	}
+	return 1;
+}
+
 static int copy_ptr(struct capn_segment *seg, char *data, struct capn_ptr *t, struct capn_ptr *f, int *dep) {
 	struct capn *c = seg->capn;
 	struct copy *cp = NULL;
-	struct capn_tree **xcp;
 	char *fbegin = f->data - 8*f->is_composite_list;
 	char *fend = fbegin + data_size(*f);
 	int zero_sized = (fend == fbegin);
 
 	/* We always copy list members as it would otherwise be an
 	 * overlapped pointer (the data is owned by the enclosing list).
-	 * We do not bother with the overlapped lookup for zero sized
+	 * We do not bother with the copy lookup for zero sized
 	 * structures/lists as they never overlap. Nor do we add them to
-	 * the copy list as there is no data to be shared by multiple
+	 * the copy table as there is no data to be shared by multiple
 	 * pointers.
 	 */
 
-	xcp = &c->copy;
-	while (*xcp && !zero_sized) {
-		cp = (struct copy*) *xcp;
-		if (fend <= cp->fbegin) {
-			xcp = &cp->hdr.link[0];
-		} else if (cp->fend <= fbegin) {
-			xcp = &cp->hdr.link[1];
-		} else if (is_ptr_equal(f, &cp->from)) {
+	if (!zero_sized) {
+		switch (find_copy(c, f, fbegin, fend, &cp)) {
+		case 1:
 			/* we already have a copy so just point to that */
 			return write_ptr(seg, data, cp->to);
-		} else {
-			/* pointer to overlapped data */
+		case -1:
+			/* pointer to overlapped data, or can't allocate a
+			 * copy structure */
 			return -1;
 		}
 	}
@@ -707,41 +1020,16 @@ static int copy_ptr(struct capn_segment *seg, char *data, struct capn_ptr *t, st
 	if (write_ptr(seg, data, *t))
 		return -1;
 
-	/* add the copy to the copy tree so we can look for overlapping
-	 * source pointers and handle recursive structures */
-	if (!zero_sized) {
-		struct copy *n;
-		struct capn_segment *cs = c->copylist;
-
-		/* need to allocate a struct copy */
-		if (!cs || cs->len + (int)sizeof(*n) > cs->cap) {
-			cs = c->create_local ? c->create_local(c->user, sizeof(*n)) : NULL;
-			if (!cs) {
-				/* can't allocate a copy structure */
-				return -1;
-			}
-			cs->next = c->copylist;
-			c->copylist = cs;
-		}
-
-		n = (struct copy*) (cs->data + cs->len);
-		cs->len += sizeof(*n);
-
-		n->from = *f;
-		n->to = *t;
-		n->fbegin = fbegin;
-		n->fend = fend;
-
-		*xcp = &n->hdr;
-		n->hdr.parent = &cp->hdr;
-
-		c->copy = capn_tree_insert(c->copy, &n->hdr);
-	}
+	/* record the copy so that pointers to the same object, including
+	 * recursive structures, point to it */
+	if (!zero_sized && add_copy(c, f, fbegin, t))
+		return -1;
 
 	/* minimize the number of types the main copy routine has to
 	 * deal with to just CAPN_LIST and CAPN_PTR_LIST. ptr list only
 	 * needs t->type, t->len, t->data, t->seg, f->data, f->seg to
-	 * be valid */
+	 * be valid. Objects without any pointers are copied with a
+	 * single memcpy. */
 	switch (t->type) {
 	case CAPN_STRUCT:
 		if (t->datasz) {
@@ -749,7 +1037,7 @@ static int copy_ptr(struct capn_segment *seg, char *data, struct capn_ptr *t, st
 			t->data += t->datasz;
 			f->data += t->datasz;
 		}
-		if (t->ptrs) {
+		if (t->ptrs && !no_ptrs(f->data, 1, 0, t->ptrs)) {
 			t->type = CAPN_PTR_LIST;
 			t->len = t->ptrs;
 			(*dep)++;
@@ -763,10 +1051,12 @@ static int copy_ptr(struct capn_segment *seg, char *data, struct capn_ptr *t, st
 	case CAPN_LIST:
 		if (!t->len) {
 			/* empty list - nothing to copy */
+		} else if (t->ptrs && no_ptrs(f->data + t->datasz, t->len, t->datasz + 8*t->ptrs, t->ptrs)) {
+			memcpy(t->data, f->data, (size_t) t->len * (t->datasz + 8*t->ptrs));
 		} else if (t->ptrs && t->datasz) {
 			(*dep)++;
 		} else if (t->datasz) {
-			memcpy(t->data, f->data, t->len * t->datasz);
+			memcpy(t->data, f->data, (size_t) t->len * t->datasz);
 		} else if (t->ptrs) {
 			t->type = CAPN_PTR_LIST;
 			t->len *= t->ptrs;
@@ -775,7 +1065,7 @@ static int copy_ptr(struct capn_segment *seg, char *data, struct capn_ptr *t, st
 		return 0;
 
 	case CAPN_PTR_LIST:
-		if (t->len) {
+		if (t->len && !no_ptrs(f->data, 1, 0, t->len)) {
 			(*dep)++;
 		}
 		return 0;
@@ -805,16 +1095,23 @@ static void copy_list_member(capn_ptr* t, capn_ptr *f, int *dep) {
 	}
 }
 
+/* The first MAX_COPY_DEPTH levels of the copy stack live on the C stack,
+ * deeper copies move it into copy memory */
 #define MAX_COPY_DEPTH 32
 
 /* TODO: handle CAPN_BIT_LIST and setting from an inner bit list member */
 int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
-	struct capn_ptr to[MAX_COPY_DEPTH], from[MAX_COPY_DEPTH];
+	struct capn_ptr to_buf[MAX_COPY_DEPTH], from_buf[MAX_COPY_DEPTH];
+	struct capn_ptr *to = to_buf, *from = from_buf;
+	struct capn *c;
 	char *data;
-	int err, dep = 0;
+	int err, dep = 0, depth = MAX_COPY_DEPTH;
 
 	capn_resolve(&p);
 
+	if (IMPORTED(p) || (p.seg && p.seg->capn && p.seg->capn->readonly))
+		return -1;
+
 	if (tgt.type == CAPN_FAR_POINTER && tgt.seg->capn == p.seg->capn) {
 		uint64_t val = capn_flip64(*(uint64_t*) tgt.data);
 		if ((val & 3) == FAR_PTR) {
@@ -831,7 +1128,7 @@ int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
 			return -1;
 
 		to[0] = p;
-		to[0].data += off * (p.datasz + 8*p.ptrs);
+		to[0].data += (size_t) off * (p.datasz + 8*p.ptrs);
 		from[0] = tgt;
 		copy_list_member(to, from, &dep);
 		break;
@@ -839,13 +1136,13 @@ int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
 	case CAPN_PTR_LIST:
 		if (off >= p.len)
 			return -1;
-		data = p.data + 8*off;
+		data = p.data + 8*(size_t) off;
 		goto copy_ptr;
 
 	case CAPN_STRUCT:
 		if (off >= p.ptrs)
 			return -1;
-		data = p.data + p.datasz + 8*off;
+		data = p.data + p.datasz + 8*(size_t) off;
 		goto copy_ptr;
 
 	copy_ptr:
@@ -855,29 +1152,38 @@ int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
 
 		/* Depth first copy the source whilst using a pointer stack to
 		 * maintain the ptr to set and size left to copy at each level.
-		 * We also maintain a rbtree (capn->copy) of the copies indexed
-		 * by the source data. This way we can detect overlapped
-		 * pointers in the source (and bail) and recursive structures
-		 * (and point to the previous copy).
+		 * We also maintain a hash table (capn->copy) of the copies
+		 * indexed by the source data. This way we can detect
+		 * overlapped pointers in the source (and bail) and recursive
+		 * structures (and point to the previous copy).
 		 */
 
 		from[0] = tgt;
-		if (copy_ptr(p.seg, data, to, from, &dep))
-			return -1;
+		if (copy_ptr(p.seg, data, to, from, &dep)) {
+			err = -1;
+			goto end;
+		}
 		break;
 
 	default:
 		return -1;
 	}
 
+	err = 0;
+
 	while (dep) {
-		struct capn_ptr *tc = &to[dep-1], *tn = &to[dep];
-		struct capn_ptr *fc = &from[dep-1], *fn = &from[dep];
+		struct capn_ptr *tc, *tn, *fc, *fn;
 
-		if (dep+1 == MAX_COPY_DEPTH) {
-			return -1;
+		if (dep+1 >= depth && grow_stack(p.seg->capn, &to, &from, &depth)) {
+			err = -1;
+			break;
 		}
 
+		tc = &to[dep-1];
+		tn = &to[dep];
+		fc = &from[dep-1];
+		fn = &from[dep];
+
 		if (!tc->len) {
 			dep--;
 			continue;
@@ -896,8 +1202,10 @@ int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
 		} else { /* CAPN_PTR_LIST */
 			*fn = read_ptr(fc->seg, fc->data);
 
-			if (fn->type && copy_ptr(tc->seg, tc->data, tn, fn, &dep))
-				return -1;
+			if (fn->type && copy_ptr(tc->seg, tc->data, tn, fn, &dep)) {
+				err = -1;
+				break;
+			}
 
 			fc->data += 8;
 			tc->data += 8;
@@ -905,119 +1213,1155 @@ int capn_setp(capn_ptr p, int off, capn_ptr tgt) {
 		}
 	}
 
-	return 0;
+end:
+	c = p.seg->capn;
+	if (c && !c->keep_copy)
+		clear_copy(c);
+	return err;
 }
 
-/* TODO: handle CAPN_LIST, CAPN_PTR_LIST for bit lists */
+/* capn_compact copies the reachable part of a message in two passes over a
+ * queue of pointers still to be copied. The first pass only adds up the
+ * size of every object so that the second can copy everything into one
+ * segment. Both passes use the copy table of dst to copy objects that are
+ * referenced more than once (or recursively) only once.
+ */
+struct compact_item {
+	struct capn_segment *seg;
+	char *slot;
+	capn_ptr from;
+};
 
-int capn_get1(capn_list1 l, int off) {
-	return l.p.type == CAPN_BIT_LIST
-		&& off < l.p.len
-		&& (l.p.data[off/8] & (1 << (off%8))) != 0;
-}
+struct compact {
+	struct capn *c;
+	struct capn_segment *seg;
+	struct compact_item *q;
+	int head, tail, cap;
+	int order;
+	size_t size;
+};
 
-int capn_set1(capn_list1 l, int off, int val) {
-	if (l.p.type != CAPN_BIT_LIST || off >= l.p.len)
-		return -1;
-	if (val) {
-		l.p.data[off/8] |= 1 << (off%8);
-	} else {
-		l.p.data[off/8] &= ~(1 << (off%8));
-	}
-	return 0;
-}
+static int compact_push(struct compact *k, struct capn_segment *seg, char *slot, capn_ptr from) {
+	struct compact_item *it;
 
-int capn_getv1(capn_list1 l, int off, uint8_t *data, int sz) {
-	/* Note we only support aligned reads */
-	int bsz;
-	capn_ptr p;
-	capn_resolve(&l.p);
-	p = l.p;
-	if (p.type != CAPN_BIT_LIST || (off & 7) != 0)
-		return -1;
+	if (from.type == CAPN_NULL)
+		return 0;
 
-	bsz = (sz + 7) / 8;
-	off /= 8;
+	if (k->tail == k->cap) {
+		int cap = k->cap ? 2 * k->cap : 256;
+		struct compact_item *q;
 
-	if (off + sz > p.datasz) {
-		memcpy(data, p.data + off, p.datasz - off);
-		return p.len - off*8;
-	} else {
-		memcpy(data, p.data + off, bsz);
-		return sz;
+		if (cap > INT_MAX / 2 / (int) sizeof(*q))
+			return -1;
+
+		q = (struct compact_item*) copy_alloc(k->c, cap * sizeof(*q));
+		if (!q)
+			return -1;
+
+		if (k->q)
+			memcpy(q, k->q + k->head, (k->tail - k->head) * sizeof(*q));
+		k->tail -= k->head;
+		k->head = 0;
+		k->q = q;
+		k->cap = cap;
 	}
-}
 
-int capn_setv1(capn_list1 l, int off, const uint8_t *data, int sz) {
-	/* Note we only support aligned writes */
-	int bsz;
-	capn_ptr p = l.p;
-	if (p.type != CAPN_BIT_LIST || (off & 7) != 0)
-		return -1;
+	it = &k->q[k->tail++];
+	it->seg = seg;
+	it->slot = slot;
+	it->from = from;
+	return 0;
+}
 
-	bsz = (sz + 7) / 8;
-	off /= 8;
+static int compact_pop(struct compact *k, struct compact_item *it) {
+	if (k->head == k->tail)
+		return 0;
 
-	if (off + sz > p.datasz) {
-		memcpy(p.data + off, data, p.datasz - off);
-		return p.len - off*8;
+	if (k->order == CAPN_BREADTH_FIRST) {
+		*it = k->q[k->head++];
 	} else {
-		memcpy(p.data + off, data, bsz);
-		return sz;
+		*it = k->q[--k->tail];
 	}
+	return 1;
 }
 
-/* pull out whether we add a tag or not as a define so the unit test can
- * test double far pointers by not creating tags */
-#ifndef ADD_TAG
-#define ADD_TAG 1
-#endif
-
-static void new_object(capn_ptr *p, int bytes) {
-	struct capn_segment *s = p->seg;
-
-	if (!s) {
-		memset(p, 0, sizeof(*p));
-		return;
+static size_t clone_size(capn_ptr p) {
+	switch (p.type) {
+	case CAPN_STRUCT:
+		return p.datasz + 8*p.ptrs;
+	case CAPN_PTR_LIST:
+		return 8*(size_t) p.len;
+	case CAPN_BIT_LIST:
+		return (p.datasz + 7) & ~7;
+	case CAPN_LIST:
+		if (p.ptrs || p.datasz > 8)
+			return 8 + (size_t) p.len * (p.datasz + 8*p.ptrs);
+		return ((size_t) p.len * p.datasz + 7) & ~(size_t) 7;
+	default:
+		return 0;
 	}
+}
 
-	/* pointer needs to be initialised to get a valid offset on write */
-	if (!bytes) {
-		p->data = s->data + s->len;
-		return;
+/* compact_ptrs queues num pointers starting at f, to be written to the
+ * matching pointers at t. Depth first pops from the back of the queue so
+ * the pointers are queued in reverse to copy them in order.
+ */
+static int compact_ptrs(struct compact *k, struct capn_segment *tseg, char *t, capn_ptr f, char *fp, int num) {
+	int i;
+
+	for (i = 0; i < num; i++) {
+		int j = k->order == CAPN_BREADTH_FIRST ? i : num - 1 - i;
+		if (!*(uint64_t*) (fp + 8*j))
+			continue;
+		if (compact_push(k, tseg, t ? t + 8*j : NULL, read_ptr(f.seg, fp + 8*j)))
+			return -1;
 	}
 
-	/* all allocations are 8 byte aligned */
-	bytes = (bytes + 7) & ~7;
+	return 0;
+}
 
-	if (s->len + bytes <= s->cap) {
-		p->data = s->data + s->len;
-		s->len += bytes;
-		return;
+static int compact_one(struct compact *k, struct compact_item *it) {
+	capn_ptr f = it->from, t = {CAPN_NULL};
+	char *fbegin = f.data - 8*f.is_composite_list;
+	char *fend = fbegin + data_size(f);
+	struct copy *cp = NULL;
+	int i;
+
+	if (fend != fbegin) {
+		switch (find_copy(k->c, &f, fbegin, fend, &cp)) {
+		case 1:
+			/* already copied, point to that */
+			return k->seg ? write_ptr(it->seg, it->slot, cp->to) : 0;
+		case -1:
+			/* pointer to overlapped data */
+			return -1;
+		}
 	}
 
-	/* add a tag whenever we switch segments so that write_ptr can
-	 * use it */
-	p->data = new_data(s->capn, bytes + ADD_TAG*8, &p->seg);
-	if (!p->data) {
-		memset(p, 0, sizeof(*p));
-		return;
+	if (k->seg) {
+		t = new_clone(k->seg, f);
+		if (t.type == CAPN_NULL || write_ptr(it->seg, it->slot, t))
+			return -1;
+	} else {
+		k->size += clone_size(f);
 	}
 
-	if (ADD_TAG) {
-		write_ptr_tag(p->data, *p, 0);
-		p->data += 8;
-		p->has_ptr_tag = 1;
-	}
-}
+	if (fend != fbegin && add_copy(k->c, &f, fbegin, &t))
+		return -1;
 
-capn_ptr capn_root(struct capn *c) {
-	capn_ptr r = {CAPN_PTR_LIST};
+	switch (f.type) {
+	case CAPN_STRUCT:
+		if (t.data)
+			memcpy(t.data, f.data, f.datasz);
+		return compact_ptrs(k, t.seg, t.data ? t.data + f.datasz : NULL, f, f.data + f.datasz, f.ptrs);
+
+	case CAPN_PTR_LIST:
+		return compact_ptrs(k, t.seg, t.data, f, f.data, f.len);
+
+	case CAPN_BIT_LIST:
+		if (t.data)
+			memcpy(t.data, f.data, f.datasz);
+		return 0;
+
+	case CAPN_LIST:
+		if (!f.ptrs) {
+			if (t.data)
+				memcpy(t.data, f.data, (size_t) f.len * f.datasz);
+			return 0;
+		}
+
+		for (i = 0; i < f.len; i++) {
+			/* depth first walks the members back to front too */
+			int j = k->order == CAPN_BREADTH_FIRST ? i : f.len - 1 - i;
+			char *fm = f.data + (size_t) j * (f.datasz + 8*f.ptrs);
+			char *tm = t.data ? t.data + (size_t) j * (f.datasz + 8*f.ptrs) : NULL;
+
+			if (tm)
+				memcpy(tm, fm, f.datasz);
+			if (compact_ptrs(k, t.seg, tm ? tm + f.datasz : NULL, f, fm + f.datasz, f.ptrs))
+				return -1;
+		}
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+static int compact_run(struct compact *k, struct capn_segment *seg, char *slot, capn_ptr root) {
+	struct compact_item it;
+
+	k->head = k->tail = k->cap = 0;
+	k->q = NULL;
+
+	if (compact_push(k, seg, slot, root))
+		return -1;
+
+	while (compact_pop(k, &it)) {
+		if (compact_one(k, &it))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int compact_ptr(capn_ptr root, struct capn *dst, enum CAPN_ORDER order) {
+	struct compact k;
+	struct capn_segment *s;
+	int err = -1;
+
+	if (dst->segnum || dst->readonly || !dst->create)
+		return -1;
+
+	memset(&k, 0, sizeof(k));
+	k.c = dst;
+	k.order = order;
+	k.size = 8;
+
+	clear_copy(dst);
+	if (compact_run(&k, NULL, NULL, root))
+		goto end;
+
+	clear_copy(dst);
+	s = dst->create(dst->user, 0, k.size);
+	if (!s)
+		goto end;
+	capn_append_segment(dst, s);
+
+	k.seg = s;
+	err = compact_run(&k, s, capn_root(dst).data, root);
+
+end:
+	clear_copy(dst);
+	return err;
+}
+
+int capn_compact(struct capn *src, struct capn *dst, enum CAPN_ORDER order) {
+	return compact_ptr(capn_getp(capn_root(src), 0, 1), dst, order);
+}
+
+/* capn_canonicalize and capn_hash both walk a message in the canonical
+ * order: each object is followed by its children in pointer order, depth
+ * first. Every object is copied for each reference to it, so recursive
+ * messages are caught by the depth limit and messages whose pointers share
+ * subtrees by the traversal limit.
+ */
+#define MAX_CANON_DEPTH 64
+
+/* canon_trim gives the size of the struct at d without trailing zero data
+ * words and trailing null pointers */
+static void canon_trim(const char *d, int datasz, int ptrs, int *tdatasz, int *tptrs) {
+	const uint64_t *w = (const uint64_t*) d;
+	int n = datasz / 8;
+
+	while (n > 0 && !w[n-1])
+		n--;
+	w = (const uint64_t*) (d + datasz);
+	while (ptrs > 0 && !w[ptrs-1])
+		ptrs--;
+
+	*tdatasz = 8*n;
+	*tptrs = ptrs;
+}
+
+/* canon_shape fills t with the canonical layout of f and returns its size
+ * in bytes or -1 if it can't be represented. Composite lists use the
+ * largest trimmed member. Other lists keep their element size as we can't
+ * tell a list of small structs from a list of primitives.
+ */
+static ssize_t canon_shape(capn_ptr f, capn_ptr *t) {
+	int i, sz, ptrs;
+
+	*t = f;
+	t->is_list_member = 0;
+	t->has_ptr_tag = 0;
+
+	switch (f.type) {
+	case CAPN_STRUCT:
+		canon_trim(f.data, f.datasz, f.ptrs, &sz, &ptrs);
+		t->datasz = sz;
+		t->ptrs = ptrs;
+		return sz + 8*ptrs;
+
+	case CAPN_PTR_LIST:
+		return 8*(ssize_t) f.len;
+
+	case CAPN_BIT_LIST:
+		return (f.datasz + 7) & ~7;
+
+	case CAPN_LIST:
+		if (!f.is_composite_list)
+			return ((ssize_t) f.len * f.datasz + 7) & ~(ssize_t) 7;
+
+		t->datasz = t->ptrs = 0;
+		for (i = 0; i < f.len; i++) {
+			canon_trim(f.data + (size_t) i * (f.datasz + 8*f.ptrs), f.datasz, f.ptrs, &sz, &ptrs);
+			t->datasz = sz > t->datasz ? sz : t->datasz;
+			t->ptrs = ptrs > t->ptrs ? ptrs : t->ptrs;
+		}
+		return 8 + (ssize_t) f.len * (t->datasz + 8*t->ptrs);
+
+	default:
+		return -1;
+	}
+}
+
+/* canon_tag returns the pointer to t with the offset set to -1, which is
+ * what a canonical zero sized struct uses */
+static uint64_t canon_tag(capn_ptr t) {
+	uint64_t val;
+	write_ptr_tag((char*) &val, t, -8);
+	return capn_flip64(val);
+}
+
+struct canon {
+	char *data;
+	size_t len;
+	int64_t budget;
+};
+
+static int canon_obj(struct canon *k, char *slot, capn_ptr f, int depth);
+
+static int canon_ptr(struct canon *k, char *slot, struct capn_segment *s, char *fp, int depth) {
+	capn_ptr f;
+
+	if (!*(uint64_t*) fp)
+		return 0;
+
+	f = read_ptr(s, fp);
+	if (f.type == CAPN_NULL)
+		return -1;
+
+	return canon_obj(k, slot, f, depth);
+}
+
+/* canon_obj lays out f at the end of the canonical message and points slot
+ * at it. While measuring (k->data is NULL) only the length is added up.
+ */
+static int canon_obj(struct canon *k, char *slot, capn_ptr f, int depth) {
+	capn_ptr t;
+	char *d = NULL;
+	ssize_t sz;
+	size_t stride, tstride;
+	int i, j;
+
+	sz = canon_shape(f, &t);
+	if (sz < 0 || depth > MAX_CANON_DEPTH || traverse(&k->budget, f))
+		return -1;
+
+	if (k->data) {
+		d = k->data + k->len;
+		/* zero sized structs point just before the pointer */
+		write_ptr_tag(slot, t, t.type == CAPN_STRUCT && !sz ? -8 : d - slot - 8);
+	}
+	k->len += sz;
+
+	switch (f.type) {
+	case CAPN_STRUCT:
+		if (d)
+			memcpy(d, f.data, t.datasz);
+		for (j = 0; j < t.ptrs; j++) {
+			if (canon_ptr(k, d ? d + t.datasz + 8*j : NULL, f.seg, f.data + f.datasz + 8*j, depth+1))
+				return -1;
+		}
+		return 0;
+
+	case CAPN_PTR_LIST:
+		for (j = 0; j < f.len; j++) {
+			if (canon_ptr(k, d ? d + 8*j : NULL, f.seg, f.data + 8*j, depth+1))
+				return -1;
+		}
+		return 0;
+
+	case CAPN_BIT_LIST:
+		if (d) {
+			memcpy(d, f.data, f.datasz);
+			if (f.len & 7)
+				d[f.len / 8] &= (1 << (f.len & 7)) - 1;
+		}
+		return 0;
+
+	case CAPN_LIST:
+		if (!f.is_composite_list) {
+			if (d)
+				memcpy(d, f.data, (size_t) f.len * f.datasz);
+			return 0;
+		}
+
+		stride = f.datasz + 8*f.ptrs;
+		tstride = t.datasz + 8*t.ptrs;
+		if (d) {
+			*(uint64_t*) d = capn_flip64(STRUCT_PTR | (U64(f.len) << 2) | (U64(t.datasz/8) << 32) | (U64(t.ptrs) << 48));
+			d += 8;
+			for (i = 0; i < f.len; i++) {
+				memcpy(d + i*tstride, f.data + i*stride, t.datasz);
+			}
+		}
+		for (i = 0; i < f.len; i++) {
+			for (j = 0; j < t.ptrs; j++) {
+				char *tp = d ? d + i*tstride + t.datasz + 8*j : NULL;
+				if (canon_ptr(k, tp, f.seg, f.data + i*stride + f.datasz + 8*j, depth+1))
+					return -1;
+			}
+		}
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+int capn_canonicalize(capn_ptr p, struct capn *dst) {
+	struct canon k;
+	struct capn_segment *s;
+
+	if (dst->segnum || dst->readonly || !dst->create)
+		return -1;
+
+	capn_resolve(&p);
+	memset(&k, 0, sizeof(k));
+	k.len = 8;
+	k.budget = traverse_limit(p.seg);
+	if (p.type != CAPN_NULL && canon_obj(&k, NULL, p, 0))
+		return -1;
+
+	s = dst->create(dst->user, 0, k.len);
+	if (!s || s->cap < k.len)
+		return -1;
+	capn_append_segment(dst, s);
+	memset(s->data, 0, k.len);
+
+	k.data = s->data;
+	k.len = 8;
+	k.budget = traverse_limit(p.seg);
+	s->len = 8;
+	if (p.type != CAPN_NULL && canon_obj(&k, s->data, p, 0))
+		return -1;
+
+	s->len = k.len;
+	return 0;
+}
+
+/* The hash is fed the canonical form one word at a time, except that each
+ * object is fed in place of the pointer to it, with the pointer offset
+ * left out. This identifies the canonical form just as well and doesn't
+ * need the size of every subtree up front. Words are mixed into two lanes
+ * in the style of MurmurHash3 x64_128.
+ */
+struct hash {
+	uint64_t h1, h2;
+	uint64_t words;
+	int64_t budget;
+};
+
+static uint64_t rotl64(uint64_t v, int r) {
+	return (v << r) | (v >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+static void hash_word(struct hash *h, uint64_t w) {
+	const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+
+	h->h1 ^= rotl64(w * c1, 31) * c2;
+	h->h1 = (rotl64(h->h1, 27) + h->h2) * 5 + 0x52dce729;
+	h->h2 ^= rotl64(w * c2, 33) * c1;
+	h->h2 = (rotl64(h->h2, 31) + h->h1) * 5 + 0x38495ab5;
+	h->words++;
+}
+
+/* hash_bytes feeds sz bytes at d as little endian words, zero padding the
+ * last one */
+static void hash_bytes(struct hash *h, const char *d, size_t sz) {
+	uint64_t w;
+
+	for (; sz >= 8; d += 8, sz -= 8) {
+		hash_word(h, capn_flip64(*(const uint64_t*) d));
+	}
+	if (sz > 0) {
+		w = 0;
+		memcpy(&w, d, sz);
+		hash_word(h, capn_flip64(w));
+	}
+}
+
+static int hash_obj(struct hash *h, capn_ptr f, int depth);
+
+static int hash_ptr(struct hash *h, struct capn_segment *s, char *fp, int depth) {
+	capn_ptr f;
+
+	if (!*(uint64_t*) fp) {
+		hash_word(h, 0);
+		return 0;
+	}
+
+	f = read_ptr(s, fp);
+	if (f.type == CAPN_NULL)
+		return -1;
+
+	return hash_obj(h, f, depth);
+}
+
+static int hash_obj(struct hash *h, capn_ptr f, int depth) {
+	capn_ptr t;
+	size_t stride;
+	int i, j, n;
+
+	if (canon_shape(f, &t) < 0 || depth > MAX_CANON_DEPTH || traverse(&h->budget, f))
+		return -1;
+
+	hash_word(h, canon_tag(t));
+
+	switch (f.type) {
+	case CAPN_STRUCT:
+		hash_bytes(h, f.data, t.datasz);
+		for (j = 0; j < t.ptrs; j++) {
+			if (hash_ptr(h, f.seg, f.data + f.datasz + 8*j, depth+1))
+				return -1;
+		}
+		return 0;
+
+	case CAPN_PTR_LIST:
+		for (j = 0; j < f.len; j++) {
+			if (hash_ptr(h, f.seg, f.data + 8*j, depth+1))
+				return -1;
+		}
+		return 0;
+
+	case CAPN_BIT_LIST:
+		/* the padding bits of the last byte are masked out */
+		n = f.datasz ? (f.datasz - 1) & ~7 : 0;
+		hash_bytes(h, f.data, n);
+		if (n < f.datasz) {
+			uint64_t w = 0;
+			memcpy(&w, f.data + n, f.datasz - n);
+			if (f.len & 7)
+				((uint8_t*) &w)[f.datasz - 1 - n] &= (1 << (f.len & 7)) - 1;
+			hash_word(h, capn_flip64(w));
+		}
+		return 0;
+
+	case CAPN_LIST:
+		if (!f.is_composite_list) {
+			hash_bytes(h, f.data, (size_t) f.len * f.datasz);
+			return 0;
+		}
+
+		hash_word(h, STRUCT_PTR | (U64(f.len) << 2) | (U64(t.datasz/8) << 32) | (U64(t.ptrs) << 48));
+		stride = f.datasz + 8*f.ptrs;
+		for (i = 0; i < f.len; i++) {
+			hash_bytes(h, f.data + i*stride, t.datasz);
+		}
+		for (i = 0; i < f.len; i++) {
+			for (j = 0; j < t.ptrs; j++) {
+				if (hash_ptr(h, f.seg, f.data + i*stride + f.datasz + 8*j, depth+1))
+					return -1;
+			}
+		}
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+int capn_hash(capn_ptr p, uint64_t seed, uint64_t hash[2]) {
+	struct hash h;
+
+	h.h1 = h.h2 = seed;
+	h.words = 0;
+
+	capn_resolve(&p);
+	h.budget = traverse_limit(p.seg);
+	if (p.type == CAPN_NULL) {
+		hash_word(&h, 0);
+	} else if (hash_obj(&h, p, 0)) {
+		return -1;
+	}
+
+	h.h1 ^= h.words;
+	h.h2 ^= h.words;
+	h.h1 += h.h2;
+	h.h2 += h.h1;
+	h.h1 = fmix64(h.h1);
+	h.h2 = fmix64(h.h2);
+	h.h1 += h.h2;
+	h.h2 += h.h1;
+
+	hash[0] = h.h1;
+	hash[1] = h.h2;
+	return 0;
+}
+
+#define MAX_LOCAL_DEPTH 64
+
+static int is_local(capn_ptr p, int depth, int64_t *budget) {
+	char *d;
+	int i, j, num, stride, ptrs;
+
+	if (traverse(budget, p))
+		return 0;
+
+	switch (p.type) {
+	case CAPN_STRUCT:
+		d = p.data + p.datasz;
+		num = 1;
+		stride = 0;
+		ptrs = p.ptrs;
+		break;
+	case CAPN_PTR_LIST:
+		d = p.data;
+		num = 1;
+		stride = 0;
+		ptrs = p.len;
+		break;
+	case CAPN_LIST:
+		d = p.data + p.datasz;
+		num = p.len;
+		stride = p.datasz + 8*p.ptrs;
+		ptrs = p.ptrs;
+		break;
+	default:
+		return 1;
+	}
+
+	for (i = 0; i < num; i++, d += stride) {
+		for (j = 0; j < ptrs; j++) {
+			char *w = d + 8*j;
+			uint64_t val = capn_flip64(*(uint64_t*) w);
+			capn_ptr c;
+
+			if (!val)
+				continue;
+			if ((val & 3) == FAR_PTR || (val & 3) == 3 || depth >= MAX_LOCAL_DEPTH)
+				return 0;
+
+			c = read_ptr(p.seg, w);
+			if (c.type == CAPN_NULL || !is_local(c, depth+1, budget))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+int capn_is_local(capn_ptr p) {
+	int64_t budget;
+	capn_resolve(&p);
+	budget = traverse_limit(p.seg);
+	return p.seg != NULL && is_local(p, 0, &budget);
+}
+
+/* capn_extract records the byte range of every object in the subtree,
+ * once per object however often it is referenced. If they all sit in the
+ * root's segment and only leave small holes between them, the bytes from
+ * the first to the last are framed as they are with the holes zeroed.
+ * Otherwise the subtree is compacted into tmp.
+ */
+#define EXTRACT_ZEROS 4096
+
+static const char extract_zeros[EXTRACT_ZEROS] = {0};
+
+struct extract_range {
+	char *begin, *end;
+};
+
+struct extract {
+	struct capn *tmp;
+	struct capn_segment *seg;
+	struct extract_range *r;
+	int num, cap;
+};
+
+static int extract_walk(struct extract *x, capn_ptr p, int depth) {
+	char *d, *begin = p.data - 8*p.is_composite_list;
+	char *end = begin + data_size(p);
+	struct copy *cp;
+	int i, j, num, stride, ptrs;
+
+	if (depth > MAX_LOCAL_DEPTH || p.seg != x->seg)
+		return -1;
+
+	if (end != begin) {
+		/* objects referenced several times are recorded and walked
+		 * once, and overlapping ones are left to capn_compact */
+		switch (find_copy(x->tmp, &p, begin, end, &cp)) {
+		case 1:
+			return 0;
+		case -1:
+			return -1;
+		}
+		if (add_copy(x->tmp, &p, begin, &p))
+			return -1;
+
+		if (x->num == x->cap) {
+			int cap = x->cap ? 2 * x->cap : 64;
+			struct extract_range *r;
+
+			if (cap > INT_MAX / 2 / (int) sizeof(*r))
+				return -1;
+			r = (struct extract_range*) copy_alloc(x->tmp, cap * sizeof(*r));
+			if (!r)
+				return -1;
+			if (x->r)
+				memcpy(r, x->r, x->num * sizeof(*r));
+			x->r = r;
+			x->cap = cap;
+		}
+
+		/* ranges cover whole words, except at the end of an external
+		 * blob which is not readable past its length */
+		x->r[x->num].begin = begin;
+		x->r[x->num].end = begin + ((end - begin + 7) & ~(size_t) 7);
+		if (x->r[x->num].end > x->seg->data + x->seg->len)
+			x->r[x->num].end = x->seg->data + x->seg->len;
+		x->num++;
+	}
+
+	switch (p.type) {
+	case CAPN_STRUCT:
+		d = p.data + p.datasz;
+		num = 1;
+		stride = 0;
+		ptrs = p.ptrs;
+		break;
+	case CAPN_PTR_LIST:
+		d = p.data;
+		num = 1;
+		stride = 0;
+		ptrs = p.len;
+		break;
+	case CAPN_LIST:
+		d = p.data + p.datasz;
+		num = p.len;
+		stride = p.datasz + 8*p.ptrs;
+		ptrs = p.ptrs;
+		break;
+	default:
+		return 0;
+	}
+
+	for (i = 0; i < num; i++, d += stride) {
+		for (j = 0; j < ptrs; j++) {
+			char *w = d + 8*j;
+			uint64_t val = capn_flip64(*(uint64_t*) w);
+			capn_ptr c;
+
+			if (!val)
+				continue;
+			if ((val & 3) == FAR_PTR || (val & 3) == 3)
+				return -1;
+
+			c = read_ptr(p.seg, w);
+			if (c.type == CAPN_NULL || extract_walk(x, c, depth+1))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_range(const void *a, const void *b) {
+	const struct extract_range *ra = (const struct extract_range*) a;
+	const struct extract_range *rb = (const struct extract_range*) b;
+	return (ra->begin > rb->begin) - (ra->begin < rb->begin);
+}
+
+static void set_iovec(struct iovec *v, const void *p, size_t sz) {
+	v->iov_base = (void*) p;
+	v->iov_len = sz;
+}
+
+/* extract_frame fills out with the ranges in x as one segment behind hdr,
+ * which holds the segment table and the root pointer. Returns the number of
+ * iovecs or -1 if the holes are larger than the data or out is too short.
+ */
+static int extract_frame(struct extract *x, capn_ptr root, uint32_t *hdr, struct iovec *out, int num) {
+	char *rbegin = root.data - 8*root.is_composite_list;
+	char *begin = x->num ? x->r[0].begin : rbegin, *end = begin;
+	size_t data = 0, holes = 0, words;
+	int i, n = 1, last = 0;
+
+	for (i = 0; i < x->num; i++) {
+		struct extract_range *r = &x->r[i];
+
+		if (r->begin > end) {
+			size_t hole = r->begin - end;
+			holes += hole;
+
+			while (hole) {
+				size_t sz = hole < EXTRACT_ZEROS ? hole : EXTRACT_ZEROS;
+				if (n == num)
+					return -1;
+				set_iovec(&out[n++], extract_zeros, sz);
+				hole -= sz;
+			}
+			last = 0;
+			end = r->begin;
+		}
+
+		if (r->end > end) {
+			/* extend the last iovec if it ends where we start */
+			if (last) {
+				out[n-1].iov_len += r->end - end;
+			} else if (n == num) {
+				return -1;
+			} else {
+				set_iovec(&out[n++], end, r->end - end);
+				last = 1;
+			}
+			data += r->end - end;
+			end = r->end;
+		}
+	}
+
+	/* zero pad a range that ends part way through a word */
+	if ((end - begin) & 7) {
+		if (n == num)
+			return -1;
+		set_iovec(&out[n++], extract_zeros, 8 - ((end - begin) & 7));
+	}
+
+	words = (end - begin + 7) / 8;
+	if (holes > data || words + 1 > UINT32_MAX)
+		return -1;
+
+	hdr[0] = capn_flip32(0);
+	hdr[1] = capn_flip32((uint32_t) (words + 1));
+	write_ptr_tag((char*) (hdr + 2), root, rbegin - begin);
+	set_iovec(&out[0], hdr, 16);
+	return n;
+}
+
+int capn_extract(capn_ptr root, struct capn *tmp, struct iovec *out, int num) {
+	struct extract x;
+	uint32_t *hdr;
+	int n = -1;
+
+	if (num < 2 || tmp->segnum || tmp->readonly)
+		return -1;
+
+	/* the copy memory of an earlier call is reused */
+	clear_copy(tmp);
+
+	capn_resolve(&root);
+	if (root.type == CAPN_NULL || (root.type == CAPN_STRUCT && !root.datasz && !root.ptrs))
+		goto copy;
+
+	memset(&x, 0, sizeof(x));
+	x.tmp = tmp;
+	x.seg = root.seg;
+	if (!root.seg || extract_walk(&x, root, 0))
+		goto copy;
+
+	if (x.num)
+		qsort(x.r, x.num, sizeof(*x.r), &cmp_range);
+
+	hdr = (uint32_t*) copy_alloc(tmp, 16);
+	if (!hdr)
+		goto end;
+	n = extract_frame(&x, root, hdr, out, num);
+	if (n > 0)
+		goto end;
+
+copy:
+	n = -1;
+	if (compact_ptr(root, tmp, CAPN_DEPTH_FIRST))
+		goto end;
+
+	hdr = (uint32_t*) copy_alloc(tmp, 8);
+	if (!hdr)
+		goto end;
+	hdr[0] = capn_flip32(0);
+	hdr[1] = capn_flip32(tmp->seglist->len / 8);
+	set_iovec(&out[0], hdr, 8);
+	set_iovec(&out[1], tmp->seglist->data, tmp->seglist->len);
+	n = 2;
+
+end:
+	/* the header stays in place until tmp is used again */
+	clear_copy(tmp);
+	return n;
+}
+
+/* TODO: handle CAPN_LIST, CAPN_PTR_LIST for bit lists */
+
+int capn_get1(capn_list1 l, int off) {
+	return l.p.type == CAPN_BIT_LIST
+		&& off < l.p.len
+		&& (l.p.data[off/8] & (1 << (off%8))) != 0;
+}
+
+int capn_set1(capn_list1 l, int off, int val) {
+	if (l.p.type != CAPN_BIT_LIST || off >= l.p.len || IMPORTED(l.p))
+		return -1;
+	if (val) {
+		l.p.data[off/8] |= 1 << (off%8);
+	} else {
+		l.p.data[off/8] &= ~(1 << (off%8));
+	}
+	return 0;
+}
+
+/* Bit lists are read and written 64 bits at a time. load_bits and
+ * store_bits move n <= 64 bits starting at any bit of d, touching only the
+ * bytes that hold them, as these can be the last bytes of a segment.
+ */
+static int popcount64(uint64_t v) {
+#ifdef __GNUC__
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & UINT64_C(0x5555555555555555));
+	v = (v & UINT64_C(0x3333333333333333)) + ((v >> 2) & UINT64_C(0x3333333333333333));
+	v = (v + (v >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	return (int) ((v * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+static int ctz64(uint64_t v) {
+#ifdef __GNUC__
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+	while (!(v & 1)) {
+		v >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static uint64_t bit_mask(int n) {
+	return n >= 64 ? ~UINT64_C(0) : (UINT64_C(1) << n) - 1;
+}
+
+static uint64_t load_bits(const char *d, size_t bit, int n) {
+	uint8_t buf[16] = {0};
+	uint64_t lo;
+	int sh = (int) (bit & 7);
+
+	memcpy(buf, d + bit/8, (sh + n + 7) / 8);
+	memcpy(&lo, buf, 8);
+	lo = capn_flip64(lo) >> sh;
+	if (sh)
+		lo |= U64(buf[8]) << (64 - sh);
+	return lo & bit_mask(n);
+}
+
+static void store_bits(char *d, size_t bit, uint64_t v, int n) {
+	uint8_t buf[16] = {0};
+	uint64_t lo, m = bit_mask(n);
+	int sh = (int) (bit & 7), nbytes = (sh + n + 7) / 8;
+
+	memcpy(buf, d + bit/8, nbytes);
+	memcpy(&lo, buf, 8);
+	lo = capn_flip64(lo);
+	lo = (lo & ~(m << sh)) | ((v & m) << sh);
+	if (sh) {
+		uint8_t mhi = (uint8_t) (m >> (64 - sh));
+		buf[8] = (buf[8] & ~mhi) | ((uint8_t) (v >> (64 - sh)) & mhi);
+	}
+	lo = capn_flip64(lo);
+	memcpy(buf, &lo, 8);
+	memcpy(d + bit/8, buf, nbytes);
+}
+
+/* bit_range clamps [off, off+sz) to the list, returning the number of bits
+ * in it or -1 if off is out of range */
+static int bit_range(capn_list1 *l, int off, int sz) {
+	capn_resolve(&l->p);
+	if (l->p.type != CAPN_BIT_LIST || off < 0 || sz < 0 || off > l->p.len)
+		return -1;
+	return sz > l->p.len - off ? l->p.len - off : sz;
+}
+
+int capn_getv1(capn_list1 l, int off, uint8_t *data, int sz) {
+	int i;
+
+	sz = bit_range(&l, off, sz);
+	for (i = 0; i < sz; i += 64) {
+		int n = min(64, sz - i);
+		uint64_t v = capn_flip64(load_bits(l.p.data, (size_t) off + i, n));
+		memcpy(data + i/8, &v, (n + 7) / 8);
+	}
+
+	return sz;
+}
+
+int capn_setv1(capn_list1 l, int off, const uint8_t *data, int sz) {
+	int i;
+
+	if (IMPORTED(l.p))
+		return -1;
+	sz = bit_range(&l, off, sz);
+	for (i = 0; i < sz; i += 64) {
+		int n = min(64, sz - i);
+		uint64_t v = 0;
+		memcpy(&v, data + i/8, (n + 7) / 8);
+		store_bits(l.p.data, (size_t) off + i, capn_flip64(v), n);
+	}
+
+	return sz;
+}
+
+int capn_popcount1(capn_list1 l, int off, int sz) {
+	int i, num = 0;
+
+	sz = bit_range(&l, off, sz);
+	if (sz < 0)
+		return -1;
+
+	for (i = 0; i < sz; i += 64) {
+		num += popcount64(load_bits(l.p.data, (size_t) off + i, min(64, sz - i)));
+	}
+
+	return num;
+}
+
+int capn_find1(capn_list1 l, int off, int val) {
+	int i, sz = bit_range(&l, off, INT_MAX);
+
+	for (i = 0; i < sz; i += 64) {
+		int n = min(64, sz - i);
+		uint64_t v = load_bits(l.p.data, (size_t) off + i, n);
+		if (!val)
+			v = ~v & bit_mask(n);
+		if (v)
+			return off + i + ctz64(v);
+	}
+
+	return -1;
+}
+
+/* AND, OR and XOR work on whole bytes without reordering bits, so they
+ * don't need to flip the words. The bits changed are counted with a
+ * popcount of the old and new words xored together.
+ */
+enum bit_op {
+	BIT_AND,
+	BIT_OR,
+	BIT_XOR
+};
+
+static int bit_op(capn_list1 dst, capn_list1 src, enum bit_op op) {
+	size_t i, words, bytes;
+	int sz, changed = 0;
+	uint8_t m;
+
+	capn_resolve(&src.p);
+	if (src.p.type != CAPN_BIT_LIST || IMPORTED(dst.p))
+		return -1;
+	sz = bit_range(&dst, 0, src.p.len);
+	if (sz < 0)
+		return -1;
+
+	words = (size_t) sz / 64;
+	for (i = 0; i < words; i++) {
+		uint64_t a, b;
+		memcpy(&a, dst.p.data + 8*i, 8);
+		memcpy(&b, src.p.data + 8*i, 8);
+		b = op == BIT_AND ? a & b : op == BIT_OR ? a | b : a ^ b;
+		changed += popcount64(a ^ b);
+		memcpy(dst.p.data + 8*i, &b, 8);
+	}
+
+	/* the last partial word, leaving dst bits past sz alone */
+	bytes = ((size_t) sz + 7) / 8;
+	for (i = 8*words; i < bytes; i++) {
+		uint8_t a = (uint8_t) dst.p.data[i], b = (uint8_t) src.p.data[i];
+		m = i == bytes - 1 && (sz & 7) ? (uint8_t) ((1 << (sz & 7)) - 1) : 0xFF;
+		b = op == BIT_AND ? a & b : op == BIT_OR ? a | b : a ^ b;
+		changed += popcount64((uint8_t) ((a ^ b) & m));
+		dst.p.data[i] = (char) ((a & ~m) | (b & m));
+	}
+
+	return changed;
+}
+
+int capn_and1(capn_list1 dst, capn_list1 src) {
+	return bit_op(dst, src, BIT_AND);
+}
+
+int capn_or1(capn_list1 dst, capn_list1 src) {
+	return bit_op(dst, src, BIT_OR);
+}
+
+int capn_xor1(capn_list1 dst, capn_list1 src) {
+	return bit_op(dst, src, BIT_XOR);
+}
+
+/* pull out whether we add a tag or not as a define so the unit test can
+ * test double far pointers by not creating tags */
+#ifndef ADD_TAG
+#define ADD_TAG 1
+#endif
+
+static void new_object(capn_ptr *p, size_t bytes) {
+	struct capn_segment *s = p->seg;
+
+	if (!s || (s->capn && s->capn->readonly)) {
+		memset(p, 0, sizeof(*p));
+		return;
+	}
+
+	/* pointer needs to be initialised to get a valid offset on write */
+	if (!bytes) {
+		p->data = s->data + s->len;
+		return;
+	}
+
+	/* all allocations are 8 byte aligned */
+	bytes = (bytes + 7) & ~(size_t) 7;
+
+	if (s->len + bytes <= s->cap) {
+		p->data = s->data + s->len;
+		s->len += bytes;
+		return;
+	}
+
+	/* add a tag whenever we switch segments so that write_ptr can
+	 * use it */
+	p->data = new_data(s->capn, bytes + ADD_TAG*8, &p->seg);
+	if (!p->data) {
+		memset(p, 0, sizeof(*p));
+		return;
+	}
+
+	if (ADD_TAG) {
+		write_ptr_tag(p->data, *p, 0);
+		p->data += 8;
+		p->has_ptr_tag = 1;
+	}
+}
+
+int capn_reserve(struct capn *c, size_t sz) {
+	struct capn_segment *s;
+
+	if (c->seglist || c->readonly || !c->create)
+		return -1;
+
+	s = c->create(c->user, c->segnum, sz);
+	if (!s)
+		return -1;
+
+	capn_append_segment(c, s);
+	return 0;
+}
+
+capn_ptr capn_root(struct capn *c) {
+	capn_ptr r = {CAPN_PTR_LIST};
 	r.seg = lookup_segment(c, NULL, 0);
 	r.data = r.seg ? r.seg->data : new_data(c, 8, &r.seg);
 	r.len = 1;
 
-	if (!r.seg || r.seg->cap < 8) {
+	if (!r.seg || r.seg->cap < 8 || (c->readonly && r.seg->len < 8)) {
 		memset(&r, 0, sizeof(r));
 	} else if (r.seg->len < 8) {
 		r.seg->len = 8;
@@ -1044,7 +2388,7 @@ capn_ptr capn_new_list(struct capn_segment *seg, int sz, int datasz, int ptrs) {
 		p.is_composite_list = 1;
 		p.datasz = (datasz + 7) & ~7;
 		p.ptrs = ptrs;
-		new_object(&p, p.len * (p.datasz + 8*p.ptrs) + 8);
+		new_object(&p, (size_t) p.len * (p.datasz + 8*p.ptrs) + 8);
 		if (p.data) {
 			uint64_t hdr = STRUCT_PTR | (U64(p.len) << 2) | (U64(p.datasz/8) << 32) | (U64(ptrs) << 48);
 			*(uint64_t*) p.data = capn_flip64(hdr);
@@ -1052,13 +2396,13 @@ capn_ptr capn_new_list(struct capn_segment *seg, int sz, int datasz, int ptrs) {
 		}
 	} else if (datasz > 4) {
 		p.datasz = 8;
-		new_object(&p, p.len * 8);
+		new_object(&p, (size_t) p.len * 8);
 	} else if (datasz > 2) {
 		p.datasz = 4;
-		new_object(&p, p.len * 4);
+		new_object(&p, (size_t) p.len * 4);
 	} else {
 		p.datasz = datasz;
-		new_object(&p, p.len * datasz);
+		new_object(&p, (size_t) p.len * datasz);
 	}
 
 	return p;
@@ -1079,7 +2423,7 @@ capn_ptr capn_new_ptr_list(struct capn_segment *seg, int sz) {
 	p.len = sz;
 	p.ptrs = 0;
 	p.datasz = 0;
-	new_object(&p, sz*8);
+	new_object(&p, (size_t) sz*8);
 	return p;
 }
 
@@ -1130,6 +2474,33 @@ capn_data capn_get_data(capn_ptr p, int off) {
 	return ret;
 }
 
+int capn_getcol1(capn_ptr p, int bit, int off, uint8_t *to, int sz) {
+	int i;
+	char *d;
+	size_t stride;
+	capn_resolve(&p);
+	if (p.type != CAPN_LIST || off < 0 || sz < 0 || bit < 0 || off > p.len)
+		return -1;
+	if (off + sz > p.len)
+		sz = p.len - off;
+
+	if (bit/8 >= p.datasz) {
+		memset(to, 0, sz);
+		return sz;
+	}
+
+	stride = p.datasz + 8*p.ptrs;
+	d = p.data + (size_t) off * stride + bit/8;
+	for (i = 0; i < sz; i++) {
+		to[i] = (d[(size_t) i * stride] >> (bit%8)) & 1;
+	}
+	return sz;
+}
+
+/* number of pointer list elements whose structs are prefetched ahead of
+ * the one being read */
+#define PTR_PREFETCH 8
+
 #define SZ 8
 #include "capn-list.inc"
 #undef SZ
@@ -33,6 +33,17 @@ typedef SSIZE_T ssize_t;
 #include <stddef.h>
 #endif
 
+/* struct iovec is POSIX too, Windows has no equivalent with the same
+ * layout so we define it */
+#ifdef _MSC_VER
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
 /* Cross-platform macro ALIGNED_(x) aligns a struct or a field
  * by `x` bytes. When applied to a struct, it applies to the
  * aggregate but not the individual members of the struct. So
@@ -57,7 +68,9 @@ extern "C" {
 #define CAPN_INLINE static
 #endif
 
-#define CAPN_VERSION 1
+/* CAPN_VERSION 2 passes segment sizes as size_t to create and create_local
+ * so that segments can be larger than 2 GiB. */
+#define CAPN_VERSION 2
 
 /* struct capn is a common structure shared between segments in the same
  * session/context so that far pointers between segments will be created.
@@ -67,8 +80,8 @@ extern "C" {
  * create is used to create or lookup an alternate segment that has at least
  * sz available (ie returned seg->len + sz <= seg->cap)
  *
- * create_local is used to create a segment for the copy tree and should be
- * allocated in the local memory space.
+ * create_local is used to create a segment for the copy state of capn_setp
+ * and should be allocated in the local memory space.
  *
  * Allocated segments must be zero initialized.
  *
@@ -78,25 +91,41 @@ extern "C" {
  * seglist and copylist are linked lists which can be used to free up segments
  * on cleanup, but should not be modified by the user.
  *
- * lookup, create, create_local, and user can be set by the user. Other values
- * should be zero initialized.
+ * keep_copy keeps the copy state between calls to capn_setp, so that a
+ * source object that is copied by several calls is only copied once. By
+ * default the state is cleared at the end of each copy; it is always
+ * released by capn_reset_copy.
+ *
+ * lookup, create, create_local, user and keep_copy can be set by the user.
+ * Other values should be zero initialized.
+ *
+ * segtab and readonly are set by capn_freeze, see below.
+ *
+ * shared is set once another session shares our segments, see capn_share.
  */
+struct capn_copy;
+struct capn_shared;
+
 struct capn {
 	/* user settable */
 	struct capn_segment *(*lookup)(void* /*user*/, uint32_t /*id */);
-	struct capn_segment *(*create)(void* /*user*/, uint32_t /*id */, int /*sz*/);
-	struct capn_segment *(*create_local)(void* /*user*/, int /*sz*/);
+	struct capn_segment *(*create)(void* /*user*/, uint32_t /*id */, size_t /*sz*/);
+	struct capn_segment *(*create_local)(void* /*user*/, size_t /*sz*/);
 	void *user;
+	int keep_copy;
 	/* zero initialized, user should not modify */
 	uint32_t segnum;
-	struct capn_tree *copy;
+	struct capn_copy *copy;
 	struct capn_tree *segtree;
 	struct capn_segment *seglist, *lastseg;
 	struct capn_segment *copylist;
+	struct capn_segment **segtab;
+	int readonly;
+	struct capn_shared *shared;
 };
 
 /* struct capn_tree is a rb tree header used internally for the segment id
- * lookup and copy tree */
+ * lookup */
 struct capn_tree {
 	struct capn_tree *parent, *link[2];
 	unsigned int red : 1;
@@ -124,10 +153,15 @@ struct capn_tree *capn_tree_insert(struct capn_tree *root, struct capn_tree *n);
  * one by incrementing cap and returning the expanded segment.
  *
  * data, len, and cap must all be 8 byte aligned, hence the ALIGNED_(8) macro
- * on the struct fields.
+ * on the struct fields. The one exception is the segment of an external
+ * blob (see capn_new_data_external), whose len and cap are the length of
+ * the blob.
  *
  * data, len, cap, and user should all be set by the user. Other values
  * should be zero initialized.
+ *
+ * shared is set on segments imported from another session by capn_share.
+ * Imported segments point at the other session's data and are read-only.
  */
 
 struct ALIGNED_(8) capn_segment {
@@ -140,6 +174,7 @@ struct ALIGNED_(8) capn_segment {
 	ALIGNED_(8) size_t len;
 	ALIGNED_(8) size_t cap;
 	ALIGNED_(8) void *user;
+	struct capn_shared *shared;
 };
 
 enum CAPN_TYPE {
@@ -151,12 +186,18 @@ enum CAPN_TYPE {
 	CAPN_FAR_POINTER = 5,
 };
 
+/* len is the number of elements of a list, which the format limits to 2^29
+ * so it fits an int. Byte sizes, which can be larger, are computed as
+ * size_t. datasz is the size of a struct's data section or of a list
+ * element, and for bit lists the size of the whole list, which takes 27
+ * bits for the largest one of 2^29 - 1 bits.
+ */
 struct capn_ptr {
 	unsigned int type : 4;
 	unsigned int has_ptr_tag : 1;
 	unsigned int is_list_member : 1;
 	unsigned int is_composite_list : 1;
-	unsigned int datasz : 19;
+	unsigned int datasz : 27;
 	unsigned int ptrs : 16;
 	int len;
 	char *data;
@@ -188,6 +229,13 @@ struct capn_msg {
 /* capn_append_segment appends a segment to a session */
 void capn_append_segment(struct capn*, struct capn_segment*);
 
+/* capn_reserve creates the first segment of an empty session with c->create
+ * and room for at least sz bytes, so that a message of known size (e.g. 8 *
+ * (1 + size_X(...)) words from a codecgen encoder) is built in one segment
+ * without far pointers. Returns 0 on success and -1 if the session already
+ * has segments or the segment could not be created. */
+int capn_reserve(struct capn *c, size_t sz);
+
 capn_ptr capn_root(struct capn *c);
 void capn_resolve(capn_ptr *p);
 
@@ -206,14 +254,15 @@ capn_text capn_get_text(capn_ptr p, int off, capn_text def);
 capn_data capn_get_data(capn_ptr p, int off);
 int capn_set_text(capn_ptr p, int off, capn_text tgt);
 /* there is no set_data -- use capn_new_list8 + capn_setv8 instead
- * and set data.p = list.p */
+ * and set data.p = list.p, or capn_new_data_external for large blobs */
 
 /* capn_get* functions get data from a list
  * The length of the list is given by p->size
  * off specifies how far into the list to start
  * sz indicates the number of elements to get
  * The function returns the number of elements read or -1 on an error.
- * off must be byte aligned for capn_getv1
+ * capn_getv1 takes any bit offset and packs the bits into data starting
+ * at bit 0 of data[0]
  */
 int capn_get1(capn_list1 p, int off);
 uint8_t capn_get8(capn_list8 p, int off);
@@ -226,11 +275,24 @@ int capn_getv16(capn_list16 p, int off, uint16_t *data, int sz);
 int capn_getv32(capn_list32 p, int off, uint32_t *data, int sz);
 int capn_getv64(capn_list64 p, int off, uint64_t *data, int sz);
 
+/* capn_getcol* functions read one field from each element of a struct list
+ * field is the byte offset of the field in the struct's data section, or the
+ * bit offset for capn_getcol1, which writes 0 or 1 to each byte of data.
+ * Elements whose data section ends before the field read as 0.
+ * The function returns the number of elements read or -1 on an error.
+ */
+int capn_getcol1(capn_ptr p, int field, int off, uint8_t *data, int sz);
+int capn_getcol8(capn_ptr p, int field, int off, uint8_t *data, int sz);
+int capn_getcol16(capn_ptr p, int field, int off, uint16_t *data, int sz);
+int capn_getcol32(capn_ptr p, int field, int off, uint32_t *data, int sz);
+int capn_getcol64(capn_ptr p, int field, int off, uint64_t *data, int sz);
+
 /* capn_set* functions set data in a list
  * off specifies how far into the list to start
  * sz indicates the number of elements to write
  * The function returns the number of elemnts written or -1 on an error.
- * off must be byte aligned for capn_setv1
+ * capn_setv1 takes any bit offset and leaves the bits around the range
+ * alone
  */
 int capn_set1(capn_list1 p, int off, int v);
 int capn_set8(capn_list8 p, int off, uint8_t v);
@@ -243,6 +305,20 @@ int capn_setv16(capn_list16 p, int off, const uint16_t *data, int sz);
 int capn_setv32(capn_list32 p, int off, const uint32_t *data, int sz);
 int capn_setv64(capn_list64 p, int off, const uint64_t *data, int sz);
 
+/* Bulk operations on bit lists
+ * capn_popcount1 counts the set bits in [off, off+sz).
+ * capn_find1 returns the index of the first bit at or after off equal to
+ * val or -1 if there is none.
+ * capn_and1, capn_or1 and capn_xor1 combine src into dst bit by bit over
+ * the length of the shorter list and return the number of bits changed.
+ * All return -1 on an error.
+ */
+int capn_popcount1(capn_list1 p, int off, int sz);
+int capn_find1(capn_list1 p, int off, int val);
+int capn_and1(capn_list1 dst, capn_list1 src);
+int capn_or1(capn_list1 dst, capn_list1 src);
+int capn_xor1(capn_list1 dst, capn_list1 src);
+
 /* capn_new_* functions create a new object
  * datasz is in bytes, ptrs is # of pointers, sz is # of elements in the list
  * On an error a CAPN_NULL pointer is returned
@@ -262,6 +338,7 @@ capn_list64 capn_new_list64(struct capn_segment *seg, int sz);
  * off is the offset into the structure in bytes
  * Rarely should these be called directly, instead use the generated code.
  * Data must be xored with the default value
+ * The writes only check the bounds, see capn_share for imported segments.
  * These are inlined
  */
 CAPN_INLINE uint8_t capn_read8(capn_ptr p, int off);
@@ -274,6 +351,14 @@ CAPN_INLINE int capn_write16(capn_ptr p, int off, uint16_t val);
 CAPN_INLINE int capn_write32(capn_ptr p, int off, uint32_t val);
 CAPN_INLINE int capn_write64(capn_ptr p, int off, uint64_t val);
 
+/* capn_prefetch_ptrs hints that the targets of the near pointers in the
+ * struct p will be read soon. The generated read_X_range functions call it
+ * on the list element CAPN_PREFETCH_AHEAD elements ahead of the one they
+ * read. Far pointers are left alone.
+ */
+#define CAPN_PREFETCH_AHEAD 8
+CAPN_INLINE void capn_prefetch_ptrs(capn_ptr p);
+
 /* capn_init_malloc inits the capn struct with a create function which
  * allocates segments on the heap using malloc
  *
@@ -281,9 +366,23 @@ CAPN_INLINE int capn_write64(capn_ptr p, int off, uint64_t val);
  * in serialized form (optionally packed). It will then setup the create
  * function ala capn_init_malloc so that further segments can be created.
  *
+ * capn_init_mem copies the message out of p, which stays owned by the
+ * caller and can be freed once it returns. Only the copy is reference
+ * counted by capn_share; buffers the caller owns (p, segments handed out by
+ * a custom create or lookup callback) are never protected by it.
+ *
+ * The segment table is checked before anything is allocated: messages
+ * larger than CAPN_MAX_MESSAGE_SIZE bytes, or than the rest of the buffer
+ * passed to capn_init_mem can hold, fail with -1. Define
+ * CAPN_MAX_MESSAGE_SIZE when building the library to change the limit.
+ *
  * capn_free frees all the segment headers and data created by the create
  * function setup by capn_init_*
  */
+#ifndef CAPN_MAX_MESSAGE_SIZE
+#define CAPN_MAX_MESSAGE_SIZE (UINT64_C(4) << 30)
+#endif
+
 void capn_init_malloc(struct capn *c);
 int capn_init_fp(struct capn *c, FILE *f, int packed);
 int capn_init_mem(struct capn *c, const uint8_t *p, size_t sz, int packed);
@@ -301,12 +400,403 @@ int64_t capn_size(struct capn *c);
  */
 /* TODO */
 /*int capn_write_fp(struct capn *c, FILE *f, int packed);*/
-int capn_write_fd(struct capn *c, ssize_t (*write_fd)(int fd, const void *p, size_t count), int fd, int packed);
+int64_t capn_write_fd(struct capn *c, ssize_t (*write_fd)(int fd, const void *p, size_t count), int fd, int packed);
 int64_t capn_write_mem(struct capn *c, uint8_t *p, size_t sz, int packed);
 
+/* capn_delta writes a patch that turns prev into next to the memory buffer,
+ * optionally packed, and returns the number of bytes written or -1 if sz
+ * is too small. The patch holds the words of each segment that differ
+ * from prev, so it stays small when next is built with the same layout as
+ * prev. next must have at least as many segments as prev; pass an empty
+ * session as prev for a full snapshot. 2*capn_size(next) + 16*segnum bytes
+ * are always enough for the unpacked form.
+ *
+ * capn_apply_delta applies a patch to c, which must match prev, appending
+ * the new segments with c->create. Existing segments can only grow within
+ * their cap, so a session that receives patches is best started with
+ * capn_init_malloc and a snapshot rather than capn_init_mem. Returns 0 on
+ * success and -1 on error, in which case c may have been partly patched.
+ */
+int64_t capn_delta(struct capn *prev, struct capn *next, uint8_t *p, size_t sz, int packed);
+int capn_apply_delta(struct capn *c, const uint8_t *p, size_t sz, int packed);
+
 void capn_free(struct capn *c);
 void capn_reset_copy(struct capn *c);
 
+/* capn_freeze puts a session into read-only mode so that a single message
+ * can be shared between reader threads without locking.
+ *
+ * After capn_freeze the read path (capn_root, capn_getp, capn_get*,
+ * capn_getv*, capn_get_text, capn_get_data, capn_resolve and copying out
+ * of the message with capn_setp) never modifies the struct capn or its
+ * segments. Segment ids are resolved through segtab, a table of segnum
+ * entries that is filled in at freeze time. Segments that are still missing
+ * are loaded through lookup on first use and published into segtab with an
+ * atomic compare and swap. If two readers race on the same id, lookup is
+ * called by both and the first segment published wins; lookup must
+ * therefore be thread safe and must hand out a segment that is not yet
+ * visible to other threads. Segments loaded this way are not added to
+ * seglist and remain owned by the user.
+ *
+ * capn_ptr, capn_text and the list types are values; capn_resolve only
+ * updates the caller's copy, so each thread should keep its own.
+ *
+ * Allocating (capn_new_*, capn_root on an empty session) and capn_setp with
+ * a frozen destination fail once the session is frozen. capn_append_segment
+ * must not be called on a frozen session.
+ *
+ * Returns 0 on success and -1 if the segment table could not be allocated.
+ * capn_free releases the table.
+ */
+int capn_freeze(struct capn *c);
+
+/* capn_traverse walks every object reachable from root and calls visit for
+ * each of them: root itself, every struct, list and text/data blob reached
+ * through a pointer, and every member of a composite list.
+ *
+ * Struct and pointer lists are split into ranges that are shared between
+ * up to threads workers (including the calling thread) using work
+ * stealing, so the order of visits is unspecified. worker is the index of
+ * the calling worker in [0, threads) and can be used to keep per-thread
+ * accumulators without locking. With threads > 1 the session must have
+ * been frozen with capn_freeze. On platforms without pthreads the walk
+ * always runs on the calling thread.
+ *
+ * If visit returns non-zero the traversal stops early and that value is
+ * returned, so visitors should return positive values to report errors.
+ *
+ * Returns 0 once every object has been visited, and -1 if the message is
+ * nested more than 64 levels deep (which includes cyclic messages), if
+ * threads > 1 is requested on a session that is not frozen, or on
+ * allocation failure.
+ */
+typedef int (*capn_visit_fn)(void *user, capn_ptr p, int worker);
+int capn_traverse(capn_ptr root, int threads, capn_visit_fn visit, void *user);
+
+/* capn_share sets the pointer like capn_setp, but shares tgt with its
+ * session instead of copying it when tgt lives in another session.
+ *
+ * The segment holding tgt is imported into p's session as an extra
+ * read-only segment that points at the same data, and a far pointer to tgt
+ * is written. Serializing p's session then writes the imported bytes
+ * straight from the source buffer. A segment is only imported once per
+ * session.
+ *
+ * Sharing is only possible when everything reachable from tgt lies in
+ * tgt's segment (no far pointers) and tgt is not a list member; otherwise
+ * capn_share falls back to copying with capn_setp.
+ *
+ * The source segments are reference counted: if the source session is
+ * freed first, capn_free keeps its segments alive until the last session
+ * sharing them is freed. The source data must not be modified while it is
+ * shared. capn_setp, capn_set* and capn_setv* fail with -1 on pointers
+ * into imported segments and nothing can be allocated in them, but the
+ * inlined capn_write* only check their bounds and must not be used on
+ * them. Reference counts are not atomic, so sessions sharing data must be
+ * freed from one thread at a time. Both sessions must use the malloc
+ * allocator (capn_init_malloc, capn_init_fp or capn_init_mem), as only
+ * segments it allocated are reference counted.
+ *
+ * Sharing walks everything reachable from tgt. Messages that take more
+ * than 8 times their size plus 64Ki words to walk, because pointers share
+ * subtrees, are copied instead.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int capn_share(capn_ptr p, int off, capn_ptr tgt);
+
+/* capn_new_data_external registers len bytes at buf as a segment of its own
+ * and returns a data list pointing at them, without copying. Set it with
+ * capn_setp as usual; the parent gets a far pointer into the new segment.
+ * The serializers write the blob straight from buf, zero padded to a whole
+ * word. buf is never read past len, even when len is not a multiple of 8.
+ *
+ * buf must stay valid and unmodified until release is called, which
+ * happens once c and every session the blob has been shared with (see
+ * capn_share) are freed. release may be NULL.
+ *
+ * Empty blobs and buffers that are not 8 byte aligned are copied into a
+ * regular segment instead and release is called straight away.
+ *
+ * Returns a CAPN_NULL pointer if len is 2^29 or more, if c is frozen, or on
+ * allocation failure; release is not called in that case.
+ */
+typedef void (*capn_release_fn)(const void *buf, size_t len);
+capn_data capn_new_data_external(struct capn *c, const void *buf, size_t len, capn_release_fn release);
+
+/* capn_compact copies everything reachable from the root of src into dst,
+ * leaving behind orphaned objects and far pointers.
+ *
+ * The reachable size is measured first so that dst gets a single segment
+ * of exactly that size from dst->create. order chooses the layout:
+ * CAPN_DEPTH_FIRST places each object right before its children in the
+ * order a reader walks them, CAPN_BREADTH_FIRST places all objects of one
+ * level before the next. Objects that are referenced several times are
+ * copied once.
+ *
+ * dst must be an empty session with create and create_local set (eg. from
+ * capn_init_malloc). src is not modified.
+ *
+ * Returns 0 on success and -1 on error, including overlapped pointers in
+ * src.
+ */
+enum CAPN_ORDER {
+	CAPN_DEPTH_FIRST = 0,
+	CAPN_BREADTH_FIRST = 1,
+};
+int capn_compact(struct capn *src, struct capn *dst, enum CAPN_ORDER order);
+
+/* capn_canonicalize writes the canonical form of p into dst: a single
+ * segment with the root pointer followed by every object in preorder,
+ * trailing zero data words and null pointers trimmed from structs, struct
+ * lists sized for their largest member and no padding or far pointers.
+ * Objects referenced several times are copied each time. Lists that are
+ * not composite keep their element size, so equal content only gives
+ * equal bytes if struct lists were built with capn_new_list the same way.
+ *
+ * dst must be an empty session with create set. Returns 0 on success and
+ * -1 on error, including recursive messages and messages that take more
+ * than 8 times their size plus 64Ki words to walk because pointers share
+ * subtrees (the canonical form of those can be exponentially larger).
+ */
+int capn_canonicalize(capn_ptr p, struct capn *dst);
+
+/* capn_hash computes a 128 bit hash of the canonical form of p in one pass
+ * over p, without building it. Messages with the same canonical form have
+ * the same hash whatever their segment layout, orphans or far pointers.
+ * hash[0] on its own can be used as a 64 bit hash. The hash is the same
+ * on big and little endian hosts but is not a cryptographic hash.
+ *
+ * Returns 0 on success and -1 on error, with the same limits as
+ * capn_canonicalize.
+ */
+int capn_hash(capn_ptr p, uint64_t seed, uint64_t hash[2]);
+
+/* struct capn_template is a message prepared for fast copies by
+ * capn_template_compile. data holds len bytes of the message in a single
+ * segment, root pointer first. objs holds num pointers to every object in
+ * data, root first and the others in preorder, and is used to find the
+ * objects in each copy without reading any pointers.
+ */
+struct capn_template {
+	char *data;
+	size_t len;
+	int num;
+	capn_ptr *objs;
+};
+
+/* capn_template_compile compacts everything reachable from the root of c
+ * into a new template. c is not modified and can be freed straight away.
+ * Returns NULL on error, including objects nested more than 64 deep.
+ *
+ * The template is freed with capn_template_free.
+ */
+struct capn_template *capn_template_compile(struct capn *c);
+void capn_template_free(struct capn_template *t);
+
+/* capn_template_instantiate copies the template into a new segment of the
+ * empty session c, with one memcpy, and returns its root. If objs is not
+ * NULL it is filled with t->num pointers to the objects of the copy in the
+ * order of t->objs, ready for capn_write* or capn_set_text. Objects added
+ * later go after the copy as usual.
+ *
+ * Returns a null pointer on error or if the template has no root.
+ */
+capn_ptr capn_template_instantiate(const struct capn_template *t, struct capn *c, capn_ptr *objs);
+
+/* struct capn_arena is a bump allocator for decoded data, such as the
+ * native structs built by the decode_X_arena functions of $C.codecgen.
+ * Memory is handed out zeroed from blocks of at least size bytes and is
+ * only given back all at once, by capn_arena_free. The capn_size of the
+ * message being decoded is a good first block size.
+ *
+ * capn_arena_calloc and capn_arena_strdup return NULL if out of memory.
+ */
+struct capn_arena_block;
+
+struct capn_arena {
+	struct capn_arena_block *blocks;
+	size_t size;
+};
+
+void capn_arena_init(struct capn_arena *a, size_t size);
+void *capn_arena_calloc(struct capn_arena *a, size_t num, size_t sz);
+char *capn_arena_strdup(struct capn_arena *a, const char *s);
+void capn_arena_free(struct capn_arena *a);
+
+/* capn_extract frames the subtree at root as a message of its own for
+ * writev, filling out with at most num iovecs and returning how many were
+ * used, or -1 on error.
+ *
+ * If the subtree sits in the root's segment without far pointers, the
+ * iovecs cover its bytes in place and only the segment table and root
+ * pointer are new. Holes between the objects of the subtree, such as the
+ * other members of a list, are sent as zeros, and so is the padding of an
+ * external blob (see capn_new_data_external) that ends part way through a
+ * word. Objects referenced several times are sent once. If the holes would
+ * be larger than the subtree, objects overlap or more than num iovecs are
+ * needed, the subtree is compacted into tmp and two iovecs are used
+ * instead.
+ *
+ * tmp must be an empty session with create and create_local set (eg. from
+ * capn_init_malloc). The iovecs are valid until tmp is freed or used again
+ * and the source is freed or modified. num must be at least 2.
+ */
+int capn_extract(capn_ptr root, struct capn *tmp, struct iovec *out, int num);
+
+/* struct capn_field describes how one member of a generated struct is read
+ * from and written to its capnp struct. Schemas compiled with
+ * $C.tabledriven get a table of these per struct, and their read_X and
+ * write_X call capn_read_fields and capn_write_fields instead of having
+ * code for each field.
+ *
+ * offset is the byte offset in the data section, the bit offset for
+ * CAPN_FIELD_BOOL and the pointer index for text, data and pointers.
+ * member is the offset of the member in the C struct. Bool members are
+ * unsigned ints and enums, including union tags, are ints.
+ *
+ * def is xored into numbers as in the generated code. defp points to the
+ * default value of text, data and pointer fields that have one.
+ *
+ * which is one more than the index of the CAPN_FIELD_WHICH entry of the
+ * union the field is in, or 0 if it is not in a union, and tag is the
+ * discriminant the field is present with. A CAPN_FIELD_WHICH entry
+ * comes before the members of its union.
+ */
+enum CAPN_FIELD_TYPE {
+	CAPN_FIELD_BOOL = 0,
+	CAPN_FIELD_BITS8,
+	CAPN_FIELD_BITS16,
+	CAPN_FIELD_BITS32,
+	CAPN_FIELD_BITS64,
+	CAPN_FIELD_ENUM,
+	CAPN_FIELD_WHICH,
+	CAPN_FIELD_TEXT,
+	CAPN_FIELD_DATA,
+	CAPN_FIELD_PTR
+};
+
+struct capn_field {
+	enum CAPN_FIELD_TYPE type;
+	unsigned offset;
+	unsigned member;
+	unsigned short which;
+	unsigned short tag;
+	uint64_t def;
+	const void *defp;
+};
+
+/* capn_read_fields fills in the members of s described by fields from the
+ * struct p, like a generated read_X. capn_write_fields writes them to p,
+ * like write_X, skipping the members of union cases that aren't selected.
+ */
+void capn_read_fields(capn_ptr p, void *s, const struct capn_field *fields, int num);
+void capn_write_fields(capn_ptr p, const void *s, const struct capn_field *fields, int num);
+
+/* capn_dynamic reads and writes messages of schemas that weren't compiled
+ * in, using the Node data that capnpc-c embeds with $C.embedschema (or any
+ * serialized CodeGeneratorRequest).
+ *
+ * A field is first resolved by name to a struct capn_dynamic_field, which
+ * holds its precomputed offset, type and default. The accessors then only
+ * read or write that slot, so resolve once and keep the descriptor.
+ */
+struct capn_dynamic {
+	struct capn capn;
+	capn_ptr nodes;
+};
+
+/* The types mirror the which of schema.capnp's Type. Groups are fields of
+ * type CAPN_DYNAMIC_GROUP whose type_id is the node of the group. */
+enum CAPN_DYNAMIC_TYPE {
+	CAPN_DYNAMIC_VOID = 0,
+	CAPN_DYNAMIC_BOOL,
+	CAPN_DYNAMIC_INT8,
+	CAPN_DYNAMIC_INT16,
+	CAPN_DYNAMIC_INT32,
+	CAPN_DYNAMIC_INT64,
+	CAPN_DYNAMIC_UINT8,
+	CAPN_DYNAMIC_UINT16,
+	CAPN_DYNAMIC_UINT32,
+	CAPN_DYNAMIC_UINT64,
+	CAPN_DYNAMIC_FLOAT32,
+	CAPN_DYNAMIC_FLOAT64,
+	CAPN_DYNAMIC_TEXT,
+	CAPN_DYNAMIC_DATA,
+	CAPN_DYNAMIC_LIST,
+	CAPN_DYNAMIC_ENUM,
+	CAPN_DYNAMIC_STRUCT,
+	CAPN_DYNAMIC_INTERFACE,
+	CAPN_DYNAMIC_ANYPOINTER,
+	CAPN_DYNAMIC_GROUP
+};
+
+/* offset is in bits for bools, in bytes for other data fields and the
+ * pointer index for pointer fields. def is xored into data fields and
+ * defp is the default of pointer fields. type_id is the node of structs,
+ * enums and groups, and of the elements of lists of structs and enums,
+ * whose type is element.
+ *
+ * union_offset is the byte offset of the discriminant of the union the
+ * field is directly in, or -1, and union_value the value it is selected
+ * with. */
+struct capn_dynamic_field {
+	const char *name;
+	enum CAPN_DYNAMIC_TYPE type;
+	enum CAPN_DYNAMIC_TYPE element;
+	unsigned offset;
+	uint64_t def;
+	capn_ptr defp;
+	uint64_t type_id;
+	int union_offset;
+	uint16_t union_value;
+};
+
+/* capn_dynamic_init reads the schema from sz bytes at data, which are
+ * copied, and freezes it so that it can be shared between threads. Names
+ * in descriptors point into it until capn_dynamic_free. Returns 0 on
+ * success and -1 on error.
+ *
+ * capn_dynamic_lookup returns the id of the node with the display name
+ * name, given either in full ("foo.capnp:Foo.Bar") or without the file
+ * ("Foo.Bar"), or 0 if there is none.
+ */
+int capn_dynamic_init(struct capn_dynamic *d, const uint8_t *data, size_t sz);
+void capn_dynamic_free(struct capn_dynamic *d);
+uint64_t capn_dynamic_lookup(struct capn_dynamic *d, const char *name);
+
+/* capn_dynamic_field resolves path in the struct id. The names of fields
+ * in groups are joined with dots, as in "employment.school".
+ * capn_dynamic_field_at describes the i'th field of the struct id, in the
+ * order of the schema's field list, instead. Both return 0 on success and
+ * -1 if there is no such field.
+ */
+int capn_dynamic_field(struct capn_dynamic *d, uint64_t id, const char *path, struct capn_dynamic_field *f);
+int capn_dynamic_field_at(struct capn_dynamic *d, uint64_t id, int i, struct capn_dynamic_field *f);
+
+/* capn_dynamic_has returns whether f is set in the struct p, which is
+ * always the case outside of unions.
+ *
+ * The getters return the value of f in p, or its default, without checking
+ * capn_dynamic_has. Numbers, bools and enums are converted between the
+ * int, uint and float getters, and other types read as 0.
+ * capn_dynamic_get_ptr returns text, data, lists and structs as a capn_ptr.
+ *
+ * The setters also select f in its union. They return 0 on success and -1
+ * if f has a different kind of type or p can't be written.
+ */
+int capn_dynamic_has(capn_ptr p, const struct capn_dynamic_field *f);
+int64_t capn_dynamic_get_int(capn_ptr p, const struct capn_dynamic_field *f);
+uint64_t capn_dynamic_get_uint(capn_ptr p, const struct capn_dynamic_field *f);
+double capn_dynamic_get_float(capn_ptr p, const struct capn_dynamic_field *f);
+capn_text capn_dynamic_get_text(capn_ptr p, const struct capn_dynamic_field *f);
+capn_ptr capn_dynamic_get_ptr(capn_ptr p, const struct capn_dynamic_field *f);
+int capn_dynamic_set_int(capn_ptr p, const struct capn_dynamic_field *f, int64_t v);
+int capn_dynamic_set_uint(capn_ptr p, const struct capn_dynamic_field *f, uint64_t v);
+int capn_dynamic_set_float(capn_ptr p, const struct capn_dynamic_field *f, double v);
+int capn_dynamic_set_text(capn_ptr p, const struct capn_dynamic_field *f, capn_text v);
+int capn_dynamic_set_ptr(capn_ptr p, const struct capn_dynamic_field *f, capn_ptr v);
+
 /* Inline functions */
 
 
@@ -423,6 +913,22 @@ CAPN_INLINE int capn_write64(capn_ptr p, int off, uint64_t val) {
 	}
 }
 
+CAPN_INLINE void capn_prefetch_ptrs(capn_ptr p) {
+#if defined(__GNUC__)
+	const char *d = p.data + p.datasz;
+	int i;
+	for (i = 0; i < p.ptrs; i++, d += 8) {
+		uint64_t val = capn_flip64(*(const uint64_t*) d);
+		/* struct (0) and list (1) pointers; prefetching never faults */
+		if (val != 0 && (val&3) < 2) {
+			__builtin_prefetch(d + 8 + (int64_t) ((int32_t) (uint32_t) val >> 2) * 8);
+		}
+	}
+#else
+	(void) p;
+#endif
+}
+
 union capn_conv_f32 {
 	uint32_t u;
 	float f;
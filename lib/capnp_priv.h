@@ -58,5 +58,65 @@ struct capn_stream {
 intern int capn_deflate(struct capn_stream*);
 intern int capn_inflate(struct capn_stream*);
 
+/* struct capn_shared keeps the segments of a session alive for as long as
+ * other sessions share them. refs counts the session itself (until
+ * capn_free) and each segment imported by capn_share.
+ *
+ * Blobs added with capn_new_data_external use the same record with buf set
+ * instead of a session: refs counts the sessions holding the blob and
+ * release is called on buf once they are all freed. */
+struct capn_shared {
+	int refs;
+	struct capn_segment *seglist;
+	const void *buf;
+	size_t len;
+	capn_release_fn release;
+};
+
+/* capn_seg_size returns the size of s as it is framed, in whole words. Only
+ * the segment of an external blob has a len that is not a multiple of 8, as
+ * it ends where the blob ends; the serializers zero pad its last word.
+ */
+#define capn_seg_size(s) (((s)->len + 7) & ~(size_t) 7)
+
+/* capn_is_local returns whether everything reachable from p lies in p.seg,
+ * ie. whether the tree has no far pointers. Trees nested more than 64 levels
+ * deep, or that take too long to walk because pointers share subtrees, are
+ * reported as not local.
+ */
+intern int capn_is_local(capn_ptr p);
+
+/* capn_prefetch hints that the cache line at p will be read soon */
+#if defined(__GNUC__)
+#define capn_prefetch(p) __builtin_prefetch((p))
+#else
+#define capn_prefetch(p) ((void) 0)
+#endif
+
+/* capn_atomic_load_ptr loads a pointer published by another thread
+ * capn_atomic_cas_ptr publishes a pointer if *p still equals *expect,
+ * otherwise it stores the current value in *expect and returns 0
+ */
+#if defined(__GNUC__)
+#define capn_atomic_load_ptr(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define capn_atomic_cas_ptr(p, expect, val) \
+	__atomic_compare_exchange_n((p), (expect), (val), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define capn_atomic_load_ptr(p) \
+	((void*) _InterlockedCompareExchangePointer((void* volatile*) (p), NULL, NULL))
+static __inline int capn_atomic_cas_ptr_(void* volatile *p, void **expect, void *val) {
+	void *prev = _InterlockedCompareExchangePointer(p, val, *expect);
+	if (prev == *expect)
+		return 1;
+	*expect = prev;
+	return 0;
+}
+#define capn_atomic_cas_ptr(p, expect, val) \
+	capn_atomic_cas_ptr_((void* volatile*) (p), (void**) (expect), (void*) (val))
+#else
+#error "capnp_priv.h: no atomic primitives for this compiler"
+#endif
+
 
 #endif /* CAPNP_PRIV_H */
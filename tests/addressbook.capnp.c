@@ -14,6 +14,24 @@ Person_list new_Person_list(struct capn_segment *s, int len) {
 }
 void read_Person(struct Person *s, Person_ptr p) {
 	capn_resolve(&p.p);
+	if (p.p.datasz >= 8) {
+		s->id = capn_flip32(*(uint32_t*) (p.p.data+0));
+		s->name = capn_get_text(p.p, 0, capn_val0);
+		s->email = capn_get_text(p.p, 1, capn_val0);
+		s->phones.p = capn_getp(p.p, 2, 0);
+		s->employment_which = (enum Person_employment_which)(int) capn_flip16(*(uint16_t*) (p.p.data+4));
+		switch (s->employment_which) {
+		case Person_employment_employer:
+			s->employment.employer = capn_get_text(p.p, 3, capn_val0);
+			break;
+		case Person_employment_school:
+			s->employment.school = capn_get_text(p.p, 3, capn_val0);
+			break;
+		default:
+			break;
+		}
+		return;
+	}
 	s->id = capn_read32(p.p, 0);
 	s->name = capn_get_text(p.p, 0, capn_val0);
 	s->email = capn_get_text(p.p, 1, capn_val0);
@@ -28,6 +46,34 @@ void read_Person(struct Person *s, Person_ptr p) {
 		break;
 	}
 }
+void read_Person_fields(struct Person *s, Person_ptr p, uint64_t mask) {
+	capn_resolve(&p.p);
+	if (mask & Person_id_mask) {
+		s->id = capn_read32(p.p, 0);
+	}
+	if (mask & Person_name_mask) {
+		s->name = capn_get_text(p.p, 0, capn_val0);
+	}
+	if (mask & Person_email_mask) {
+		s->email = capn_get_text(p.p, 1, capn_val0);
+	}
+	if (mask & Person_phones_mask) {
+		s->phones.p = capn_getp(p.p, 2, 0);
+	}
+	if (mask & Person_employment_mask) {
+		s->employment_which = (enum Person_employment_which)(int) capn_read16(p.p, 4);
+		switch (s->employment_which) {
+		case Person_employment_employer:
+			s->employment.employer = capn_get_text(p.p, 3, capn_val0);
+			break;
+		case Person_employment_school:
+			s->employment.school = capn_get_text(p.p, 3, capn_val0);
+			break;
+		default:
+			break;
+		}
+	}
+}
 void write_Person(const struct Person *s, Person_ptr p) {
 	capn_resolve(&p.p);
 	capn_write32(p.p, 0, s->id);
@@ -55,11 +101,57 @@ void set_Person(const struct Person *s, Person_list l, int i) {
 	write_Person(s, p);
 }
 
-uint32_t Person_get_id(Person_ptr p)
+int read_Person_range(Person_list l, int start, int n, struct Person *out) {
+	Person_ptr p;
+	capn_ptr ahead;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			get_Person(&out[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	ahead = p.p;
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		if (i + CAPN_PREFETCH_AHEAD < n) {
+			ahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;
+			capn_prefetch_ptrs(ahead);
+		}
+		read_Person(&out[i], p);
+	}
+	return n;
+}
+
+int write_Person_range(Person_list l, int start, int n, const struct Person *in) {
+	Person_ptr p;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			set_Person(&in[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		write_Person(&in[i], p);
+	}
+	return n;
+}
+
+int Person_list_get_id_column(Person_list l, int start, int n, uint32_t *out)
 {
-	uint32_t id;
-	id = capn_read32(p.p, 0);
-	return id;
+	return capn_getcol32(l.p, 0, start, out, n);
 }
 
 capn_text Person_get_name(Person_ptr p)
@@ -83,11 +175,6 @@ Person_PhoneNumber_list Person_get_phones(Person_ptr p)
 	return phones;
 }
 
-void Person_set_id(Person_ptr p, uint32_t id)
-{
-	capn_write32(p.p, 0, id);
-}
-
 void Person_set_name(Person_ptr p, capn_text name)
 {
 	capn_set_text(p.p, 0, name);
@@ -103,6 +190,22 @@ void Person_set_phones(Person_ptr p, Person_PhoneNumber_list phones)
 	capn_setp(p.p, 2, phones.p);
 }
 
+static const struct capn_arrow_field Person_arrow_fields[] = {
+	{"id", CAPN_ARROW_UINT32, 0, 0, 0, 0},
+	{"name", CAPN_ARROW_TEXT, 0, 0, 0, 0},
+	{"email", CAPN_ARROW_TEXT, 1, 0, 0, 0},
+	{"employment", CAPN_ARROW_UNION, 4, 4, 0, 0},
+	{"unemployed", CAPN_ARROW_NULL, 0, 0, 0, 0},
+	{"employer", CAPN_ARROW_TEXT, 3, 0, 1, 0},
+	{"school", CAPN_ARROW_TEXT, 3, 0, 2, 0},
+	{"selfEmployed", CAPN_ARROW_NULL, 0, 0, 3, 0},
+};
+
+int Person_list_to_arrow(Person_list l, struct ArrowArray *array, struct ArrowSchema *schema)
+{
+	return capn_arrow_export(l.p, Person_arrow_fields, 8, array, schema);
+}
+
 Person_PhoneNumber_ptr new_Person_PhoneNumber(struct capn_segment *s) {
 	Person_PhoneNumber_ptr p;
 	p.p = capn_new_struct(s, 8, 1);
@@ -115,9 +218,23 @@ Person_PhoneNumber_list new_Person_PhoneNumber_list(struct capn_segment *s, int
 }
 void read_Person_PhoneNumber(struct Person_PhoneNumber *s, Person_PhoneNumber_ptr p) {
 	capn_resolve(&p.p);
+	if (p.p.datasz >= 8) {
+		s->number = capn_get_text(p.p, 0, capn_val0);
+		s->type = (enum Person_PhoneNumber_Type)(int) capn_flip16(*(uint16_t*) (p.p.data+0));
+		return;
+	}
 	s->number = capn_get_text(p.p, 0, capn_val0);
 	s->type = (enum Person_PhoneNumber_Type)(int) capn_read16(p.p, 0);
 }
+void read_Person_PhoneNumber_fields(struct Person_PhoneNumber *s, Person_PhoneNumber_ptr p, uint64_t mask) {
+	capn_resolve(&p.p);
+	if (mask & Person_PhoneNumber_number_mask) {
+		s->number = capn_get_text(p.p, 0, capn_val0);
+	}
+	if (mask & Person_PhoneNumber_type_mask) {
+		s->type = (enum Person_PhoneNumber_Type)(int) capn_read16(p.p, 0);
+	}
+}
 void write_Person_PhoneNumber(const struct Person_PhoneNumber *s, Person_PhoneNumber_ptr p) {
 	capn_resolve(&p.p);
 	capn_set_text(p.p, 0, s->number);
@@ -134,6 +251,54 @@ void set_Person_PhoneNumber(const struct Person_PhoneNumber *s, Person_PhoneNumb
 	write_Person_PhoneNumber(s, p);
 }
 
+int read_Person_PhoneNumber_range(Person_PhoneNumber_list l, int start, int n, struct Person_PhoneNumber *out) {
+	Person_PhoneNumber_ptr p;
+	capn_ptr ahead;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			get_Person_PhoneNumber(&out[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	ahead = p.p;
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		if (i + CAPN_PREFETCH_AHEAD < n) {
+			ahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;
+			capn_prefetch_ptrs(ahead);
+		}
+		read_Person_PhoneNumber(&out[i], p);
+	}
+	return n;
+}
+
+int write_Person_PhoneNumber_range(Person_PhoneNumber_list l, int start, int n, const struct Person_PhoneNumber *in) {
+	Person_PhoneNumber_ptr p;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			set_Person_PhoneNumber(&in[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		write_Person_PhoneNumber(&in[i], p);
+	}
+	return n;
+}
+
 capn_text Person_PhoneNumber_get_number(Person_PhoneNumber_ptr p)
 {
 	capn_text number;
@@ -141,11 +306,22 @@ capn_text Person_PhoneNumber_get_number(Person_PhoneNumber_ptr p)
 	return number;
 }
 
-enum Person_PhoneNumber_Type Person_PhoneNumber_get_type(Person_PhoneNumber_ptr p)
+int Person_PhoneNumber_list_get_type_column(Person_PhoneNumber_list l, int start, int n, enum Person_PhoneNumber_Type *out)
 {
-	enum Person_PhoneNumber_Type type;
-	type = (enum Person_PhoneNumber_Type)(int) capn_read16(p.p, 0);
-	return type;
+	uint16_t buf[64];
+	int i = 0, j, m;
+	while (i < n) {
+		m = capn_getcol16(l.p, 0, start + i, buf, n - i < 64 ? n - i : 64);
+		if (m < 0)
+			return -1;
+		if (m == 0)
+			break;
+		for (j = 0; j < m; j++) {
+			out[i + j] = (enum Person_PhoneNumber_Type)(int)(buf[j]);
+		}
+		i += m;
+	}
+	return i;
 }
 
 void Person_PhoneNumber_set_number(Person_PhoneNumber_ptr p, capn_text number)
@@ -153,9 +329,14 @@ void Person_PhoneNumber_set_number(Person_PhoneNumber_ptr p, capn_text number)
 	capn_set_text(p.p, 0, number);
 }
 
-void Person_PhoneNumber_set_type(Person_PhoneNumber_ptr p, enum Person_PhoneNumber_Type type)
+static const struct capn_arrow_field Person_PhoneNumber_arrow_fields[] = {
+	{"number", CAPN_ARROW_TEXT, 0, 0, 0, 0},
+	{"type", CAPN_ARROW_UINT16, 0, 0, 0, 0},
+};
+
+int Person_PhoneNumber_list_to_arrow(Person_PhoneNumber_list l, struct ArrowArray *array, struct ArrowSchema *schema)
 {
-	capn_write16(p.p, 0, (uint16_t) (type));
+	return capn_arrow_export(l.p, Person_PhoneNumber_arrow_fields, 2, array, schema);
 }
 
 AddressBook_ptr new_AddressBook(struct capn_segment *s) {
@@ -172,6 +353,12 @@ void read_AddressBook(struct AddressBook *s, AddressBook_ptr p) {
 	capn_resolve(&p.p);
 	s->people.p = capn_getp(p.p, 0, 0);
 }
+void read_AddressBook_fields(struct AddressBook *s, AddressBook_ptr p, uint64_t mask) {
+	capn_resolve(&p.p);
+	if (mask & AddressBook_people_mask) {
+		s->people.p = capn_getp(p.p, 0, 0);
+	}
+}
 void write_AddressBook(const struct AddressBook *s, AddressBook_ptr p) {
 	capn_resolve(&p.p);
 	capn_setp(p.p, 0, s->people.p);
@@ -187,6 +374,54 @@ void set_AddressBook(const struct AddressBook *s, AddressBook_list l, int i) {
 	write_AddressBook(s, p);
 }
 
+int read_AddressBook_range(AddressBook_list l, int start, int n, struct AddressBook *out) {
+	AddressBook_ptr p;
+	capn_ptr ahead;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			get_AddressBook(&out[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	ahead = p.p;
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		if (i + CAPN_PREFETCH_AHEAD < n) {
+			ahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;
+			capn_prefetch_ptrs(ahead);
+		}
+		read_AddressBook(&out[i], p);
+	}
+	return n;
+}
+
+int write_AddressBook_range(AddressBook_list l, int start, int n, const struct AddressBook *in) {
+	AddressBook_ptr p;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			set_AddressBook(&in[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		write_AddressBook(&in[i], p);
+	}
+	return n;
+}
+
 Person_list AddressBook_get_people(AddressBook_ptr p)
 {
 	Person_list people;
@@ -198,3 +433,185 @@ void AddressBook_set_people(AddressBook_ptr p, Person_list people)
 {
 	capn_setp(p.p, 0, people.p);
 }
+
+int AddressBook_list_to_arrow(AddressBook_list l, struct ArrowArray *array, struct ArrowSchema *schema)
+{
+	return capn_arrow_export(l.p, NULL, 0, array, schema);
+}
+
+const uint8_t addressbook_capnp_schema[2776] = {
+	0,0,0,0,90,1,0,0,0,0,0,0,0,0,2,0,
+	5,0,0,0,23,2,0,0,0,0,0,0,0,0,0,0,
+	24,0,0,0,5,0,6,0,116,225,110,248,25,46,179,158,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	241,0,0,0,146,0,0,0,249,0,0,0,39,0,0,0,
+	21,1,0,0,31,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	24,188,232,50,152,142,128,152,18,0,0,0,1,0,1,0,
+	116,225,110,248,25,46,179,158,4,0,7,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,13,1,0,0,202,0,0,0,
+	25,1,0,0,23,0,0,0,41,1,0,0,7,0,0,0,
+	41,1,0,0,31,1,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,231,215,217,196,181,164,94,188,
+	25,0,0,0,1,0,1,0,24,188,232,50,152,142,128,152,
+	4,0,7,0,1,0,4,0,2,0,0,0,0,0,0,0,
+	69,2,0,0,34,1,0,0,85,2,0,0,7,0,0,0,
+	85,2,0,0,7,0,0,0,85,2,0,0,231,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	208,138,158,156,178,144,78,129,25,0,0,0,1,0,1,0,
+	24,188,232,50,152,142,128,152,1,0,7,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,69,3,0,0,42,1,0,0,
+	85,3,0,0,23,0,0,0,97,3,0,0,7,0,0,0,
+	97,3,0,0,119,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,47,6,133,213,4,189,224,145,
+	37,0,0,0,2,0,0,0,208,138,158,156,178,144,78,129,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	197,3,0,0,82,1,0,0,217,3,0,0,7,0,0,0,
+	217,3,0,0,7,0,0,0,217,3,0,0,79,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	52,161,168,84,179,217,52,249,18,0,0,0,1,0,0,0,
+	116,225,110,248,25,46,179,158,1,0,7,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,249,3,0,0,242,0,0,0,
+	5,4,0,0,7,0,0,0,5,4,0,0,7,0,0,0,
+	5,4,0,0,63,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,97,100,100,114,101,115,115,98,
+	111,111,107,46,99,97,112,110,112,0,0,0,0,0,0,0,
+	8,0,0,0,1,0,1,0,24,188,232,50,152,142,128,152,
+	9,0,0,0,58,0,0,0,52,161,168,84,179,217,52,249,
+	5,0,0,0,98,0,0,0,80,101,114,115,111,110,0,0,
+	65,100,100,114,101,115,115,66,111,111,107,0,0,0,0,0,
+	4,0,0,0,1,0,2,0,88,32,111,75,201,215,225,163,
+	4,0,0,0,2,0,1,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,97,100,100,114,101,115,115,98,
+	111,111,107,46,99,97,112,110,112,58,80,101,114,115,111,110,
+	0,0,0,0,0,0,0,0,4,0,0,0,1,0,1,0,
+	208,138,158,156,178,144,78,129,1,0,0,0,98,0,0,0,
+	80,104,111,110,101,78,117,109,98,101,114,0,0,0,0,0,
+	0,0,0,0,1,0,2,0,20,0,0,0,3,0,4,0,
+	0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,125,0,0,0,26,0,0,0,
+	125,0,0,0,7,0,0,0,124,0,0,0,3,0,1,0,
+	136,0,0,0,2,0,1,0,1,0,0,0,0,0,0,0,
+	0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
+	133,0,0,0,42,0,0,0,133,0,0,0,7,0,0,0,
+	132,0,0,0,3,0,1,0,144,0,0,0,2,0,1,0,
+	2,0,0,0,1,0,0,0,0,0,1,0,2,0,0,0,
+	0,0,0,0,0,0,0,0,141,0,0,0,50,0,0,0,
+	141,0,0,0,7,0,0,0,140,0,0,0,3,0,1,0,
+	152,0,0,0,2,0,1,0,3,0,0,0,2,0,0,0,
+	0,0,1,0,3,0,0,0,0,0,0,0,0,0,0,0,
+	149,0,0,0,58,0,0,0,149,0,0,0,7,0,0,0,
+	148,0,0,0,3,0,1,0,176,0,0,0,2,0,1,0,
+	4,0,0,0,0,0,0,0,1,0,1,0,4,0,0,0,
+	231,215,217,196,181,164,94,188,173,0,0,0,90,0,0,0,
+	177,0,0,0,7,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,105,100,0,0,0,0,0,0,
+	0,0,0,0,1,0,2,0,8,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,8,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	110,97,109,101,0,0,0,0,0,0,0,0,1,0,2,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,101,109,97,105,108,0,0,0,
+	0,0,0,0,1,0,2,0,12,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,12,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	112,104,111,110,101,115,0,0,0,0,0,0,1,0,2,0,
+	14,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,3,0,1,0,
+	16,0,0,0,0,0,0,0,208,138,158,156,178,144,78,129,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	14,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,101,109,112,108,111,121,109,101,
+	110,116,0,0,0,0,0,0,0,0,0,0,1,0,2,0,
+	97,100,100,114,101,115,115,98,111,111,107,46,99,97,112,110,
+	112,58,80,101,114,115,111,110,46,101,109,112,108,111,121,109,
+	101,110,116,0,0,0,0,0,0,0,0,0,1,0,1,0,
+	0,0,0,0,1,0,2,0,16,0,0,0,3,0,4,0,
+	0,0,255,255,0,0,0,0,0,0,1,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,97,0,0,0,90,0,0,0,
+	101,0,0,0,7,0,0,0,100,0,0,0,3,0,1,0,
+	112,0,0,0,2,0,1,0,1,0,254,255,3,0,0,0,
+	0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
+	109,0,0,0,74,0,0,0,113,0,0,0,7,0,0,0,
+	112,0,0,0,3,0,1,0,124,0,0,0,2,0,1,0,
+	2,0,253,255,3,0,0,0,0,0,1,0,2,0,0,0,
+	0,0,0,0,0,0,0,0,121,0,0,0,58,0,0,0,
+	121,0,0,0,7,0,0,0,120,0,0,0,3,0,1,0,
+	132,0,0,0,2,0,1,0,3,0,252,255,0,0,0,0,
+	0,0,1,0,3,0,0,0,0,0,0,0,0,0,0,0,
+	129,0,0,0,106,0,0,0,133,0,0,0,7,0,0,0,
+	132,0,0,0,3,0,1,0,144,0,0,0,2,0,1,0,
+	117,110,101,109,112,108,111,121,101,100,0,0,0,0,0,0,
+	0,0,0,0,1,0,2,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	101,109,112,108,111,121,101,114,0,0,0,0,0,0,0,0,
+	0,0,0,0,1,0,2,0,12,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,12,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	115,99,104,111,111,108,0,0,0,0,0,0,1,0,2,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,115,101,108,102,69,109,112,108,
+	111,121,101,100,0,0,0,0,0,0,0,0,1,0,2,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,97,100,100,114,101,115,115,98,
+	111,111,107,46,99,97,112,110,112,58,80,101,114,115,111,110,
+	46,80,104,111,110,101,78,117,109,98,101,114,0,0,0,0,
+	4,0,0,0,1,0,1,0,47,6,133,213,4,189,224,145,
+	1,0,0,0,42,0,0,0,84,121,112,101,0,0,0,0,
+	0,0,0,0,1,0,2,0,8,0,0,0,3,0,4,0,
+	0,0,0,0,0,0,0,0,0,0,1,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,41,0,0,0,58,0,0,0,
+	41,0,0,0,7,0,0,0,40,0,0,0,3,0,1,0,
+	52,0,0,0,2,0,1,0,1,0,0,0,0,0,0,0,
+	0,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,
+	49,0,0,0,42,0,0,0,49,0,0,0,7,0,0,0,
+	48,0,0,0,3,0,1,0,60,0,0,0,2,0,1,0,
+	110,117,109,98,101,114,0,0,0,0,0,0,1,0,2,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	12,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,116,121,112,101,0,0,0,0,
+	0,0,0,0,1,0,2,0,15,0,0,0,0,0,0,0,
+	47,6,133,213,4,189,224,145,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,15,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	97,100,100,114,101,115,115,98,111,111,107,46,99,97,112,110,
+	112,58,80,101,114,115,111,110,46,80,104,111,110,101,78,117,
+	109,98,101,114,46,84,121,112,101,0,0,0,0,0,0,0,
+	0,0,0,0,1,0,1,0,0,0,0,0,1,0,2,0,
+	12,0,0,0,1,0,2,0,0,0,0,0,0,0,0,0,
+	29,0,0,0,58,0,0,0,29,0,0,0,7,0,0,0,
+	1,0,0,0,0,0,0,0,25,0,0,0,42,0,0,0,
+	25,0,0,0,7,0,0,0,2,0,0,0,0,0,0,0,
+	21,0,0,0,42,0,0,0,21,0,0,0,7,0,0,0,
+	109,111,98,105,108,101,0,0,0,0,0,0,1,0,2,0,
+	104,111,109,101,0,0,0,0,0,0,0,0,1,0,2,0,
+	119,111,114,107,0,0,0,0,0,0,0,0,1,0,2,0,
+	97,100,100,114,101,115,115,98,111,111,107,46,99,97,112,110,
+	112,58,65,100,100,114,101,115,115,66,111,111,107,0,0,0,
+	0,0,0,0,1,0,1,0,0,0,0,0,1,0,2,0,
+	4,0,0,0,3,0,4,0,0,0,0,0,0,0,0,0,
+	0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	13,0,0,0,58,0,0,0,13,0,0,0,7,0,0,0,
+	12,0,0,0,3,0,1,0,40,0,0,0,2,0,1,0,
+	112,101,111,112,108,101,0,0,0,0,0,0,1,0,2,0,
+	14,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,3,0,1,0,
+	16,0,0,0,0,0,0,0,24,188,232,50,152,142,128,152,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	14,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0
+};
@@ -2,8 +2,9 @@
 #define CAPN_9EB32E19F86EE174
 /* AUTO GENERATED - DO NOT EDIT */
 #include <capnp_c.h>
+#include <capn-arrow.h>
 
-#if CAPN_VERSION != 1
+#if CAPN_VERSION != 2
 #error "version mismatch between capnp_c.h and generated code"
 #endif
 
@@ -55,7 +56,24 @@ static const size_t Person_pointer_count = 4;
 
 static const size_t Person_struct_bytes_count = 40;
 
-uint32_t Person_get_id(Person_ptr p);
+static const uint64_t Person_id_mask = (uint64_t) 1 << 0;
+
+static const uint64_t Person_name_mask = (uint64_t) 1 << 1;
+
+static const uint64_t Person_email_mask = (uint64_t) 1 << 2;
+
+static const uint64_t Person_phones_mask = (uint64_t) 1 << 3;
+
+static const uint64_t Person_employment_mask = (uint64_t) 1 << 4;
+
+CAPN_INLINE uint32_t Person_get_id(Person_ptr p)
+{
+	uint32_t id;
+	id = capn_read32(p.p, 0);
+	return id;
+}
+
+int Person_list_get_id_column(Person_list l, int start, int n, uint32_t *out);
 
 capn_text Person_get_name(Person_ptr p);
 
@@ -63,7 +81,10 @@ capn_text Person_get_email(Person_ptr p);
 
 Person_PhoneNumber_list Person_get_phones(Person_ptr p);
 
-void Person_set_id(Person_ptr p, uint32_t id);
+CAPN_INLINE void Person_set_id(Person_ptr p, uint32_t id)
+{
+	capn_write32(p.p, 0, id);
+}
 
 void Person_set_name(Person_ptr p, capn_text name);
 
@@ -71,6 +92,8 @@ void Person_set_email(Person_ptr p, capn_text email);
 
 void Person_set_phones(Person_ptr p, Person_PhoneNumber_list phones);
 
+int Person_list_to_arrow(Person_list l, struct ArrowArray *array, struct ArrowSchema *schema);
+
 struct Person_PhoneNumber {
 	capn_text number;
 	enum Person_PhoneNumber_Type type;
@@ -82,13 +105,29 @@ static const size_t Person_PhoneNumber_pointer_count = 1;
 
 static const size_t Person_PhoneNumber_struct_bytes_count = 16;
 
+static const uint64_t Person_PhoneNumber_number_mask = (uint64_t) 1 << 0;
+
+static const uint64_t Person_PhoneNumber_type_mask = (uint64_t) 1 << 1;
+
 capn_text Person_PhoneNumber_get_number(Person_PhoneNumber_ptr p);
 
-enum Person_PhoneNumber_Type Person_PhoneNumber_get_type(Person_PhoneNumber_ptr p);
+CAPN_INLINE enum Person_PhoneNumber_Type Person_PhoneNumber_get_type(Person_PhoneNumber_ptr p)
+{
+	enum Person_PhoneNumber_Type type;
+	type = (enum Person_PhoneNumber_Type)(int) capn_read16(p.p, 0);
+	return type;
+}
+
+int Person_PhoneNumber_list_get_type_column(Person_PhoneNumber_list l, int start, int n, enum Person_PhoneNumber_Type *out);
 
 void Person_PhoneNumber_set_number(Person_PhoneNumber_ptr p, capn_text number);
 
-void Person_PhoneNumber_set_type(Person_PhoneNumber_ptr p, enum Person_PhoneNumber_Type type);
+CAPN_INLINE void Person_PhoneNumber_set_type(Person_PhoneNumber_ptr p, enum Person_PhoneNumber_Type type)
+{
+	capn_write16(p.p, 0, (uint16_t) (type));
+}
+
+int Person_PhoneNumber_list_to_arrow(Person_PhoneNumber_list l, struct ArrowArray *array, struct ArrowSchema *schema);
 
 struct AddressBook {
 	Person_list people;
@@ -100,10 +139,14 @@ static const size_t AddressBook_pointer_count = 1;
 
 static const size_t AddressBook_struct_bytes_count = 8;
 
+static const uint64_t AddressBook_people_mask = (uint64_t) 1 << 0;
+
 Person_list AddressBook_get_people(AddressBook_ptr p);
 
 void AddressBook_set_people(AddressBook_ptr p, Person_list people);
 
+int AddressBook_list_to_arrow(AddressBook_list l, struct ArrowArray *array, struct ArrowSchema *schema);
+
 Person_ptr new_Person(struct capn_segment*);
 Person_PhoneNumber_ptr new_Person_PhoneNumber(struct capn_segment*);
 AddressBook_ptr new_AddressBook(struct capn_segment*);
@@ -116,6 +159,10 @@ void read_Person(struct Person*, Person_ptr);
 void read_Person_PhoneNumber(struct Person_PhoneNumber*, Person_PhoneNumber_ptr);
 void read_AddressBook(struct AddressBook*, AddressBook_ptr);
 
+void read_Person_fields(struct Person*, Person_ptr, uint64_t mask);
+void read_Person_PhoneNumber_fields(struct Person_PhoneNumber*, Person_PhoneNumber_ptr, uint64_t mask);
+void read_AddressBook_fields(struct AddressBook*, AddressBook_ptr, uint64_t mask);
+
 void write_Person(const struct Person*, Person_ptr);
 void write_Person_PhoneNumber(const struct Person_PhoneNumber*, Person_PhoneNumber_ptr);
 void write_AddressBook(const struct AddressBook*, AddressBook_ptr);
@@ -128,6 +175,16 @@ void set_Person(const struct Person*, Person_list, int i);
 void set_Person_PhoneNumber(const struct Person_PhoneNumber*, Person_PhoneNumber_list, int i);
 void set_AddressBook(const struct AddressBook*, AddressBook_list, int i);
 
+int read_Person_range(Person_list, int start, int n, struct Person *out);
+int read_Person_PhoneNumber_range(Person_PhoneNumber_list, int start, int n, struct Person_PhoneNumber *out);
+int read_AddressBook_range(AddressBook_list, int start, int n, struct AddressBook *out);
+
+int write_Person_range(Person_list, int start, int n, const struct Person *in);
+int write_Person_PhoneNumber_range(Person_PhoneNumber_list, int start, int n, const struct Person_PhoneNumber *in);
+int write_AddressBook_range(AddressBook_list, int start, int n, const struct AddressBook *in);
+
+extern const uint8_t addressbook_capnp_schema[2776];
+
 #ifdef __cplusplus
 }
 #endif
@@ -80,13 +80,42 @@ TEST(Stream, ReadStream_Even) {
   capn_free(&ctx);
 }
 
-static struct capn_segment *CreateSmallSegment(void *u, uint32_t id, int sz) {
+static struct capn_segment *CreateSmallSegment(void *u, uint32_t id, size_t sz) {
   struct capn_segment *s = (struct capn_segment*) calloc(1, sizeof(*s));
   s->data = (char*) calloc(1, sz);
   s->cap = sz;
   return s;
 }
 
+TEST(Stream, ReadOversizedHeader) {
+  // one segment of 2^28 - 1 words, but no data behind the header
+  AlignedData<1> data = {{
+    0, 0, 0, 0, // num of segs - 1
+    0xff, 0xff, 0xff, 0x0f,
+  }};
+
+  struct capn ctx;
+  EXPECT_EQ(-1, capn_init_mem(&ctx, data.bytes, 8, 0));
+
+  // the same header packed: two bytes of input can't expand to that much
+  const uint8_t packed[] = {0xf0, 0xff, 0xff, 0xff, 0x0f, 0x00, 0x00};
+  EXPECT_EQ(-1, capn_init_mem(&ctx, packed, sizeof(packed), 1));
+
+  // two segments of 2^32 - 1 words are over CAPN_MAX_MESSAGE_SIZE
+  AlignedData<2> big = {{
+    1, 0, 0, 0, // num of segs - 1
+    0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff,
+    0, 0, 0, 0,
+  }};
+  FILE *f = tmpfile();
+  ASSERT_TRUE(f != NULL);
+  ASSERT_EQ(1u, fwrite(big.bytes, sizeof(big.bytes), 1, f));
+  rewind(f);
+  EXPECT_EQ(-1, capn_init_fp(&ctx, f, 0));
+  fclose(f);
+}
+
 TEST(Stream, SizeEmptyStream) {
   struct capn ctx;
   capn_init_malloc(&ctx);
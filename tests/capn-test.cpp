@@ -8,6 +8,10 @@
 
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 static int g_AddTag = 1;
 #define ADD_TAG g_AddTag
@@ -271,7 +275,7 @@ TEST(WireFormat, StructRoundTrip_OneSegment) {
   checkStruct(&ctx2);
 }
 
-static struct capn_segment *CreateSmallSegment(void *u, uint32_t id, int sz) {
+static struct capn_segment *CreateSmallSegment(void *u, uint32_t id, size_t sz) {
   struct capn_segment *s = (struct capn_segment*) calloc(1, sizeof(*s));
   s->data = (char*) calloc(1, sz);
   s->cap = sz;
@@ -387,7 +391,7 @@ TEST(WireFormat, StructRoundTrip_OneSegmentPerAllocation_NoTag) {
 }
 
 
-static struct capn_segment *CreateSegment64(void *u, uint32_t id, int sz) {
+static struct capn_segment *CreateSegment64(void *u, uint32_t id, size_t sz) {
   if (sz < 64) {
     sz = 64;
   }
@@ -447,6 +451,1592 @@ TEST(WireFormat, CopyStruct) {
   checkStruct(&ctx2.capn);
 }
 
+TEST(WireFormat, CopyDeepChain) {
+  Session ctx1, ctx2;
+  const int depth = 500;
+
+  capn_ptr root = capn_root(&ctx1.capn);
+  capn_ptr parent = root;
+  for (int i = 0; i < depth; i++) {
+    capn_ptr s = capn_new_struct(root.seg, 8, 1);
+    ASSERT_EQ(0, capn_write32(s, 0, i));
+    ASSERT_EQ(0, capn_setp(parent, 0, s));
+    parent = s;
+  }
+
+  capn_ptr src = capn_getp(capn_root(&ctx1.capn), 0, 1);
+  EXPECT_EQ(0, capn_setp(capn_root(&ctx2.capn), 0, src));
+  EXPECT_TRUE(ctx2.capn.copy == NULL);
+
+  capn_ptr p = capn_getp(capn_root(&ctx2.capn), 0, 1);
+  for (int i = 0; i < depth; i++) {
+    ASSERT_EQ(CAPN_STRUCT, p.type);
+    EXPECT_EQ((uint32_t) i, capn_read32(p, 0));
+    p = capn_getp(p, 0, 1);
+  }
+  EXPECT_EQ(CAPN_NULL, p.type);
+}
+
+TEST(WireFormat, CopySharedAndPointerFree) {
+  Session ctx1, ctx2;
+
+  capn_ptr root = capn_root(&ctx1.capn);
+  capn_ptr s = capn_new_struct(root.seg, 0, 3);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+
+  capn_text text = {5, "hello", NULL};
+  ASSERT_EQ(0, capn_set_text(s, 0, text));
+  ASSERT_EQ(0, capn_setp(s, 1, capn_getp(s, 0, 1)));
+
+  capn_ptr list = capn_new_list(s.seg, 100, 8, 1);
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(0, capn_write64(capn_getp(list, i, 1), 0, 1000 + i));
+  }
+  ASSERT_EQ(0, capn_setp(s, 2, list));
+
+  capn_ptr src = capn_getp(capn_root(&ctx1.capn), 0, 1);
+  EXPECT_EQ(0, capn_setp(capn_root(&ctx2.capn), 0, src));
+
+  capn_ptr d = capn_getp(capn_root(&ctx2.capn), 0, 1);
+  capn_text t0 = capn_get_text(d, 0, text);
+  capn_text t1 = capn_get_text(d, 1, text);
+  EXPECT_STREQ("hello", t0.str);
+  EXPECT_EQ(t0.str, t1.str);
+
+  capn_ptr dlist = capn_getp(d, 2, 1);
+  ASSERT_EQ(100, dlist.len);
+  for (int i = 0; i < 100; i++) {
+    capn_ptr m = capn_getp(dlist, i, 1);
+    EXPECT_EQ(UINT64_C(1000) + i, capn_read64(m, 0));
+    EXPECT_EQ(CAPN_NULL, capn_getp(m, 0, 1).type);
+  }
+}
+
+TEST(WireFormat, CopyKeepCopyState) {
+  Session ctx1, ctx2;
+  setupStruct(&ctx1.capn);
+  capn_ptr src = capn_getp(capn_getp(capn_root(&ctx1.capn), 0, 1), 1, 1);
+
+  capn_ptr dst = capn_new_struct(capn_root(&ctx2.capn).seg, 0, 4);
+  ASSERT_EQ(0, capn_setp(capn_root(&ctx2.capn), 0, dst));
+
+  // Without keep_copy each call makes a new copy.
+  EXPECT_EQ(0, capn_setp(dst, 0, src));
+  EXPECT_EQ(0, capn_setp(dst, 1, src));
+  EXPECT_TRUE(ctx2.capn.copy == NULL);
+  EXPECT_NE(capn_getp(dst, 0, 1).data, capn_getp(dst, 1, 1).data);
+
+  // With keep_copy the second call points at the first copy.
+  ctx2.capn.keep_copy = 1;
+  EXPECT_EQ(0, capn_setp(dst, 2, src));
+  EXPECT_EQ(0, capn_setp(dst, 3, src));
+  EXPECT_TRUE(ctx2.capn.copy != NULL);
+  EXPECT_EQ(capn_getp(dst, 2, 1).data, capn_getp(dst, 3, 1).data);
+  EXPECT_EQ(202u, capn_get32(capn_list32{capn_getp(dst, 3, 1)}, 2));
+
+  capn_reset_copy(&ctx2.capn);
+  EXPECT_TRUE(ctx2.capn.copy == NULL);
+}
+
+static void checkStructList(capn_ptr list) {
+  ASSERT_EQ(CAPN_LIST, list.type);
+  ASSERT_EQ(4, list.len);
+  for (int i = 0; i < 4; i++) {
+    capn_ptr element = capn_getp(list, i, 1);
+    EXPECT_EQ(300u + i, capn_read32(element, 0));
+    EXPECT_EQ(400u + i, capn_read32(capn_getp(element, 0, 1), 0));
+  }
+}
+
+TEST(Share, SharesSegmentWithoutCopying) {
+  struct capn src, dst;
+  capn_init_malloc(&src);
+  capn_init_malloc(&dst);
+  setupStruct(&src);
+
+  capn_ptr list = capn_getp(capn_getp(capn_root(&src), 0, 1), 2, 1);
+  capn_ptr root = capn_root(&dst);
+  capn_ptr s = capn_new_struct(root.seg, 8, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  ASSERT_EQ(1, dst.segnum);
+
+  EXPECT_EQ(0, capn_share(s, 0, list));
+  EXPECT_EQ(0, capn_share(s, 1, list));
+  EXPECT_EQ(2, dst.segnum);
+  EXPECT_EQ(list.seg->data, dst.seglist->next->data);
+  EXPECT_EQ(list.data, capn_getp(s, 0, 1).data);
+  EXPECT_EQ(list.data, capn_getp(s, 1, 1).data);
+
+  // imported segments are read-only
+  capn_ptr member = capn_getp(capn_getp(s, 0, 1), 0, 1);
+  EXPECT_EQ(-1, capn_setp(member, 0, s));
+  EXPECT_EQ(300u, capn_read32(member, 0));
+
+  // the shared data survives the source session
+  capn_free(&src);
+  checkStructList(capn_getp(s, 0, 1));
+
+  std::vector<uint8_t> buf(capn_size(&dst) + 64);
+  int64_t sz = capn_write_mem(&dst, buf.data(), buf.size(), 0);
+  ASSERT_GT(sz, 0);
+  capn_free(&dst);
+
+  struct capn rd;
+  ASSERT_EQ(0, capn_init_mem(&rd, buf.data(), sz, 0));
+  capn_ptr r = capn_getp(capn_root(&rd), 0, 1);
+  checkStructList(capn_getp(r, 0, 1));
+  checkStructList(capn_getp(r, 1, 1));
+  capn_free(&rd);
+}
+
+TEST(Share, FreeDestinationFirst) {
+  struct capn src, dst;
+  capn_init_malloc(&src);
+  capn_init_malloc(&dst);
+  setupStruct(&src);
+
+  capn_ptr list = capn_getp(capn_getp(capn_root(&src), 0, 1), 2, 1);
+  EXPECT_EQ(0, capn_share(capn_root(&dst), 0, list));
+  EXPECT_EQ(2, dst.segnum);
+  capn_free(&dst);
+
+  checkStruct(&src);
+  capn_free(&src);
+}
+
+TEST(Share, FallsBackToCopy) {
+  Session src, dst;
+  src.capn.create = &CreateSmallSegment;
+  setupStruct(&src.capn);
+
+  // the list members point into other segments
+  capn_ptr list = capn_getp(capn_getp(capn_root(&src.capn), 0, 1), 2, 1);
+  EXPECT_EQ(0, capn_share(capn_root(&dst.capn), 0, list));
+  EXPECT_EQ(1, dst.capn.segnum);
+  EXPECT_TRUE(src.capn.shared == NULL);
+  checkStructList(capn_getp(capn_root(&dst.capn), 0, 1));
+
+  // so do cyclic structures
+  Session src2;
+  setupStruct(&src2.capn);
+  EXPECT_EQ(0, capn_share(capn_root(&dst.capn), 0, capn_getp(capn_root(&src2.capn), 0, 1)));
+  EXPECT_EQ(1, dst.capn.segnum);
+  checkStruct(&dst.capn);
+}
+
+// Builds a chain of n structs in which each struct points at the next one
+// twice, so walking every pointer visits 2^n structs.
+static capn_ptr setupDag(struct capn *c, int n) {
+  capn_ptr root = capn_root(c);
+  capn_ptr top = capn_new_struct(root.seg, 8, 2), prev = top;
+  for (int i = 0; i < n; i++) {
+    capn_ptr s = capn_new_struct(root.seg, 8, 2);
+    capn_write64(s, 0, i);
+    EXPECT_EQ(0, capn_setp(prev, 0, s));
+    EXPECT_EQ(0, capn_setp(prev, 1, s));
+    prev = s;
+  }
+  EXPECT_EQ(0, capn_setp(root, 0, top));
+  return capn_getp(root, 0, 1);
+}
+
+TEST(Share, SharedSubtreesAreCopied) {
+  Session src, dst;
+  capn_ptr top = setupDag(&src.capn, 60);
+
+  // walking the DAG would take 2^60 steps, so it is copied once instead
+  EXPECT_EQ(0, capn_share(capn_root(&dst.capn), 0, top));
+  EXPECT_EQ(1, dst.capn.segnum);
+  EXPECT_TRUE(src.capn.shared == NULL);
+  capn_ptr p = capn_getp(capn_root(&dst.capn), 0, 1);
+  for (int i = 0; i < 60; i++) {
+    capn_ptr a = capn_getp(p, 0, 1), b = capn_getp(p, 1, 1);
+    ASSERT_EQ(a.data, b.data);
+    EXPECT_EQ((uint64_t) i, capn_read64(a, 0));
+    p = a;
+  }
+}
+
+static int g_Released;
+
+static void ReleaseBlob(const void *buf, size_t len) {
+  g_Released++;
+}
+
+static std::vector<uint8_t> g_FdOutput;
+
+static ssize_t WriteToVector(int fd, const void *p, size_t count) {
+  const uint8_t *b = (const uint8_t*) p;
+  g_FdOutput.insert(g_FdOutput.end(), b, b + count);
+  return count;
+}
+
+static void checkBlob(const std::vector<uint8_t> &msg, size_t len, int packed) {
+  struct capn rd;
+  ASSERT_EQ(0, capn_init_mem(&rd, msg.data(), msg.size(), packed));
+  capn_data d = capn_get_data(capn_getp(capn_root(&rd), 0, 1), 0);
+  ASSERT_EQ((int) len, d.p.len);
+  for (size_t i = 0; i < len; i++) {
+    ASSERT_EQ((uint8_t) (i * 7), (uint8_t) d.p.data[i]);
+  }
+  capn_free(&rd);
+}
+
+TEST(External, BlobIsNotCopied) {
+  const size_t len = 100003;
+  std::vector<uint64_t> storage((len + 7) / 8);
+  uint8_t *blob = (uint8_t*) storage.data();
+  for (size_t i = 0; i < len; i++) {
+    blob[i] = (uint8_t) (i * 7);
+  }
+
+  g_Released = 0;
+  struct capn c;
+  capn_init_malloc(&c);
+  capn_ptr root = capn_root(&c);
+  capn_ptr s = capn_new_struct(root.seg, 8, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+
+  capn_data d = capn_new_data_external(&c, blob, len, &ReleaseBlob);
+  ASSERT_EQ(CAPN_LIST, d.p.type);
+  EXPECT_EQ((char*) blob, d.p.data);
+  ASSERT_EQ(0, capn_setp(s, 0, d.p));
+  EXPECT_EQ((char*) blob, capn_get_data(s, 0).p.data);
+
+  // the blob segment is read-only
+  EXPECT_EQ(-1, capn_setp(d.p, 0, s));
+
+  for (int packed = 0; packed < 2; packed++) {
+    std::vector<uint8_t> msg(2 * capn_size(&c));
+    int64_t sz = capn_write_mem(&c, msg.data(), msg.size(), packed);
+    ASSERT_GT(sz, 0);
+    msg.resize(sz);
+    checkBlob(msg, len, packed);
+
+    g_FdOutput.clear();
+    EXPECT_EQ(sz, capn_write_fd(&c, &WriteToVector, 0, packed));
+    EXPECT_EQ(msg, g_FdOutput);
+  }
+
+  EXPECT_EQ(0, g_Released);
+  capn_free(&c);
+  EXPECT_EQ(1, g_Released);
+}
+
+TEST(External, SharedBlobOutlivesSession) {
+  uint64_t storage[4] = {0};
+  memcpy(storage, "an external blob", 16);
+
+  g_Released = 0;
+  struct capn src, dst;
+  capn_init_malloc(&src);
+  capn_init_malloc(&dst);
+  capn_data d = capn_new_data_external(&src, storage, 16, &ReleaseBlob);
+  ASSERT_EQ(0, capn_setp(capn_root(&src), 0, d.p));
+  ASSERT_EQ(0, capn_share(capn_root(&dst), 0, d.p));
+
+  capn_free(&src);
+  EXPECT_EQ(0, g_Released);
+  capn_data got = capn_get_data(capn_root(&dst), 0);
+  EXPECT_EQ((char*) storage, got.p.data);
+  capn_free(&dst);
+  EXPECT_EQ(1, g_Released);
+}
+
+TEST(External, UnalignedBlobIsCopied) {
+  uint64_t storage[4] = {0};
+  const char *blob = (const char*) storage + 1;
+  memcpy((char*) blob, "unaligned", 9);
+
+  g_Released = 0;
+  Session ctx;
+  capn_data d = capn_new_data_external(&ctx.capn, blob, 9, &ReleaseBlob);
+  ASSERT_EQ(CAPN_LIST, d.p.type);
+  EXPECT_NE(blob, d.p.data);
+  EXPECT_EQ(0, memcmp(blob, d.p.data, 9));
+  EXPECT_EQ(1, g_Released);
+
+  EXPECT_EQ(CAPN_NULL, capn_new_data_external(&ctx.capn, blob, 1 << 29, &ReleaseBlob).p.type);
+  EXPECT_EQ(1, g_Released);
+}
+
+TEST(External, ReadsStopAtBlobEnd) {
+  // no padding after the blob, so reading past it is caught by ASan
+  std::unique_ptr<char[]> storage(new char[13]);
+  char *blob = storage.get();
+  memcpy(blob, "thirteen byte", 13);
+
+  Session ctx;
+  capn_ptr root = capn_root(&ctx.capn);
+  capn_ptr s = capn_new_struct(root.seg, 0, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_data d = capn_new_data_external(&ctx.capn, blob, 13, NULL);
+  ASSERT_EQ((char*) blob, d.p.data);
+  ASSERT_EQ(0, capn_setp(s, 0, d.p));
+  EXPECT_EQ(13, capn_get_data(s, 0).p.len);
+
+  // the tag of the double far pointer to the blob, stretched to its whole
+  // last word
+  uint64_t val = capn_flip64(*(uint64_t*) s.data);
+  ASSERT_EQ(6u, val & 7);
+  struct capn_segment *pad = ctx.capn.seglist;
+  while (pad->id != (uint32_t) (val >> 32)) {
+    pad = pad->next;
+  }
+  uint64_t *tag = (uint64_t*) (pad->data + (val & 0xFFFFFFF8u)) + 1;
+  uint64_t good = *tag;
+  *tag = capn_flip64((capn_flip64(good) & 0x7FFFFFFFFull) | (UINT64_C(16) << 35));
+  EXPECT_EQ(CAPN_NULL, capn_getp(s, 0, 1).type);
+  *tag = good;
+  EXPECT_EQ(13, capn_get_data(s, 0).p.len);
+}
+
+TEST(Compact, SingleSegment) {
+  Session src;
+  src.capn.create = &CreateSmallSegment;
+  setupStruct(&src.capn);
+  ASSERT_EQ(16, src.capn.segnum);
+
+  for (int order = CAPN_DEPTH_FIRST; order <= CAPN_BREADTH_FIRST; order++) {
+    Session dst;
+    ASSERT_EQ(0, capn_compact(&src.capn, &dst.capn, (enum CAPN_ORDER) order));
+    ASSERT_EQ(1, dst.capn.segnum);
+    // the 38 words of StructRoundTrip_OneSegment
+    EXPECT_EQ(38*8, dst.capn.seglist->len);
+    checkStruct(&dst.capn);
+
+    // compacting into a non-empty session fails
+    EXPECT_EQ(-1, capn_compact(&src.capn, &dst.capn, (enum CAPN_ORDER) order));
+  }
+}
+
+TEST(Compact, DropsOrphans) {
+  Session src, dst;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr s = capn_new_struct(root.seg, 8, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  for (int i = 0; i < 100; i++) {
+    char str[32];
+    snprintf(str, sizeof(str), "value %d", i);
+    capn_text t = {(int) strlen(str), str, NULL};
+    ASSERT_EQ(0, capn_set_text(s, 0, t));
+  }
+
+  ASSERT_EQ(0, capn_compact(&src.capn, &dst.capn, CAPN_DEPTH_FIRST));
+  // root pointer, struct and "value 99"
+  EXPECT_EQ(8 + 16 + 16, dst.capn.seglist->len);
+  capn_text def = {0, "", NULL};
+  EXPECT_STREQ("value 99", capn_get_text(capn_getp(capn_root(&dst.capn), 0, 1), 0, def).str);
+}
+
+TEST(Compact, Order) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr r = capn_new_struct(root.seg, 0, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, r));
+  for (int i = 0; i < 2; i++) {
+    capn_ptr c = capn_new_struct(root.seg, 8, 1);
+    capn_ptr g = capn_new_struct(root.seg, 8, 0);
+    capn_write64(c, 0, 10 + i);
+    capn_write64(g, 0, 20 + i);
+    ASSERT_EQ(0, capn_setp(c, 0, g));
+    ASSERT_EQ(0, capn_setp(r, i, c));
+  }
+
+  Session dfs, bfs;
+  ASSERT_EQ(0, capn_compact(&src.capn, &dfs.capn, CAPN_DEPTH_FIRST));
+  ASSERT_EQ(0, capn_compact(&src.capn, &bfs.capn, CAPN_BREADTH_FIRST));
+
+  // words: root ptr, r (2 ptrs), then 10/20/11/21 depth first or
+  // 10/11/20/21 breadth first (each child has a pointer after its data)
+  const uint64_t *d = (const uint64_t*) dfs.capn.seglist->data;
+  const uint64_t *b = (const uint64_t*) bfs.capn.seglist->data;
+  EXPECT_EQ(UINT64_C(10), capn_flip64(d[3]));
+  EXPECT_EQ(UINT64_C(20), capn_flip64(d[5]));
+  EXPECT_EQ(UINT64_C(11), capn_flip64(d[6]));
+  EXPECT_EQ(UINT64_C(21), capn_flip64(d[8]));
+  EXPECT_EQ(UINT64_C(10), capn_flip64(b[3]));
+  EXPECT_EQ(UINT64_C(11), capn_flip64(b[5]));
+  EXPECT_EQ(UINT64_C(20), capn_flip64(b[7]));
+  EXPECT_EQ(UINT64_C(21), capn_flip64(b[8]));
+}
+
+TEST(Compact, OverlappedPointers) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr s = capn_new_struct(root.seg, 0, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_ptr l = capn_new_list(root.seg, 64, 1, 0);
+  ASSERT_EQ(0, capn_setp(s, 0, l));
+  // the second pointer points into the middle of the first list
+  l.data += 8;
+  l.len -= 8;
+  ASSERT_EQ(0, capn_setp(s, 1, l));
+
+  Session dst, cmp;
+  EXPECT_EQ(-1, capn_setp(capn_root(&dst.capn), 0, s));
+  EXPECT_EQ(-1, capn_compact(&src.capn, &cmp.capn, CAPN_DEPTH_FIRST));
+
+  // the same list twice is still copied once
+  l.data -= 8;
+  l.len += 8;
+  ASSERT_EQ(0, capn_setp(s, 1, l));
+  Session ok;
+  ASSERT_EQ(0, capn_compact(&src.capn, &ok.capn, CAPN_DEPTH_FIRST));
+  // root pointer, struct and one list
+  EXPECT_EQ(8 + 16 + 64, ok.capn.seglist->len);
+}
+
+TEST(Compact, OverlappedStructs) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr l = capn_new_ptr_list(root.seg, 64);
+  ASSERT_EQ(0, capn_setp(root, 0, l));
+  capn_ptr data = capn_new_struct(root.seg, 64*8, 0);
+
+  // each struct starts one word into the one before, so that copying them
+  // one by one would take 64 times as much room as they share
+  for (int i = 0; i < 64; i++) {
+    capn_ptr s = data;
+    s.data += 8*i;
+    s.datasz = 8*(64 - i);
+    ASSERT_EQ(0, capn_setp(l, i, s));
+  }
+
+  Session dst, cmp;
+  EXPECT_EQ(-1, capn_setp(capn_root(&dst.capn), 0, l));
+  EXPECT_EQ(-1, capn_compact(&src.capn, &cmp.capn, CAPN_DEPTH_FIRST));
+}
+
+// Builds the same content with the given padding in every struct, and an
+// orphaned text first if orphan is set.
+static void setupCanonical(struct capn *c, int pad, bool orphan) {
+  capn_ptr root = capn_root(c);
+  if (orphan) {
+    capn_new_string(root.seg, "orphan", -1);
+  }
+
+  capn_ptr s = capn_new_struct(root.seg, 8 + pad*8, 3 + pad);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_write64(s, 0, 7);
+  capn_text hello = {5, "hello", NULL};
+  ASSERT_EQ(0, capn_set_text(s, 0, hello));
+
+  capn_ptr list = capn_new_list(s.seg, 3, 16 + pad*8, 1 + pad);
+  ASSERT_EQ(0, capn_setp(s, 1, list));
+  for (int i = 0; i < 3; i++) {
+    capn_ptr m = capn_getp(list, i, 1);
+    capn_write32(m, 0, i);
+    if (i == 1) {
+      capn_text world = {5, "world", NULL};
+      ASSERT_EQ(0, capn_set_text(m, 0, world));
+    }
+  }
+
+  capn_list1 bits = capn_new_list1(s.seg, 3);
+  capn_set1(bits, 0, 1);
+  capn_set1(bits, 2, 1);
+  if (pad) {
+    // padding bits are not part of the content
+    *(uint8_t*) bits.p.data |= 0xF0;
+  }
+  ASSERT_EQ(0, capn_setp(s, 2, bits.p));
+}
+
+static std::vector<uint64_t> canonicalWords(capn_ptr p) {
+  Session dst;
+  EXPECT_EQ(0, capn_canonicalize(p, &dst.capn));
+  EXPECT_EQ(1, dst.capn.segnum);
+  const uint64_t *d = (const uint64_t*) dst.capn.seglist->data;
+  std::vector<uint64_t> words;
+  for (size_t i = 0; i < dst.capn.seglist->len / 8; i++) {
+    words.push_back(capn_flip64(d[i]));
+  }
+  return words;
+}
+
+TEST(Canonical, IndependentOfLayout) {
+  Session a, b;
+  b.capn.create = &CreateSmallSegment;
+  setupCanonical(&a.capn, 0, false);
+  setupCanonical(&b.capn, 2, true);
+  ASSERT_GT(b.capn.segnum, 1);
+
+  capn_ptr ra = capn_getp(capn_root(&a.capn), 0, 1);
+  capn_ptr rb = capn_getp(capn_root(&b.capn), 0, 1);
+  std::vector<uint64_t> wa = canonicalWords(ra);
+  EXPECT_EQ(wa, canonicalWords(rb));
+
+  uint64_t ha[2], hb[2];
+  ASSERT_EQ(0, capn_hash(ra, 0, ha));
+  ASSERT_EQ(0, capn_hash(rb, 0, hb));
+  EXPECT_EQ(ha[0], hb[0]);
+  EXPECT_EQ(ha[1], hb[1]);
+
+  // the canonical message reads back and hashes the same
+  Session canon;
+  ASSERT_EQ(0, capn_canonicalize(ra, &canon.capn));
+  capn_ptr rc = capn_getp(capn_root(&canon.capn), 0, 1);
+  uint64_t hc[2];
+  ASSERT_EQ(0, capn_hash(rc, 0, hc));
+  EXPECT_EQ(ha[0], hc[0]);
+  EXPECT_EQ(ha[1], hc[1]);
+  EXPECT_EQ(7, capn_read64(rc, 0));
+  capn_text def = {0, "", NULL};
+  EXPECT_STREQ("hello", capn_get_text(rc, 0, def).str);
+  capn_ptr list = capn_getp(rc, 1, 1);
+  EXPECT_EQ(3, list.len);
+  EXPECT_EQ(2, capn_read32(capn_getp(list, 2, 1), 0));
+  EXPECT_STREQ("world", capn_get_text(capn_getp(list, 1, 1), 0, def).str);
+}
+
+TEST(Canonical, Layout) {
+  Session src;
+  setupCanonical(&src.capn, 1, true);
+  std::vector<uint64_t> w = canonicalWords(capn_getp(capn_root(&src.capn), 0, 1));
+
+  std::vector<uint64_t> expect = {
+    UINT64_C(0x0003000100000000), // root: 1 data word, 3 pointers
+    7,
+    UINT64_C(0x0000003200000009), // "hello" at word 5
+    UINT64_C(0x0000003700000009), // 3 members of 2 words at word 6
+    UINT64_C(0x0000001900000025), // 3 bits at word 14
+    UINT64_C(0x0000006f6c6c6568),
+    UINT64_C(0x000100010000000c), // 3 members of 1 data word, 1 pointer
+    0, 0,
+    1, UINT64_C(0x0000003200000009), // "world" at word 13
+    2, 0,
+    UINT64_C(0x000000646c726f77),
+    5,
+  };
+  EXPECT_EQ(expect, w);
+}
+
+TEST(Canonical, EmptyStruct) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr s = capn_new_struct(root.seg, 16, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+
+  std::vector<uint64_t> expect = {UINT64_C(0xfffffffc)};
+  EXPECT_EQ(expect, canonicalWords(s));
+
+  uint64_t empty[2], null[2];
+  ASSERT_EQ(0, capn_hash(s, 0, empty));
+  capn_ptr p = {CAPN_NULL};
+  ASSERT_EQ(0, capn_hash(p, 0, null));
+  EXPECT_NE(empty[0], null[0]);
+}
+
+TEST(Canonical, HashDependsOnContentAndSeed) {
+  Session a, b;
+  setupCanonical(&a.capn, 0, false);
+  setupCanonical(&b.capn, 0, false);
+  capn_ptr ra = capn_getp(capn_root(&a.capn), 0, 1);
+  capn_ptr rb = capn_getp(capn_root(&b.capn), 0, 1);
+  capn_write32(capn_getp(capn_getp(rb, 1, 1), 2, 1), 4, 1);
+
+  uint64_t ha[2], hb[2], hs[2];
+  ASSERT_EQ(0, capn_hash(ra, 0, ha));
+  ASSERT_EQ(0, capn_hash(rb, 0, hb));
+  ASSERT_EQ(0, capn_hash(ra, 1, hs));
+  EXPECT_NE(ha[0], hb[0]);
+  EXPECT_NE(ha[1], hb[1]);
+  EXPECT_NE(ha[0], hs[0]);
+}
+
+TEST(Canonical, RecursiveMessage) {
+  Session src, dst;
+  setupStruct(&src.capn);
+  capn_ptr root = capn_getp(capn_root(&src.capn), 0, 1);
+  uint64_t h[2];
+  EXPECT_EQ(-1, capn_hash(root, 0, h));
+  EXPECT_EQ(-1, capn_canonicalize(root, &dst.capn));
+}
+
+TEST(Canonical, SharedSubtrees) {
+  uint64_t h[2], ch[2];
+
+  // a few levels of sharing are expanded into a tree of 2^8 copies
+  Session small, canon;
+  capn_ptr root = setupDag(&small.capn, 8);
+  ASSERT_EQ(0, capn_hash(root, 0, h));
+  ASSERT_EQ(0, capn_canonicalize(root, &canon.capn));
+  ASSERT_EQ(0, capn_hash(capn_getp(capn_root(&canon.capn), 0, 1), 0, ch));
+  EXPECT_EQ(h[0], ch[0]);
+  EXPECT_EQ(h[1], ch[1]);
+
+  // but not 2^60
+  Session large, dst;
+  root = setupDag(&large.capn, 60);
+  EXPECT_EQ(-1, capn_hash(root, 0, h));
+  EXPECT_EQ(-1, capn_canonicalize(root, &dst.capn));
+  EXPECT_EQ(0, dst.capn.segnum);
+}
+
+TEST(Template, InstantiateStruct) {
+  Session src;
+  src.capn.create = &CreateSmallSegment;
+  setupStruct(&src.capn);
+
+  struct capn_template *t = capn_template_compile(&src.capn);
+  ASSERT_TRUE(t != NULL);
+  // the 38 words of StructRoundTrip_OneSegment
+  EXPECT_EQ(38*8, t->len);
+
+  for (int i = 0; i < 3; i++) {
+    Session dst;
+    capn_ptr root = capn_template_instantiate(t, &dst.capn, NULL);
+    ASSERT_EQ(CAPN_STRUCT, root.type);
+    EXPECT_EQ(1, dst.capn.segnum);
+    checkStruct(&dst.capn);
+
+    // only empty sessions can be instantiated into
+    EXPECT_EQ(CAPN_NULL, capn_template_instantiate(t, &dst.capn, NULL).type);
+  }
+
+  capn_template_free(t);
+}
+
+TEST(Template, PatchObjects) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr s = capn_new_struct(root.seg, 8, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_ptr list = capn_new_list(s.seg, 2, 8, 1);
+  ASSERT_EQ(0, capn_setp(s, 0, list));
+  capn_text name = {4, "name", NULL};
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(0, capn_set_text(capn_getp(list, i, 1), 0, name));
+  }
+  ASSERT_EQ(0, capn_set_text(s, 1, name));
+
+  struct capn_template *t = capn_template_compile(&src.capn);
+  ASSERT_TRUE(t != NULL);
+  // root, list, its two texts and the last text
+  ASSERT_EQ(5, t->num);
+  EXPECT_EQ(CAPN_STRUCT, t->objs[0].type);
+  EXPECT_EQ(CAPN_LIST, t->objs[1].type);
+  EXPECT_EQ(2, t->objs[1].len);
+  EXPECT_EQ(5, t->objs[4].len);
+
+  for (int i = 0; i < 100; i++) {
+    Session dst;
+    capn_ptr objs[5];
+    capn_ptr r = capn_template_instantiate(t, &dst.capn, objs);
+    ASSERT_EQ(r.data, objs[0].data);
+    capn_write64(objs[0], 0, i);
+    capn_write32(capn_getp(objs[1], 1, 0), 0, i + 1);
+    capn_text value = {10, "some value", NULL};
+    ASSERT_EQ(0, capn_set_text(objs[0], 1, value));
+
+    capn_ptr rr = capn_getp(capn_root(&dst.capn), 0, 1);
+    capn_text def = {0, "", NULL};
+    EXPECT_EQ((uint64_t) i, capn_read64(rr, 0));
+    capn_ptr m = capn_getp(capn_getp(rr, 0, 1), 1, 1);
+    EXPECT_EQ((uint32_t) i + 1, capn_read32(m, 0));
+    EXPECT_STREQ("name", capn_get_text(m, 0, def).str);
+    EXPECT_STREQ("some value", capn_get_text(rr, 1, def).str);
+  }
+
+  // the template itself is not modified by the instances
+  EXPECT_EQ(UINT64_C(0), capn_read64(t->objs[0], 0));
+  capn_template_free(t);
+}
+
+static std::vector<uint8_t> Gather(const struct iovec *v, int n) {
+  std::vector<uint8_t> buf;
+  for (int i = 0; i < n; i++) {
+    const uint8_t *p = (const uint8_t*) v[i].iov_base;
+    buf.insert(buf.end(), p, p + v[i].iov_len);
+  }
+  return buf;
+}
+
+TEST(Extract, InPlace) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr s = capn_new_struct(root.seg, 8, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_ptr child = capn_new_struct(root.seg, 8, 1);
+  ASSERT_EQ(0, capn_setp(s, 0, child));
+  capn_write64(child, 0, 42);
+  capn_text t = {5, "hello", NULL};
+  ASSERT_EQ(0, capn_set_text(child, 0, t));
+
+  Session tmp;
+  struct iovec v[8];
+  int n = capn_extract(child, &tmp.capn, v, 8);
+  ASSERT_EQ(2, n);
+  EXPECT_EQ(0, tmp.capn.segnum);
+  EXPECT_EQ(child.data, v[1].iov_base);
+  EXPECT_EQ(24u, v[1].iov_len);
+
+  std::vector<uint8_t> buf = Gather(v, n);
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  capn_ptr r = capn_getp(capn_root(&ctx), 0, 1);
+  capn_text def = {0, "", NULL};
+  EXPECT_EQ(UINT64_C(42), capn_read64(r, 0));
+  EXPECT_STREQ("hello", capn_get_text(r, 0, def).str);
+  capn_free(&ctx);
+}
+
+TEST(Extract, ListMemberWithHoles) {
+  Session src;
+  capn_ptr root = capn_root(&src.capn);
+  capn_ptr list = capn_new_list(root.seg, 3, 8, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, list));
+  for (int i = 0; i < 3; i++) {
+    capn_ptr m = capn_getp(list, i, 1);
+    capn_write64(m, 0, 100 + i);
+    capn_text t = {5, "abcde", NULL};
+    ASSERT_EQ(0, capn_set_text(m, 0, t));
+  }
+
+  Session tmp;
+  struct iovec v[8];
+  int n = capn_extract(capn_getp(list, 1, 1), &tmp.capn, v, 8);
+  // header, member 1, the zeroed member 2 and text 0, text 1
+  ASSERT_EQ(4, n);
+  EXPECT_EQ(0, tmp.capn.segnum);
+  EXPECT_EQ(24u, v[2].iov_len);
+
+  std::vector<uint8_t> buf = Gather(v, n);
+  EXPECT_EQ(8u + 8 + 16 + 24 + 8, buf.size());
+  // the other members are not sent
+  EXPECT_EQ(std::vector<uint8_t>(24, 0), std::vector<uint8_t>(buf.begin() + 32, buf.begin() + 56));
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  capn_ptr r = capn_getp(capn_root(&ctx), 0, 1);
+  capn_text def = {0, "", NULL};
+  EXPECT_EQ(UINT64_C(101), capn_read64(r, 0));
+  EXPECT_STREQ("abcde", capn_get_text(r, 0, def).str);
+  capn_free(&ctx);
+
+  // with too few iovecs the member is copied
+  Session tmp2;
+  n = capn_extract(capn_getp(list, 1, 1), &tmp2.capn, v, 3);
+  ASSERT_EQ(2, n);
+  EXPECT_EQ(1, tmp2.capn.segnum);
+  buf = Gather(v, n);
+  EXPECT_EQ(8u + 8 + 16 + 8, buf.size());
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  r = capn_getp(capn_root(&ctx), 0, 1);
+  EXPECT_EQ(UINT64_C(101), capn_read64(r, 0));
+  EXPECT_STREQ("abcde", capn_get_text(r, 0, def).str);
+  capn_free(&ctx);
+}
+
+TEST(Extract, CopiesFarPointers) {
+  Session src;
+  src.capn.create = &CreateSmallSegment;
+  setupStruct(&src.capn);
+
+  Session tmp;
+  struct iovec v[8];
+  int n = capn_extract(capn_getp(capn_root(&src.capn), 0, 1), &tmp.capn, v, 8);
+  ASSERT_EQ(2, n);
+  EXPECT_EQ(1, tmp.capn.segnum);
+
+  std::vector<uint8_t> buf = Gather(v, n);
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  checkStruct(&ctx);
+  capn_free(&ctx);
+}
+
+TEST(Extract, ExternalBlob) {
+  // no padding after the blob, so reading past it is caught by ASan
+  std::unique_ptr<char[]> storage(new char[13]);
+  memcpy(storage.get(), "thirteen byte", 13);
+
+  Session src;
+  capn_root(&src.capn);
+  capn_data d = capn_new_data_external(&src.capn, storage.get(), 13, NULL);
+  ASSERT_EQ(storage.get(), d.p.data);
+
+  Session tmp;
+  struct iovec v[8];
+  int n = capn_extract(d.p, &tmp.capn, v, 8);
+  // header, the blob and the zero padding of its last word
+  ASSERT_EQ(3, n);
+  EXPECT_EQ(storage.get(), v[1].iov_base);
+  EXPECT_EQ(13u, v[1].iov_len);
+  EXPECT_EQ(3u, v[2].iov_len);
+
+  std::vector<uint8_t> buf = Gather(v, n);
+  ASSERT_EQ(8u + 8 + 16, buf.size());
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  capn_ptr r = capn_getp(capn_root(&ctx), 0, 1);
+  ASSERT_EQ(13, r.len);
+  EXPECT_EQ(0, memcmp("thirteen byte", r.data, 13));
+  capn_free(&ctx);
+}
+
+TEST(Extract, SharedSubtrees) {
+  Session src;
+  capn_ptr top = setupDag(&src.capn, 60);
+
+  // each struct is sent once although it is reached 2^i times
+  Session tmp;
+  struct iovec v[8];
+  int n = capn_extract(top, &tmp.capn, v, 8);
+  ASSERT_EQ(2, n);
+  EXPECT_EQ(0, tmp.capn.segnum);
+  EXPECT_EQ(61u * 24, v[1].iov_len);
+
+  std::vector<uint8_t> buf = Gather(v, n);
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  capn_ptr p = capn_getp(capn_root(&ctx), 0, 1);
+  for (int i = 0; i < 60; i++) {
+    capn_ptr a = capn_getp(p, 0, 1), b = capn_getp(p, 1, 1);
+    ASSERT_EQ(a.data, b.data);
+    EXPECT_EQ((uint64_t) i, capn_read64(a, 0));
+    p = a;
+  }
+  capn_free(&ctx);
+}
+
+static size_t CopyMemory(struct capn *c) {
+  size_t sz = 0;
+  for (struct capn_segment *s = c->copylist; s != NULL; s = s->next) {
+    sz += s->cap;
+  }
+  return sz;
+}
+
+TEST(Extract, RepeatedCallsReuseMemory) {
+  Session src;
+  capn_ptr top = setupDag(&src.capn, 20);
+
+  Session tmp;
+  struct iovec v[8];
+  ASSERT_EQ(2, capn_extract(top, &tmp.capn, v, 8));
+  size_t first = CopyMemory(&tmp.capn);
+  EXPECT_GT(first, 0u);
+
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQ(2, capn_extract(top, &tmp.capn, v, 8));
+  }
+  EXPECT_EQ(first, CopyMemory(&tmp.capn));
+  EXPECT_TRUE(tmp.capn.copy == NULL);
+
+  // the last frame is still intact
+  std::vector<uint8_t> buf = Gather(v, 2);
+  struct capn ctx;
+  ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), buf.size(), 0));
+  EXPECT_EQ(CAPN_STRUCT, capn_getp(capn_root(&ctx), 0, 1).type);
+  capn_free(&ctx);
+}
+
+static std::vector<uint8_t> Serialize(struct capn *c) {
+  std::vector<uint8_t> buf(capn_size(c));
+  EXPECT_EQ((int64_t) buf.size(), capn_write_mem(c, buf.data(), buf.size(), 0));
+  return buf;
+}
+
+static std::vector<uint8_t> Delta(struct capn *prev, struct capn *next, int packed) {
+  std::vector<uint8_t> buf(2*capn_size(next) + 16*next->segnum);
+  int64_t sz = capn_delta(prev, next, buf.data(), buf.size(), packed);
+  EXPECT_GT(sz, 0);
+  buf.resize(sz);
+  return buf;
+}
+
+TEST(Delta, RoundTrip) {
+  for (int packed = 0; packed < 2; packed++) {
+    Session next, empty, base;
+    next.capn.create = &CreateSmallSegment;
+    setupStruct(&next.capn);
+
+    // the first patch is a snapshot
+    std::vector<uint8_t> d = Delta(&empty.capn, &next.capn, packed);
+    ASSERT_EQ(0, capn_apply_delta(&base.capn, d.data(), d.size(), packed));
+    checkStruct(&base.capn);
+    EXPECT_EQ(Serialize(&next.capn), Serialize(&base.capn));
+
+    std::vector<uint8_t> snapshot = Serialize(&next.capn);
+    struct capn prev;
+    ASSERT_EQ(0, capn_init_mem(&prev, snapshot.data(), snapshot.size(), 0));
+
+    // change a scalar and add a text in a new segment
+    capn_ptr root = capn_getp(capn_root(&next.capn), 0, 1);
+    capn_write16(root, 0, 0x1234);
+    capn_text t = {4, "more", NULL};
+    ASSERT_EQ(0, capn_set_text(root, 5, t));
+    ASSERT_EQ(17, next.capn.segnum);
+
+    d = Delta(&prev, &next.capn, packed);
+    // header, 17 segment headers and a few small ranges
+    EXPECT_LT(d.size(), (size_t) (8 + 17*8 + 64));
+    ASSERT_EQ(0, capn_apply_delta(&base.capn, d.data(), d.size(), packed));
+    EXPECT_EQ(Serialize(&next.capn), Serialize(&base.capn));
+    capn_free(&prev);
+  }
+}
+
+TEST(Delta, Mismatch) {
+  Session next, empty, base;
+  setupStruct(&next.capn);
+  std::vector<uint8_t> d = Delta(&empty.capn, &next.capn, 0);
+
+  // the base must have the segments of prev
+  capn_root(&base.capn);
+  EXPECT_EQ(-1, capn_apply_delta(&base.capn, d.data(), d.size(), 0));
+
+  // segments of a session read from memory can't grow
+  std::vector<uint8_t> buf = Serialize(&next.capn);
+  struct capn prev;
+  ASSERT_EQ(0, capn_init_mem(&prev, buf.data(), buf.size(), 0));
+  capn_ptr s = capn_new_struct(next.capn.seglist, 8, 0);
+  ASSERT_EQ(0, capn_setp(capn_root(&next.capn), 0, s));
+  d = Delta(&prev, &next.capn, 0);
+  EXPECT_EQ(-1, capn_apply_delta(&prev, d.data(), d.size(), 0));
+
+  // truncated patches are rejected
+  EXPECT_EQ(-1, capn_apply_delta(&base.capn, d.data(), 12, 0));
+  capn_free(&prev);
+}
+
+TEST(WireFormat, ListGetvOffset) {
+  Session ctx;
+  capn_list32 l = capn_new_list32(capn_root(&ctx.capn).seg, 4);
+  for (int i = 0; i < 4; i++) {
+    capn_set32(l, i, 100 + i);
+  }
+  uint32_t v[2] = {0, 0};
+  EXPECT_EQ(2, capn_getv32(l, 2, v, 2));
+  EXPECT_EQ(102u, v[0]);
+  EXPECT_EQ(103u, v[1]);
+}
+
+static FILE *g_LargeFile;
+
+static ssize_t WriteToFile(int fd, const void *p, size_t sz) {
+  (void) fd;
+  return (ssize_t) fwrite(p, 1, sz, g_LargeFile);
+}
+
+// Builds, writes and reads back a list of more than 2 GiB, which needs
+// about 2 GiB of memory for the copy that is read back and the same on
+// disk. Set CAPN_TEST_LARGE to run it.
+TEST(Large, ListOver2GiB) {
+  if (!getenv("CAPN_TEST_LARGE")) {
+    GTEST_SKIP() << "set CAPN_TEST_LARGE to run";
+  }
+
+  const int n = (1 << 28) + 16;
+  const int idx[] = {0, 1 << 27, n - 1};
+  int64_t sz;
+
+  {
+    Session c;
+    capn_ptr root = capn_root(&c.capn);
+    capn_list64 l = capn_new_list64(root.seg, n);
+    if (l.p.type == CAPN_NULL) {
+      GTEST_SKIP() << "can't allocate the list";
+    }
+    for (int i : idx) {
+      ASSERT_EQ(0, capn_set64(l, i, UINT64_C(0x0102030405060708) + i));
+    }
+    ASSERT_EQ(0, capn_setp(root, 0, l.p));
+    ASSERT_GT(l.p.seg->len, (size_t) INT32_MAX);
+
+    sz = capn_size(&c.capn);
+    EXPECT_GT(sz, (int64_t) n * 8);
+
+    g_LargeFile = tmpfile();
+    ASSERT_TRUE(g_LargeFile != NULL);
+    ASSERT_EQ(sz, capn_write_fd(&c.capn, &WriteToFile, 0, 0));
+  }
+
+  rewind(g_LargeFile);
+  struct capn r;
+  ASSERT_EQ(0, capn_init_fp(&r, g_LargeFile, 0));
+  fclose(g_LargeFile);
+
+  capn_list64 l = {capn_getp(capn_root(&r), 0, 1)};
+  ASSERT_EQ(CAPN_LIST, l.p.type);
+  EXPECT_EQ(n, l.p.len);
+  for (int i : idx) {
+    EXPECT_EQ(UINT64_C(0x0102030405060708) + i, capn_get64(l, i));
+  }
+
+  uint64_t tail[4];
+  EXPECT_EQ(4, capn_getv64(l, n - 4, tail, 4));
+  EXPECT_EQ(UINT64_C(0), tail[0]);
+  EXPECT_EQ(UINT64_C(0x0102030405060708) + n - 1, tail[3]);
+  capn_free(&r);
+}
+
+static uint64_t NextRandom(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static capn_list1 RandomBits(struct capn_segment *seg, int len, uint64_t *state) {
+  capn_list1 l = capn_new_list1(seg, len);
+  for (int i = 0; i < len; i++) {
+    capn_set1(l, i, NextRandom(state) & 1);
+  }
+  return l;
+}
+
+TEST(BitList, UnalignedGetSet) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  uint64_t state = 88172645463325252ULL;
+  const int len = 300;
+
+  capn_list1 src = RandomBits(seg, len, &state);
+  for (int off = 0; off < 80; off += 3) {
+    for (int sz = 0; sz < 200; sz += 7) {
+      uint8_t buf[32];
+      memset(buf, 0xAA, sizeof(buf));
+      ASSERT_EQ(sz, capn_getv1(src, off, buf, sz));
+      for (int i = 0; i < sz; i++) {
+        ASSERT_EQ(capn_get1(src, off + i), (buf[i/8] >> (i%8)) & 1);
+      }
+      if (sz % 8) {
+        EXPECT_EQ(0, buf[sz/8] >> (sz%8));
+      }
+
+      capn_list1 dst = RandomBits(seg, len, &state);
+      std::vector<int> before(len);
+      for (int i = 0; i < len; i++) {
+        before[i] = capn_get1(dst, i);
+      }
+      ASSERT_EQ(sz, capn_setv1(dst, off, buf, sz));
+      for (int i = 0; i < len; i++) {
+        int want = i >= off && i < off + sz ? capn_get1(src, i) : before[i];
+        ASSERT_EQ(want, capn_get1(dst, i)) << off << " " << sz << " " << i;
+      }
+    }
+  }
+
+  uint8_t buf[8];
+  EXPECT_EQ(20, capn_getv1(src, len - 20, buf, 64));
+  EXPECT_EQ(0, capn_getv1(src, len, buf, 64));
+  EXPECT_EQ(-1, capn_getv1(src, len + 1, buf, 1));
+  EXPECT_EQ(-1, capn_setv1(src, -1, buf, 1));
+
+  capn_free(&c);
+}
+
+TEST(BitList, PopcountAndFind) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  uint64_t state = 2463534242ULL;
+  const int len = 517;
+
+  capn_list1 l = RandomBits(seg, len, &state);
+  for (int off = 0; off < len; off += 37) {
+    for (int sz = 0; off + sz <= len; sz += 61) {
+      int want = 0;
+      for (int i = off; i < off + sz; i++) {
+        want += capn_get1(l, i);
+      }
+      ASSERT_EQ(want, capn_popcount1(l, off, sz));
+    }
+  }
+  EXPECT_EQ(capn_popcount1(l, 500, 17), capn_popcount1(l, 500, 1000));
+
+  capn_list1 sparse = capn_new_list1(seg, len);
+  EXPECT_EQ(-1, capn_find1(sparse, 0, 1));
+  EXPECT_EQ(0, capn_find1(sparse, 0, 0));
+  capn_set1(sparse, 3, 1);
+  capn_set1(sparse, 130, 1);
+  capn_set1(sparse, len - 1, 1);
+  EXPECT_EQ(3, capn_find1(sparse, 0, 1));
+  EXPECT_EQ(3, capn_find1(sparse, 3, 1));
+  EXPECT_EQ(130, capn_find1(sparse, 4, 1));
+  EXPECT_EQ(len - 1, capn_find1(sparse, 131, 1));
+  EXPECT_EQ(-1, capn_find1(sparse, len, 1));
+
+  for (int i = 0; i < len; i++) {
+    capn_set1(sparse, i, i != 200);
+  }
+  EXPECT_EQ(200, capn_find1(sparse, 1, 0));
+  EXPECT_EQ(-1, capn_find1(sparse, 201, 0));
+
+  capn_free(&c);
+}
+
+TEST(BitList, AndOrXor) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  uint64_t state = 1234567ULL;
+
+  int (*ops[])(capn_list1, capn_list1) = {capn_and1, capn_or1, capn_xor1};
+  for (int op = 0; op < 3; op++) {
+    capn_list1 a = RandomBits(seg, 203, &state);
+    capn_list1 b = RandomBits(seg, 150, &state);
+    std::vector<int> before(203);
+    for (int i = 0; i < 203; i++) {
+      before[i] = capn_get1(a, i);
+    }
+
+    int changed = ops[op](a, b), want_changed = 0;
+    for (int i = 0; i < 203; i++) {
+      int want = before[i];
+      if (i < 150) {
+        int y = capn_get1(b, i);
+        want = op == 0 ? want & y : op == 1 ? want | y : want ^ y;
+      }
+      want_changed += want != before[i];
+      ASSERT_EQ(want, capn_get1(a, i)) << op << " " << i;
+    }
+    EXPECT_EQ(want_changed, changed) << op;
+  }
+
+  // only the bits that differ are counted, in full words and the tail
+  capn_list1 ones = capn_new_list1(seg, 70), mixed = capn_new_list1(seg, 70);
+  for (int i = 0; i < 70; i++) {
+    ASSERT_EQ(0, capn_set1(ones, i, 1));
+    ASSERT_EQ(0, capn_set1(mixed, i, i % 3 == 0));
+  }
+  EXPECT_EQ(0, capn_or1(ones, mixed));
+  EXPECT_EQ(46, capn_and1(ones, mixed));
+  EXPECT_EQ(0, capn_and1(ones, mixed));
+  EXPECT_EQ(24, capn_xor1(ones, mixed));
+  EXPECT_EQ(0, capn_popcount1(ones, 0, 70));
+
+  capn_list8 bytes = capn_new_list8(seg, 8);
+  capn_list1 bits = capn_new_list1(seg, 8);
+  capn_list1 notbits = {bytes.p};
+  EXPECT_EQ(-1, capn_and1(bits, notbits));
+
+  capn_free(&c);
+}
+
+TEST(BitList, Largest) {
+  // 2^29 - 1 bits take 2^26 bytes, which needs all 27 bits of datasz
+  const int n = (1 << 29) - 1;
+  Session c;
+  capn_ptr root = capn_root(&c.capn);
+  capn_list1 l = capn_new_list1(root.seg, n);
+  ASSERT_EQ(CAPN_BIT_LIST, l.p.type);
+  EXPECT_EQ(1u << 26, l.p.datasz);
+  ASSERT_EQ(0, capn_set1(l, n - 1, 1));
+  ASSERT_EQ(0, capn_setp(root, 0, l.p));
+
+  capn_list1 r = {capn_getp(root, 0, 1)};
+  ASSERT_EQ(CAPN_BIT_LIST, r.p.type);
+  EXPECT_EQ(n, r.p.len);
+  EXPECT_EQ(1u << 26, r.p.datasz);
+  EXPECT_EQ(1, capn_get1(r, n - 1));
+  EXPECT_EQ(0, capn_get1(r, n - 2));
+  EXPECT_EQ(1, capn_popcount1(r, 0, n));
+}
+
+TEST(WireFormat, ListGetvStrided) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  const int len = 37;
+  int shapes[][2] = {{8, 0}, {8, 1}, {16, 1}, {24, 1}, {8, 4}};
+
+  for (auto &shape : shapes) {
+    capn_ptr list = capn_new_list(seg, len, shape[0], shape[1]);
+    ASSERT_EQ(CAPN_LIST, list.type);
+    for (int i = 0; i < len; i++) {
+      capn_write64(capn_getp(list, i, 1), 0, 0x0101010101010101ULL * i);
+    }
+
+    uint64_t v64[len];
+    uint32_t v32[len];
+    uint16_t v16[len];
+    uint8_t v8[len];
+    capn_list64 l64 = {list};
+    capn_list32 l32 = {list};
+    capn_list16 l16 = {list};
+    capn_list8 l8 = {list};
+    EXPECT_EQ(len - 3, capn_getv64(l64, 3, v64, len));
+    EXPECT_EQ(len - 3, capn_getv32(l32, 3, v32, len));
+    EXPECT_EQ(len - 3, capn_getv16(l16, 3, v16, len));
+    EXPECT_EQ(len - 3, capn_getv8(l8, 3, v8, len));
+    for (int i = 0; i < len - 3; i++) {
+      EXPECT_EQ(0x0101010101010101ULL * (i + 3), v64[i]);
+      EXPECT_EQ(0x01010101U * (i + 3), v32[i]);
+      EXPECT_EQ(0x0101 * (i + 3), v16[i]);
+      EXPECT_EQ(i + 3, v8[i]);
+    }
+
+    for (int i = 0; i < len; i++) {
+      v32[i] = 1000 + i;
+    }
+    EXPECT_EQ(10, capn_setv32(l32, 5, v32, 10));
+    for (int i = 0; i < len; i++) {
+      capn_ptr m = capn_getp(list, i, 1);
+      uint32_t want = i >= 5 && i < 15 ? 1000 + i - 5 : 0x01010101U * i;
+      EXPECT_EQ(want, capn_read32(m, 0));
+      EXPECT_EQ(0x01010101U * i, capn_read32(m, 4));
+    }
+  }
+
+  capn_free(&c);
+}
+
+TEST(WireFormat, ListGetColumn) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  const int len = 20;
+
+  capn_ptr list = capn_new_list(seg, len, 16, 1);
+  for (int i = 0; i < len; i++) {
+    capn_ptr m = capn_getp(list, i, 1);
+    capn_write16(m, 2, i);
+    capn_write1(m, 67, i & 1);
+  }
+
+  uint16_t v16[len];
+  uint8_t flags[len];
+  EXPECT_EQ(len - 4, capn_getcol16(list, 2, 4, v16, len));
+  EXPECT_EQ(len, capn_getcol1(list, 67, 0, flags, len));
+  for (int i = 0; i < len; i++) {
+    if (i < len - 4) {
+      EXPECT_EQ(i + 4, v16[i]);
+    }
+    EXPECT_EQ(i & 1, flags[i]);
+  }
+
+  /* a field past the end of the elements' data reads as 0 */
+  uint64_t v64[len];
+  memset(v64, 0xFF, sizeof(v64));
+  EXPECT_EQ(len, capn_getcol64(list, 16, 0, v64, len));
+  for (int i = 0; i < len; i++) {
+    EXPECT_EQ(0u, v64[i]);
+  }
+
+  EXPECT_EQ(-1, capn_getcol16(capn_new_ptr_list(seg, 2), 0, 0, v16, 2));
+
+  capn_free(&c);
+}
+
+// Columns of fields with defaults, read the way $C.fieldcolumns code does:
+// the raw values are xored with the default after the gather.
+TEST(WireFormat, ListGetColumnDefaults) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  const int len = 10;
+  // int16 @0 = -5, bool @16 = true, float32 @1 = 1.5
+  const uint16_t xint = (uint16_t) (int16_t) -5;
+  const uint32_t xfloat = capn_from_f32(1.5f);
+
+  capn_ptr list = capn_new_list(seg, len, 8, 0);
+  for (int i = 0; i < len; i++) {
+    capn_ptr m = capn_getp(list, i, 1);
+    capn_write16(m, 0, (uint16_t) (int16_t) (i - 5) ^ xint);
+    capn_write1(m, 16, (i % 3 == 0) ^ 1);
+    capn_write32(m, 4, capn_from_f32(i * 0.25f) ^ xfloat);
+  }
+
+  int16_t ints[len];
+  uint8_t flags[len];
+  float floats[len];
+  uint32_t raw[len];
+  ASSERT_EQ(len, capn_getcol16(list, 0, 0, (uint16_t*) ints, len));
+  ASSERT_EQ(len, capn_getcol1(list, 16, 0, flags, len));
+  ASSERT_EQ(len, capn_getcol32(list, 4, 0, raw, len));
+  for (int i = 0; i < len; i++) {
+    ints[i] = (int16_t) (ints[i] ^ xint);
+    flags[i] ^= 1;
+    floats[i] = capn_to_f32(raw[i] ^ xfloat);
+    EXPECT_EQ(i - 5, ints[i]);
+    EXPECT_EQ(i % 3 == 0, flags[i]);
+    EXPECT_EQ(i * 0.25f, floats[i]);
+  }
+
+  // elements written before the fields existed read as the defaults
+  capn_ptr old = capn_new_list(seg, len, 0, 1);
+  ASSERT_EQ(len, capn_getcol16(old, 0, 0, (uint16_t*) ints, len));
+  ASSERT_EQ(len, capn_getcol1(old, 16, 0, flags, len));
+  ASSERT_EQ(len, capn_getcol32(old, 4, 0, raw, len));
+  for (int i = 0; i < len; i++) {
+    EXPECT_EQ(-5, (int16_t) (ints[i] ^ xint));
+    EXPECT_EQ(1, flags[i] ^ 1);
+    EXPECT_EQ(1.5f, capn_to_f32(raw[i] ^ xfloat));
+  }
+
+  capn_free(&c);
+}
+
+TEST(WireFormat, ListGetvPointerList) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+  const int len = 29;
+
+  capn_ptr list = capn_new_ptr_list(seg, len);
+  for (int i = 0; i < len; i++) {
+    capn_ptr s = capn_new_struct(seg, 16, 1);
+    capn_write64(s, 0, 100 + i);
+    ASSERT_EQ(0, capn_setp(list, i, s));
+  }
+
+  uint64_t v64[len];
+  uint32_t v32[len];
+  capn_list64 l64 = {list};
+  capn_list32 l32 = {list};
+  ASSERT_EQ(len, capn_getv64(l64, 0, v64, len));
+  for (int i = 0; i < len; i++) {
+    EXPECT_EQ(100 + i, (int) v64[i]);
+  }
+
+  for (int i = 0; i < len; i++) {
+    v32[i] = 7 * i;
+  }
+  ASSERT_EQ(len - 2, capn_setv32(l32, 2, v32, len));
+  for (int i = 2; i < len; i++) {
+    EXPECT_EQ(7 * (i - 2), (int) capn_read32(capn_getp(list, i, 1), 0));
+    EXPECT_EQ(7 * (i - 2), (int) capn_get32(l32, i));
+  }
+
+  /* a struct without room for the field fails the whole read */
+  ASSERT_EQ(0, capn_setp(list, 10, capn_new_struct(seg, 0, 1)));
+  EXPECT_EQ(-1, capn_getv64(l64, 0, v64, len));
+  EXPECT_EQ(0, (int) capn_get64(l64, 10));
+
+  capn_free(&c);
+}
+
+TEST(WireFormat, ListVectorEmpty) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *seg = capn_root(&c).seg;
+
+  /* codecs pass the members of an empty native list straight through */
+  capn_list32 l = capn_new_list32(seg, 0);
+  EXPECT_EQ(0, capn_setv32(l, 0, NULL, 0));
+  EXPECT_EQ(0, capn_getv32(l, 0, NULL, 0));
+
+  capn_free(&c);
+}
+
+TEST(Session, Reserve) {
+  struct capn c;
+  capn_init_malloc(&c);
+  ASSERT_EQ(0, capn_reserve(&c, 8 * 2000));
+  EXPECT_EQ(-1, capn_reserve(&c, 8));
+
+  capn_ptr root = capn_root(&c);
+  capn_list64 l = capn_new_list64(root.seg, 1999);
+  ASSERT_EQ(CAPN_LIST, l.p.type);
+  ASSERT_EQ(0, capn_setp(root, 0, l.p));
+  EXPECT_EQ(1, c.segnum);
+  EXPECT_EQ(8 * 2000, (int) c.seglist->len);
+  capn_free(&c);
+}
+
+struct FieldsTest {
+  unsigned flag;
+  int16_t small;
+  uint64_t big;
+  int which;
+  capn_text label;
+  double weight;
+};
+
+static capn_text fields_def = {3, "def", 0};
+
+static const struct capn_field fields_table[] = {
+  {CAPN_FIELD_BOOL, 3, offsetof(FieldsTest, flag), 0, 0, 1, NULL},
+  {CAPN_FIELD_BITS16, 2, offsetof(FieldsTest, small), 0, 0, 0xfffbu, NULL},
+  {CAPN_FIELD_BITS64, 8, offsetof(FieldsTest, big), 0, 0, 7, NULL},
+  {CAPN_FIELD_WHICH, 4, offsetof(FieldsTest, which), 0, 0, 0, NULL},
+  {CAPN_FIELD_TEXT, 0, offsetof(FieldsTest, label), 4, 0, 0, &fields_def},
+  {CAPN_FIELD_BITS64, 16, offsetof(FieldsTest, weight), 4, 1, 0, NULL},
+};
+
+TEST(Fields, ReadWrite) {
+  Session ctx;
+  capn_ptr root = capn_root(&ctx.capn);
+  capn_ptr p = capn_new_struct(root.seg, 24, 1);
+  ASSERT_EQ(0, capn_setp(root, 0, p));
+
+  FieldsTest in = {1, -5, 7, 0, fields_def, 2.5}, out;
+  memset(&out, 0xff, sizeof(out));
+  capn_read_fields(p, &out, fields_table, 6);
+  EXPECT_EQ(1u, out.flag);
+  EXPECT_EQ(-5, out.small);
+  EXPECT_EQ(7u, out.big);
+  EXPECT_EQ(0, out.which);
+  EXPECT_STREQ("def", out.label.str);
+
+  // every field is at its default, so the data section stays zero
+  capn_write_fields(p, &in, fields_table, 6);
+  EXPECT_EQ(0u, capn_read64(p, 0) | capn_read64(p, 8) | capn_read64(p, 16));
+  EXPECT_EQ(0, capn_get_text(p, 0, fields_def).len);
+
+  in.flag = 0;
+  in.small = 300;
+  in.big = 1;
+  in.which = 1;
+  in.weight = 2.5;
+  capn_write_fields(p, &in, fields_table, 6);
+  EXPECT_EQ(0x8u, capn_read8(p, 0));
+  EXPECT_EQ(300 ^ 0xfffb, (int) capn_read16(p, 2));
+  EXPECT_EQ(6u, capn_read64(p, 8));
+  EXPECT_EQ(1, (int) capn_read16(p, 4));
+
+  memset(&out, 0, sizeof(out));
+  out.label.str = "untouched";
+  capn_read_fields(p, &out, fields_table, 6);
+  EXPECT_EQ(0u, out.flag);
+  EXPECT_EQ(300, out.small);
+  EXPECT_EQ(1u, out.big);
+  EXPECT_EQ(1, out.which);
+  EXPECT_EQ(2.5, out.weight);
+  // not the selected union case, so neither read nor written
+  EXPECT_STREQ("untouched", out.label.str);
+}
+
+TEST(Arena, AllocAndFree) {
+  struct capn_arena a;
+  capn_arena_init(&a, 64);
+
+  uint32_t *small = (uint32_t*) capn_arena_calloc(&a, 3, sizeof(uint32_t));
+  ASSERT_TRUE(small != NULL);
+  EXPECT_EQ(0u, small[0] | small[1] | small[2]);
+  small[2] = 7;
+
+  char *s = capn_arena_strdup(&a, "hello");
+  ASSERT_TRUE(s != NULL);
+  EXPECT_STREQ("hello", s);
+  EXPECT_EQ(0u, ((uintptr_t) s) % 16);
+  EXPECT_EQ(NULL, capn_arena_strdup(&a, NULL));
+
+  // larger than the current block, so a new one is added
+  std::vector<uint8_t> zero(100000);
+  uint8_t *big = (uint8_t*) capn_arena_calloc(&a, zero.size(), 1);
+  ASSERT_TRUE(big != NULL);
+  EXPECT_EQ(0, memcmp(big, zero.data(), zero.size()));
+  memset(big, 0xff, zero.size());
+
+  EXPECT_EQ(7u, small[2]);
+  EXPECT_STREQ("hello", s);
+  EXPECT_EQ(NULL, capn_arena_calloc(&a, SIZE_MAX / 2, 4));
+
+  capn_arena_free(&a);
+  EXPECT_EQ(NULL, a.blocks);
+}
+
+static void checkStructConcurrently(struct capn *ctx) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([ctx] {
+      for (int j = 0; j < 100; j++) {
+        checkStruct(ctx);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+}
+
+TEST(ReadOnly, ConcurrentReaders) {
+  Session ctx;
+  ctx.capn.create = &CreateSmallSegment;
+  setupStruct(&ctx.capn);
+
+  struct capn_segment *segments[16];
+  getSegments(&ctx.capn, segments, 16);
+
+  struct capn ctx2;
+  memset(&ctx2, 0, sizeof(ctx2));
+  for (size_t i = 0; i < sizeof(segments)/sizeof(segments[0]); i++) {
+    capn_append_segment(&ctx2, segments[i]);
+  }
+
+  ASSERT_EQ(0, capn_freeze(&ctx2));
+  EXPECT_EQ(1, ctx2.readonly);
+  checkStructConcurrently(&ctx2);
+
+  free(ctx2.segtab);
+}
+
+struct LazySegments {
+  struct capn_segment **segments;
+  std::mutex mutex;
+  std::vector<struct capn_segment*> loaded;
+};
+
+static struct capn_segment *LookupLazySegment(void *u, uint32_t id) {
+  LazySegments *lazy = (LazySegments*) u;
+  struct capn_segment *s = (struct capn_segment*) malloc(sizeof(*s));
+  *s = *lazy->segments[id];
+  std::lock_guard<std::mutex> lock(lazy->mutex);
+  lazy->loaded.push_back(s);
+  return s;
+}
+
+TEST(ReadOnly, ConcurrentLazyLookup) {
+  Session ctx;
+  ctx.capn.create = &CreateSmallSegment;
+  setupStruct(&ctx.capn);
+
+  struct capn_segment *segments[16];
+  getSegments(&ctx.capn, segments, 16);
+
+  LazySegments lazy;
+  lazy.segments = segments;
+
+  struct capn_segment root = *segments[0];
+  struct capn ctx2;
+  memset(&ctx2, 0, sizeof(ctx2));
+  ctx2.lookup = &LookupLazySegment;
+  ctx2.user = &lazy;
+  capn_append_segment(&ctx2, &root);
+  ctx2.segnum = 16;
+
+  ASSERT_EQ(0, capn_freeze(&ctx2));
+  checkStructConcurrently(&ctx2);
+
+  for (uint32_t i = 1; i < 16; i++) {
+    ASSERT_TRUE(ctx2.segtab[i] != NULL);
+    EXPECT_EQ(i, ctx2.segtab[i]->id);
+    EXPECT_EQ(segments[i]->data, ctx2.segtab[i]->data);
+  }
+  EXPECT_GE(lazy.loaded.size(), 15u);
+
+  free(ctx2.segtab);
+  for (auto s : lazy.loaded) {
+    free(s);
+  }
+}
+
+TEST(ReadOnly, RejectsWrites) {
+  Session ctx1, ctx2;
+  setupStruct(&ctx1.capn);
+  setupStruct(&ctx2.capn);
+
+  ASSERT_EQ(0, capn_freeze(&ctx2.capn));
+  ASSERT_EQ(0, capn_freeze(&ctx2.capn));
+
+  capn_ptr root = capn_root(&ctx2.capn);
+  EXPECT_EQ(CAPN_PTR_LIST, root.type);
+  EXPECT_EQ(-1, capn_setp(root, 0, capn_getp(capn_root(&ctx1.capn), 0, 1)));
+  EXPECT_EQ(CAPN_NULL, capn_new_struct(root.seg, 8, 0).type);
+  EXPECT_EQ(CAPN_NULL, capn_new_list(root.seg, 4, 4, 0).type);
+
+  // Copying out of a frozen session is still allowed.
+  Session ctx3;
+  EXPECT_EQ(0, capn_setp(capn_root(&ctx3.capn), 0, capn_getp(root, 0, 1)));
+  checkStruct(&ctx3.capn);
+  checkStruct(&ctx2.capn);
+}
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
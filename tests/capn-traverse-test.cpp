@@ -0,0 +1,163 @@
+/* capn-traverse-test.cpp
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <vector>
+
+#include "capnp_c.h"
+
+static const int kMembers = 5000;
+static const int kBlobs = 3000;
+
+// root struct
+//   ptr 0: composite list of kMembers structs, each with a text pointer
+//   ptr 1: pointer list of kBlobs data blobs
+static void setupLargeMessage(struct capn *c) {
+  capn_ptr root = capn_root(c);
+  capn_ptr s = capn_new_struct(root.seg, 8, 2);
+  ASSERT_EQ(0, capn_setp(root, 0, s));
+  capn_write64(s, 0, kMembers);
+
+  capn_ptr list = capn_new_list(s.seg, kMembers, 8, 1);
+  ASSERT_EQ(0, capn_setp(s, 0, list));
+  for (int i = 0; i < kMembers; i++) {
+    capn_ptr m = capn_getp(list, i, 1);
+    capn_write32(m, 0, i);
+    capn_text t = {5, "hello", NULL};
+    ASSERT_EQ(0, capn_set_text(m, 0, t));
+  }
+
+  capn_ptr blobs = capn_new_ptr_list(s.seg, kBlobs);
+  ASSERT_EQ(0, capn_setp(s, 1, blobs));
+  for (int i = 0; i < kBlobs; i++) {
+    capn_list8 d = capn_new_list8(blobs.seg, 16);
+    capn_set8(d, 0, (uint8_t) i);
+    ASSERT_EQ(0, capn_setp(blobs, i, d.p));
+  }
+}
+
+struct Counts {
+  std::atomic<long> objects{0};
+  std::atomic<long> members{0};
+  std::atomic<long> texts{0};
+  std::vector<long> perWorker;
+};
+
+static int CountObject(void *user, capn_ptr p, int worker) {
+  Counts *c = (Counts*) user;
+  c->objects++;
+  if (p.type == CAPN_STRUCT && p.is_list_member) {
+    c->members++;
+  }
+  if (p.type == CAPN_LIST && p.datasz == 1 && p.len == 6) {
+    c->texts++;
+  }
+  c->perWorker[worker]++;
+  return 0;
+}
+
+class TraverseTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    struct capn src;
+    capn_init_malloc(&src);
+    setupLargeMessage(&src);
+    buf.resize(capn_size(&src) + 64);
+    int64_t sz = capn_write_mem(&src, buf.data(), buf.size(), 0);
+    capn_free(&src);
+    ASSERT_GT(sz, 0);
+    ASSERT_EQ(0, capn_init_mem(&ctx, buf.data(), sz, 0));
+  }
+  void TearDown() override {
+    capn_free(&ctx);
+  }
+
+  std::vector<uint8_t> buf;
+  struct capn ctx;
+};
+
+TEST_F(TraverseTest, SingleThread) {
+  Counts c;
+  c.perWorker.resize(1);
+  capn_ptr root = capn_getp(capn_root(&ctx), 0, 1);
+  EXPECT_EQ(0, capn_traverse(root, 1, &CountObject, &c));
+
+  // root struct, composite list, its members and their texts, the pointer
+  // list and its blobs
+  EXPECT_EQ(1 + 1 + 2*kMembers + 1 + kBlobs, c.objects);
+  EXPECT_EQ(kMembers, c.members);
+  EXPECT_EQ(kMembers, c.texts);
+}
+
+TEST_F(TraverseTest, RequiresFrozenSessionForThreads) {
+  Counts c;
+  c.perWorker.resize(4);
+  capn_ptr root = capn_getp(capn_root(&ctx), 0, 1);
+  EXPECT_EQ(-1, capn_traverse(root, 4, &CountObject, &c));
+  EXPECT_EQ(0, c.objects);
+}
+
+TEST_F(TraverseTest, MultipleThreads) {
+  ASSERT_EQ(0, capn_freeze(&ctx));
+
+  Counts c;
+  c.perWorker.resize(4);
+  capn_ptr root = capn_getp(capn_root(&ctx), 0, 1);
+  EXPECT_EQ(0, capn_traverse(root, 4, &CountObject, &c));
+
+  EXPECT_EQ(1 + 1 + 2*kMembers + 1 + kBlobs, c.objects);
+  EXPECT_EQ(kMembers, c.members);
+  EXPECT_EQ(kMembers, c.texts);
+
+  long total = 0;
+  for (long n : c.perWorker) {
+    total += n;
+  }
+  EXPECT_EQ(c.objects, total);
+}
+
+static int StopAtText(void *user, capn_ptr p, int worker) {
+  (void) user;
+  (void) worker;
+  return p.type == CAPN_LIST && p.datasz == 1 ? 7 : 0;
+}
+
+TEST_F(TraverseTest, VisitorStopsTraversal) {
+  ASSERT_EQ(0, capn_freeze(&ctx));
+  capn_ptr root = capn_getp(capn_root(&ctx), 0, 1);
+  EXPECT_EQ(7, capn_traverse(root, 4, &StopAtText, NULL));
+}
+
+TEST(Traverse, CyclicMessage) {
+  struct capn c;
+  capn_init_malloc(&c);
+  capn_ptr root = capn_root(&c);
+  capn_ptr recurse = capn_new_struct(root.seg, 0, 1);
+  ASSERT_EQ(0, capn_setp(recurse, 0, recurse));
+  ASSERT_EQ(0, capn_setp(root, 0, recurse));
+
+  Counts counts;
+  counts.perWorker.resize(1);
+  EXPECT_EQ(-1, capn_traverse(capn_getp(root, 0, 1), 1, &CountObject, &counts));
+  capn_free(&c);
+}
+
+TEST(Traverse, CompositeListWithoutPointers) {
+  struct capn c;
+  capn_init_malloc(&c);
+  capn_ptr root = capn_root(&c);
+  capn_ptr list = capn_new_list(root.seg, 10, 16, 0);
+  ASSERT_TRUE(list.is_composite_list);
+  ASSERT_EQ(0, capn_setp(root, 0, list));
+
+  Counts counts;
+  counts.perWorker.resize(1);
+  EXPECT_EQ(0, capn_traverse(capn_getp(root, 0, 1), 1, &CountObject, &counts));
+  EXPECT_EQ(1 + 10, counts.objects);
+  EXPECT_EQ(10, counts.members);
+  capn_free(&c);
+}
@@ -13,6 +13,9 @@
 
 #include <gtest/gtest.h>
 #include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include "capnp_c.h"
 #include "addressbook.capnp.h"
@@ -163,3 +166,280 @@ TEST(Examples, PersonWithAccessors) {
 
   capn_free(&c);
 }
+
+// Read one field of every element of a struct list without decoding the
+// elements.
+TEST(Examples, ListColumns) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  const int count = 100;
+  Person_list people = new_Person_list(cs, count);
+  Person_PhoneNumber_list phones = new_Person_PhoneNumber_list(cs, count);
+  for (int i = 0; i < count; i++) {
+    Person_ptr p;
+    p.p = capn_getp(people.p, i, 0);
+    Person_set_id(p, 1000 + i);
+    Person_set_name(p, chars_to_text("Name"));
+
+    Person_PhoneNumber_ptr pn;
+    pn.p = capn_getp(phones.p, i, 0);
+    Person_PhoneNumber_set_type(pn, (enum Person_PhoneNumber_Type) (i % 3));
+  }
+
+  uint32_t ids[count];
+  EXPECT_EQ(count - 10, Person_list_get_id_column(people, 10, count, ids));
+  for (int i = 0; i < count - 10; i++) {
+    EXPECT_EQ(1010 + i, (int) ids[i]);
+  }
+
+  enum Person_PhoneNumber_Type types[count];
+  EXPECT_EQ(count, Person_PhoneNumber_list_get_type_column(phones, 0, count, types));
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(i % 3, (int) types[i]);
+  }
+
+  EXPECT_EQ(0, Person_list_get_id_column(people, count, 1, ids));
+  EXPECT_EQ(-1, Person_list_get_id_column(people, count + 1, 1, ids));
+
+  capn_free(&c);
+}
+
+// Export a struct list as Apache Arrow columns.
+TEST(Examples, ListToArrow) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  const int count = 6;
+  Person_list people = new_Person_list(cs, count);
+  for (int i = 0; i < count; i++) {
+    struct Person p;
+    memset(&p, 0, sizeof(p));
+    p.id = 100 + i;
+    p.name = chars_to_text(i % 2 ? "Alice" : "Bob");
+    p.employment_which = (enum Person_employment_which) (i % 4);
+    if (p.employment_which == Person_employment_employer) {
+      p.employment.employer = chars_to_text("ACME");
+    }
+    set_Person(&p, people, i);
+  }
+
+  struct ArrowArray array;
+  struct ArrowSchema schema;
+  ASSERT_EQ(0, Person_list_to_arrow(people, &array, &schema));
+  capn_free(&c);
+
+  // the arrays don't refer to the message
+  EXPECT_STREQ("+s", schema.format);
+  EXPECT_EQ(count, array.length);
+  ASSERT_EQ(4, schema.n_children);
+  ASSERT_EQ(4, array.n_children);
+
+  EXPECT_STREQ("id", schema.children[0]->name);
+  EXPECT_STREQ("I", schema.children[0]->format);
+  const uint32_t *ids = (const uint32_t*) array.children[0]->buffers[1];
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(100 + i, (int) ids[i]);
+  }
+
+  EXPECT_STREQ("u", schema.children[1]->format);
+  const int32_t *offsets = (const int32_t*) array.children[1]->buffers[1];
+  const char *values = (const char*) array.children[1]->buffers[2];
+  EXPECT_EQ(0, offsets[0]);
+  EXPECT_EQ(3, offsets[1]);
+  EXPECT_EQ(8, offsets[2]);
+  EXPECT_EQ(std::string("BobAlice"), std::string(values, 8));
+
+  EXPECT_STREQ("employment", schema.children[3]->name);
+  EXPECT_STREQ("+us:0,1,2,3", schema.children[3]->format);
+  struct ArrowArray *u = array.children[3];
+  const int8_t *types = (const int8_t*) u->buffers[0];
+  for (int i = 0; i < count; i++) {
+    EXPECT_EQ(i % 4, types[i]);
+  }
+  const int32_t *employers = (const int32_t*) u->children[1]->buffers[1];
+  EXPECT_EQ(0, employers[1]);
+  EXPECT_EQ(4, employers[2]);
+  EXPECT_EQ(8, employers[count]);
+
+  array.release(&array);
+  schema.release(&schema);
+  EXPECT_EQ(NULL, array.release);
+  EXPECT_EQ(NULL, schema.release);
+}
+
+TEST(Examples, InlineAccessorsOnShortStruct) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  // an older writer may send a struct without a data section
+  Person_ptr p;
+  p.p = capn_new_struct(cs, 0, 4);
+  EXPECT_EQ(0u, Person_get_id(p));
+  Person_set_id(p, 42);
+  EXPECT_EQ(0u, Person_get_id(p));
+
+  Person_PhoneNumber_ptr pn = new_Person_PhoneNumber(cs);
+  EXPECT_EQ(Person_PhoneNumber_Type_mobile, Person_PhoneNumber_get_type(pn));
+  Person_PhoneNumber_set_type(pn, Person_PhoneNumber_Type_work);
+  EXPECT_EQ(Person_PhoneNumber_Type_work, Person_PhoneNumber_get_type(pn));
+
+  capn_free(&c);
+}
+
+TEST(Examples, ReadStructOlderVersion) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  // a full sized struct takes the unchecked path
+  Person_ptr full = new_Person(cs);
+  Person_set_id(full, 7);
+  Person_set_name(full, chars_to_text("Alice"));
+  struct Person p;
+  read_Person(&p, full);
+  EXPECT_EQ(7u, p.id);
+  EXPECT_EQ(std::string("Alice"), std::string(p.name.str, p.name.len));
+
+  // a struct written before id and employment were added only has pointers
+  Person_ptr older;
+  older.p = capn_new_struct(cs, 0, 2);
+  capn_set_text(older.p, 0, chars_to_text("Bob"));
+  read_Person(&p, older);
+  EXPECT_EQ(0u, p.id);
+  EXPECT_EQ(Person_employment_unemployed, p.employment_which);
+  EXPECT_EQ(std::string("Bob"), std::string(p.name.str, p.name.len));
+  EXPECT_EQ(0, p.email.len);
+  EXPECT_EQ(CAPN_NULL, p.phones.p.type);
+
+  capn_free(&c);
+}
+
+TEST(Examples, ReadSelectedFields) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  Person_ptr pp = new_Person(cs);
+  Person_set_id(pp, 12);
+  Person_set_name(pp, chars_to_text("Alice"));
+  Person_set_email(pp, chars_to_text("alice@example.com"));
+  struct Person p;
+  p.id = 0;
+  p.email = chars_to_text("untouched");
+  p.employment_which = Person_employment_school;
+  p.phones.p.type = CAPN_BIT_LIST;
+
+  read_Person_fields(&p, pp, Person_id_mask | Person_name_mask);
+  EXPECT_EQ(12u, p.id);
+  EXPECT_EQ(std::string("Alice"), std::string(p.name.str, p.name.len));
+  EXPECT_EQ(std::string("untouched"), std::string(p.email.str, p.email.len));
+  EXPECT_EQ(Person_employment_school, p.employment_which);
+  EXPECT_EQ(CAPN_BIT_LIST, p.phones.p.type);
+
+  read_Person_fields(&p, pp, Person_employment_mask | Person_phones_mask);
+  EXPECT_EQ(Person_employment_unemployed, p.employment_which);
+  capn_resolve(&p.phones.p);
+  EXPECT_EQ(CAPN_NULL, p.phones.p.type);
+
+  capn_free(&c);
+}
+
+TEST(Examples, ReadWritePersonRange) {
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  const int len = 20;
+  std::vector<std::string> names(len);
+  std::vector<struct Person> in(len);
+  for (int i = 0; i < len; i++) {
+    names[i] = "person" + std::to_string(i);
+    memset(&in[i], 0, sizeof(in[i]));
+    in[i].id = 100 + i;
+    in[i].name = chars_to_text(names[i].c_str());
+    in[i].employment_which = Person_employment_unemployed;
+  }
+
+  Person_list people = new_Person_list(cs, len);
+  EXPECT_EQ(len, write_Person_range(people, 0, len, in.data()));
+
+  std::vector<struct Person> out(len);
+  EXPECT_EQ(len - 5, read_Person_range(people, 5, len, out.data()));
+  for (int i = 0; i < len - 5; i++) {
+    EXPECT_EQ(105u + i, out[i].id);
+    EXPECT_EQ(names[i + 5], std::string(out[i].name.str, out[i].name.len));
+  }
+
+  EXPECT_EQ(0, read_Person_range(people, len, 3, out.data()));
+  EXPECT_EQ(-1, read_Person_range(people, len + 1, 1, out.data()));
+  EXPECT_EQ(-1, write_Person_range(people, -1, 1, in.data()));
+
+  capn_free(&c);
+}
+
+TEST(Examples, DynamicFields) {
+  struct capn_dynamic d;
+  ASSERT_EQ(0, capn_dynamic_init(&d, addressbook_capnp_schema,
+                                 sizeof(addressbook_capnp_schema)));
+
+  struct capn c;
+  capn_init_malloc(&c);
+  struct capn_segment *cs = capn_root(&c).seg;
+
+  struct Person p;
+  memset(&p, 0, sizeof(p));
+  p.id = 17;
+  p.name = chars_to_text("Bob");
+  p.employment_which = Person_employment_school;
+  p.employment.school = chars_to_text("MIT");
+  Person_ptr pp = new_Person(cs);
+  write_Person(&p, pp);
+
+  uint64_t id = capn_dynamic_lookup(&d, "Person");
+  ASSERT_NE(0u, id);
+  EXPECT_EQ(id, capn_dynamic_lookup(&d, "addressbook.capnp:Person"));
+  EXPECT_NE(0u, capn_dynamic_lookup(&d, "Person.PhoneNumber"));
+  EXPECT_EQ(0u, capn_dynamic_lookup(&d, "Nobody"));
+
+  struct capn_dynamic_field f;
+  ASSERT_EQ(0, capn_dynamic_field(&d, id, "id", &f));
+  EXPECT_EQ(CAPN_DYNAMIC_UINT32, f.type);
+  EXPECT_EQ(17, capn_dynamic_get_int(pp.p, &f));
+  EXPECT_EQ(17.0, capn_dynamic_get_float(pp.p, &f));
+  EXPECT_EQ(0, capn_dynamic_set_uint(pp.p, &f, 18));
+  EXPECT_EQ(18u, Person_get_id(pp));
+
+  ASSERT_EQ(0, capn_dynamic_field(&d, id, "name", &f));
+  capn_text name = capn_dynamic_get_text(pp.p, &f);
+  EXPECT_EQ(std::string("Bob"), std::string(name.str, name.len));
+  EXPECT_EQ(-1, capn_dynamic_set_int(pp.p, &f, 1));
+
+  struct capn_dynamic_field school, employer;
+  ASSERT_EQ(0, capn_dynamic_field(&d, id, "employment.school", &school));
+  ASSERT_EQ(0, capn_dynamic_field(&d, id, "employment.employer", &employer));
+  EXPECT_TRUE(capn_dynamic_has(pp.p, &school));
+  EXPECT_FALSE(capn_dynamic_has(pp.p, &employer));
+  EXPECT_EQ(0, capn_dynamic_set_text(pp.p, &employer, chars_to_text("ACME")));
+  read_Person(&p, pp);
+  EXPECT_EQ(Person_employment_employer, p.employment_which);
+  EXPECT_EQ(std::string("ACME"),
+            std::string(p.employment.employer.str, p.employment.employer.len));
+
+  ASSERT_EQ(0, capn_dynamic_field(&d, id, "phones", &f));
+  EXPECT_EQ(CAPN_DYNAMIC_LIST, f.type);
+  EXPECT_EQ(CAPN_DYNAMIC_STRUCT, f.element);
+  EXPECT_EQ(capn_dynamic_lookup(&d, "Person.PhoneNumber"), f.type_id);
+
+  EXPECT_EQ(-1, capn_dynamic_field(&d, id, "nobody", &f));
+  EXPECT_EQ(-1, capn_dynamic_field(&d, id, "name.first", &f));
+  EXPECT_EQ(0, capn_dynamic_field_at(&d, id, 0, &f));
+  EXPECT_STREQ("id", f.name);
+  EXPECT_EQ(-1, capn_dynamic_field_at(&d, id, 100, &f));
+
+  capn_free(&c);
+  capn_dynamic_free(&d);
+}
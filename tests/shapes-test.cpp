@@ -0,0 +1,140 @@
+/* shapes-test.cpp
+ *
+ * Tests the codec of $C.contiguouslist with shapes.capnp.
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "capnp_c.h"
+#include "shapes.capnp.h"
+
+static point_t points[] = {
+  {1, -1, (char *) "a"},
+  {20, -20, (char *) "bb"},
+  {300, -300, NULL},
+};
+static float weights[] = {0.5f, 1.5f, 2.5f};
+
+// Encodes a polygon of three points and serializes it, so that decoding
+// reads the wire format rather than the segments written by the encoder.
+static std::vector<uint8_t> encodePolygon() {
+  struct capn c;
+  capn_init_malloc(&c);
+  capn_ptr root = capn_root(&c);
+
+  polygon_t poly;
+  poly.n_points = 3;
+  poly.points = points;
+  poly.n_weights = 3;
+  poly.weights = weights;
+
+  Polygon_ptr p;
+  encode_Polygon_ptr(root.seg, &p, &poly);
+  EXPECT_EQ(0, capn_setp(root, 0, p.p));
+
+  std::vector<uint8_t> buf((size_t) capn_size(&c));
+  EXPECT_EQ((int64_t) buf.size(), capn_write_mem(&c, buf.data(), buf.size(), 0));
+  capn_free(&c);
+  return buf;
+}
+
+static void expectPoints(const polygon_t *poly) {
+  ASSERT_EQ(3, poly->n_points);
+  ASSERT_TRUE(poly->points != NULL);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(points[i].x, poly->points[i].x);
+    EXPECT_EQ(points[i].y, poly->points[i].y);
+  }
+  EXPECT_STREQ("a", poly->points[0].label);
+  EXPECT_STREQ("bb", poly->points[1].label);
+  EXPECT_STREQ("", poly->points[2].label);
+
+  ASSERT_EQ(3, poly->n_weights);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(weights[i], poly->weights[i]);
+}
+
+TEST(ContiguousList, Layout) {
+  std::vector<uint8_t> buf = encodePolygon();
+  struct capn c;
+  ASSERT_EQ(0, capn_init_mem(&c, buf.data(), buf.size(), 0));
+
+  Polygon_ptr p;
+  p.p = capn_getp(capn_root(&c), 0, 1);
+  ASSERT_EQ(CAPN_STRUCT, p.p.type);
+
+  // the points are a composite list of Point structs, not a pointer list
+  Point_list list = Polygon_get_points(p);
+  capn_resolve(&list.p);
+  ASSERT_EQ(CAPN_LIST, list.p.type);
+  EXPECT_EQ(1, list.p.is_composite_list);
+  EXPECT_EQ(3, list.p.len);
+  EXPECT_EQ(8, list.p.datasz);
+  EXPECT_EQ(1, list.p.ptrs);
+  for (int i = 0; i < 3; i++) {
+    struct Point s;
+    get_Point(&s, list, i);
+    EXPECT_EQ(points[i].x, s.x);
+    EXPECT_EQ(points[i].y, s.y);
+  }
+
+  capn_list32 w = Polygon_get_weights(p);
+  capn_resolve(&w.p);
+  EXPECT_EQ(3, w.p.len);
+  EXPECT_EQ(4, w.p.datasz);
+
+  capn_free(&c);
+}
+
+TEST(ContiguousList, Decode) {
+  std::vector<uint8_t> buf = encodePolygon();
+  struct capn c;
+  ASSERT_EQ(0, capn_init_mem(&c, buf.data(), buf.size(), 0));
+
+  Polygon_ptr p;
+  p.p = capn_getp(capn_root(&c), 0, 1);
+
+  // the points decode into one array of point_t
+  polygon_t *poly = NULL;
+  decode_Polygon_ptr(&poly, p);
+  ASSERT_TRUE(poly != NULL);
+  expectPoints(poly);
+  free_Polygon_ptr(&poly);
+  EXPECT_TRUE(poly == NULL);
+
+  struct capn_arena arena;
+  capn_arena_init(&arena, (size_t) capn_size(&c));
+  decode_Polygon_ptr_arena(&arena, &poly, p);
+  ASSERT_TRUE(poly != NULL);
+  expectPoints(poly);
+  capn_arena_free(&arena);
+
+  capn_free(&c);
+}
+
+TEST(ContiguousList, Empty) {
+  struct capn c;
+  capn_init_malloc(&c);
+  capn_ptr root = capn_root(&c);
+
+  polygon_t poly;
+  memset(&poly, 0, sizeof(poly));
+  Polygon_ptr p;
+  encode_Polygon_ptr(root.seg, &p, &poly);
+  EXPECT_EQ(0, Polygon_get_points(p).p.len);
+
+  polygon_t *out = NULL;
+  decode_Polygon_ptr(&out, p);
+  ASSERT_TRUE(out != NULL);
+  EXPECT_EQ(0, out->n_points);
+  EXPECT_TRUE(out->points == NULL);
+  free_Polygon_ptr(&out);
+
+  capn_free(&c);
+}
@@ -0,0 +1,663 @@
+#include "shapes.capnp.h"
+/* AUTO GENERATED - DO NOT EDIT */
+#ifdef __GNUC__
+# define capnp_unused __attribute__((unused))
+# define capnp_use(x) (void) (x);
+#else
+# define capnp_unused
+# define capnp_use(x)
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+static const capn_text capn_val0 = {0,"",0};
+static const capn_ptr capn_null = {CAPN_NULL};
+
+Point_ptr new_Point(struct capn_segment *s) {
+	Point_ptr p;
+	p.p = capn_new_struct(s, 8, 1);
+	return p;
+}
+Point_list new_Point_list(struct capn_segment *s, int len) {
+	Point_list p;
+	p.p = capn_new_list(s, len, 8, 1);
+	return p;
+}
+void read_Point(struct Point *s capnp_unused, Point_ptr p) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	if (p.p.datasz >= 8) {
+		s->x = (int32_t) ((int32_t)capn_flip32(*(uint32_t*) (p.p.data+0)));
+		s->y = (int32_t) ((int32_t)capn_flip32(*(uint32_t*) (p.p.data+4)));
+		s->label = capn_get_text(p.p, 0, capn_val0);
+		return;
+	}
+	s->x = (int32_t) ((int32_t)capn_read32(p.p, 0));
+	s->y = (int32_t) ((int32_t)capn_read32(p.p, 4));
+	s->label = capn_get_text(p.p, 0, capn_val0);
+}
+void read_Point_fields(struct Point *s capnp_unused, Point_ptr p, uint64_t mask) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	if (mask & Point_x_mask) {
+		s->x = (int32_t) ((int32_t)capn_read32(p.p, 0));
+	}
+	if (mask & Point_y_mask) {
+		s->y = (int32_t) ((int32_t)capn_read32(p.p, 4));
+	}
+	if (mask & Point_label_mask) {
+		s->label = capn_get_text(p.p, 0, capn_val0);
+	}
+}
+void write_Point(const struct Point *s capnp_unused, Point_ptr p) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	capn_write32(p.p, 0, (uint32_t) (s->x));
+	capn_write32(p.p, 4, (uint32_t) (s->y));
+	capn_set_text(p.p, 0, s->label);
+}
+void get_Point(struct Point *s, Point_list l, int i) {
+	Point_ptr p;
+	p.p = capn_getp(l.p, i, 0);
+	read_Point(s, p);
+}
+void set_Point(const struct Point *s, Point_list l, int i) {
+	Point_ptr p;
+	p.p = capn_getp(l.p, i, 0);
+	write_Point(s, p);
+}
+
+int read_Point_range(Point_list l, int start, int n, struct Point *out) {
+	Point_ptr p;
+	capn_ptr ahead;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			get_Point(&out[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	ahead = p.p;
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		if (i + CAPN_PREFETCH_AHEAD < n) {
+			ahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;
+			capn_prefetch_ptrs(ahead);
+		}
+		read_Point(&out[i], p);
+	}
+	return n;
+}
+
+int write_Point_range(Point_list l, int start, int n, const struct Point *in) {
+	Point_ptr p;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			set_Point(&in[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		write_Point(&in[i], p);
+	}
+	return n;
+}
+
+void encode_Point(struct capn_segment *cs capnp_unused,struct Point *d, point_t *s) {
+	capnp_use(cs);
+	d->x = s->x;
+	d->y = s->y;
+	if (s->label != NULL) {
+		d->label.str = s->label;
+		d->label.len = strlen(s->label);
+	}
+	else{
+		d->label.str = "";
+		d->label.len = 0;
+	}
+	d->label.seg = NULL;
+
+}
+
+void decode_Point_arena(struct capn_arena *a capnp_unused, point_t *d, struct Point *s) {
+	capnp_use(a);
+	d->x = s->x;
+	d->y = s->y;
+	d->label = capn_codec_strdup(a, s->label.str);
+
+}
+
+void decode_Point(point_t *d, struct Point *s) {
+	decode_Point_arena(NULL, d, s);
+}
+
+void free_Point(point_t *d) {
+	if (d->label != NULL) {
+		free(d->label);
+	}
+
+}
+
+size_t size_Point(const point_t *d) {
+	size_t n_ = 2;
+	if (d == NULL) return n_;
+	n_ += d->label ? (strlen(d->label) + 8) / 8 : 1;
+	return n_;
+}
+
+int32_t Point_get_x(Point_ptr p)
+{
+	int32_t x;
+	x = (int32_t) ((int32_t)capn_read32(p.p, 0));
+	return x;
+}
+
+int32_t Point_get_y(Point_ptr p)
+{
+	int32_t y;
+	y = (int32_t) ((int32_t)capn_read32(p.p, 4));
+	return y;
+}
+
+capn_text Point_get_label(Point_ptr p)
+{
+	capn_text label;
+	label = capn_get_text(p.p, 0, capn_val0);
+	return label;
+}
+
+void Point_set_x(Point_ptr p, int32_t x)
+{
+	capn_write32(p.p, 0, (uint32_t) (x));
+}
+
+void Point_set_y(Point_ptr p, int32_t y)
+{
+	capn_write32(p.p, 4, (uint32_t) (y));
+}
+
+void Point_set_label(Point_ptr p, capn_text label)
+{
+	capn_set_text(p.p, 0, label);
+}
+void encode_Point_list(struct capn_segment *cs, Point_list *l,int count,point_t **s) {
+	Point_list lst;
+	int i;
+	lst = new_Point_list(cs, count);
+	for(i = 0; i < count; i ++) {
+		struct Point d;
+		encode_Point(cs, &d, s[i]);
+		set_Point(&d, lst, i);
+	}
+	(*l) = lst;
+}
+void encode_Point_array(struct capn_segment *cs, Point_list *l,int count,point_t *s) {
+	Point_list lst;
+	int i;
+	lst = new_Point_list(cs, count);
+	for(i = 0; i < count; i ++) {
+		struct Point d;
+		encode_Point(cs, &d, &s[i]);
+		set_Point(&d, lst, i);
+	}
+	(*l) = lst;
+}
+void encode_Point_ptr(struct capn_segment *cs, Point_ptr *p,point_t *s) {
+	Point_ptr ptr;
+	struct Point d;
+	ptr = new_Point(cs);
+	if (s == NULL) {
+		ptr.p = capn_null;
+	}
+	else{
+		encode_Point(cs, &d, s);
+		write_Point(&d, ptr);
+	}
+	(*p) = ptr;
+}
+void decode_Point_list_arena(struct capn_arena *a, int *pcount, point_t ***d, Point_list list) {
+	int i;
+	int nc;
+	point_t **ptr;
+	capn_resolve(&(list.p));
+	nc = list.p.len;
+	if (nc == 0) {
+		(*d) = NULL;
+		(*pcount) = 0;
+		return;
+	}
+	ptr = (point_t **)capn_codec_calloc(a, nc, sizeof(point_t *));
+	for(i = 0; i < nc; i ++) {
+		struct Point s;
+		get_Point(&s, list, i);
+		ptr[i] = (point_t *)capn_codec_calloc(a, 1, sizeof(point_t));
+		decode_Point_arena(a, ptr[i], &s);
+	}
+	(*d) = ptr;
+	(*pcount) = nc;
+}
+void decode_Point_list(int *pcount, point_t ***d, Point_list list) {
+	decode_Point_list_arena(NULL, pcount, d, list);
+}
+void decode_Point_array_arena(struct capn_arena *a, int *pcount, point_t **d, Point_list list) {
+	int i;
+	int nc;
+	point_t *ptr;
+	capn_resolve(&(list.p));
+	nc = list.p.len;
+	if (nc == 0) {
+		(*d) = NULL;
+		(*pcount) = 0;
+		return;
+	}
+	ptr = (point_t *)capn_codec_calloc(a, nc, sizeof(point_t));
+	for(i = 0; i < nc; i ++) {
+		struct Point s;
+		get_Point(&s, list, i);
+		decode_Point_arena(a, &ptr[i], &s);
+	}
+	(*d) = ptr;
+	(*pcount) = nc;
+}
+void decode_Point_array(int *pcount, point_t **d, Point_list list) {
+	decode_Point_array_arena(NULL, pcount, d, list);
+}
+void decode_Point_ptr_arena(struct capn_arena *a, point_t **d,Point_ptr p) {
+	struct Point s;
+	capn_resolve(&(p.p));
+	if (p.p.type == CAPN_NULL) {
+		(*d) = NULL;
+		return;
+	}
+	*d = (point_t *)capn_codec_calloc(a, 1, sizeof(point_t));
+	read_Point(&s, p);
+	decode_Point_arena(a, *d, &s);
+}
+void decode_Point_ptr(point_t **d,Point_ptr p) {
+	decode_Point_ptr_arena(NULL, d, p);
+}
+void decode_Point_fields(point_t **d,Point_ptr p, uint64_t mask) {
+	struct Point s;
+	capn_resolve(&(p.p));
+	if (p.p.type == CAPN_NULL) {
+		(*d) = NULL;
+		return;
+	}
+	memset(&s, 0, sizeof(s));
+	*d = (point_t *)calloc(1, sizeof(point_t));
+	read_Point_fields(&s, p, mask);
+	decode_Point(*d, &s);
+}
+void free_Point_list(int pcount, point_t **d) {
+	int i;
+	int nc = pcount;
+	point_t **ptr = d;
+	if (ptr == NULL) return;
+	for(i = 0; i < nc; i ++) {
+		if(ptr[i] == NULL) continue;
+		free_Point(ptr[i]);
+		free(ptr[i]);
+	}
+	free(ptr);
+}
+void free_Point_array(int pcount, point_t *d) {
+	int i;
+	if (d == NULL) return;
+	for(i = 0; i < pcount; i ++) {
+		free_Point(&d[i]);
+	}
+	free(d);
+}
+void free_Point_ptr(point_t **d){
+	if((*d) == NULL) return;
+	free_Point(*d);
+	free(*d);
+	(*d) = NULL;
+}
+size_t size_Point_list(int count, point_t **d) {
+	size_t n_ = 1;
+	int i;
+	for(i = 0; i < count; i ++) {
+		n_ += size_Point(d[i]);
+	}
+	return n_;
+}
+size_t size_Point_array(int count, const point_t *d) {
+	size_t n_ = 1;
+	int i;
+	for(i = 0; i < count; i ++) {
+		n_ += size_Point(&d[i]);
+	}
+	return n_;
+}
+
+Polygon_ptr new_Polygon(struct capn_segment *s) {
+	Polygon_ptr p;
+	p.p = capn_new_struct(s, 0, 2);
+	return p;
+}
+Polygon_list new_Polygon_list(struct capn_segment *s, int len) {
+	Polygon_list p;
+	p.p = capn_new_list(s, len, 0, 2);
+	return p;
+}
+void read_Polygon(struct Polygon *s capnp_unused, Polygon_ptr p) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	s->points.p = capn_getp(p.p, 0, 0);
+	s->weights.p = capn_getp(p.p, 1, 0);
+}
+void read_Polygon_fields(struct Polygon *s capnp_unused, Polygon_ptr p, uint64_t mask) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	if (mask & Polygon_points_mask) {
+		s->points.p = capn_getp(p.p, 0, 0);
+	}
+	if (mask & Polygon_weights_mask) {
+		s->weights.p = capn_getp(p.p, 1, 0);
+	}
+}
+void write_Polygon(const struct Polygon *s capnp_unused, Polygon_ptr p) {
+	capn_resolve(&p.p);
+	capnp_use(s);
+	capn_setp(p.p, 0, s->points.p);
+	capn_setp(p.p, 1, s->weights.p);
+}
+void get_Polygon(struct Polygon *s, Polygon_list l, int i) {
+	Polygon_ptr p;
+	p.p = capn_getp(l.p, i, 0);
+	read_Polygon(s, p);
+}
+void set_Polygon(const struct Polygon *s, Polygon_list l, int i) {
+	Polygon_ptr p;
+	p.p = capn_getp(l.p, i, 0);
+	write_Polygon(s, p);
+}
+
+int read_Polygon_range(Polygon_list l, int start, int n, struct Polygon *out) {
+	Polygon_ptr p;
+	capn_ptr ahead;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			get_Polygon(&out[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	ahead = p.p;
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		if (i + CAPN_PREFETCH_AHEAD < n) {
+			ahead.data = p.p.data + CAPN_PREFETCH_AHEAD * stride;
+			capn_prefetch_ptrs(ahead);
+		}
+		read_Polygon(&out[i], p);
+	}
+	return n;
+}
+
+int write_Polygon_range(Polygon_list l, int start, int n, const struct Polygon *in) {
+	Polygon_ptr p;
+	size_t stride;
+	int i;
+	capn_resolve(&l.p);
+	if (start < 0 || n < 0 || start > l.p.len) return -1;
+	if (n > l.p.len - start) n = l.p.len - start;
+	if (l.p.type != CAPN_LIST) {
+		for (i = 0; i < n; i++) {
+			set_Polygon(&in[i], l, start + i);
+		}
+		return n;
+	}
+	stride = l.p.datasz + 8 * (size_t) l.p.ptrs;
+	p.p = capn_getp(l.p, start, 0);
+	for (i = 0; i < n; i++, p.p.data += stride) {
+		write_Polygon(&in[i], p);
+	}
+	return n;
+}
+
+void encode_Polygon(struct capn_segment *cs capnp_unused,struct Polygon *d, polygon_t *s) {
+	capnp_use(cs);
+	encode_Point_array(cs, &(d->points), s->n_points, s->points);
+		if (1) {
+		int i_;
+		d->weights = capn_new_list32(cs, s->n_weights);
+		capn_setv32(d->weights, 0, (const uint32_t *) s->weights, s->n_weights);
+		capnp_use(i_);
+	}
+
+}
+
+void decode_Polygon_arena(struct capn_arena *a capnp_unused, polygon_t *d, struct Polygon *s) {
+	capnp_use(a);
+	decode_Point_array_arena(a, &(d->n_points), &(d->points), s->points);
+		if (1) {
+		int i_, nc_;
+		capn_resolve(&(s->weights.p));
+		nc_ = s->weights.p.len;
+		if (nc_ == 0) {
+			d->weights = NULL;
+		}
+		else {
+			d->weights = (float *)capn_codec_calloc(a, nc_, sizeof(float));
+			capn_getv32(s->weights, 0, (uint32_t *) d->weights, nc_);
+			capnp_use(i_);
+		}
+	d->n_weights = nc_;
+	}
+
+}
+
+void decode_Polygon(polygon_t *d, struct Polygon *s) {
+	decode_Polygon_arena(NULL, d, s);
+}
+
+void free_Polygon(polygon_t *d) {
+	free_Point_array(d->n_points, d->points);
+		if (1) {
+		int i_, nc_ = d->n_weights;
+		capnp_use(i_);capnp_use(nc_);
+		free(d->weights);
+	}
+
+}
+
+size_t size_Polygon(const polygon_t *d) {
+	size_t n_ = 2;
+	if (d == NULL) return n_;
+	n_ += size_Point_array(d->n_points, d->points);
+	n_ += (4 * (size_t) d->n_weights + 7) / 8;
+	return n_;
+}
+
+Point_list Polygon_get_points(Polygon_ptr p)
+{
+	Point_list points;
+	points.p = capn_getp(p.p, 0, 0);
+	return points;
+}
+
+capn_list32 Polygon_get_weights(Polygon_ptr p)
+{
+	capn_list32 weights;
+	weights.p = capn_getp(p.p, 1, 0);
+	return weights;
+}
+
+void Polygon_set_points(Polygon_ptr p, Point_list points)
+{
+	capn_setp(p.p, 0, points.p);
+}
+
+void Polygon_set_weights(Polygon_ptr p, capn_list32 weights)
+{
+	capn_setp(p.p, 1, weights.p);
+}
+void encode_Polygon_list(struct capn_segment *cs, Polygon_list *l,int count,polygon_t **s) {
+	Polygon_list lst;
+	int i;
+	lst = new_Polygon_list(cs, count);
+	for(i = 0; i < count; i ++) {
+		struct Polygon d;
+		encode_Polygon(cs, &d, s[i]);
+		set_Polygon(&d, lst, i);
+	}
+	(*l) = lst;
+}
+void encode_Polygon_array(struct capn_segment *cs, Polygon_list *l,int count,polygon_t *s) {
+	Polygon_list lst;
+	int i;
+	lst = new_Polygon_list(cs, count);
+	for(i = 0; i < count; i ++) {
+		struct Polygon d;
+		encode_Polygon(cs, &d, &s[i]);
+		set_Polygon(&d, lst, i);
+	}
+	(*l) = lst;
+}
+void encode_Polygon_ptr(struct capn_segment *cs, Polygon_ptr *p,polygon_t *s) {
+	Polygon_ptr ptr;
+	struct Polygon d;
+	ptr = new_Polygon(cs);
+	if (s == NULL) {
+		ptr.p = capn_null;
+	}
+	else{
+		encode_Polygon(cs, &d, s);
+		write_Polygon(&d, ptr);
+	}
+	(*p) = ptr;
+}
+void decode_Polygon_list_arena(struct capn_arena *a, int *pcount, polygon_t ***d, Polygon_list list) {
+	int i;
+	int nc;
+	polygon_t **ptr;
+	capn_resolve(&(list.p));
+	nc = list.p.len;
+	if (nc == 0) {
+		(*d) = NULL;
+		(*pcount) = 0;
+		return;
+	}
+	ptr = (polygon_t **)capn_codec_calloc(a, nc, sizeof(polygon_t *));
+	for(i = 0; i < nc; i ++) {
+		struct Polygon s;
+		get_Polygon(&s, list, i);
+		ptr[i] = (polygon_t *)capn_codec_calloc(a, 1, sizeof(polygon_t));
+		decode_Polygon_arena(a, ptr[i], &s);
+	}
+	(*d) = ptr;
+	(*pcount) = nc;
+}
+void decode_Polygon_list(int *pcount, polygon_t ***d, Polygon_list list) {
+	decode_Polygon_list_arena(NULL, pcount, d, list);
+}
+void decode_Polygon_array_arena(struct capn_arena *a, int *pcount, polygon_t **d, Polygon_list list) {
+	int i;
+	int nc;
+	polygon_t *ptr;
+	capn_resolve(&(list.p));
+	nc = list.p.len;
+	if (nc == 0) {
+		(*d) = NULL;
+		(*pcount) = 0;
+		return;
+	}
+	ptr = (polygon_t *)capn_codec_calloc(a, nc, sizeof(polygon_t));
+	for(i = 0; i < nc; i ++) {
+		struct Polygon s;
+		get_Polygon(&s, list, i);
+		decode_Polygon_arena(a, &ptr[i], &s);
+	}
+	(*d) = ptr;
+	(*pcount) = nc;
+}
+void decode_Polygon_array(int *pcount, polygon_t **d, Polygon_list list) {
+	decode_Polygon_array_arena(NULL, pcount, d, list);
+}
+void decode_Polygon_ptr_arena(struct capn_arena *a, polygon_t **d,Polygon_ptr p) {
+	struct Polygon s;
+	capn_resolve(&(p.p));
+	if (p.p.type == CAPN_NULL) {
+		(*d) = NULL;
+		return;
+	}
+	*d = (polygon_t *)capn_codec_calloc(a, 1, sizeof(polygon_t));
+	read_Polygon(&s, p);
+	decode_Polygon_arena(a, *d, &s);
+}
+void decode_Polygon_ptr(polygon_t **d,Polygon_ptr p) {
+	decode_Polygon_ptr_arena(NULL, d, p);
+}
+void decode_Polygon_fields(polygon_t **d,Polygon_ptr p, uint64_t mask) {
+	struct Polygon s;
+	capn_resolve(&(p.p));
+	if (p.p.type == CAPN_NULL) {
+		(*d) = NULL;
+		return;
+	}
+	memset(&s, 0, sizeof(s));
+	*d = (polygon_t *)calloc(1, sizeof(polygon_t));
+	read_Polygon_fields(&s, p, mask);
+	decode_Polygon(*d, &s);
+}
+void free_Polygon_list(int pcount, polygon_t **d) {
+	int i;
+	int nc = pcount;
+	polygon_t **ptr = d;
+	if (ptr == NULL) return;
+	for(i = 0; i < nc; i ++) {
+		if(ptr[i] == NULL) continue;
+		free_Polygon(ptr[i]);
+		free(ptr[i]);
+	}
+	free(ptr);
+}
+void free_Polygon_array(int pcount, polygon_t *d) {
+	int i;
+	if (d == NULL) return;
+	for(i = 0; i < pcount; i ++) {
+		free_Polygon(&d[i]);
+	}
+	free(d);
+}
+void free_Polygon_ptr(polygon_t **d){
+	if((*d) == NULL) return;
+	free_Polygon(*d);
+	free(*d);
+	(*d) = NULL;
+}
+size_t size_Polygon_list(int count, polygon_t **d) {
+	size_t n_ = 1;
+	int i;
+	for(i = 0; i < count; i ++) {
+		n_ += size_Polygon(d[i]);
+	}
+	return n_;
+}
+size_t size_Polygon_array(int count, const polygon_t *d) {
+	size_t n_ = 1;
+	int i;
+	for(i = 0; i < count; i ++) {
+		n_ += size_Polygon(&d[i]);
+	}
+	return n_;
+}
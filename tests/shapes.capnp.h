@@ -0,0 +1,170 @@
+#ifndef CAPN_D3C1E5A79B4F2816
+#define CAPN_D3C1E5A79B4F2816
+/* AUTO GENERATED - DO NOT EDIT */
+#include <capnp_c.h>
+#include "shapes.h"
+
+#ifndef STRING_DUP
+#define STRING_DUP strdup
+#endif
+
+#ifndef capn_codec_calloc
+#define capn_codec_calloc(a, n, sz) ((a) ? capn_arena_calloc((a), (n), (sz)) : calloc((n), (sz)))
+#define capn_codec_strdup(a, s) ((a) ? capn_arena_strdup((a), (s)) : STRING_DUP(s))
+#endif
+
+#if CAPN_VERSION != 2
+#error "version mismatch between capnp_c.h and generated code"
+#endif
+
+#ifndef capnp_nowarn
+# ifdef __GNUC__
+#  define capnp_nowarn __extension__
+# else
+#  define capnp_nowarn
+# endif
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct Point;
+struct Polygon;
+
+typedef struct {capn_ptr p;} Point_ptr;
+typedef struct {capn_ptr p;} Polygon_ptr;
+
+typedef struct {capn_ptr p;} Point_list;
+typedef struct {capn_ptr p;} Polygon_list;
+
+struct Point {
+	int32_t x;
+	int32_t y;
+	capn_text label;
+};
+
+static const size_t Point_word_count = 1;
+
+static const size_t Point_pointer_count = 1;
+
+static const size_t Point_struct_bytes_count = 16;
+
+static const uint64_t Point_x_mask = (uint64_t) 1 << 0;
+
+static const uint64_t Point_y_mask = (uint64_t) 1 << 1;
+
+static const uint64_t Point_label_mask = (uint64_t) 1 << 2;
+
+
+int32_t Point_get_x(Point_ptr p);
+
+int32_t Point_get_y(Point_ptr p);
+
+capn_text Point_get_label(Point_ptr p);
+
+void Point_set_x(Point_ptr p, int32_t x);
+
+void Point_set_y(Point_ptr p, int32_t y);
+
+void Point_set_label(Point_ptr p, capn_text label);
+
+struct Polygon {
+	Point_list points;
+	capn_list32 weights;
+};
+
+static const size_t Polygon_word_count = 0;
+
+static const size_t Polygon_pointer_count = 2;
+
+static const size_t Polygon_struct_bytes_count = 16;
+
+static const uint64_t Polygon_points_mask = (uint64_t) 1 << 0;
+
+static const uint64_t Polygon_weights_mask = (uint64_t) 1 << 1;
+
+
+Point_list Polygon_get_points(Polygon_ptr p);
+
+capn_list32 Polygon_get_weights(Polygon_ptr p);
+
+void Polygon_set_points(Polygon_ptr p, Point_list points);
+
+void Polygon_set_weights(Polygon_ptr p, capn_list32 weights);
+
+Point_ptr new_Point(struct capn_segment*);
+Polygon_ptr new_Polygon(struct capn_segment*);
+
+Point_list new_Point_list(struct capn_segment*, int len);
+Polygon_list new_Polygon_list(struct capn_segment*, int len);
+
+void read_Point(struct Point*, Point_ptr);
+void read_Polygon(struct Polygon*, Polygon_ptr);
+
+void read_Point_fields(struct Point*, Point_ptr, uint64_t mask);
+void read_Polygon_fields(struct Polygon*, Polygon_ptr, uint64_t mask);
+
+void write_Point(const struct Point*, Point_ptr);
+void write_Polygon(const struct Polygon*, Polygon_ptr);
+
+void get_Point(struct Point*, Point_list, int i);
+void get_Polygon(struct Polygon*, Polygon_list, int i);
+
+void set_Point(const struct Point*, Point_list, int i);
+void set_Polygon(const struct Polygon*, Polygon_list, int i);
+
+int read_Point_range(Point_list, int start, int n, struct Point *out);
+int read_Polygon_range(Polygon_list, int start, int n, struct Polygon *out);
+
+int write_Point_range(Point_list, int start, int n, const struct Point *in);
+int write_Polygon_range(Polygon_list, int start, int n, const struct Polygon *in);
+
+void encode_Point(struct capn_segment *,struct Point *, point_t *);
+void decode_Point(point_t *, struct Point *);
+void decode_Point_arena(struct capn_arena *, point_t *, struct Point *);
+void free_Point(point_t *);
+void encode_Point_list(struct capn_segment *,Point_list *, int, point_t **);
+void decode_Point_list(int *, point_t ***, Point_list);
+void decode_Point_list_arena(struct capn_arena *, int *, point_t ***, Point_list);
+void free_Point_list(int, point_t **);
+void encode_Point_array(struct capn_segment *,Point_list *, int, point_t *);
+void decode_Point_array(int *, point_t **, Point_list);
+void decode_Point_array_arena(struct capn_arena *, int *, point_t **, Point_list);
+void free_Point_array(int, point_t *);
+void encode_Point_ptr(struct capn_segment*, Point_ptr *, point_t *);
+void decode_Point_ptr(point_t **, Point_ptr);
+void decode_Point_ptr_arena(struct capn_arena *, point_t **, Point_ptr);
+void decode_Point_fields(point_t **, Point_ptr, uint64_t);
+void free_Point_ptr(point_t **);
+size_t size_Point(const point_t *);
+size_t size_Point_list(int, point_t **);
+size_t size_Point_array(int, const point_t *);
+
+void encode_Polygon(struct capn_segment *,struct Polygon *, polygon_t *);
+void decode_Polygon(polygon_t *, struct Polygon *);
+void decode_Polygon_arena(struct capn_arena *, polygon_t *, struct Polygon *);
+void free_Polygon(polygon_t *);
+void encode_Polygon_list(struct capn_segment *,Polygon_list *, int, polygon_t **);
+void decode_Polygon_list(int *, polygon_t ***, Polygon_list);
+void decode_Polygon_list_arena(struct capn_arena *, int *, polygon_t ***, Polygon_list);
+void free_Polygon_list(int, polygon_t **);
+void encode_Polygon_array(struct capn_segment *,Polygon_list *, int, polygon_t *);
+void decode_Polygon_array(int *, polygon_t **, Polygon_list);
+void decode_Polygon_array_arena(struct capn_arena *, int *, polygon_t **, Polygon_list);
+void free_Polygon_array(int, polygon_t *);
+void encode_Polygon_ptr(struct capn_segment*, Polygon_ptr *, polygon_t *);
+void decode_Polygon_ptr(polygon_t **, Polygon_ptr);
+void decode_Polygon_ptr_arena(struct capn_arena *, polygon_t **, Polygon_ptr);
+void decode_Polygon_fields(polygon_t **, Polygon_ptr, uint64_t);
+void free_Polygon_ptr(polygon_t **);
+size_t size_Polygon(const polygon_t *);
+size_t size_Polygon_list(int, polygon_t **);
+size_t size_Polygon_array(int, const polygon_t *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
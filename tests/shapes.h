@@ -0,0 +1,20 @@
+#if !defined(_SHAPES_H_)
+
+#define _SHAPES_H_ 1
+
+#include <stdint.h>
+
+typedef struct {
+  int32_t x;
+  int32_t y;
+  char *label;
+} point_t;
+
+typedef struct {
+  int n_points;
+  point_t *points;
+  int n_weights;
+  float *weights;
+} polygon_t;
+
+#endif